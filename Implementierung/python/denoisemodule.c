@@ -0,0 +1,163 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "../src/denoise.h"
+#include <string.h>
+
+// default coefficients for the grayscale conversion, the same as in main.c
+#define DEFAULT_A 0.2126f
+#define DEFAULT_B 0.7152f
+#define DEFAULT_C 0.0722f
+
+// Get the buffer of a uint8 array with the given number of dimensions
+// The rows may be strided, e.g. a crop of a larger array, but the pixels of a row must be contiguous
+static int get_uint8_buffer(PyObject* object, Py_buffer* view, int ndim, int writable, const char* name)
+{
+    int flags = PyBUF_STRIDES | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+    if (PyObject_GetBuffer(object, view, flags) < 0)
+        return -1;
+    if (view->itemsize != 1 || (view->format && strcmp(view->format, "B") != 0)) {
+        PyErr_Format(PyExc_TypeError, "%s must be an array of uint8", name);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    if (view->ndim != ndim) {
+        PyErr_Format(PyExc_ValueError, "%s must have %d dimensions", name, ndim);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    // (height, width) or (height, width, 3) with contiguous pixels and rows in increasing order
+    Py_ssize_t pixel_size = ndim == 3 ? view->shape[2] : 1;
+    if ((ndim == 3 && view->strides[2] != 1) || view->strides[1] != pixel_size || view->strides[0] < view->shape[1] * pixel_size) {
+        PyErr_Format(PyExc_ValueError, "the pixels of each row of %s must be contiguous", name);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+// Shared part of denoise_simd() and denoise_integer(), the kernels read and write the buffers directly
+static PyObject* run_denoise(PyObject* args, PyObject* kwargs, int simd)
+{
+    static char* kwlist[] = { "image", "out", "coeffs", NULL };
+    PyObject* image_object;
+    PyObject* out_object = Py_None;
+    float a = DEFAULT_A, b = DEFAULT_B, c = DEFAULT_C;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O(fff)", kwlist, &image_object, &out_object, &a, &b, &c))
+        return NULL;
+
+    Py_buffer image;
+    if (get_uint8_buffer(image_object, &image, 3, 0, "image") < 0)
+        return NULL;
+    size_t height = (size_t)image.shape[0];
+    size_t width = (size_t)image.shape[1];
+    if (image.shape[2] != 3 || width == 0 || height == 0) {
+        PyErr_SetString(PyExc_ValueError, "image must have the shape (height, width, 3)");
+        PyBuffer_Release(&image);
+        return NULL;
+    }
+
+    // without out a new (height, width) memoryview of a bytearray is returned, numpy.asarray() can wrap it
+    if (out_object == Py_None) {
+        PyObject* bytes = PyByteArray_FromStringAndSize(NULL, (Py_ssize_t)(width * height));
+        PyObject* view = bytes ? PyMemoryView_FromObject(bytes) : NULL;
+        Py_XDECREF(bytes);
+        out_object = view ? PyObject_CallMethod(view, "cast", "s(nn)", "B", (Py_ssize_t)height, (Py_ssize_t)width) : NULL;
+        Py_XDECREF(view);
+        if (!out_object) {
+            PyBuffer_Release(&image);
+            return NULL;
+        }
+    } else {
+        Py_INCREF(out_object);
+    }
+    Py_buffer out;
+    if (get_uint8_buffer(out_object, &out, 2, 1, "out") < 0) {
+        Py_DECREF(out_object);
+        PyBuffer_Release(&image);
+        return NULL;
+    }
+    if ((size_t)out.shape[0] != height || (size_t)out.shape[1] != width) {
+        PyErr_SetString(PyExc_ValueError, "out must have the shape (height, width) of image");
+        PyBuffer_Release(&out);
+        Py_DECREF(out_object);
+        PyBuffer_Release(&image);
+        return NULL;
+    }
+
+    // only the temporary results are allocated, the raw allocator can be used without the GIL
+    size_t padded_size = (width + 2) * (height + 2);
+    void* tmp1 = simd ? PyMem_RawCalloc(padded_size, sizeof(uint16_t)) : PyMem_RawMalloc(width * height);
+    void* tmp2 = simd ? PyMem_RawCalloc(padded_size, sizeof(uint16_t)) : PyMem_RawMalloc(width * height);
+    void* tmp3 = simd ? PyMem_RawCalloc(padded_size, sizeof(uint16_t)) : NULL;
+    if (!tmp1 || !tmp2 || (simd && !tmp3)) {
+        PyMem_RawFree(tmp1);
+        PyMem_RawFree(tmp2);
+        PyMem_RawFree(tmp3);
+        PyBuffer_Release(&out);
+        Py_DECREF(out_object);
+        PyBuffer_Release(&image);
+        return PyErr_NoMemory();
+    }
+
+    // the kernels work on the strided buffers directly, crops of larger arrays are not copied
+    struct image_view image_view = { image.buf, width, height, (size_t)image.strides[0] };
+    struct image_view out_view = { out.buf, width, height, (size_t)out.strides[0] };
+
+    // the buffers stay exported while the GIL is released, so they can't be resized or freed
+    Py_BEGIN_ALLOW_THREADS;
+    if (simd)
+        denoise_simd_view(image_view, a, b, c, tmp1, tmp2, tmp3, out_view);
+    else
+        denoise_integer_view(image_view, a, b, c, tmp1, tmp2, out_view);
+    Py_END_ALLOW_THREADS;
+
+    PyMem_RawFree(tmp1);
+    PyMem_RawFree(tmp2);
+    PyMem_RawFree(tmp3);
+    PyBuffer_Release(&out);
+    PyBuffer_Release(&image);
+    return out_object;
+}
+
+static PyObject* py_denoise_simd(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    (void)self;
+    return run_denoise(args, kwargs, 1);
+}
+
+static PyObject* py_denoise_integer(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    (void)self;
+    return run_denoise(args, kwargs, 0);
+}
+
+static PyMethodDef denoise_methods[] = {
+    { "denoise_simd", (PyCFunction)(void (*)(void))py_denoise_simd, METH_VARARGS | METH_KEYWORDS,
+        "denoise_simd(image, out=None, coeffs=(0.2126, 0.7152, 0.0722))\n--\n\n"
+        "Denoise a uint8 RGB image of shape (height, width, 3) with the SIMD version.\n"
+        "The result is written into out, a writable uint8 array of shape (height, width),\n"
+        "or into a new memoryview of that shape if out is None. The GIL is released while denoising.\n"
+        "image and out may be crops of larger arrays, as long as the pixels of a row are contiguous." },
+    { "denoise_integer", (PyCFunction)(void (*)(void))py_denoise_integer, METH_VARARGS | METH_KEYWORDS,
+        "denoise_integer(image, out=None, coeffs=(0.2126, 0.7152, 0.0722))\n--\n\n"
+        "Does the same as denoise_simd(), using the integer SISD version." },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef denoise_module = {
+    PyModuleDef_HEAD_INIT,
+    "denoise",
+    "Image noise reduction on buffer protocol objects, e.g. NumPy arrays, without copying the images.",
+    -1,
+    denoise_methods,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+PyMODINIT_FUNC PyInit_denoise(void)
+{
+    return PyModule_Create(&denoise_module);
+}
@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ascii.h"
+#include <pthread.h>
+#include <smmintrin.h>
+#include <string.h>
+#include <unistd.h>
+
+// texts smaller than this per thread are not worth starting a thread
+#define MIN_CHUNK_SIZE (1 << 20)
+#define MAX_CHUNKS 64
+
+struct chunk {
+    const char* text;
+    size_t begin;
+    size_t end;
+    uint16_t maxValue;
+    size_t count; // number of values in the chunk, counted in the first pass
+    uint8_t* pixels; // the values of the chunk are written from here on in the second pass
+    int in_comment; // whether the chunk begins in a comment
+    int failed;
+};
+
+#define is_space(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+#define is_line_end(c) ((c) == '\n' || (c) == '\r')
+
+// Classify 64 bytes, bit i is set if text[i] is a digit or whitespace respectively
+static inline void classify(const char* text, uint64_t* digits, uint64_t* spaces)
+{
+    __m128i zero_char = _mm_set1_epi8('0');
+    __m128i nine = _mm_set1_epi8(9);
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    __m128i four = _mm_set1_epi8(4);
+    uint64_t d = 0, s = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(text + 16 * i));
+        // c - '0' <= 9 as unsigned bytes
+        __m128i t = _mm_sub_epi8(c, zero_char);
+        __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(t, nine), t);
+        // ' ' or one of '\t', '\n', '\v', '\f', '\r', which follow each other
+        __m128i control = _mm_sub_epi8(c, tab);
+        __m128i whitespace = _mm_or_si128(_mm_cmpeq_epi8(c, space), _mm_cmpeq_epi8(_mm_min_epu8(control, four), control));
+        d |= (uint64_t)(uint16_t)_mm_movemask_epi8(digit) << (16 * i);
+        s |= (uint64_t)(uint16_t)_mm_movemask_epi8(whitespace) << (16 * i);
+    }
+    *digits = d;
+    *spaces = s;
+}
+
+// Bits of the bytes from a '#' to the end of its line, only called for blocks with other characters than digits and whitespace
+static uint64_t comments(const char* text, uint64_t valid, int* in_comment)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < 64 && (valid >> i) & 1; i++) {
+        if (text[i] == '#')
+            *in_comment = 1;
+        else if (is_line_end(text[i]))
+            *in_comment = 0;
+        mask |= (uint64_t)*in_comment << i;
+    }
+    return mask;
+}
+
+// First pass: validate the characters and count the values of a chunk
+static void* count_chunk(void* arg)
+{
+    struct chunk* chunk = arg;
+    uint64_t carry = 0, invalid = 0;
+    size_t count = 0;
+    int in_comment = chunk->in_comment;
+    for (size_t pos = chunk->begin; pos < chunk->end; pos += 64) {
+        size_t n = chunk->end - pos;
+        uint64_t valid = n >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+        uint64_t digits, spaces;
+        classify(chunk->text + pos, &digits, &spaces);
+        uint64_t other = ~(digits | spaces) & valid;
+        if (other || in_comment) {
+            // comments count as whitespace
+            uint64_t comment = comments(chunk->text + pos, valid, &in_comment);
+            digits &= ~comment;
+            other &= ~comment;
+        }
+        invalid |= other;
+        digits &= valid;
+        // a value starts at every digit that doesn't follow a digit
+        count += (size_t)__builtin_popcountll(digits & ~((digits << 1) | carry));
+        carry = digits >> 63;
+    }
+    chunk->count = count;
+    chunk->failed = invalid != 0;
+    return NULL;
+}
+
+// Second pass: convert every run of digits to a value
+static void* parse_chunk(void* arg)
+{
+    // masks for the last 1, 2 or 3 bytes of a little endian word, 0 for runs longer than 3 digits
+    static const uint32_t digit_mask[4] = { 0, 0xFF000000, 0xFFFF0000, 0xFFFFFF00 };
+    struct chunk* chunk = arg;
+    const char* text = chunk->text;
+    uint8_t* pixels = chunk->pixels;
+    uint64_t carry = 0;
+    size_t start = 0;
+    uint32_t bad = 0;
+    int in_comment = chunk->in_comment;
+    for (size_t pos = chunk->begin; pos < chunk->end; pos += 64) {
+        size_t n = chunk->end - pos;
+        uint64_t valid = n >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+        uint64_t digits, spaces;
+        classify(text + pos, &digits, &spaces);
+        if ((~(digits | spaces) & valid) || in_comment)
+            digits &= ~comments(text + pos, valid, &in_comment);
+        digits &= valid;
+        // a value ends at every digit that isn't followed by a digit, the byte after the block decides for bit 63
+        uint64_t next = n > 64 && (unsigned char)(text[pos + 64] - '0') <= 9;
+        uint64_t starts = digits & ~((digits << 1) | carry);
+        uint64_t ends = digits & ~((digits >> 1) | (next << 63));
+        carry = digits >> 63;
+
+        // starts and ends alternate, a value may have started in a previous block
+        while (ends) {
+            if (starts && __builtin_ctzll(starts) <= __builtin_ctzll(ends)) {
+                start = pos + (size_t)__builtin_ctzll(starts);
+                starts &= starts - 1;
+            }
+            size_t end = pos + (size_t)__builtin_ctzll(ends);
+            ends &= ends - 1;
+            size_t length = end - start + 1;
+
+            // the word ends with the last digit, the bytes in front of the value are masked out
+            uint32_t word;
+            memcpy(&word, text + end - 3, sizeof(word));
+            uint32_t mask = digit_mask[length > 3 ? 0 : length];
+            uint32_t d = (word & mask) - (0x30303030 & mask);
+            uint32_t value = (d >> 24) + 10 * ((d >> 16) & 0xFF) + 100 * ((d >> 8) & 0xFF);
+            bad |= (length > 3) | (value > chunk->maxValue);
+            *pixels++ = (uint8_t)value;
+        }
+        if (starts)
+            start = pos + (size_t)__builtin_ctzll(starts);
+    }
+    chunk->failed = bad != 0;
+    return NULL;
+}
+
+// Run the pass on all chunks, chunk 0 on the calling thread
+static int run_chunks(struct chunk* chunks, size_t count, void* (*pass)(void*))
+{
+    pthread_t threads[MAX_CHUNKS];
+    int started[MAX_CHUNKS] = { 0 };
+    for (size_t i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, pass, &chunks[i]) == 0;
+        if (!started[i])
+            pass(&chunks[i]);
+    }
+    pass(&chunks[0]);
+    int failed = chunks[0].failed;
+    for (size_t i = 1; i < count; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        failed |= chunks[i].failed;
+    }
+    return failed;
+}
+
+// Whether text[begin] is in a comment, that is whether a '#' is in front of it on the same line
+static int starts_in_comment(const char* text, size_t begin)
+{
+    for (size_t i = begin; i > 0 && !is_line_end(text[i - 1]); i--) {
+        if (text[i - 1] == '#')
+            return 1;
+    }
+    return 0;
+}
+
+int parse_ascii_pixels(const char* text, size_t size, uint16_t maxValue, uint8_t* pixels, size_t count)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t chunk_count = size / MIN_CHUNK_SIZE;
+    if (cpus > 0 && chunk_count > (size_t)cpus)
+        chunk_count = (size_t)cpus;
+    return parse_ascii_pixels_chunks(text, size, maxValue, pixels, count, chunk_count);
+}
+
+int parse_ascii_pixels_chunks(const char* text, size_t size, uint16_t maxValue, uint8_t* pixels, size_t count, size_t chunk_count)
+{
+    if (maxValue > 255)
+        return -1;
+    if (chunk_count > MAX_CHUNKS)
+        chunk_count = MAX_CHUNKS;
+    if (chunk_count == 0)
+        chunk_count = 1;
+
+    // every chunk begins at whitespace, so no value is split between two chunks, a comment may be
+    struct chunk chunks[MAX_CHUNKS];
+    size_t begin = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        size_t end = i == chunk_count - 1 ? size : size * (i + 1) / chunk_count;
+        if (end < begin)
+            end = begin;
+        while (end < size && !is_space(text[end]))
+            end++;
+        chunks[i] = (struct chunk) { .text = text, .begin = begin, .end = end, .maxValue = maxValue, .in_comment = starts_in_comment(text, begin) };
+        begin = end;
+    }
+
+    if (run_chunks(chunks, chunk_count, count_chunk))
+        return -1;
+    size_t total = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        chunks[i].pixels = pixels + total;
+        total += chunks[i].count;
+    }
+    if (total != count)
+        return -1;
+    return run_chunks(chunks, chunk_count, parse_chunk) ? -1 : 0;
+}
@@ -0,0 +1,26 @@
+#ifndef ASCII_H
+#define ASCII_H
+#include <stdint.h>
+#include <stdlib.h>
+
+// bytes of whitespace required before and after the text given to parse_ascii_pixels()
+#define ASCII_PADDING 64
+
+/**
+ * Parse the pixel values of an ASCII (P3) netpbm image.
+ * Whitespace and digits are classified 16 bytes at a time using SSE, then every run of up to 3 digits
+ * is converted without branches on the single characters. Comments from '#' to the end of the line count as whitespace.
+ * Large texts are split into chunks at whitespace, which are parsed by several threads.
+ * @param text: pointer to the pixel data, ASCII_PADDING bytes before and after it must be readable whitespace
+ * @param size: size of the pixel data in bytes
+ * @param maxValue: largest allowed value, at most 255
+ * @param pixels: pointer to the result
+ * @param count: number of values expected, width * height * 3 for a PPM image
+ * Returns 0 on success and -1 if the text is not exactly count values separated by whitespace.
+ */
+int parse_ascii_pixels(const char* text, size_t size, uint16_t maxValue, uint8_t* pixels, size_t count);
+
+// parse_ascii_pixels() with the text split into chunk_count chunks, one thread each, instead of one per MiB and cpu
+int parse_ascii_pixels_chunks(const char* text, size_t size, uint16_t maxValue, uint8_t* pixels, size_t count, size_t chunk_count);
+
+#endif // ASCII_H
@@ -0,0 +1,256 @@
+#include "bench.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double median(const double* samples, size_t count)
+{
+    if (count == 0)
+        return 0;
+    double sorted[BENCH_MAX_SAMPLES];
+    memcpy(sorted, samples, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_doubles);
+    size_t half = count / 2;
+    return count % 2 ? sorted[half] : (sorted[half - 1] + sorted[half]) / 2;
+}
+
+double bench_median(const struct bench_result* result)
+{
+    return median(result->seconds, result->count);
+}
+
+void bench_spread(struct bench_result* result, size_t runs)
+{
+    result->spread = 0;
+    size_t length = runs ? result->count / runs : 0;
+    if (runs < 2 || length == 0)
+        return;
+    double lowest = INFINITY, highest = 0;
+    for (size_t i = 0; i < runs; i++) {
+        double run_median = median(result->seconds + i * length, length);
+        lowest = fmin(lowest, run_median);
+        highest = fmax(highest, run_median);
+    }
+    result->spread = lowest > 0 ? highest / lowest - 1 : 0;
+}
+
+// sample of the pooled samples of both sides, side 0 for a and 1 for b
+struct ranked {
+    double value;
+    int side;
+};
+
+static int compare_ranked(const void* a, const void* b)
+{
+    return compare_doubles(&((const struct ranked*)a)->value, &((const struct ranked*)b)->value);
+}
+
+double mann_whitney(const double* a, size_t a_count, const double* b, size_t b_count)
+{
+    size_t n = a_count + b_count;
+    if (a_count == 0 || b_count == 0)
+        return 1;
+    struct ranked* pooled = malloc(n * sizeof(struct ranked));
+    if (!pooled)
+        return 1;
+    for (size_t i = 0; i < a_count; i++)
+        pooled[i] = (struct ranked) { a[i], 0 };
+    for (size_t i = 0; i < b_count; i++)
+        pooled[a_count + i] = (struct ranked) { b[i], 1 };
+    qsort(pooled, n, sizeof(struct ranked), compare_ranked);
+
+    // sum of the ranks of a, ties get the average of the ranks 1..n they span
+    double rank_sum = 0, ties = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while (j < n && pooled[j].value == pooled[i].value)
+            j++;
+        double rank = (double)(i + 1 + j) / 2;
+        for (size_t k = i; k < j; k++)
+            if (pooled[k].side == 0)
+                rank_sum += rank;
+        double t = (double)(j - i);
+        ties += t * t * t - t;
+        i = j;
+    }
+    free(pooled);
+
+    double u = rank_sum - (double)a_count * (double)(a_count + 1) / 2;
+    double mean = (double)a_count * (double)b_count / 2;
+    double variance = (double)a_count * (double)b_count / 12 * ((double)(n + 1) - ties / ((double)n * (double)(n - 1)));
+    if (variance <= 0)
+        return 1;
+    // with continuity correction
+    double distance = fabs(u - mean) - 0.5;
+    if (distance <= 0)
+        return 1;
+    return erfc(distance / sqrt(variance) / sqrt(2));
+}
+
+enum bench_verdict bench_compare(const struct bench_result* baseline, const struct bench_result* current, double* change, double* p)
+{
+    double before = bench_median(baseline);
+    *change = before > 0 ? bench_median(current) / before - 1 : 0;
+    *p = mann_whitney(baseline->seconds, baseline->count, current->seconds, current->count);
+    if (*p >= BENCH_ALPHA || fabs(*change) < fmax(BENCH_MIN_CHANGE, baseline->spread))
+        return BENCH_UNCHANGED;
+    return *change > 0 ? BENCH_SLOWER : BENCH_FASTER;
+}
+
+const struct bench_result* bench_find(const struct bench_run* run, const char* stage, const char* variant)
+{
+    for (size_t i = 0; i < run->count; i++) {
+        if (strcmp(run->results[i].stage, stage) == 0 && strcmp(run->results[i].variant, variant) == 0)
+            return &run->results[i];
+    }
+    return NULL;
+}
+
+// JSON string with the quotes, only quotes and backslashes are escaped, the names and paths have no control characters
+static void write_string(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\')
+            fputc('\\', file);
+        fputc(*text, file);
+    }
+    fputc('"', file);
+}
+
+int bench_save(const char* path, const struct bench_run* run)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return -1;
+    fprintf(file, "{\n  \"image\": ");
+    write_string(file, run->image);
+    fprintf(file, ",\n  \"width\": %zu,\n  \"height\": %zu,\n  \"results\": [", run->width, run->height);
+    for (size_t i = 0; i < run->count; i++) {
+        const struct bench_result* result = &run->results[i];
+        fprintf(file, "%s\n    {\"stage\": ", i ? "," : "");
+        write_string(file, result->stage);
+        fprintf(file, ", \"variant\": ");
+        write_string(file, result->variant);
+        fprintf(file, ", \"calls\": %zu, \"spread\": %.9g, \"seconds\": [", result->calls, result->spread);
+        for (size_t j = 0; j < result->count; j++)
+            fprintf(file, "%s%.9g", j ? ", " : "", result->seconds[j]);
+        fprintf(file, "]}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static const char* skip_space(const char* text)
+{
+    while (isspace((unsigned char)*text))
+        text++;
+    return text;
+}
+
+// Value of the next key after text, NULL if there is none
+static const char* find_value(const char* text, const char* key)
+{
+    char quoted[BENCH_NAME_SIZE + 2];
+    snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+    text = strstr(text, quoted);
+    if (!text)
+        return NULL;
+    text = skip_space(text + strlen(quoted));
+    if (*text != ':')
+        return NULL;
+    return skip_space(text + 1);
+}
+
+// Copy a JSON string written by write_string(), returns the text after it or NULL if it is invalid or too long
+static const char* read_string(const char* text, char* out, size_t size)
+{
+    if (!text || *text++ != '"')
+        return NULL;
+    size_t length = 0;
+    for (; *text != '"'; text++) {
+        if (*text == '\\')
+            text++;
+        if (*text == '\0' || length + 1 == size)
+            return NULL;
+        out[length++] = *text;
+    }
+    out[length] = '\0';
+    return text + 1;
+}
+
+static const char* read_size(const char* text, size_t* value)
+{
+    if (!text || !isdigit((unsigned char)*text))
+        return NULL;
+    char* end;
+    *value = strtoull(text, &end, 10);
+    return end;
+}
+
+static const char* read_double(const char* text, double* value)
+{
+    if (!text)
+        return NULL;
+    char* end;
+    *value = strtod(text, &end);
+    return end == text ? NULL : end;
+}
+
+static int parse_run(const char* text, struct bench_run* run)
+{
+    memset(run, 0, sizeof(*run));
+    if (!(text = read_string(find_value(text, "image"), run->image, sizeof(run->image)))
+        || !(text = read_size(find_value(text, "width"), &run->width))
+        || !(text = read_size(find_value(text, "height"), &run->height))
+        || !(text = find_value(text, "results")) || *text++ != '[')
+        return -1;
+    while (*(text = skip_space(text)) != ']') {
+        if (run->count == BENCH_MAX_RESULTS || (run->count > 0 && *text++ != ','))
+            return -1;
+        struct bench_result* result = &run->results[run->count++];
+        if (!(text = read_string(find_value(text, "stage"), result->stage, sizeof(result->stage)))
+            || !(text = read_string(find_value(text, "variant"), result->variant, sizeof(result->variant)))
+            || !(text = read_size(find_value(text, "calls"), &result->calls))
+            || !(text = read_double(find_value(text, "spread"), &result->spread))
+            || !(text = find_value(text, "seconds")) || *text++ != '[')
+            return -1;
+        while (*(text = skip_space(text)) != ']') {
+            if (result->count == BENCH_MAX_SAMPLES || (result->count > 0 && *text++ != ','))
+                return -1;
+            if (!(text = read_double(text, &result->seconds[result->count++])))
+                return -1;
+        }
+        text = skip_space(text + 1);
+        if (*text++ != '}')
+            return -1;
+    }
+    return 0;
+}
+
+int bench_load(const char* path, struct bench_run* run)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -1;
+    char* text = NULL;
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0)
+        text = malloc((size_t)size + 1);
+    int status = -1;
+    if (text && fread(text, 1, (size_t)size, file) == (size_t)size) {
+        text[size] = '\0';
+        status = parse_run(text, run);
+    }
+    free(text);
+    fclose(file);
+    return status;
+}
@@ -0,0 +1,76 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <stddef.h>
+
+#define BENCH_MAX_SAMPLES 64
+#define BENCH_MAX_RESULTS 64
+#define BENCH_NAME_SIZE 32
+// significance level of the Mann-Whitney U test
+#define BENCH_ALPHA 0.01
+// smallest change of the median that counts as faster or slower, smaller significant changes are reported as unchanged.
+// The noise floor: the same binary differs from its own baseline by up to 17% on a shared machine
+#define BENCH_MIN_CHANGE 0.2
+// runs of the benchmarks a baseline is pooled from, their spread is the noise a change has to exceed
+#define BENCH_BASELINE_RUNS 3
+
+// Runtimes of one variant of one stage, e.g. "combine" and "simd"
+struct bench_result {
+    char stage[BENCH_NAME_SIZE];
+    char variant[BENCH_NAME_SIZE];
+    size_t count;
+    size_t calls; // calls per sample
+    double spread; // relative range of the medians of the runs of a baseline, 0 for a single run
+    double seconds[BENCH_MAX_SAMPLES]; // time of one call, the mean over the calls of a sample
+};
+
+// All results of one run of the benchmarks and the input they were measured with
+struct bench_run {
+    char image[256];
+    size_t width;
+    size_t height;
+    size_t count;
+    struct bench_result results[BENCH_MAX_RESULTS];
+};
+
+enum bench_verdict {
+    BENCH_UNCHANGED,
+    BENCH_FASTER,
+    BENCH_SLOWER,
+};
+
+// Median of the samples of a result, 0 without samples
+double bench_median(const struct bench_result* result);
+
+/**
+ * Split the samples of a result into runs of equal length, in the order they were taken, and set its spread to the
+ * relative range of their medians, the highest divided by the lowest minus 1. A single run has a spread of 0.
+ */
+void bench_spread(struct bench_result* result, size_t runs);
+
+/**
+ * Two-sided Mann-Whitney U test of whether the samples a and b come from the same distribution.
+ * Tied samples get the average of their ranks, the p value uses the normal approximation with tie correction,
+ * which is close enough from about 8 samples per side on.
+ * Returns the p value, 1 if all samples are equal.
+ */
+double mann_whitney(const double* a, size_t a_count, const double* b, size_t b_count);
+
+/**
+ * Compare the current result of a variant with its baseline. It is faster or slower if the Mann-Whitney U test rejects
+ * equal distributions at BENCH_ALPHA and the medians differ by at least BENCH_MIN_CHANGE and the spread of the baseline,
+ * otherwise unchanged. The test only sees the noise within a run, the spread the noise between runs.
+ * @param change: relative change of the median, e.g. 0.1 if the current run is 10% slower
+ * @param p: p value of the test
+ */
+enum bench_verdict bench_compare(const struct bench_result* baseline, const struct bench_result* current, double* change, double* p);
+
+// Result of a stage and variant in a run, NULL if it was not measured
+const struct bench_result* bench_find(const struct bench_run* run, const char* stage, const char* variant);
+
+// Write a run as JSON, returns 0 on success and -1 if the file can't be written
+int bench_save(const char* path, const struct bench_run* run);
+
+// Read a run written by bench_save(), returns 0 on success and -1 if the file is missing or invalid
+int bench_load(const char* path, struct bench_run* run);
+
+#endif // BENCH_H
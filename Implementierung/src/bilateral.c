@@ -0,0 +1,186 @@
+#include "bilateral.h"
+#include "median.h"
+#include <math.h>
+#include <smmintrin.h>
+#include <string.h>
+
+void bilateral_weights(struct bilateral_weights* weights, size_t window, float sigma_spatial, float sigma_range)
+{
+    ptrdiff_t radius = (ptrdiff_t)window / 2;
+    weights->window = window;
+    for (ptrdiff_t dy = -radius; dy <= radius; dy++) {
+        for (ptrdiff_t dx = -radius; dx <= radius; dx++)
+            weights->spatial[(dy + radius) * (ptrdiff_t)window + dx + radius] = (uint8_t)lround(255 * exp(-(double)(dx * dx + dy * dy) / (2.0 * sigma_spatial * sigma_spatial)));
+    }
+    weights->segment_count = 0;
+    for (size_t d = 0; d < 256; d++) {
+        weights->range[d] = (uint8_t)lround(255 * exp(-(double)(d * d) / (2.0 * sigma_range * sigma_range)));
+        if (weights->range[d])
+            weights->segment_count = d / 16 + 1;
+        for (size_t k = 0; k < window * window; k++)
+            weights->table[k][d] = (uint8_t)((weights->spatial[k] * weights->range[d]) >> 8);
+    }
+}
+
+void bilateral(const uint8_t* image, size_t width, size_t height, const struct bilateral_weights* weights, uint8_t* result)
+{
+    ptrdiff_t window = (ptrdiff_t)weights->window, radius = window / 2;
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            uint8_t center = image[y * width + x];
+            uint32_t sum = 0, weight_sum = 0;
+            for (ptrdiff_t dy = -radius; dy <= radius; dy++) {
+                ptrdiff_t ny = (ptrdiff_t)y + dy < 0 ? 0 : (size_t)((ptrdiff_t)y + dy) >= height ? (ptrdiff_t)height - 1 : (ptrdiff_t)y + dy;
+                for (ptrdiff_t dx = -radius; dx <= radius; dx++) {
+                    ptrdiff_t nx = (ptrdiff_t)x + dx < 0 ? 0 : (size_t)((ptrdiff_t)x + dx) >= width ? (ptrdiff_t)width - 1 : (ptrdiff_t)x + dx;
+                    uint8_t pixel = image[ny * (ptrdiff_t)width + nx];
+                    uint32_t weight = weights->table[(dy + radius) * window + dx + radius][abs(pixel - center)];
+                    sum += weight * pixel;
+                    weight_sum += weight;
+                }
+            }
+            // the center always has a weight of 254, rounded to the nearest value
+            result[y * width + x] = (uint8_t)((2 * sum + weight_sum) / (2 * weight_sum));
+        }
+    }
+}
+
+// Weights of 16 absolute differences, looked up with one pshufb per 16 byte segment of the table
+static inline __m128i lookup(const uint8_t* table, size_t segment_count, __m128i difference)
+{
+    // adding 0x70 with saturation sets the high bit of every difference outside the segment, pshufb returns 0 for them
+    __m128i offset = _mm_set1_epi8(0x70);
+    __m128i weight = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)table), _mm_adds_epu8(difference, offset));
+    for (size_t s = 1; s < segment_count; s++) {
+        __m128i index = _mm_adds_epu8(_mm_sub_epi8(difference, _mm_set1_epi8((char)(16 * s))), offset);
+        weight = _mm_or_si128(weight, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(table + 16 * s)), index));
+    }
+    return weight;
+}
+
+// (2 * sum + weight_sum) / (2 * weight_sum) of 4 pixels, the operands are below 2^24, so the float quotient truncates to the exact result
+static inline __m128i rounded_quotient(__m128i sum, __m128i weight_sum)
+{
+    __m128 numerator = _mm_cvtepi32_ps(_mm_add_epi32(_mm_slli_epi32(sum, 1), weight_sum));
+    __m128 denominator = _mm_cvtepi32_ps(_mm_slli_epi32(weight_sum, 1));
+    return _mm_cvttps_epi32(_mm_div_ps(numerator, denominator));
+}
+
+// Add weight_a * pixel_a + weight_b * pixel_b of two neighbours of 16 pixels to the 32 bit sums with pmaddwd, weight_a + weight_b
+// to the 16 bit sums of the weights with pmaddubsw
+static inline void accumulate(__m128i* sum, __m128i* weight_sum, __m128i weight_a, __m128i weight_b, __m128i pixel_a, __m128i pixel_b)
+{
+    __m128i weights_low = _mm_unpacklo_epi8(weight_a, weight_b), weights_high = _mm_unpackhi_epi8(weight_a, weight_b);
+    __m128i pixels_low = _mm_unpacklo_epi8(pixel_a, pixel_b), pixels_high = _mm_unpackhi_epi8(pixel_a, pixel_b);
+    __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+    weight_sum[0] = _mm_add_epi16(weight_sum[0], _mm_maddubs_epi16(weights_low, one));
+    weight_sum[1] = _mm_add_epi16(weight_sum[1], _mm_maddubs_epi16(weights_high, one));
+    sum[0] = _mm_add_epi32(sum[0], _mm_madd_epi16(_mm_unpacklo_epi8(weights_low, zero), _mm_unpacklo_epi8(pixels_low, zero)));
+    sum[1] = _mm_add_epi32(sum[1], _mm_madd_epi16(_mm_unpackhi_epi8(weights_low, zero), _mm_unpackhi_epi8(pixels_low, zero)));
+    sum[2] = _mm_add_epi32(sum[2], _mm_madd_epi16(_mm_unpacklo_epi8(weights_high, zero), _mm_unpacklo_epi8(pixels_high, zero)));
+    sum[3] = _mm_add_epi32(sum[3], _mm_madd_epi16(_mm_unpackhi_epi8(weights_high, zero), _mm_unpackhi_epi8(pixels_high, zero)));
+}
+
+/**
+ * Look up the weights of the neighbours after the center of the window for 16 centers starting at column j - radius of a row.
+ * rows are the rows of the center and the radius rows below it, forward the window * window / 2 rows of the weights.
+ */
+static inline void forward_weights(const struct bilateral_weights* weights, uint8_t* const* rows, size_t j, size_t window, uint8_t* forward, size_t forward_length)
+{
+    size_t radius = window / 2, center_index = window * window / 2;
+    __m128i center = _mm_loadu_si128((const __m128i*)(rows[0] + j + radius));
+#pragma GCC unroll 12
+    for (size_t k = center_index + 1; k < window * window; k++) {
+        __m128i pixel = _mm_loadu_si128((const __m128i*)(rows[k / window - radius] + j + k % window));
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(pixel, center), _mm_subs_epu8(center, pixel));
+        _mm_storeu_si128((__m128i*)(forward + (k - center_index - 1) * forward_length + j), lookup(weights->table[k], weights->segment_count, difference));
+    }
+}
+
+/**
+ * Filter 16 pixels starting at x, window is a constant in both calls and the loops over the window are unrolled, so the indices are constants.
+ * forward[i] are the weights of forward_weights() of row i of the window up to the center row.
+ */
+static inline __m128i bilateral_16(const struct bilateral_weights* weights, uint8_t* const* window_rows, uint8_t* const* forward, size_t forward_length,
+    size_t x, size_t window)
+{
+    size_t radius = window / 2, center_index = window * window / 2;
+    __m128i zero = _mm_setzero_si128();
+    // the sums of the weights fit into 16 bits, the weighted sums of the pixels need 32 bits
+    __m128i weight_sum[2] = { zero, zero };
+    __m128i sum[4] = { zero, zero, zero, zero };
+    __m128i weight[26], pixel[26];
+#pragma GCC unroll 25
+    for (size_t k = 0; k < window * window; k++)
+        pixel[k] = _mm_loadu_si128((const __m128i*)(window_rows[k / window] + x + radius + k % window));
+    // the weight of a neighbour before the center is the forward weight of the neighbour for this pixel, the tables are symmetric
+#pragma GCC unroll 12
+    for (size_t k = 0; k < center_index; k++)
+        weight[k] = _mm_loadu_si128((const __m128i*)(forward[k / window] + (center_index - 1 - k) * forward_length + x + k % window));
+    weight[center_index] = _mm_set1_epi8((char)weights->table[center_index][0]);
+#pragma GCC unroll 12
+    for (size_t k = center_index + 1; k < window * window; k++)
+        weight[k] = _mm_loadu_si128((const __m128i*)(forward[radius] + (k - center_index - 1) * forward_length + x + radius));
+    // the neighbours are accumulated in pairs, the last one of the odd window is paired with a zero weight
+    weight[window * window] = pixel[window * window] = zero;
+#pragma GCC unroll 13
+    for (size_t k = 0; k < window * window; k += 2)
+        accumulate(sum, weight_sum, weight[k], weight[k + 1], pixel[k], pixel[k + 1]);
+    __m128i low = _mm_packus_epi32(rounded_quotient(sum[0], _mm_unpacklo_epi16(weight_sum[0], zero)), rounded_quotient(sum[1], _mm_unpackhi_epi16(weight_sum[0], zero)));
+    __m128i high = _mm_packus_epi32(rounded_quotient(sum[2], _mm_unpacklo_epi16(weight_sum[1], zero)), rounded_quotient(sum[3], _mm_unpackhi_epi16(weight_sum[1], zero)));
+    return _mm_packus_epi16(low, high);
+}
+
+void bilateral_simd(const uint8_t* image, size_t width, size_t height, const struct bilateral_weights* weights, uint8_t* scratch, uint8_t* result)
+{
+    size_t window = weights->window, radius = window / 2;
+    size_t length = BILATERAL_ROW_LENGTH(width), forward_length = BILATERAL_FORWARD_LENGTH(width), forward_size = window * window / 2 * forward_length;
+    uint8_t* rows[5];
+    for (size_t k = 0; k < window; k++)
+        rows[k] = scratch + k * length;
+    // the forward weights of the center row and the radius rows above it are a ring too, row i is in forward[(i + radius) % (radius + 1)]
+    uint8_t* forward[3];
+    for (size_t k = 0; k <= radius; k++)
+        forward[k] = scratch + window * length + k * forward_size;
+
+    // the rows of the window are a ring like in median_simd(), source row i is in rows[(i + radius) % window]
+    // the rows are extended by 2 * radius pixels on the left, the forward weights of centers up to radius pixels outside the image are needed
+    for (size_t k = 0; k + 1 < window; k++)
+        extend_row(image, width, height, (ptrdiff_t)k - (ptrdiff_t)radius, 2 * radius, length, rows[k]);
+    // the weights of the neighbours above the first rows are the forward weights of the rows above the image
+    for (size_t k = 0; k < radius; k++) {
+        uint8_t* below[3];
+        for (size_t i = 0; i <= radius; i++)
+            below[i] = rows[k + i];
+        for (size_t j = 0; j < forward_length; j += 16)
+            window == 3 ? forward_weights(weights, below, j, 3, forward[k], forward_length) : forward_weights(weights, below, j, 5, forward[k], forward_length);
+    }
+    for (size_t y = 0; y < height; y++) {
+        extend_row(image, width, height, (ptrdiff_t)(y + radius), 2 * radius, length, rows[(y + 2 * radius) % window]);
+        uint8_t* window_rows[5];
+        for (size_t k = 0; k < window; k++)
+            window_rows[k] = rows[(y + k) % window];
+        uint8_t* window_forward[3];
+        for (size_t k = 0; k <= radius; k++)
+            window_forward[k] = forward[(y + k) % (radius + 1)];
+
+        // the forward weights of the row are looked up one block ahead of the pixels, the neighbours before the center reach radius pixels into it
+        uint8_t* row = result + y * width;
+        uint8_t* const* center_rows = window_rows + radius;
+        window == 3 ? forward_weights(weights, center_rows, 0, 3, window_forward[radius], forward_length)
+                    : forward_weights(weights, center_rows, 0, 5, window_forward[radius], forward_length);
+        for (size_t x = 0; x < width; x += 16) {
+            window == 3 ? forward_weights(weights, center_rows, x + 16, 3, window_forward[radius], forward_length)
+                        : forward_weights(weights, center_rows, x + 16, 5, window_forward[radius], forward_length);
+            __m128i filtered = window == 3 ? bilateral_16(weights, window_rows, window_forward, forward_length, x, 3)
+                                           : bilateral_16(weights, window_rows, window_forward, forward_length, x, 5);
+            if (x + 16 <= width) {
+                _mm_storeu_si128((__m128i*)(row + x), filtered);
+            } else {
+                uint8_t tail[16];
+                _mm_storeu_si128((__m128i*)tail, filtered);
+                memcpy(row + x, tail, width - x);
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef BILATERAL_H
+#define BILATERAL_H
+#include <stddef.h>
+#include <stdint.h>
+
+// bytes of a row of the window and of a row of the forward weights of bilateral_simd()
+#define BILATERAL_ROW_LENGTH(width) (((width) + 15) / 16 * 16 + 32)
+#define BILATERAL_FORWARD_LENGTH(width) (((width) + 15) / 16 * 16 + 16)
+// bytes of scratch memory bilateral_simd() needs for a row width and window size, the rows of the window and the forward weights
+// of window / 2 + 1 rows
+#define BILATERAL_SCRATCH_SIZE(width, window) \
+    ((window) * BILATERAL_ROW_LENGTH(width) + ((window) / 2 + 1) * ((window) * (window) / 2) * BILATERAL_FORWARD_LENGTH(width))
+
+/**
+ * Fixed-point weights of a bilateral filter, computed once by bilateral_weights() before filtering.
+ * The spatial weights are baked into one table per offset of the window, so filtering only needs lookups:
+ * the weight of the neighbour at offset k is table[k][|neighbour - center|].
+ */
+struct bilateral_weights {
+    size_t window; // 3 or 5
+    uint8_t spatial[25]; // window * window weights of the offsets, 255 for the center
+    uint8_t range[256]; // weights of the absolute differences, 255 for no difference
+    uint8_t table[25][256]; // (spatial[k] * range[d]) >> 8, split into 16 byte segments for lookups with pshufb
+    size_t segment_count; // segments up to the last nonzero range weight, the others are skipped
+};
+
+/**
+ * Compute the weights of a bilateral filter with gaussian spatial and range kernels.
+ * @param window: 3 or 5 for a 3x3 or 5x5 window
+ * @param sigma_spatial: standard deviation of the spatial kernel in pixels
+ * @param sigma_range: standard deviation of the range kernel in gray values, smaller values preserve weaker edges
+ */
+void bilateral_weights(struct bilateral_weights* weights, size_t window, float sigma_spatial, float sigma_range);
+
+/**
+ * Bilateral filter of a grayscale image: every pixel becomes the mean of its window,
+ * weighted by the distance to the neighbours and the difference of their values.
+ * Naive implementation, the pixels outside the image are replaced by the nearest edge pixel.
+ */
+void bilateral(const uint8_t* image, size_t width, size_t height, const struct bilateral_weights* weights, uint8_t* result);
+
+/**
+ * Does the same as bilateral(), optimized using SSE, SSE4.1 is required. The result is exact.
+ * 16 pixels are filtered at once, the range weights are looked up with one pshufb per 16 byte segment of the table.
+ * The tables are symmetric, so only the weights of the neighbours after the center are looked up and kept for radius rows,
+ * the weight of a neighbour before the center is the one the neighbour looked up for this pixel.
+ * @param scratch: BILATERAL_SCRATCH_SIZE(width, weights->window) bytes for the rows of the window and the forward weights
+ */
+void bilateral_simd(const uint8_t* image, size_t width, size_t height, const struct bilateral_weights* weights, uint8_t* scratch, uint8_t* result);
+
+#endif // BILATERAL_H
@@ -0,0 +1,174 @@
+#include "box.h"
+#include <math.h>
+#include <smmintrin.h>
+
+void gaussian_boxes(float sigma, size_t* radii)
+{
+    // the variance of a box of odd width w is (w * w - 1) / 12, the variances of the passes add up,
+    // so the widths are the odd numbers below and above the ideal width, mixed to match 12 * sigma^2
+    double variance = 12.0 * sigma * sigma;
+    long lower = (long)floor(sqrt(variance / BOX_PASSES + 1));
+    if (lower % 2 == 0)
+        lower--;
+    long lower_count = lround((variance - BOX_PASSES * lower * lower - 4 * BOX_PASSES * lower - 3 * BOX_PASSES) / (-4.0 * lower - 4));
+    for (long i = 0; i < BOX_PASSES; i++) {
+        size_t radius = (size_t)((i < lower_count ? lower : lower + 2) - 1) / 2;
+        radii[i] = radius < BOX_MAX_RADIUS ? radius : BOX_MAX_RADIUS;
+    }
+}
+
+// round(65536 / (2 * radius + 1)), the mean of a window is (sum * reciprocal + 32768) >> 16
+static inline uint32_t reciprocal(size_t radius)
+{
+    return (uint32_t)((65536 + radius) / (2 * radius + 1));
+}
+
+static inline size_t clamp(ptrdiff_t i, size_t size)
+{
+    return i < 0 ? 0 : (size_t)i >= size ? size - 1 : (size_t)i;
+}
+
+// One box filter along the columns, summing every window, source and destination have the given row stride and column step
+static void box_pass(const uint8_t* source, size_t length, size_t count, size_t stride, size_t step, size_t radius, uint8_t* destination)
+{
+    uint32_t factor = reciprocal(radius);
+    for (size_t j = 0; j < count; j++) {
+        for (size_t i = 0; i < length; i++) {
+            uint32_t sum = 0;
+            for (ptrdiff_t k = -(ptrdiff_t)radius; k <= (ptrdiff_t)radius; k++)
+                sum += source[clamp((ptrdiff_t)i + k, length) * stride + j * step];
+            destination[i * stride + j * step] = (uint8_t)((sum * factor + 32768) >> 16);
+        }
+    }
+}
+
+void box_blur(const uint8_t* image, size_t width, size_t height, const size_t* radii, uint8_t* tmp, uint8_t* result)
+{
+    // the passes alternate between tmp and result, passes with a radius of 0 are skipped
+    const uint8_t* current = image;
+    for (size_t pass = 0; pass < 2 * BOX_PASSES; pass++) {
+        size_t radius = radii[pass % BOX_PASSES];
+        if (radius == 0)
+            continue;
+        uint8_t* next = current == result ? tmp : result;
+        if (pass < BOX_PASSES)
+            box_pass(current, height, width, width, 1, radius, next);
+        else
+            box_pass(current, width, height, 1, width, radius, next);
+        current = next;
+    }
+    if (current != result) {
+        for (size_t i = 0; i < width * height; i++)
+            result[i] = current[i];
+    }
+}
+
+// ----- SIMD -----
+// (sum * reciprocal + 32768) >> 16 of 8 sums: the high half of the product plus the rounding carry of the low half
+static inline __m128i mean_8(__m128i sum, __m128i factor)
+{
+    return _mm_add_epi16(_mm_mulhi_epu16(sum, factor), _mm_srli_epi16(_mm_mullo_epi16(sum, factor), 15));
+}
+
+// One box filter along the columns with running sums: every row adds the row entering the window and subtracts the row leaving it
+static void box_pass_simd(const uint8_t* source, size_t width, size_t height, size_t radius, uint16_t* sums, uint8_t* destination)
+{
+    uint32_t factor = reciprocal(radius);
+    __m128i factors = _mm_set1_epi16((short)factor);
+    __m128i zero = _mm_setzero_si128();
+    // the window of row 0 holds the first row radius + 1 times, rows outside the image are replaced by the nearest edge row
+    for (size_t x = 0; x < width; x++)
+        sums[x] = (uint16_t)((radius + 1) * source[x]);
+    for (size_t k = 1; k <= radius; k++) {
+        const uint8_t* row = source + clamp((ptrdiff_t)k, height) * width;
+        for (size_t x = 0; x < width; x++)
+            sums[x] = (uint16_t)(sums[x] + row[x]);
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* entering = source + clamp((ptrdiff_t)(y + radius + 1), height) * width;
+        const uint8_t* leaving = source + clamp((ptrdiff_t)y - (ptrdiff_t)radius, height) * width;
+        uint8_t* row = destination + y * width;
+        size_t x = 0;
+        // the sums are at most 255 * 257 and wrap around between the addition and the subtraction, the result is still right
+        for (; x + 16 <= width; x += 16) {
+            __m128i low = _mm_loadu_si128((const __m128i*)&sums[x]);
+            __m128i high = _mm_loadu_si128((const __m128i*)&sums[x + 8]);
+            _mm_storeu_si128((__m128i*)&row[x], _mm_packus_epi16(mean_8(low, factors), mean_8(high, factors)));
+            __m128i in = _mm_loadu_si128((const __m128i*)&entering[x]);
+            __m128i out = _mm_loadu_si128((const __m128i*)&leaving[x]);
+            low = _mm_sub_epi16(_mm_add_epi16(low, _mm_unpacklo_epi8(in, zero)), _mm_unpacklo_epi8(out, zero));
+            high = _mm_sub_epi16(_mm_add_epi16(high, _mm_unpackhi_epi8(in, zero)), _mm_unpackhi_epi8(out, zero));
+            _mm_storeu_si128((__m128i*)&sums[x], low);
+            _mm_storeu_si128((__m128i*)&sums[x + 8], high);
+        }
+        for (; x < width; x++) {
+            row[x] = (uint8_t)((sums[x] * factor + 32768) >> 16);
+            sums[x] = (uint16_t)(sums[x] + entering[x] - leaving[x]);
+        }
+    }
+}
+
+// Transpose a block of 16x16 pixels: 4 rounds of interleaving the rows i and i + 8 swap the 4 bits of the row and the column index
+static inline void transpose_16x16(const uint8_t* source, size_t source_stride, uint8_t* destination, size_t destination_stride)
+{
+    __m128i rows[16], interleaved[16];
+    for (size_t i = 0; i < 16; i++)
+        rows[i] = _mm_loadu_si128((const __m128i*)(source + i * source_stride));
+    for (int round = 0; round < 4; round++) {
+        for (size_t i = 0; i < 8; i++) {
+            interleaved[2 * i] = _mm_unpacklo_epi8(rows[i], rows[i + 8]);
+            interleaved[2 * i + 1] = _mm_unpackhi_epi8(rows[i], rows[i + 8]);
+        }
+        for (size_t i = 0; i < 16; i++)
+            rows[i] = interleaved[i];
+    }
+    for (size_t i = 0; i < 16; i++)
+        _mm_storeu_si128((__m128i*)(destination + i * destination_stride), rows[i]);
+}
+
+// The width x height image becomes a height x width image
+static void transpose(const uint8_t* source, size_t width, size_t height, uint8_t* destination)
+{
+    size_t y = 0;
+    for (; y + 16 <= height; y += 16) {
+        size_t x = 0;
+        for (; x + 16 <= width; x += 16)
+            transpose_16x16(source + y * width + x, width, destination + x * height + y, height);
+        for (; x < width; x++) {
+            for (size_t k = y; k < y + 16; k++)
+                destination[x * height + k] = source[k * width + x];
+        }
+    }
+    for (; y < height; y++) {
+        for (size_t x = 0; x < width; x++)
+            destination[x * height + y] = source[y * width + x];
+    }
+}
+
+void box_blur_simd(const uint8_t* image, size_t width, size_t height, const size_t* radii, uint8_t* scratch, uint8_t* result)
+{
+    uint8_t* buffers[2] = { scratch, scratch + width * height };
+    uint16_t* sums = (uint16_t*)(scratch + 2 * width * height);
+    // the passes alternate between the two buffers, passes with a radius of 0 are skipped
+    const uint8_t* current = image;
+    for (size_t pass = 0; pass < BOX_PASSES; pass++) {
+        if (radii[pass] == 0)
+            continue;
+        uint8_t* next = current == buffers[0] ? buffers[1] : buffers[0];
+        box_pass_simd(current, width, height, radii[pass], sums, next);
+        current = next;
+    }
+    // the rows become columns, so the passes along the rows can use the running sums of the columns as well
+    uint8_t* transposed = current == buffers[0] ? buffers[1] : buffers[0];
+    transpose(current, width, height, transposed);
+    current = transposed;
+    for (size_t pass = 0; pass < BOX_PASSES; pass++) {
+        if (radii[pass] == 0)
+            continue;
+        uint8_t* next = current == buffers[0] ? buffers[1] : buffers[0];
+        box_pass_simd(current, height, width, radii[pass], sums, next);
+        current = next;
+    }
+    transpose(current, height, width, result);
+}
@@ -0,0 +1,40 @@
+#ifndef BOX_H
+#define BOX_H
+#include <stddef.h>
+#include <stdint.h>
+
+// box filters in each direction that approximate a gaussian
+#define BOX_PASSES 3
+// largest radius of a single box filter, the sum of a window of 2 * 128 + 1 pixels still fits into 16 bits
+#define BOX_MAX_RADIUS 128
+
+// bytes of scratch memory box_blur_simd() needs for an image size: two images for the passes and the column sums
+#define BOX_SCRATCH_SIZE(width, height) (2 * (width) * (height) + 2 * ((width) > (height) ? (width) : (height)))
+
+/**
+ * Compute the radii of BOX_PASSES box filters whose repeated application approximates a gaussian blur
+ * with the given standard deviation. The radii differ by at most 1, some may be 0 for small deviations.
+ * Radii above BOX_MAX_RADIUS are limited to it.
+ */
+void gaussian_boxes(float sigma, size_t* radii);
+
+/**
+ * Blur a grayscale image with BOX_PASSES box filters along the columns and then BOX_PASSES along the rows.
+ * Every pass rounds the mean of its window to 8 bits with a 16 bit fixed-point reciprocal of the window size.
+ * Naive implementation that sums every window, the pixels outside the image are replaced by the nearest edge pixel.
+ * @param radii: BOX_PASSES radii of the box filters, e.g. from gaussian_boxes()
+ * @param tmp: width * height bytes for the passes in between
+ */
+void box_blur(const uint8_t* image, size_t width, size_t height, const size_t* radii, uint8_t* tmp, uint8_t* result);
+
+/**
+ * Does the same as box_blur(), optimized using SSE, SSE4.1 is required. The result is exact.
+ * The windows are not summed, every row adds the row entering the window to running sums of the columns
+ * and subtracts the row leaving it, so the time per pixel does not depend on the radii.
+ * Only the sums of the first window of every pass add up radius + 1 rows.
+ * The passes along the rows run along the columns of the transposed image.
+ * @param scratch: BOX_SCRATCH_SIZE(width, height) bytes
+ */
+void box_blur_simd(const uint8_t* image, size_t width, size_t height, const size_t* radii, uint8_t* scratch, uint8_t* result);
+
+#endif // BOX_H
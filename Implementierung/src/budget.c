@@ -0,0 +1,45 @@
+#include "budget.h"
+#include "denoise.h"
+#include "tiled.h"
+
+size_t plan_bytes(const struct memory_plan* plan)
+{
+    return plan->input_bytes + plan->result_bytes + plan->padded_bytes + plan->strip_bytes;
+}
+
+int plan_memory(size_t width, size_t height, enum pixel_format format, int tiles_possible, size_t threads, int in_place,
+    size_t budget, struct memory_plan* plan)
+{
+    size_t input = width * height * pixel_size(format);
+    *plan = (struct memory_plan) {
+        .strategy = MEMORY_FULL_FRAME,
+        .input_bytes = input,
+        .result_bytes = width * height,
+        .padded_bytes = 3 * (width + 2) * (height + 2) * sizeof(uint16_t),
+    };
+    if (plan_bytes(plan) <= budget)
+        return 0;
+
+    // the highest strip that fits next to the loaded image and the result, if it is not written over the image
+    size_t result = in_place ? 0 : width * height;
+    size_t rows = height < BUDGET_MAX_STRIP_ROWS ? height : BUDGET_MAX_STRIP_ROWS;
+    while (rows > 0 && input + result + STRIP_SCRATCH_SIZE(width, rows) > budget)
+        rows--;
+    if (rows > 0) {
+        *plan = (struct memory_plan) {
+            .strategy = MEMORY_STRIPS,
+            .strip_rows = rows,
+            .input_bytes = input,
+            .result_bytes = result,
+            .strip_bytes = STRIP_SCRATCH_SIZE(width, rows),
+        };
+        return 0;
+    }
+
+    struct tile_size tile;
+    if (tiles_possible && choose_tile_size(width, height, budget, threads, &tile) == 0) {
+        *plan = (struct memory_plan) { .strategy = MEMORY_TILES, .strip_bytes = budget };
+        return 0;
+    }
+    return -1;
+}
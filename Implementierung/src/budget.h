@@ -0,0 +1,40 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+#include "view.h"
+#include <stddef.h>
+
+// largest strip of the strip strategy, more rows only save the halo rows, which are already less than 2 / 64 of the work
+#define BUDGET_MAX_STRIP_ROWS 64
+
+// Ways to denoise an image with the SIMD version, from the fastest to the one with the smallest footprint
+enum memory_strategy {
+    MEMORY_FULL_FRAME, // the whole image with padded arrays of the whole image, the only one that uses -T for a single image
+    MEMORY_STRIPS, // denoise_simd_strips() over the loaded image, the result may be written over the input
+    MEMORY_TILES, // denoise_tiled(), the image is never loaded
+};
+
+// Strategy for one image and the bytes it allocates for every stage
+struct memory_plan {
+    enum memory_strategy strategy;
+    size_t strip_rows; // rows of a strip of MEMORY_STRIPS
+    size_t input_bytes; // the loaded image, read
+    size_t result_bytes; // grayscale image and result, grayscale conversion and combine, 0 if combined in place
+    size_t padded_bytes; // padded image, laplace and blur, padding and convolution
+    size_t strip_bytes; // scratch of the strips or the budget of the tiles in flight
+};
+
+/**
+ * Pick the fastest strategy whose buffers fit into budget bytes: the whole frame, strips of the loaded image or tiles read
+ * from the file. The strips are as high as the budget allows, up to BUDGET_MAX_STRIP_ROWS rows.
+ * @param tiles_possible: whether the image can be denoised by denoise_tiled(), which only reads binary PPM files
+ * @param threads: tiles in flight of MEMORY_TILES
+ * @param in_place: whether the strips may write the result over the input, not if it is denoised again, e.g. with -B
+ * Returns 0 on success and -1 if not even the tiles fit.
+ */
+int plan_memory(size_t width, size_t height, enum pixel_format format, int tiles_possible, size_t threads, int in_place,
+    size_t budget, struct memory_plan* plan);
+
+// Sum of the bytes of all stages of a plan
+size_t plan_bytes(const struct memory_plan* plan);
+
+#endif // BUDGET_H
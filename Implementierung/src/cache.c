@@ -0,0 +1,427 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <smmintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PRIME32_1 0x9E3779B1u
+#define PRIME32_2 0x85EBCA77u
+#define PRIME64_1 0x9E3779B97F4A7C15u
+#define PRIME64_2 0xC2B2AE3D27D4EB4Fu
+#define HASH_LANES 16
+#define HASH_BLOCK (4 * HASH_LANES)
+
+// name of a result file: the key as 32 hex digits and the extension
+#define CACHE_NAME_LENGTH 36
+#define CACHE_PATH_SIZE 4096
+#define CACHE_MIN_BUCKETS 64
+
+// The lanes start with the seed, every lane with a different offset so that equal words in different lanes differ
+static inline uint32_t lane_start(uint64_t seed, size_t lane)
+{
+    return (uint32_t)(seed >> (lane % 2 * 32)) + (uint32_t)lane * PRIME32_2;
+}
+
+static inline uint32_t hash_round(uint32_t lane, uint32_t word)
+{
+    lane += word * PRIME32_2;
+    lane = lane << 13 | lane >> 19;
+    return lane * PRIME32_1;
+}
+
+// The first half of the lanes is mixed into the low half of the key, the second half into the high half
+static void hash_finish(const uint32_t* lanes, size_t size, struct cache_key* key)
+{
+    uint64_t low = size, high = size ^ PRIME64_2;
+    for (size_t i = 0; i < HASH_LANES / 2; i++) {
+        low = (low ^ lanes[i]) * PRIME64_1;
+        low ^= low >> 29;
+        high = (high ^ lanes[i + HASH_LANES / 2]) * PRIME64_1;
+        high ^= high >> 29;
+    }
+    key->low = low;
+    key->high = high;
+}
+
+void cache_hash(const uint8_t* data, size_t size, uint64_t seed, struct cache_key* key)
+{
+    uint32_t lanes[HASH_LANES];
+    for (size_t i = 0; i < HASH_LANES; i++)
+        lanes[i] = lane_start(seed, i);
+    for (size_t offset = 0; offset < size; offset += HASH_BLOCK) {
+        for (size_t i = 0; i < HASH_LANES; i++) {
+            // little endian words, the bytes after the end are 0
+            uint32_t word = 0;
+            for (size_t j = 0; j < 4; j++) {
+                size_t index = offset + 4 * i + j;
+                word |= (uint32_t)(index < size ? data[index] : 0) << (8 * j);
+            }
+            lanes[i] = hash_round(lanes[i], word);
+        }
+    }
+    hash_finish(lanes, size, key);
+}
+
+// ----- SIMD -----
+static inline __m128i hash_round_4(__m128i lanes, __m128i words)
+{
+    lanes = _mm_add_epi32(lanes, _mm_mullo_epi32(words, _mm_set1_epi32((int)PRIME32_2)));
+    lanes = _mm_or_si128(_mm_slli_epi32(lanes, 13), _mm_srli_epi32(lanes, 19));
+    return _mm_mullo_epi32(lanes, _mm_set1_epi32((int)PRIME32_1));
+}
+
+void cache_hash_simd(const uint8_t* data, size_t size, uint64_t seed, struct cache_key* key)
+{
+    uint32_t lanes[HASH_LANES];
+    for (size_t i = 0; i < HASH_LANES; i++)
+        lanes[i] = lane_start(seed, i);
+    __m128i lanes_0 = _mm_loadu_si128((__m128i*)&lanes[0]);
+    __m128i lanes_1 = _mm_loadu_si128((__m128i*)&lanes[4]);
+    __m128i lanes_2 = _mm_loadu_si128((__m128i*)&lanes[8]);
+    __m128i lanes_3 = _mm_loadu_si128((__m128i*)&lanes[12]);
+    size_t offset = 0;
+    for (; offset + HASH_BLOCK <= size; offset += HASH_BLOCK) {
+        lanes_0 = hash_round_4(lanes_0, _mm_loadu_si128((const __m128i*)&data[offset]));
+        lanes_1 = hash_round_4(lanes_1, _mm_loadu_si128((const __m128i*)&data[offset + 16]));
+        lanes_2 = hash_round_4(lanes_2, _mm_loadu_si128((const __m128i*)&data[offset + 32]));
+        lanes_3 = hash_round_4(lanes_3, _mm_loadu_si128((const __m128i*)&data[offset + 48]));
+    }
+    if (offset < size) {
+        uint8_t last[HASH_BLOCK] = { 0 };
+        memcpy(last, &data[offset], size - offset);
+        lanes_0 = hash_round_4(lanes_0, _mm_loadu_si128((const __m128i*)&last[0]));
+        lanes_1 = hash_round_4(lanes_1, _mm_loadu_si128((const __m128i*)&last[16]));
+        lanes_2 = hash_round_4(lanes_2, _mm_loadu_si128((const __m128i*)&last[32]));
+        lanes_3 = hash_round_4(lanes_3, _mm_loadu_si128((const __m128i*)&last[48]));
+    }
+    _mm_storeu_si128((__m128i*)&lanes[0], lanes_0);
+    _mm_storeu_si128((__m128i*)&lanes[4], lanes_1);
+    _mm_storeu_si128((__m128i*)&lanes[8], lanes_2);
+    _mm_storeu_si128((__m128i*)&lanes[12], lanes_3);
+    hash_finish(lanes, size, key);
+}
+
+// ----- Tiers -----
+static inline int same_key(struct cache_key a, struct cache_key b)
+{
+    return a.low == b.low && a.high == b.high;
+}
+
+static void unlink_entry(struct cache_tier* tier, struct cache_entry* entry)
+{
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else
+        tier->newest = entry->older;
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else
+        tier->oldest = entry->newer;
+}
+
+static void push_newest(struct cache_tier* tier, struct cache_entry* entry)
+{
+    entry->newer = NULL;
+    entry->older = tier->newest;
+    if (tier->newest)
+        tier->newest->newer = entry;
+    else
+        tier->oldest = entry;
+    tier->newest = entry;
+}
+
+// The keys are hashes, so their low bits already spread the entries over the buckets
+static inline struct cache_entry** bucket(const struct cache_tier* tier, struct cache_key key)
+{
+    return &tier->buckets[key.low & (tier->bucket_count - 1)];
+}
+
+// Make room for one more entry in the index, the buckets are doubled and refilled from the list of the tier
+// Returns -1 only if the tier has no index at all, a full index just gets longer chains
+static int grow_index(struct cache_tier* tier)
+{
+    if (tier->count < tier->bucket_count)
+        return 0;
+    size_t bucket_count = tier->bucket_count ? 2 * tier->bucket_count : CACHE_MIN_BUCKETS;
+    struct cache_entry** buckets = calloc(bucket_count, sizeof(struct cache_entry*));
+    if (!buckets)
+        return tier->buckets ? 0 : -1;
+    free(tier->buckets);
+    tier->buckets = buckets;
+    tier->bucket_count = bucket_count;
+    for (struct cache_entry* entry = tier->newest; entry; entry = entry->older) {
+        struct cache_entry** chain = bucket(tier, entry->key);
+        entry->next = *chain;
+        *chain = entry;
+    }
+    return 0;
+}
+
+// Add a new entry as the most recently used, grow_index() must have succeeded
+static void add_entry(struct cache_tier* tier, struct cache_entry* entry)
+{
+    push_newest(tier, entry);
+    struct cache_entry** chain = bucket(tier, entry->key);
+    entry->next = *chain;
+    *chain = entry;
+    tier->bytes += entry->bytes;
+    tier->count++;
+}
+
+static struct cache_entry* find_entry(const struct cache_tier* tier, struct cache_key key)
+{
+    if (!tier->buckets)
+        return NULL;
+    for (struct cache_entry* entry = *bucket(tier, key); entry; entry = entry->next) {
+        if (same_key(entry->key, key))
+            return entry;
+    }
+    return NULL;
+}
+
+// Unlink an entry from the list and the index, without freeing it
+static void drop_entry(struct cache_tier* tier, struct cache_entry* entry)
+{
+    unlink_entry(tier, entry);
+    struct cache_entry** chain = bucket(tier, entry->key);
+    while (*chain != entry)
+        chain = &(*chain)->next;
+    *chain = entry->next;
+    tier->bytes -= entry->bytes;
+    tier->count--;
+}
+
+static int entry_path(const struct result_cache* cache, struct cache_key key, char* path)
+{
+    int length = snprintf(path, CACHE_PATH_SIZE, "%s/%016" PRIx64 "%016" PRIx64 ".pgm", cache->directory, key.high, key.low);
+    return length < 0 || length >= CACHE_PATH_SIZE ? -1 : 0;
+}
+
+static void remove_entry(struct result_cache* cache, struct cache_tier* tier, struct cache_entry* entry)
+{
+    drop_entry(tier, entry);
+    if (tier == &cache->disk) {
+        char path[CACHE_PATH_SIZE];
+        if (entry_path(cache, entry->key, path) == 0)
+            remove(path);
+    }
+    free(entry->pixels);
+    free(entry);
+}
+
+// Evict the least recently used entries until bytes more fit into the tier
+static void make_room(struct result_cache* cache, struct cache_tier* tier, size_t bytes)
+{
+    while (tier->oldest && tier->bytes + bytes > tier->capacity) {
+        remove_entry(cache, tier, tier->oldest);
+        cache->stats.evictions++;
+    }
+}
+
+static void insert_memory(struct result_cache* cache, struct cache_key key, size_t width, size_t height, const uint8_t* pixels)
+{
+    size_t bytes = width * height;
+    if (bytes > cache->memory.capacity)
+        return;
+    struct cache_entry* entry = malloc(sizeof(struct cache_entry));
+    uint8_t* copy = malloc(bytes);
+    if (!entry || !copy || grow_index(&cache->memory) != 0) {
+        // the cache is only an optimization, the result is just not cached
+        free(entry);
+        free(copy);
+        return;
+    }
+    make_room(cache, &cache->memory, bytes);
+    memcpy(copy, pixels, bytes);
+    *entry = (struct cache_entry) { .key = key, .width = width, .height = height, .pixels = copy, .bytes = bytes };
+    add_entry(&cache->memory, entry);
+}
+
+static void insert_disk(struct result_cache* cache, struct cache_key key, size_t size)
+{
+    struct cache_entry* entry = malloc(sizeof(struct cache_entry));
+    if (!entry || grow_index(&cache->disk) != 0) {
+        free(entry);
+        return;
+    }
+    // the size of the image is only known once the file is read
+    *entry = (struct cache_entry) { .key = key, .bytes = size };
+    add_entry(&cache->disk, entry);
+}
+
+// result file found in the directory
+struct cache_file {
+    struct cache_key key;
+    size_t size;
+    struct timespec modified;
+};
+
+static int compare_modified(const void* a, const void* b)
+{
+    const struct timespec* x = &((const struct cache_file*)a)->modified;
+    const struct timespec* y = &((const struct cache_file*)b)->modified;
+    if (x->tv_sec != y->tv_sec)
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+// Take over the result files of earlier runs, from the least to the most recently modified
+static int scan_directory(struct result_cache* cache)
+{
+    DIR* dir = opendir(cache->directory);
+    if (!dir)
+        return -1;
+    struct cache_file* files = NULL;
+    size_t count = 0, allocated = 0;
+    struct dirent* item;
+    while ((item = readdir(dir)) != NULL) {
+        struct cache_key key;
+        char extension[5] = "";
+        if (strlen(item->d_name) != CACHE_NAME_LENGTH
+            || sscanf(item->d_name, "%16" SCNx64 "%16" SCNx64 "%4s", &key.high, &key.low, extension) != 3
+            || strcmp(extension, ".pgm") != 0)
+            continue;
+        char path[CACHE_PATH_SIZE];
+        struct stat file;
+        if (entry_path(cache, key, path) != 0 || stat(path, &file) != 0)
+            continue;
+        if (count == allocated) {
+            allocated = allocated ? 2 * allocated : 64;
+            struct cache_file* grown = realloc(files, allocated * sizeof(struct cache_file));
+            if (!grown)
+                break;
+            files = grown;
+        }
+        files[count++] = (struct cache_file) { .key = key, .size = (size_t)file.st_size, .modified = file.st_mtim };
+    }
+    closedir(dir);
+    if (count > 0)
+        qsort(files, count, sizeof(struct cache_file), compare_modified);
+    for (size_t i = 0; i < count; i++)
+        insert_disk(cache, files[i].key, files[i].size);
+    free(files);
+    make_room(cache, &cache->disk, 0);
+    return 0;
+}
+
+int cache_open(struct result_cache* cache, size_t memory_capacity, const char* directory, size_t disk_capacity)
+{
+    *cache = (struct result_cache) { .directory = directory };
+    cache->memory.capacity = memory_capacity;
+    cache->disk.capacity = disk_capacity;
+    // the directory is created by the first run
+    if (directory && ((mkdir(directory, 0777) != 0 && errno != EEXIST) || scan_directory(cache) != 0))
+        return -1;
+    return 0;
+}
+
+// Read a result file written by write_file(), returns 0 if it holds a result of the given size
+static int read_file(const char* path, size_t width, size_t height, uint8_t* result)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return -1;
+    size_t file_width, file_height;
+    unsigned max_value;
+    int fail = fscanf(file, "P5 %zu %zu %u", &file_width, &file_height, &max_value) != 3 || fgetc(file) != '\n';
+    fail = fail || file_width != width || file_height != height || max_value != 255;
+    fail = fail || fread(result, 1, width * height, file) != width * height;
+    fclose(file);
+    return fail ? -1 : 0;
+}
+
+// Write a result file, through a temporary file so that other runs never read a partial file. Returns its size or 0 on error.
+static size_t write_file(const char* path, size_t width, size_t height, const uint8_t* pixels)
+{
+    char temporary[CACHE_PATH_SIZE + 4];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    FILE* file = fopen(temporary, "wb");
+    if (!file)
+        return 0;
+    int header = fprintf(file, "P5\n%zu %zu\n255\n", width, height);
+    int fail = header < 0 || fwrite(pixels, 1, width * height, file) != width * height;
+    fail |= fclose(file) != 0;
+    if (fail || rename(temporary, path) != 0) {
+        remove(temporary);
+        return 0;
+    }
+    return (size_t)header + width * height;
+}
+
+int cache_lookup(struct result_cache* cache, struct cache_key key, size_t width, size_t height, uint8_t* result)
+{
+    struct cache_entry* entry = find_entry(&cache->memory, key);
+    if (entry && entry->width == width && entry->height == height) {
+        unlink_entry(&cache->memory, entry);
+        push_newest(&cache->memory, entry);
+        memcpy(result, entry->pixels, width * height);
+        cache->stats.memory_hits++;
+        return 0;
+    }
+    entry = cache->directory ? find_entry(&cache->disk, key) : NULL;
+    char path[CACHE_PATH_SIZE];
+    if (entry && entry_path(cache, key, path) == 0) {
+        if (read_file(path, width, height, result) == 0) {
+            // the modification time keeps the order of use for the next run
+            utimensat(AT_FDCWD, path, NULL, 0);
+            unlink_entry(&cache->disk, entry);
+            push_newest(&cache->disk, entry);
+            insert_memory(cache, key, width, height, result);
+            cache->stats.disk_hits++;
+            return 0;
+        }
+        // removed by another run or not a result of this size
+        remove_entry(cache, &cache->disk, entry);
+    }
+    cache->stats.misses++;
+    return -1;
+}
+
+int cache_insert(struct result_cache* cache, struct cache_key key, size_t width, size_t height, const uint8_t* pixels)
+{
+    struct cache_entry* entry = find_entry(&cache->memory, key);
+    if (entry)
+        remove_entry(cache, &cache->memory, entry);
+    insert_memory(cache, key, width, height, pixels);
+    if (!cache->directory)
+        return 0;
+
+    entry = find_entry(&cache->disk, key);
+    if (entry)
+        remove_entry(cache, &cache->disk, entry);
+    char path[CACHE_PATH_SIZE];
+    if (entry_path(cache, key, path) != 0)
+        return -1;
+    // the header has at most 64 bytes, room is made before writing, so the directory never grows beyond its capacity
+    if (width * height + 64 > cache->disk.capacity)
+        return 0;
+    make_room(cache, &cache->disk, width * height + 64);
+    size_t size = write_file(path, width, height, pixels);
+    if (size == 0)
+        return -1;
+    insert_disk(cache, key, size);
+    return 0;
+}
+
+void cache_close(struct result_cache* cache)
+{
+    while (cache->memory.oldest)
+        remove_entry(cache, &cache->memory, cache->memory.oldest);
+    // only the entries are freed, the files stay
+    while (cache->disk.oldest) {
+        struct cache_entry* entry = cache->disk.oldest;
+        drop_entry(&cache->disk, entry);
+        free(entry);
+    }
+    free(cache->memory.buckets);
+    free(cache->disk.buckets);
+    cache->memory.buckets = cache->disk.buckets = NULL;
+    cache->memory.bucket_count = cache->disk.bucket_count = 0;
+}
@@ -0,0 +1,87 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <stddef.h>
+#include <stdint.h>
+
+// 128 bit hash of an input image and the parameters it was denoised with
+struct cache_key {
+    uint64_t low;
+    uint64_t high;
+};
+
+// Cached result, either in memory with its pixels or only as a file in the cache directory
+struct cache_entry {
+    struct cache_key key;
+    size_t width;
+    size_t height;
+    uint8_t* pixels; // NULL for entries on disk
+    size_t bytes; // pixels in memory or size of the file on disk
+    struct cache_entry* newer;
+    struct cache_entry* older;
+    struct cache_entry* next; // next entry in the same bucket of the index
+};
+
+// Entries of one tier from the most to the least recently used, the least recently used are evicted first
+// They are found by key through a hash table, the list only keeps the order of use
+struct cache_tier {
+    struct cache_entry* newest;
+    struct cache_entry* oldest;
+    size_t bytes; // sum of the bytes of the entries
+    size_t capacity;
+    struct cache_entry** buckets; // power of two number of chains, at least as many as entries
+    size_t bucket_count;
+    size_t count; // number of entries
+};
+
+// Counters to size the cache, every lookup is one hit or one miss
+struct cache_stats {
+    size_t memory_hits;
+    size_t disk_hits;
+    size_t misses;
+    size_t evictions; // of both tiers
+};
+
+struct result_cache {
+    struct cache_tier memory;
+    struct cache_tier disk;
+    const char* directory; // NULL without a disk tier
+    struct cache_stats stats;
+};
+
+/**
+ * Hash size bytes into a 128 bit key. Naive implementation of the hash of cache_hash_simd().
+ * 16 lanes of 32 bits each take every 16th word of 4 bytes like the round of xxHash32: the word is multiplied with a prime
+ * and added, the lane rotated and multiplied with another prime. The last block of 64 bytes is padded with zeros,
+ * the lanes and the size are mixed into the key at the end. Not a cryptographic hash.
+ * @param seed: start value of the lanes, e.g. the low half of the key of the parameters
+ */
+void cache_hash(const uint8_t* data, size_t size, uint64_t seed, struct cache_key* key);
+
+// Does the same as cache_hash(), optimized using SSE, SSE4.1 is required. The lanes are the 32 bit elements of four vectors,
+// so four chains of multiplications are in flight.
+void cache_hash_simd(const uint8_t* data, size_t size, uint64_t seed, struct cache_key* key);
+
+/**
+ * Start an empty cache of denoised results, the memory tier holds at most memory_capacity bytes of pixels.
+ * With a directory, the results are also written to it as PGM files named after their key, at most disk_capacity bytes.
+ * The directory is created if it doesn't exist, the files already in it are taken over and the least recently modified
+ * are evicted first. Returns 0 on success and -1 if the directory can't be created or read.
+ */
+int cache_open(struct result_cache* cache, size_t memory_capacity, const char* directory, size_t disk_capacity);
+
+/**
+ * Look up the result of a key, a hit on disk is moved into the memory tier.
+ * Returns 0 and copies the width * height pixels of the result on a hit, -1 on a miss.
+ */
+int cache_lookup(struct result_cache* cache, struct cache_key key, size_t width, size_t height, uint8_t* result);
+
+/**
+ * Store the result of a key in both tiers, evicting the least recently used entries until it fits.
+ * Results larger than a tier are not stored in it. Returns 0 on success and -1 if the file can't be written.
+ */
+int cache_insert(struct result_cache* cache, struct cache_key key, size_t width, size_t height, const uint8_t* pixels);
+
+// Free the memory tier, the files in the directory are kept for the next run
+void cache_close(struct result_cache* cache);
+
+#endif // CACHE_H
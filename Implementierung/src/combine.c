@@ -1,6 +1,10 @@
 #include "combine.h"
+#include "convolution.h"
 #include <emmintrin.h>
+#include <smmintrin.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define combine_acc(sum) (round(sum / 255.0))
 #define combine_int(sum) (sum / 255)
@@ -8,42 +12,453 @@
 // laplace convolution already converts it's results to an intermediary result that can be stored in a uint8_t array
 void combine(const uint8_t* original, const uint8_t* laplace, const uint8_t* blur, size_t width, size_t height, uint8_t* result, int accurate)
 {
-    size_t size = width * height;
-    for (size_t i = 0; i < size; i++) {
-        int sum = laplace[i] * original[i] + (255 - laplace[i]) * blur[i];
-        result[i] = (uint8_t)(accurate ? combine_acc(sum) : combine_int(sum));
+    combine_view(packed_view(original, width, height, 1), packed_view(laplace, width, height, 1), packed_view(blur, width, height, 1),
+        packed_view(result, width, height, 1), accurate);
+}
+
+void combine_view(struct image_view original, struct image_view laplace, struct image_view blur, struct image_view result, int accurate)
+{
+    for (size_t y = 0; y < original.height; y++) {
+        const uint8_t* original_row = view_row(original, y);
+        const uint8_t* laplace_row = view_row(laplace, y);
+        const uint8_t* blur_row = view_row(blur, y);
+        uint8_t* result_row = view_row(result, y);
+        for (size_t x = 0; x < original.width; x++) {
+            int sum = laplace_row[x] * original_row[x] + (255 - laplace_row[x]) * blur_row[x];
+            result_row[x] = (uint8_t)(accurate ? combine_acc(sum) : combine_int(sum));
+        }
+    }
+}
+
+// inlined with the unit gain into combine_simd_view(), so the scaling costs nothing there
+// Combine the 16 pixels of a row starting at x, the laplace responses are scaled by the gain
+static inline __m128i combine_16(const uint8_t* original_row, const uint16_t* laplace_row, const uint16_t* blur_row, size_t x, uint16_t gain)
+{
+    __m128i i255 = _mm_set1_epi16(255);
+    __m128i gain_16b = _mm_set1_epi16((short)gain);
+    __m128i original_8b = _mm_loadu_si128((__m128i*)&original_row[x]);
+
+    __m128i original_16b_low = _mm_unpacklo_epi8(original_8b, _mm_setzero_si128());
+    __m128i laplace_16b_low = _mm_loadu_si128((__m128i*)&laplace_row[x]);
+    if (gain != ADAPTIVE_UNIT_GAIN)
+        laplace_16b_low = _mm_min_epi16(_mm_srli_epi16(_mm_mullo_epi16(laplace_16b_low, gain_16b), 4), i255);
+    __m128i blur_16b_low = _mm_loadu_si128((__m128i*)&blur_row[x]);
+    __m128i res_low = _mm_mullo_epi16(laplace_16b_low, original_16b_low);
+    res_low = _mm_add_epi16(res_low, _mm_mullo_epi16(_mm_sub_epi16(i255, laplace_16b_low), blur_16b_low));
+    res_low = _mm_srli_epi16(res_low, 8);
+
+    __m128i original_16b_high = _mm_unpackhi_epi8(original_8b, _mm_setzero_si128());
+    __m128i laplace_16b_high = _mm_loadu_si128((__m128i*)&laplace_row[x + 8]);
+    if (gain != ADAPTIVE_UNIT_GAIN)
+        laplace_16b_high = _mm_min_epi16(_mm_srli_epi16(_mm_mullo_epi16(laplace_16b_high, gain_16b), 4), i255);
+    __m128i blur_16b_high = _mm_loadu_si128((__m128i*)&blur_row[x + 8]);
+    __m128i res_high = _mm_mullo_epi16(laplace_16b_high, original_16b_high);
+    res_high = _mm_add_epi16(res_high, _mm_mullo_epi16(_mm_sub_epi16(i255, laplace_16b_high), blur_16b_high));
+    res_high = _mm_srli_epi16(res_high, 8);
+
+    return _mm_packus_epi16(res_low, res_high);
+}
+
+// inlined with the unit gain into combine_simd_view(), so the scaling costs nothing there
+static inline void combine_simd_scaled(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, uint16_t gain, struct image_view result)
+{
+    size_t width = original.width;
+    size_t aligned = width - width % 16;
+
+    for (size_t y = 0; y < original.height; y++) {
+        const uint8_t* original_row = view_row(original, y);
+        const uint16_t* laplace_row = padded_laplace + (y + 1) * padded_width + 1;
+        const uint16_t* blur_row = padded_blur + (y + 1) * padded_width + 1;
+        uint8_t* result_row = view_row(result, y);
+        // rows of at least 16 pixels end with a vector that overlaps the one before instead of a scalar tail,
+        // it is computed first, because the result may overwrite the original
+        __m128i last = width >= 16 && aligned < width ? combine_16(original_row, laplace_row, blur_row, width - 16, gain) : _mm_setzero_si128();
+        for (size_t x = 0; x < aligned; x += 16)
+            _mm_storeu_si128((__m128i*)&result_row[x], combine_16(original_row, laplace_row, blur_row, x, gain));
+        if (width >= 16) {
+            if (aligned < width)
+                _mm_storeu_si128((__m128i*)&result_row[width - 16], last);
+            continue;
+        }
+        for (size_t x = aligned; x < width; x++) {
+            int laplace = laplace_row[x];
+            if (gain != ADAPTIVE_UNIT_GAIN)
+                laplace = laplace * gain >> 4 < 255 ? laplace * gain >> 4 : 255;
+            int sum = laplace * original_row[x] + (255 - laplace) * blur_row[x];
+            // shift like the vectorized pixels so that the result doesn't depend on the position in the row
+            result_row[x] = (uint8_t)(sum >> 8);
+        }
     }
 }
 
 void combine_simd(const uint8_t* original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
     size_t width, size_t height, size_t padded_width, uint8_t* result)
 {
+    combine_simd_view(packed_view(original, width, height, 1), padded_laplace, padded_blur, padded_width, packed_view(result, width, height, 1));
+}
+
+void combine_simd_view(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, struct image_view result)
+{
+    combine_simd_scaled(original, padded_laplace, padded_blur, padded_width, ADAPTIVE_UNIT_GAIN, result);
+}
+
+void combine_simd_gain_view(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, uint16_t gain, struct image_view result)
+{
+    combine_simd_scaled(original, padded_laplace, padded_blur, padded_width, gain, result);
+}
+
+// Combine 16 pixels from 8 bit laplace responses and blur in registers
+static inline __m128i combine_8bit_lanes(__m128i original, __m128i laplace, __m128i blur)
+{
+    const __m128i sign = _mm_set1_epi8((char)0x80);
+    const __m128i offset = _mm_set1_epi16(255 * 128);
+    __m128i inverse = _mm_xor_si128(laplace, _mm_set1_epi8((char)0xff)); // 255 - laplace
+    original = _mm_xor_si128(original, sign);
+    blur = _mm_xor_si128(blur, sign);
+    // laplace * (original - 128) + (255 - laplace) * (blur - 128) lies within +-255 * 128, so the sums don't saturate
+    // and adding 255 * 128 back wraps them into the unsigned sum of combine_simd_view()
+    __m128i low = _mm_maddubs_epi16(_mm_unpacklo_epi8(laplace, inverse), _mm_unpacklo_epi8(original, blur));
+    __m128i high = _mm_maddubs_epi16(_mm_unpackhi_epi8(laplace, inverse), _mm_unpackhi_epi8(original, blur));
+    low = _mm_srli_epi16(_mm_add_epi16(low, offset), 8);
+    high = _mm_srli_epi16(_mm_add_epi16(high, offset), 8);
+    return _mm_packus_epi16(low, high);
+}
+
+// Combine the 16 pixels of a row starting at x from 8 bit laplace responses and blur
+static inline __m128i combine_16_8bit(const uint8_t* original_row, const uint8_t* laplace_row, const uint8_t* blur_row, size_t x)
+{
+    return combine_8bit_lanes(_mm_loadu_si128((const __m128i*)&original_row[x]), _mm_loadu_si128((const __m128i*)&laplace_row[x]),
+        _mm_loadu_si128((const __m128i*)&blur_row[x]));
+}
+
+void combine_simd_8bit_view(struct image_view original, const uint8_t* padded_laplace, const uint8_t* padded_blur,
+    size_t padded_width, struct image_view result)
+{
+    size_t width = original.width;
     size_t aligned = width - width % 16;
-    __m128i i255 = _mm_set1_epi16(255);
+    for (size_t y = 0; y < original.height; y++) {
+        const uint8_t* original_row = view_row(original, y);
+        const uint8_t* laplace_row = padded_laplace + (y + 1) * padded_width + 1;
+        const uint8_t* blur_row = padded_blur + (y + 1) * padded_width + 1;
+        uint8_t* result_row = view_row(result, y);
+        // like combine_simd_view(), the overlapping last vector is computed first, because the result may overwrite the original
+        __m128i last = width >= 16 && aligned < width ? combine_16_8bit(original_row, laplace_row, blur_row, width - 16) : _mm_setzero_si128();
+        for (size_t x = 0; x < aligned; x += 16)
+            _mm_storeu_si128((__m128i*)&result_row[x], combine_16_8bit(original_row, laplace_row, blur_row, x));
+        if (width >= 16) {
+            if (aligned < width)
+                _mm_storeu_si128((__m128i*)&result_row[width - 16], last);
+            continue;
+        }
+        for (size_t x = aligned; x < width; x++)
+            result_row[x] = (uint8_t)((laplace_row[x] * original_row[x] + (255 - laplace_row[x]) * blur_row[x]) >> 8);
+    }
+}
 
-    for (size_t y = 0; y < height; y++) {
-        for (size_t x = 0; x < aligned; x += 16) {
-            __m128i original_8b = _mm_loadu_si128((__m128i*)&original[x + y * width]);
 
-            __m128i original_16b_low = _mm_unpacklo_epi8(original_8b, _mm_setzero_si128());
-            __m128i laplace_16b_low = _mm_loadu_si128((__m128i*)&padded_laplace[x + 1 + (y + 1) * padded_width]);
-            __m128i blur_16b_low = _mm_loadu_si128((__m128i*)&padded_blur[x + 1 + (y + 1) * padded_width]);
-            __m128i res_low = _mm_mullo_epi16(laplace_16b_low, original_16b_low);
-            res_low = _mm_add_epi16(res_low, _mm_mullo_epi16(_mm_sub_epi16(i255, laplace_16b_low), blur_16b_low));
-            res_low = _mm_srli_epi16(res_low, 8);
+// Average of bytes rounding down and [1 2 1] / 4 of bytes, the same as in convolution_simd_8bit()
+static inline __m128i avg_floor_epu8(__m128i a, __m128i b)
+{
+    return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
 
-            __m128i original_16b_high = _mm_unpackhi_epi8(original_8b, _mm_setzero_si128());
-            __m128i laplace_16b_high = _mm_loadu_si128((__m128i*)&padded_laplace[x + 9 + (y + 1) * padded_width]);
-            __m128i blur_16b_high = _mm_loadu_si128((__m128i*)&padded_blur[x + 9 + (y + 1) * padded_width]);
-            __m128i res_high = _mm_mullo_epi16(laplace_16b_high, original_16b_high);
-            res_high = _mm_add_epi16(res_high, _mm_mullo_epi16(_mm_sub_epi16(i255, laplace_16b_high), blur_16b_high));
-            res_high = _mm_srli_epi16(res_high, 8);
+static inline __m128i blur_121_epu8(__m128i outer, __m128i center, __m128i other_outer)
+{
+    return _mm_avg_epu8(avg_floor_epu8(outer, other_outer), center);
+}
+
+// The kernels of convolution_simd_8bit() and combine_8bit_lanes() for 16 pixels, from their neighbours and the blurred columns
+// left of, at and right of them
+static inline __m128i convolve_combine_16_8bit(__m128i up, __m128i left, __m128i center, __m128i right, __m128i down,
+    __m128i column_left, __m128i column_center, __m128i column_right)
+{
+    __m128i blur = blur_121_epu8(column_left, column_center, column_right);
+    __m128i neighbours = _mm_avg_epu8(_mm_avg_epu8(up, down), _mm_avg_epu8(left, right));
+    __m128i laplace = _mm_or_si128(_mm_subs_epu8(neighbours, center), _mm_subs_epu8(center, neighbours));
+    return combine_8bit_lanes(center, laplace, blur);
+}
 
-            _mm_storeu_si128((__m128i*)&result[x + y * width], _mm_packus_epi16(res_low, res_high));
+// convolve_combine_16_8bit() of the 16 pixels of a row starting at x, all neighbours are loaded
+static inline __m128i convolve_combine_at_8bit(const uint8_t* above, size_t padded_width, size_t x)
+{
+    const uint8_t* row = above + padded_width;
+    const uint8_t* below = row + padded_width;
+    __m128i up = _mm_loadu_si128((const __m128i*)&above[x + 1]);
+    __m128i left = _mm_loadu_si128((const __m128i*)&row[x]);
+    __m128i center = _mm_loadu_si128((const __m128i*)&row[x + 1]);
+    __m128i right = _mm_loadu_si128((const __m128i*)&row[x + 2]);
+    __m128i down = _mm_loadu_si128((const __m128i*)&below[x + 1]);
+    __m128i column_left = blur_121_epu8(_mm_loadu_si128((const __m128i*)&above[x]), left, _mm_loadu_si128((const __m128i*)&below[x]));
+    __m128i column_right = blur_121_epu8(_mm_loadu_si128((const __m128i*)&above[x + 2]), right, _mm_loadu_si128((const __m128i*)&below[x + 2]));
+    return convolve_combine_16_8bit(up, left, center, right, down, column_left, blur_121_epu8(up, center, down), column_right);
+}
+
+void convolve_combine_simd_8bit_view(const uint8_t* padded_image, size_t padded_width, struct image_view result)
+{
+    size_t width = result.width;
+    for (size_t y = 0; y < result.height; y++) {
+        const uint8_t* above = padded_image + y * padded_width;
+        const uint8_t* row = above + padded_width;
+        const uint8_t* below = row + padded_width;
+        uint8_t* result_row = view_row(result, y);
+        // the vectors slide along the row, only the columns of the next vector are blurred, the blurred columns left and right
+        // of a vector are shifted in from the vectors before and after it, before the first one lies the zero border
+        __m128i previous_columns = _mm_setzero_si128();
+        __m128i up = _mm_loadu_si128((const __m128i*)&above[1]);
+        __m128i center = _mm_loadu_si128((const __m128i*)&row[1]);
+        __m128i down = _mm_loadu_si128((const __m128i*)&below[1]);
+        __m128i columns = blur_121_epu8(up, center, down);
+        size_t x = 0;
+        // the next vector has to lie inside the padded row
+        for (; x + 31 <= width; x += 16) {
+            __m128i next_up = _mm_loadu_si128((const __m128i*)&above[x + 17]);
+            __m128i next_center = _mm_loadu_si128((const __m128i*)&row[x + 17]);
+            __m128i next_down = _mm_loadu_si128((const __m128i*)&below[x + 17]);
+            __m128i next_columns = blur_121_epu8(next_up, next_center, next_down);
+            _mm_storeu_si128((__m128i*)&result_row[x],
+                convolve_combine_16_8bit(up, _mm_loadu_si128((const __m128i*)&row[x]), center, _mm_loadu_si128((const __m128i*)&row[x + 2]), down,
+                    _mm_alignr_epi8(columns, previous_columns, 15), columns, _mm_alignr_epi8(next_columns, columns, 1)));
+            previous_columns = columns;
+            up = next_up;
+            center = next_center;
+            down = next_down;
+            columns = next_columns;
+        }
+        // the last vectors load their neighbours, the one at the end overlaps the one before
+        for (; x + 16 <= width; x += 16)
+            _mm_storeu_si128((__m128i*)&result_row[x], convolve_combine_at_8bit(above, padded_width, x));
+        if (x < width)
+            _mm_storeu_si128((__m128i*)&result_row[width - 16], convolve_combine_at_8bit(above, padded_width, width - 16));
+    }
+}
+
+// Rounded means of 8 whole blocks of factor 2 or 4 from the sums of their factor * 8 columns, packed into the low 8 bytes
+static inline __m128i block_means_8(const __m128i* column_sums, size_t factor)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i round = _mm_set1_epi32((int)(factor * factor / 2));
+    // whole blocks have factor * factor pixels, a power of two, the means are rounded with a shift
+    int shift = factor == 2 ? 2 : 4;
+    __m128i low = _mm_madd_epi16(column_sums[0], ones);
+    __m128i high = _mm_madd_epi16(column_sums[1], ones);
+    if (factor == 4) {
+        low = _mm_hadd_epi32(low, high);
+        high = _mm_hadd_epi32(_mm_madd_epi16(column_sums[2], ones), _mm_madd_epi16(column_sums[3], ones));
+    }
+    low = _mm_srli_epi32(_mm_add_epi32(low, round), shift);
+    high = _mm_srli_epi32(_mm_add_epi32(high, round), shift);
+    __m128i pixels = _mm_packs_epi32(low, high);
+    return _mm_packus_epi16(pixels, pixels);
+}
+
+// Write the rounded means of the blocks of a row of column sums over rows rows
+static void downscale_row(const uint16_t* sums, size_t width, size_t factor, size_t rows, uint8_t* result_row)
+{
+    size_t x = 0;
+    if (rows == factor && (factor == 2 || factor == 4)) {
+        for (; (x + 8) * factor <= width; x += 8) {
+            __m128i column_sums[4];
+            for (size_t i = 0; i < factor; i++)
+                column_sums[i] = _mm_loadu_si128((const __m128i*)&sums[x * factor + 8 * i]);
+            _mm_storel_epi64((__m128i*)&result_row[x], block_means_8(column_sums, factor));
+        }
+    }
+    // a multiplication with the reciprocal rounded up is an exact division for sums below 2^32 / divisor
+    size_t divisor = 0;
+    uint64_t reciprocal = 0;
+    for (; x * factor < width; x++) {
+        size_t columns = width - x * factor < factor ? width - x * factor : factor;
+        if (columns * rows != divisor) {
+            divisor = columns * rows;
+            reciprocal = ((uint64_t)1 << 32) / divisor + 1;
+        }
+        uint32_t sum = 0;
+        for (size_t i = 0; i < columns; i++)
+            sum += sums[x * factor + i];
+        result_row[x] = (uint8_t)((sum + divisor / 2) * reciprocal >> 32);
+    }
+}
+
+void combine_simd_downscale_view(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, size_t factor, uint16_t* sums, struct image_view result)
+{
+    size_t width = original.width;
+    size_t aligned = width - width % 8;
+    const __m128i i255 = _mm_set1_epi16(255);
+
+    for (size_t y0 = 0; y0 < original.height; y0 += factor) {
+        size_t rows = original.height - y0 < factor ? original.height - y0 : factor;
+        memset(sums, 0, width * sizeof(uint16_t));
+        for (size_t y = y0; y < y0 + rows; y++) {
+            const uint8_t* original_row = view_row(original, y);
+            const uint16_t* laplace_row = padded_laplace + (y + 1) * padded_width + 1;
+            const uint16_t* blur_row = padded_blur + (y + 1) * padded_width + 1;
+            // the combined pixels are added to the sums before they are packed to 8 bits, the same as combine_16()
+            for (size_t x = 0; x < aligned; x += 8) {
+                __m128i original_16b = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&original_row[x]));
+                __m128i laplace_16b = _mm_loadu_si128((const __m128i*)&laplace_row[x]);
+                __m128i blur_16b = _mm_loadu_si128((const __m128i*)&blur_row[x]);
+                __m128i res = _mm_mullo_epi16(laplace_16b, original_16b);
+                res = _mm_add_epi16(res, _mm_mullo_epi16(_mm_sub_epi16(i255, laplace_16b), blur_16b));
+                res = _mm_srli_epi16(res, 8);
+                _mm_storeu_si128((__m128i*)&sums[x], _mm_add_epi16(_mm_loadu_si128((const __m128i*)&sums[x]), res));
+            }
+            for (size_t x = aligned; x < width; x++) {
+                int sum = laplace_row[x] * original_row[x] + (255 - laplace_row[x]) * blur_row[x];
+                sums[x] = (uint16_t)(sums[x] + (sum >> 8));
+            }
+        }
+        downscale_row(sums, width, factor, rows, view_row(result, y0 / factor));
+    }
+}
+
+// The kernels of convolution_simd() and the combination of combine_16() for the 8 pixels at index i of the padded image,
+// the original pixels are the centers of the kernels. Without the stored laplace responses and blur the combination is
+// 255 * blur + laplace * (original - blur), modulo 2^16 the same as the sum of combine_16(), which is below 2^16.
+static inline __m128i convolve_combine_8(const uint16_t* padded_image, size_t padded_width, size_t i)
+{
+    __m128i x0y1 = _mm_loadu_si128((const __m128i*)&padded_image[i + padded_width]);
+    __m128i x1y0 = _mm_loadu_si128((const __m128i*)&padded_image[i + 1]);
+    __m128i x1y1 = _mm_loadu_si128((const __m128i*)&padded_image[i + padded_width + 1]);
+    __m128i x1y2 = _mm_loadu_si128((const __m128i*)&padded_image[i + 2 * padded_width + 1]);
+    __m128i x2y1 = _mm_loadu_si128((const __m128i*)&padded_image[i + padded_width + 2]);
+    __m128i center = _mm_slli_epi16(x1y1, 2);
+    __m128i cross = _mm_add_epi16(_mm_add_epi16(x0y1, x1y0), _mm_add_epi16(x1y2, x2y1));
+    __m128i laplace = _mm_srli_epi16(_mm_abs_epi16(_mm_sub_epi16(cross, center)), 2);
+
+    __m128i corners = _mm_add_epi16(
+        _mm_add_epi16(_mm_loadu_si128((const __m128i*)&padded_image[i]), _mm_loadu_si128((const __m128i*)&padded_image[i + 2 * padded_width])),
+        _mm_add_epi16(_mm_loadu_si128((const __m128i*)&padded_image[i + 2]), _mm_loadu_si128((const __m128i*)&padded_image[i + 2 * padded_width + 2])));
+    __m128i blur = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(corners, _mm_slli_epi16(cross, 1)), center), 4);
+
+    __m128i res = _mm_sub_epi16(_mm_slli_epi16(blur, 8), blur);
+    res = _mm_add_epi16(res, _mm_mullo_epi16(laplace, _mm_sub_epi16(x1y1, blur)));
+    return _mm_srli_epi16(res, 8);
+}
+
+// convolve_combine_8() of the single pixel at index i, for the smaller blocks at the right edge
+static inline int convolve_combine_1(const uint16_t* padded_image, size_t padded_width, size_t i)
+{
+    const uint16_t* p = padded_image + i;
+    int center = p[padded_width + 1];
+    int cross = p[padded_width] + p[1] + p[2 * padded_width + 1] + p[padded_width + 2];
+    int laplace = abs(cross - 4 * center) >> 2;
+    int blur = (p[0] + p[2] + p[2 * padded_width] + p[2 * padded_width + 2] + 2 * cross + 4 * center) >> 4;
+    return (255 * blur + laplace * (center - blur)) >> 8;
+}
+
+// inlined with the literal factors into convolve_combine_downscale_simd(), so the loops over the blocks are unrolled
+static inline void convolve_combine_blocks(const uint16_t* padded_image, size_t padded_width, size_t width, size_t height,
+    size_t factor, struct image_view result)
+{
+    size_t blocks = width / factor;
+    size_t edge_columns = width % factor;
+    for (size_t y = 0; y < height; y += factor) {
+        uint8_t* result_row = view_row(result, y / factor);
+        for (size_t block = 0; block < blocks; block += 8) {
+            // the last group overlaps the one before and writes some of its blocks again
+            size_t x = (block + 8 <= blocks ? block : blocks - 8) * factor;
+            __m128i column_sums[4];
+#pragma GCC unroll 4
+            for (size_t i = 0; i < factor; i++) {
+                column_sums[i] = convolve_combine_8(padded_image, padded_width, y * padded_width + x + 8 * i);
+#pragma GCC unroll 4
+                for (size_t row = 1; row < factor; row++)
+                    column_sums[i] = _mm_add_epi16(column_sums[i], convolve_combine_8(padded_image, padded_width, (y + row) * padded_width + x + 8 * i));
+            }
+            _mm_storel_epi64((__m128i*)&result_row[x / factor], block_means_8(column_sums, factor));
+        }
+        if (edge_columns) {
+            int sum = 0;
+            for (size_t row = y; row < y + factor; row++)
+                for (size_t x = blocks * factor; x < width; x++)
+                    sum += convolve_combine_1(padded_image, padded_width, row * padded_width + x);
+            int divisor = (int)(edge_columns * factor);
+            result_row[blocks] = (uint8_t)((sum + divisor / 2) / divisor);
+        }
+    }
+}
+
+void convolve_combine_downscale_simd(const uint16_t* padded_image, size_t padded_width, size_t width, size_t height,
+    size_t factor, struct image_view result)
+{
+    if (factor == 2)
+        convolve_combine_blocks(padded_image, padded_width, width, height, 2, result);
+    else
+        convolve_combine_blocks(padded_image, padded_width, width, height, 4, result);
+}
+
+static inline int is_uniform(const struct laplace_summary* summary)
+{
+    return summary->flat || summary->laplace_max == 0 || summary->laplace_min == 255;
+}
+
+// combine_simd_view() of a tile, or the fast path if the tile is uniform
+static void combine_tile(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, const struct laplace_summary* summary, struct image_view result)
+{
+    // (0 * original + 255 * blur) >> 8 and (255 * original + 0 * blur) >> 8 are the value minus 1, but 0 stays 0
+    if (summary->flat) {
+        for (size_t y = 0; y < original.height; y++)
+            memset(view_row(result, y), summary->value ? summary->value - 1 : 0, original.width);
+        return;
+    }
+    if (!is_uniform(summary)) {
+        combine_simd_view(original, padded_laplace, padded_blur, padded_width, result);
+        return;
+    }
+    int blur_only = summary->laplace_max == 0;
+    size_t width = original.width;
+    size_t aligned = width - width % 16;
+    __m128i one = _mm_set1_epi8(1);
+    for (size_t y = 0; y < original.height; y++) {
+        const uint8_t* original_row = view_row(original, y);
+        const uint16_t* blur_row = padded_blur + (y + 1) * padded_width + 1;
+        uint8_t* result_row = view_row(result, y);
+        for (size_t x = 0; x < aligned; x += 16) {
+            __m128i value = blur_only ? _mm_packus_epi16(_mm_loadu_si128((const __m128i*)&blur_row[x]), _mm_loadu_si128((const __m128i*)&blur_row[x + 8]))
+                                      : _mm_loadu_si128((const __m128i*)&original_row[x]);
+            _mm_storeu_si128((__m128i*)&result_row[x], _mm_subs_epu8(value, one));
         }
         for (size_t x = aligned; x < width; x++) {
-            int sum = padded_laplace[x + 1 + (y + 1) * padded_width] * original[x + y * width] + (255 - padded_laplace[x + 1 + (y + 1) * padded_width]) * padded_blur[x + 1 + (y + 1) * padded_width];
-            result[x + y * width] = (uint8_t)combine_int(sum);
+            int value = blur_only ? blur_row[x] : original_row[x];
+            result_row[x] = (uint8_t)(value ? value - 1 : 0);
         }
     }
-}
\ No newline at end of file
+}
+
+void combine_simd_strip(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, const struct laplace_summary* summaries, struct image_view result)
+{
+    size_t tiles = (original.width + FLAT_TILE_WIDTH - 1) / FLAT_TILE_WIDTH;
+    for (size_t t = 0; t < tiles;) {
+        // neighbouring tiles that need the full combine are combined together, with longer rows
+        size_t last = t;
+        while (!is_uniform(&summaries[t]) && last + 1 < tiles && !is_uniform(&summaries[last + 1]))
+            last++;
+        size_t x = t * FLAT_TILE_WIDTH;
+        size_t end = (last + 1) * FLAT_TILE_WIDTH < original.width ? (last + 1) * FLAT_TILE_WIDTH : original.width;
+        combine_tile(view_region(original, x, 0, end - x, original.height, 1), padded_laplace + x, padded_blur + x,
+            padded_width, &summaries[t], view_region(result, x, 0, end - x, original.height, 1));
+        t = last + 1;
+    }
+}
+
+uint16_t adaptive_gain(const uint32_t* histogram)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < 256; i++)
+        total += histogram[i];
+    // median laplace response, robust against the strong responses of edges
+    uint64_t count = 0;
+    size_t median = 0;
+    while (median < 255 && (count += histogram[median]) * 2 < total)
+        median++;
+    if (median == 0)
+        return ADAPTIVE_MAX_GAIN;
+    size_t gain = ADAPTIVE_UNIT_GAIN * ADAPTIVE_REFERENCE / median;
+    return (uint16_t)(gain < ADAPTIVE_MIN_GAIN ? ADAPTIVE_MIN_GAIN : gain > ADAPTIVE_MAX_GAIN ? ADAPTIVE_MAX_GAIN : gain);
+}
@@ -1,8 +1,18 @@
 #ifndef COMBINE_H
 #define COMBINE_H
+#include "view.h"
 #include <stddef.h>
 #include <stdint.h>
 
+struct laplace_summary;
+
+// gains of the laplace weights are fixed-point numbers with 4 fractional bits
+#define ADAPTIVE_UNIT_GAIN 16
+#define ADAPTIVE_MIN_GAIN 4
+#define ADAPTIVE_MAX_GAIN 255
+// median laplace response that is combined with the unit gain, like without adaptive strength
+#define ADAPTIVE_REFERENCE 4
+
 /**
  * Function to combine results of blur and edge detection(laplace) with the original grayscale image
  * Results are calculated with floating point arithmetic and rounded accurately.
@@ -10,6 +20,9 @@
  */
 void combine(const uint8_t* original, const uint8_t* laplace, const uint8_t* blur, size_t width, size_t height, uint8_t* result, int accurate);
 
+// Does the same as combine() on strided views of the same size, result may be the same view as original
+void combine_view(struct image_view original, struct image_view laplace, struct image_view blur, struct image_view result, int accurate);
+
 /**
  * Does the same as combine(), optimized using SIMD, SSE4.1 is required
  * Also unpadding is done here, so the padded arrays, resulting from the convolution_simd(), are required
@@ -18,4 +31,79 @@ void combine(const uint8_t* original, const uint8_t* laplace, const uint8_t* blu
 void combine_simd(const uint8_t* original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
     size_t width, size_t height, size_t padded_width, uint8_t* result);
 
+// Does the same as combine_simd() on strided views of the same size, the padded arrays are always packed
+void combine_simd_view(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, struct image_view result);
+
+/**
+ * Does the same as combine_simd_view() for the 8 bit padded arrays of convolution_simd_8bit(), with the same result for the same
+ * laplace responses and blur. The weights and the pixels are interleaved in 8 bit lanes and multiplied and summed with
+ * _mm_maddubs_epi16(), which takes signed pixels: 128 is subtracted from them and 255 * 128 added back to the sums.
+ */
+void combine_simd_8bit_view(struct image_view original, const uint8_t* padded_laplace, const uint8_t* padded_blur,
+    size_t padded_width, struct image_view result);
+
+/**
+ * Does the same as convolution_simd_8bit() and combine_simd_8bit_view() in one pass, with the same result: the laplace responses
+ * and the blur are kept in registers. The vectors of 16 pixels slide along the rows, so every column is blurred once,
+ * the blurred columns left and right of a vector are shifted in from the vectors before and after it with _mm_alignr_epi8().
+ * The original pixels are the centers of the kernels.
+ * @param padded_image: padded with zeros by pad_image_8bit_view(), points to the top left pixel of the halo
+ * @param result: at least 16 pixels wide, must not overlap the padded image
+ */
+void convolve_combine_simd_8bit_view(const uint8_t* padded_image, size_t padded_width, struct image_view result);
+
+// largest factor of combine_simd_downscale_view(), the sum of a block of 16 x 16 pixels still fits into 16 bits
+#define DOWNSCALE_MAX_FACTOR 16
+// width or height of an image reduced by a factor, the blocks at the right and bottom edge may be smaller
+#define DOWNSCALED_SIZE(size, factor) (((size) + (factor) - 1) / (factor))
+
+/**
+ * Does the same as combine_simd_view() and reduces the result by an integer factor in the same pass, for thumbnails and previews.
+ * The combined pixels are summed per column over factor rows and every block of factor x factor pixels is written as its
+ * rounded mean (area averaging), so only the reduced image is written. The blocks at the edges average the pixels they contain.
+ * Factors 2 and 4 reduce whole blocks with multiply-adds, the others with scalar sums.
+ * @param factor: 1 to DOWNSCALE_MAX_FACTOR
+ * @param sums: original.width 16 bit sums of a row of blocks
+ * @param result: DOWNSCALED_SIZE(original.width, factor) x DOWNSCALED_SIZE(original.height, factor) pixels
+ */
+void combine_simd_downscale_view(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, size_t factor, uint16_t* sums, struct image_view result);
+
+/**
+ * Does the same as convolution_simd() and combine_simd_downscale_view() with factor 2 or 4 in one pass, the laplace responses
+ * and the blur are kept in registers and the combined pixels summed per block, so nothing but the reduced image is written.
+ * Whole blocks are reduced in groups of 8, the smaller blocks at the right edge with scalar sums.
+ * The padded image points to the top left pixel of the halo, like convolution_simd() gets it, its border must be zero.
+ * @param width: at least 8 * factor
+ * @param height: a multiple of factor
+ * @param factor: 2 or 4
+ * @param result: DOWNSCALED_SIZE(width, factor) x height / factor pixels
+ */
+void convolve_combine_downscale_simd(const uint16_t* padded_image, size_t padded_width, size_t width, size_t height,
+    size_t factor, struct image_view result);
+
+/**
+ * Does the same as combine_simd_view() for a strip convolved by convolution_simd_strip(), with fast paths for uniform tiles:
+ * flat tiles are filled with their value, tiles without laplace response are the blur and tiles with only full responses the original.
+ * The padded arrays point to the top left pixel of the halo of the strip, like for convolution_simd_strip().
+ */
+void combine_simd_strip(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, const struct laplace_summary* summaries, struct image_view result);
+
+/**
+ * Does the same as combine_simd_view(), but the laplace weights are scaled by gain / 16 and limited to 255 first.
+ * A gain above 16 keeps more of the original image, a gain below 16 blurs more.
+ */
+void combine_simd_gain_view(struct image_view original, const uint16_t* padded_laplace, const uint16_t* padded_blur,
+    size_t padded_width, uint16_t gain, struct image_view result);
+
+/**
+ * Pick the gain for combine_simd_gain_view() from a histogram of laplace responses, see convolution_simd_histogram().
+ * The median response of flat areas grows linearly with the sigma of the noise (about 0.75 sigma for gaussian noise),
+ * edges only move the median a little. The gain is ADAPTIVE_REFERENCE / median in 1/16 steps,
+ * so clean images are blurred less and very noisy images more, between ADAPTIVE_MIN_GAIN and ADAPTIVE_MAX_GAIN.
+ */
+uint16_t adaptive_gain(const uint32_t* histogram);
+
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "convolution.h"
 #include <math.h>
 #include <smmintrin.h>
+#include <string.h>
 
 #define laplace_accurate(sum) ((uint8_t)round(abs(sum) / 4.0))
 #define blur_accurate(sum) ((uint8_t)round(sum / 16.0))
@@ -11,19 +12,24 @@ int16_t laplace_kernel[9] = { 0, 1, 0, 1, -4, 1, 0, 1, 0 };
 // Naive implementation of convolution
 void convolution(const uint8_t* image, size_t width, size_t height, uint8_t* result, const int16_t* kernel, int laplace)
 {
+    convolution_view(packed_view(image, width, height, 1), packed_view(result, width, height, 1), kernel, laplace);
+}
+
+void convolution_view(struct image_view image, struct image_view result, const int16_t* kernel, int laplace)
+{
+    size_t width = image.width, height = image.height;
     for (size_t y = 0; y < height; y++) {
         for (size_t x = 0; x < width; x++) {
-            size_t index = y * width + x;
             int16_t sum = 0;
             for (int16_t i = -1; i <= 1; i++) {
                 for (int16_t j = -1; j <= 1; j++) {
                     if ((int64_t)x + i < 0 || (int64_t)y + j < 0 || x + i >= width || y + j >= height) {
                         continue;
                     }
-                    sum += (int16_t)image[index + i + j * width] * kernel[(i + 1) + (j + 1) * 3];
+                    sum += (int16_t)view_row(image, y + j)[x + i] * kernel[(i + 1) + (j + 1) * 3];
                 }
             }
-            result[index] = laplace ? laplace_accurate(sum) : blur_accurate(sum);
+            view_row(result, y)[x] = laplace ? laplace_accurate(sum) : blur_accurate(sum);
         }
     }
 }
@@ -31,89 +37,336 @@ void convolution(const uint8_t* image, size_t width, size_t height, uint8_t* res
 // First Optimization: Perform two convolutions in one pass
 void convolution_1pass(const uint8_t* image, size_t width, size_t height, uint8_t* result_laplace, uint8_t* result_blur)
 {
+    convolution_1pass_view(packed_view(image, width, height, 1), packed_view(result_laplace, width, height, 1), packed_view(result_blur, width, height, 1));
+}
+
+void convolution_1pass_view(struct image_view image, struct image_view result_laplace, struct image_view result_blur)
+{
+    size_t width = image.width, height = image.height;
     for (size_t y = 0; y < height; y++) {
         for (size_t x = 0; x < width; x++) {
-            size_t index = y * width + x;
             int16_t sum_blur = 0, sum_laplace = 0;
             for (int16_t i = -1; i <= 1; i++) {
                 for (int16_t j = -1; j <= 1; j++) {
                     if ((int64_t)x + i < 0 || (int64_t)y + j < 0 || x + i >= width || y + j >= height) {
                         continue;
                     }
-                    sum_blur += (int16_t)image[index + i + j * width] * blur_kernel[(i + 1) + (j + 1) * 3];
-                    sum_laplace += (int16_t)image[index + i + j * width] * laplace_kernel[(i + 1) + (j + 1) * 3];
+                    int16_t pixel = (int16_t)view_row(image, y + j)[x + i];
+                    sum_blur += pixel * blur_kernel[(i + 1) + (j + 1) * 3];
+                    sum_laplace += pixel * laplace_kernel[(i + 1) + (j + 1) * 3];
                 }
             }
-            result_blur[index] = (uint8_t)(sum_blur / 16);
-            result_laplace[index] = (uint8_t)(abs(sum_laplace) / 4);
+            view_row(result_blur, y)[x] = (uint8_t)(sum_blur / 16);
+            view_row(result_laplace, y)[x] = (uint8_t)(abs(sum_laplace) / 4);
         }
     }
 }
 
 // Second Optimization: Use SIMD to perform convolution
-void convolution_simd(const uint16_t* padded_image, size_t padded_width, size_t padded_height, uint16_t* padded_laplace, uint16_t* padded_blur)
+// Convolve the 8 pixels whose 3x3 neighbourhoods start at padded index i, returns the laplace responses
+static inline __m128i convolve_8(const uint16_t* padded_image, size_t padded_width, size_t i, uint16_t* padded_laplace, uint16_t* padded_blur)
+{
+    __m128i negate_mask = _mm_set1_epi16(-1);
+    // apply the kernel: {0, 1, 0, 1, -4, 1, 0, 1, 0}
+    __m128i x0y1 = _mm_loadu_si128((__m128i*)&padded_image[i + padded_width]);
+    __m128i x1y0 = _mm_loadu_si128((__m128i*)&padded_image[i + 1]);
+    __m128i x1y1 = _mm_slli_epi16(_mm_loadu_si128((__m128i*)&padded_image[i + padded_width + 1]), 2); // *4
+    __m128i x1y2 = _mm_loadu_si128((__m128i*)&padded_image[i + 2 * padded_width + 1]);
+    __m128i x2y1 = _mm_loadu_si128((__m128i*)&padded_image[i + padded_width + 2]);
+    __m128i x1y1_laplace = _mm_sign_epi16(x1y1, negate_mask); // negate to get *-4
+    __m128i sum_laplace = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(x0y1, x1y0), x1y1_laplace), x1y2), x2y1);
+    sum_laplace = _mm_srli_epi16(_mm_abs_epi16(sum_laplace), 2);
+    _mm_storeu_si128((__m128i*)&padded_laplace[i + padded_width + 1], sum_laplace);
+
+    // apply the kernel: {1, 2, 1, 2, 4, 2, 1, 2, 1} ...
+    __m128i x0y0 = _mm_loadu_si128((__m128i*)&padded_image[i]);
+    __m128i x0y2 = _mm_loadu_si128((__m128i*)&padded_image[i + 2 * padded_width]);
+    __m128i x2y0 = _mm_loadu_si128((__m128i*)&padded_image[i + 2]);
+    __m128i x2y2 = _mm_loadu_si128((__m128i*)&padded_image[i + 2 * padded_width + 2]);
+    x0y1 = _mm_slli_epi16(x0y1, 1);
+    x1y0 = _mm_slli_epi16(x1y0, 1);
+    x1y2 = _mm_slli_epi16(x1y2, 1);
+    x2y1 = _mm_slli_epi16(x2y1, 1);
+
+    __m128i sum_blur = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(x0y0, x0y1), _mm_add_epi16(x0y2, x1y0)), _mm_add_epi16(_mm_add_epi16(x1y1, x1y2), _mm_add_epi16(x2y0, x2y1))), x2y2);
+    sum_blur = _mm_srli_epi16(sum_blur, 4);
+    _mm_storeu_si128((__m128i*)&padded_blur[i + padded_width + 1], sum_blur);
+    return sum_laplace;
+}
+
+// Average of bytes rounding down, _mm_avg_epu8() rounds up
+static inline __m128i avg_floor_epu8(__m128i a, __m128i b)
+{
+    return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+// [1 2 1] / 4 of bytes, rounding down the outer pixels and rounding up with the center balances the rounding errors
+static inline __m128i blur_121_epu8(__m128i outer, __m128i center, __m128i other_outer)
+{
+    return _mm_avg_epu8(avg_floor_epu8(outer, other_outer), center);
+}
+
+static inline uint8_t blur_121_8bit(uint8_t outer, uint8_t center, uint8_t other_outer)
+{
+    return (uint8_t)((((outer + other_outer) >> 1) + center + 1) >> 1);
+}
+
+// Convolve the 16 pixels whose 3x3 neighbourhoods start at padded index i in 8 bit lanes
+static inline void convolve_16_8bit(const uint8_t* padded_image, size_t padded_width, size_t i, uint8_t* padded_laplace, uint8_t* padded_blur)
+{
+    const uint8_t* above = padded_image + i;
+    const uint8_t* row = above + padded_width;
+    const uint8_t* below = row + padded_width;
+    __m128i up = _mm_loadu_si128((const __m128i*)&above[1]);
+    __m128i left = _mm_loadu_si128((const __m128i*)&row[0]);
+    __m128i center = _mm_loadu_si128((const __m128i*)&row[1]);
+    __m128i right = _mm_loadu_si128((const __m128i*)&row[2]);
+    __m128i down = _mm_loadu_si128((const __m128i*)&below[1]);
+
+    // the columns are blurred first, then the row of the three columns
+    __m128i column_left = blur_121_epu8(_mm_loadu_si128((const __m128i*)&above[0]), left, _mm_loadu_si128((const __m128i*)&below[0]));
+    __m128i column_center = blur_121_epu8(up, center, down);
+    __m128i column_right = blur_121_epu8(_mm_loadu_si128((const __m128i*)&above[2]), right, _mm_loadu_si128((const __m128i*)&below[2]));
+    _mm_storeu_si128((__m128i*)&padded_blur[i + padded_width + 1], blur_121_epu8(column_left, column_center, column_right));
+
+    // |up + left + right + down - 4 center| / 4 is the distance of the center from the mean of its neighbours
+    __m128i neighbours = _mm_avg_epu8(_mm_avg_epu8(up, down), _mm_avg_epu8(left, right));
+    __m128i laplace = _mm_or_si128(_mm_subs_epu8(neighbours, center), _mm_subs_epu8(center, neighbours));
+    _mm_storeu_si128((__m128i*)&padded_laplace[i + padded_width + 1], laplace);
+}
+
+// Convolve the single pixel at padded index i in 8 bit like convolve_16_8bit()
+static inline void convolve_1_8bit(const uint8_t* padded_image, size_t padded_width, size_t i, uint8_t* padded_laplace, uint8_t* padded_blur)
+{
+    const uint8_t* row = padded_image + i;
+    const uint8_t* above = row - padded_width;
+    const uint8_t* below = row + padded_width;
+    uint8_t column_left = blur_121_8bit(above[-1], row[-1], below[-1]);
+    uint8_t column_center = blur_121_8bit(above[0], row[0], below[0]);
+    uint8_t column_right = blur_121_8bit(above[1], row[1], below[1]);
+    padded_blur[i] = blur_121_8bit(column_left, column_center, column_right);
+    int neighbours = (((above[0] + below[0] + 1) >> 1) + ((row[-1] + row[1] + 1) >> 1) + 1) >> 1;
+    padded_laplace[i] = (uint8_t)abs(neighbours - row[0]);
+}
+
+void convolution_simd_8bit(const uint8_t* padded_image, size_t padded_width, size_t padded_height, uint8_t* padded_laplace, uint8_t* padded_blur)
 {
     size_t padded_size = padded_width * padded_height;
     size_t i = 0;
-    __m128i negate_mask = _mm_set1_epi16(-1);
+    // like convolution_simd(), the loads of the last vectors would pass the end of the padded image
+    for (; i + padded_width * 2 + 17 < padded_size; i += 16)
+        convolve_16_8bit(padded_image, padded_width, i, padded_laplace, padded_blur);
+    for (i = i + padded_width + 1; i < padded_size - padded_width - 1; i++)
+        convolve_1_8bit(padded_image, padded_width, i, padded_laplace, padded_blur);
+}
+
+// Convolve the single pixel at padded index i, returns the laplace response
+static inline uint16_t convolve_1(const uint16_t* padded_image, size_t padded_width, size_t i, uint16_t* padded_laplace, uint16_t* padded_blur)
+{
+    int16_t sum_blur = 0, sum_laplace = 0;
+    for (int j = 0; j < 9; j++) {
+        sum_blur += (int16_t)padded_image[i + j % 3 - 1 + (j / 3 - 1) * padded_width] * blur_kernel[j];
+        sum_laplace += (int16_t)padded_image[i + j % 3 - 1 + (j / 3 - 1) * padded_width] * laplace_kernel[j];
+    }
+    padded_blur[i] = (uint8_t)(sum_blur / 16);
+    padded_laplace[i] = (uint8_t)(abs(sum_laplace) / 4);
+    return padded_laplace[i];
+}
+
+// Count the laplace responses of the whole vectors inside padded row r, the padding columns are left out
+static inline void count_row(const uint16_t* padded_laplace, size_t padded_width, size_t r, uint32_t* histogram)
+{
+    const uint16_t* row = padded_laplace + r * padded_width;
+    for (size_t x = 1; x + 8 <= padded_width - 1; x += 8) {
+        for (size_t k = 0; k < 8; k++)
+            histogram[row[x + k]]++;
+    }
+}
+
+// inlined with histogram == NULL into convolution_simd(), so the counting costs nothing there
+static inline void convolution_simd_counting(const uint16_t* padded_image, size_t padded_width, size_t padded_height,
+    uint16_t* padded_laplace, uint16_t* padded_blur, uint32_t* histogram)
+{
+    size_t padded_size = padded_width * padded_height;
     // till loading data may cause an undefined behavior because of out of bound access
-    for (; i < padded_size - padded_width * 2 - 9; i += 8) {
-        // apply the kernel: {0, 1, 0, 1, -4, 1, 0, 1, 0}
-        __m128i x0y1 = _mm_loadu_si128((__m128i*)&padded_image[i + padded_width]);
-        __m128i x1y0 = _mm_loadu_si128((__m128i*)&padded_image[i + 1]);
-        __m128i x1y1 = _mm_slli_epi16(_mm_loadu_si128((__m128i*)&padded_image[i + padded_width + 1]), 2); // *4
-        __m128i x1y2 = _mm_loadu_si128((__m128i*)&padded_image[i + 2 * padded_width + 1]);
-        __m128i x2y1 = _mm_loadu_si128((__m128i*)&padded_image[i + padded_width + 2]);
-        __m128i x1y1_laplace = _mm_sign_epi16(x1y1, negate_mask); // negate to get *-4
-        __m128i sum_laplace = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(x0y1, x1y0), x1y1_laplace), x1y2), x2y1);
-        sum_laplace = _mm_srli_epi16(_mm_abs_epi16(sum_laplace), 2);
-        _mm_storeu_si128((__m128i*)&padded_laplace[i + padded_width + 1], sum_laplace);
-
-        // apply the kernel: {1, 2, 1, 2, 4, 2, 1, 2, 1} ...
-        __m128i x0y0 = _mm_loadu_si128((__m128i*)&padded_image[i]);
-        __m128i x0y2 = _mm_loadu_si128((__m128i*)&padded_image[i + 2 * padded_width]);
-        __m128i x2y0 = _mm_loadu_si128((__m128i*)&padded_image[i + 2]);
-        __m128i x2y2 = _mm_loadu_si128((__m128i*)&padded_image[i + 2 * padded_width + 2]);
-        x0y1 = _mm_slli_epi16(x0y1, 1);
-        x1y0 = _mm_slli_epi16(x1y0, 1);
-        x1y2 = _mm_slli_epi16(x1y2, 1);
-        x2y1 = _mm_slli_epi16(x2y1, 1);
-
-        __m128i sum_blur = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(x0y0, x0y1), _mm_add_epi16(x0y2, x1y0)), _mm_add_epi16(_mm_add_epi16(x1y1, x1y2), _mm_add_epi16(x2y0, x2y1))), x2y2);
-        sum_blur = _mm_srli_epi16(sum_blur, 4);
-        _mm_storeu_si128((__m128i*)&padded_blur[i + padded_width + 1], sum_blur);
+    size_t vectors_end = padded_size > padded_width * 2 + 9 ? padded_size - padded_width * 2 - 9 : 0;
+    size_t i = 0;
+    size_t counted_row = 1;
+    for (;;) {
+        // with a histogram the sweep pauses before the vector that completes the next counted row,
+        // every 16th row is counted then while its responses are still in the cache
+        size_t end = vectors_end;
+        if (histogram && counted_row * padded_width < vectors_end + 10)
+            end = counted_row * padded_width > 10 ? counted_row * padded_width - 10 : 0;
+        for (; i < end; i += 8)
+            convolve_8(padded_image, padded_width, i, padded_laplace, padded_blur);
+        if (!histogram || i >= vectors_end)
+            break;
+        convolve_8(padded_image, padded_width, i, padded_laplace, padded_blur);
+        i += 8;
+        count_row(padded_laplace, padded_width, counted_row, histogram);
+        counted_row += 16;
     }
     // apply the kernel to the remaining pixels
-    for (i = i + padded_width + 1; i < padded_size - padded_width - 1; i++) {
-        int16_t sum_blur = 0, sum_laplace = 0;
-        for (int j = 0; j < 9; j++) {
-            sum_blur += (int16_t)padded_image[i + j % 3 - 1 + (j / 3 - 1) * padded_width] * blur_kernel[j];
-            sum_laplace += (int16_t)padded_image[i + j % 3 - 1 + (j / 3 - 1) * padded_width] * laplace_kernel[j];
+    for (i = i + padded_width + 1; i < padded_size - padded_width - 1; i++)
+        convolve_1(padded_image, padded_width, i, padded_laplace, padded_blur);
+    for (; histogram && counted_row + 1 < padded_height; counted_row += 16)
+        count_row(padded_laplace, padded_width, counted_row, histogram);
+}
+
+void convolution_simd(const uint16_t* padded_image, size_t padded_width, size_t padded_height, uint16_t* padded_laplace, uint16_t* padded_blur)
+{
+    convolution_simd_counting(padded_image, padded_width, padded_height, padded_laplace, padded_blur, NULL);
+}
+
+void convolution_simd_histogram(const uint16_t* padded_image, size_t padded_width, size_t padded_height,
+    uint16_t* padded_laplace, uint16_t* padded_blur, uint32_t* histogram)
+{
+    convolution_simd_counting(padded_image, padded_width, padded_height, padded_laplace, padded_blur, histogram);
+}
+
+// Convolve a row of width >= 8 pixels starting at padded index i and update the minimum and maximum laplace responses
+static inline void convolve_row(const uint16_t* padded_image, size_t padded_width, size_t i, size_t width,
+    uint16_t* padded_laplace, uint16_t* padded_blur, __m128i* minimum, __m128i* maximum)
+{
+    __m128i row_minimum = *minimum, row_maximum = *maximum;
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i laplace = convolve_8(padded_image, padded_width, i + x, padded_laplace, padded_blur);
+        row_minimum = _mm_min_epu16(row_minimum, laplace);
+        row_maximum = _mm_max_epu16(row_maximum, laplace);
+    }
+    // the last vector overlaps the one before, the pixels computed twice get the same values
+    if (x < width) {
+        __m128i laplace = convolve_8(padded_image, padded_width, i + width - 8, padded_laplace, padded_blur);
+        row_minimum = _mm_min_epu16(row_minimum, laplace);
+        row_maximum = _mm_max_epu16(row_maximum, laplace);
+    }
+    *minimum = row_minimum;
+    *maximum = row_maximum;
+}
+
+// True if the padded pixels of the rectangle of at least 8 columns all have the given value
+static int is_flat(const uint16_t* padded_image, size_t padded_width, size_t width, size_t height, uint16_t value)
+{
+    __m128i expected = _mm_set1_epi16((short)value);
+    for (size_t y = 0; y < height; y++) {
+        const uint16_t* row = padded_image + y * padded_width;
+        // the differences of a row are collected without branches and tested once, the last vector overlaps the one before
+        __m128i difference = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&row[width - 8]), expected);
+        for (size_t x = 0; x + 8 <= width; x += 8)
+            difference = _mm_or_si128(difference, _mm_xor_si128(_mm_loadu_si128((const __m128i*)&row[x]), expected));
+        if (!_mm_testz_si128(difference, difference))
+            return 0;
+    }
+    return 1;
+}
+
+int convolution_simd_strip(const uint16_t* padded_image, size_t padded_width, size_t width, size_t height,
+    uint16_t* padded_laplace, uint16_t* padded_blur, struct laplace_summary* summaries, int find_flat)
+{
+    size_t tiles = (width + FLAT_TILE_WIDTH - 1) / FLAT_TILE_WIDTH;
+    // a tile with the same value as its halo has a laplace response of 0 and a blur of the value, it is not convolved
+    // most tiles of textured images already differ in the first row of their halo
+    int any_flat = 0;
+    for (size_t t = 0; t < tiles; t++) {
+        size_t x0 = t * FLAT_TILE_WIDTH;
+        size_t tile_width = x0 + FLAT_TILE_WIDTH < width ? FLAT_TILE_WIDTH : width - x0;
+        uint16_t value = padded_image[x0];
+        int flat = find_flat && tile_width >= 6 && is_flat(padded_image + x0, padded_width, tile_width + 2, height + 2, value);
+        summaries[t] = (struct laplace_summary) { 255, 0, flat, (uint8_t)value };
+        any_flat |= flat;
+    }
+    // textured strips without flat tiles rarely have uniform tiles either, they are convolved without the summaries
+    if (!any_flat && width >= 8) {
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x + 8 <= width; x += 8)
+                convolve_8(padded_image, padded_width, y * padded_width + x, padded_laplace, padded_blur);
+            if (width % 8)
+                convolve_8(padded_image, padded_width, y * padded_width + width - 8, padded_laplace, padded_blur);
+        }
+        for (size_t t = 0; t < tiles; t++) {
+            summaries[t].laplace_min = 0;
+            summaries[t].laplace_max = 255;
+        }
+        return 0;
+    }
+
+    __m128i minimum[FLAT_STRIP_TILES], maximum[FLAT_STRIP_TILES];
+    for (size_t t = 0; t < tiles; t++) {
+        minimum[t] = _mm_set1_epi16(255);
+        maximum[t] = _mm_setzero_si128();
+    }
+
+    // the rows are convolved one after the other like in convolution_simd(), which the prefetcher handles much better than tile by tile
+    for (size_t y = 0; y < height; y++) {
+        size_t i = y * padded_width;
+        for (size_t t = 0; t < tiles; t++) {
+            if (summaries[t].flat)
+                continue;
+            size_t x0 = t * FLAT_TILE_WIDTH;
+            size_t tile_width = x0 + FLAT_TILE_WIDTH < width ? FLAT_TILE_WIDTH : width - x0;
+            if (tile_width < 8) {
+                for (size_t x = x0; x < x0 + tile_width; x++) {
+                    uint16_t laplace = convolve_1(padded_image, padded_width, i + x + padded_width + 1, padded_laplace, padded_blur);
+                    summaries[t].laplace_min = laplace < summaries[t].laplace_min ? laplace : summaries[t].laplace_min;
+                    summaries[t].laplace_max = laplace > summaries[t].laplace_max ? laplace : summaries[t].laplace_max;
+                }
+                continue;
+            }
+            // full tiles have a constant width, so the compiler unrolls their loop
+            if (tile_width == FLAT_TILE_WIDTH)
+                convolve_row(padded_image, padded_width, i + x0, FLAT_TILE_WIDTH, padded_laplace, padded_blur, &minimum[t], &maximum[t]);
+            else
+                convolve_row(padded_image, padded_width, i + x0, tile_width, padded_laplace, padded_blur, &minimum[t], &maximum[t]);
         }
-        padded_blur[i] = (uint8_t)(sum_blur / 16);
-        padded_laplace[i] = (uint8_t)(abs(sum_laplace) / 4);
     }
+
+    for (size_t t = 0; t < tiles; t++) {
+        if (summaries[t].flat || width - t * FLAT_TILE_WIDTH < 8)
+            continue;
+        // phminposuw finds the minimum, the maximum is the minimum of the complement
+        summaries[t].laplace_min = (uint16_t)_mm_extract_epi16(_mm_minpos_epu16(minimum[t]), 0);
+        summaries[t].laplace_max = (uint16_t)~_mm_extract_epi16(_mm_minpos_epu16(_mm_xor_si128(maximum[t], _mm_set1_epi16(-1))), 0);
+    }
+    return any_flat;
 }
 
 // ----- Helper functions for SIMD -----
 // Have to write SIMD code since gcc auto-vectorization with O2 uses up to SSE2 but SSE4.1 is needed for _mm_cvtepu8_epi16
 void pad_image_simd(const uint8_t* img, size_t width, size_t height, size_t padded_width, uint16_t* padded_image)
 {
+    pad_image_simd_view(packed_view(img, width, height, 1), padded_width, padded_image);
+}
+
+void pad_image_simd_view(struct image_view img, size_t padded_width, uint16_t* padded_image)
+{
+    size_t width = img.width;
     size_t aligned = width - width % 16;
-    for (size_t y = 0; y < height; y++) {
-        for (size_t x = 0; x < aligned; x += 16) {
-            __m128i pix_8b = _mm_loadu_si128((__m128i*)&img[x + y * width]);
+    for (size_t y = 0; y < img.height; y++) {
+        const uint8_t* row = view_row(img, y);
+        // rows of at least 16 pixels end with a vector that overlaps the one before instead of a scalar tail
+        size_t end = width >= 16 && aligned < width ? width + 16 - width % 16 : aligned;
+        for (size_t x = 0; x < end; x += 16) {
+            size_t start = x < width - 16 + 1 ? x : width - 16;
+            __m128i pix_8b = _mm_loadu_si128((__m128i*)&row[start]);
             __m128i pix_16b_low = _mm_cvtepu8_epi16(pix_8b);
             __m128i pix_16b_high = _mm_unpackhi_epi8(pix_8b, _mm_setzero_si128());
-            _mm_storeu_si128((__m128i*)&padded_image[x + 1 + (y + 1) * padded_width], pix_16b_low);
-            _mm_storeu_si128((__m128i*)&padded_image[x + 9 + (y + 1) * padded_width], pix_16b_high);
+            _mm_storeu_si128((__m128i*)&padded_image[start + 1 + (y + 1) * padded_width], pix_16b_low);
+            _mm_storeu_si128((__m128i*)&padded_image[start + 9 + (y + 1) * padded_width], pix_16b_high);
         }
-        for (size_t x = aligned; x < width; x++) {
-            padded_image[x + 1 + (y + 1) * padded_width] = img[x + y * width];
+        for (size_t x = end; x < width; x++) {
+            padded_image[x + 1 + (y + 1) * padded_width] = row[x];
         }
     }
 }
 
+void pad_image_8bit_view(struct image_view img, size_t padded_width, uint8_t* padded_image)
+{
+    for (size_t y = 0; y < img.height; y++)
+        memcpy(&padded_image[(y + 1) * padded_width + 1], view_row(img, y), img.width);
+}
+
 // ----- Blur in 2 passes -----
 void blur_2_1d(const uint8_t* image, size_t width, size_t height, uint16_t* tmp, uint8_t* result)
 {
@@ -144,4 +397,39 @@ void blur_2_1d(const uint8_t* image, size_t width, size_t height, uint16_t* tmp,
             result[x * width + y] = (uint8_t)(sum / 16);
         }
     }
-}
\ No newline at end of file
+}
+
+void blur_2_1d_simd(const uint8_t* image, size_t width, size_t height, uint16_t* sums, uint8_t* result)
+{
+    // the pixels outside the image are zero, like in blur_2_1d()
+    sums[0] = 0;
+    sums[width + 1] = 0;
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* above = y > 0 ? image + (y - 1) * width : NULL;
+        const uint8_t* row = image + y * width;
+        const uint8_t* below = y + 1 < height ? image + (y + 1) * width : NULL;
+        // sums[x + 1] is the blur of column x along the columns
+        size_t x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m128i sum = _mm_slli_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&row[x])), 1);
+            if (above)
+                sum = _mm_add_epi16(sum, _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&above[x])));
+            if (below)
+                sum = _mm_add_epi16(sum, _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&below[x])));
+            _mm_storeu_si128((__m128i*)&sums[x + 1], sum);
+        }
+        for (; x < width; x++)
+            sums[x + 1] = (uint16_t)((above ? above[x] : 0) + 2 * row[x] + (below ? below[x] : 0));
+
+        uint8_t* out = result + y * width;
+        for (x = 0; x + 8 <= width; x += 8) {
+            __m128i center = _mm_loadu_si128((const __m128i*)&sums[x + 1]);
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)&sums[x]), _mm_loadu_si128((const __m128i*)&sums[x + 2])),
+                _mm_slli_epi16(center, 1));
+            sum = _mm_srli_epi16(sum, 4);
+            _mm_storel_epi64((__m128i*)&out[x], _mm_packus_epi16(sum, sum));
+        }
+        for (; x < width; x++)
+            out[x] = (uint8_t)((sums[x] + 2 * sums[x + 1] + sums[x + 2]) / 16);
+    }
+}
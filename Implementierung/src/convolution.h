@@ -1,9 +1,23 @@
 #ifndef CONVOLUTION_H
 #define CONVOLUTION_H
+#include "view.h"
 
 #include <stdint.h>
 #include <stdlib.h>
 
+// tiles of convolution_simd_strip(), a strip has at most FLAT_STRIP_TILES tiles of FLAT_TILE_WIDTH x rows pixels
+#define FLAT_TILE_WIDTH 64
+#define FLAT_TILE_ROWS 8
+#define FLAT_STRIP_TILES 32
+
+// Laplace responses of a tile, see convolution_simd_strip()
+struct laplace_summary {
+    uint16_t laplace_min;
+    uint16_t laplace_max;
+    int flat; // the tile and its halo have the same value, it is not convolved
+    uint8_t value; // value of a flat tile
+};
+
 extern int16_t blur_kernel[9];
 extern int16_t laplace_kernel[9];
 
@@ -12,6 +26,10 @@ extern int16_t laplace_kernel[9];
  * Use the function fn to convert the sum to a pixel value.
  */
 void convolution(const uint8_t* image, size_t width, size_t height, uint8_t* result, const int16_t* kernel, int laplace);
+
+// Does the same as convolution() on strided views, the result view must have the size of the image view
+void convolution_view(struct image_view image, struct image_view result, const int16_t* kernel, int laplace);
+
 /**
  * Perform two convolutions on an image, one with a 2D laplace kernel and one with a 2D gaussian kernel.
  * Laplace filter is used for edge detection and gaussian filter is used to blur the image to reduce noise.
@@ -19,6 +37,9 @@ void convolution(const uint8_t* image, size_t width, size_t height, uint8_t* res
  */
 void convolution_1pass(const uint8_t* image, size_t width, size_t height, uint8_t* result_laplace, uint8_t* result_blur);
 
+// Does the same as convolution_1pass() on strided views
+void convolution_1pass_view(struct image_view image, struct image_view result_laplace, struct image_view result_blur);
+
 /**
  * Does the same as convolution(), but optimized using SSE, SSE4.1 is required.
  * Integer arithmetic is used for better performance, but the result is less accurate.
@@ -27,12 +48,43 @@ void convolution_1pass(const uint8_t* image, size_t width, size_t height, uint8_
  */
 void convolution_simd(const uint16_t* padded_image, size_t padded_width, size_t padded_height, uint16_t* padded_laplace, uint16_t* padded_blur);
 
+/**
+ * Does the same as convolution_simd() and estimates the noise in the same sweep:
+ * the laplace responses of every 16th row are counted into histogram, which has 256 entries.
+ * Only the whole vectors of 8 pixels inside the image are counted, the padding columns are left out.
+ * The histogram is not cleared, so it can be accumulated over several tiles.
+ * The border of the padded image must be zero, then every response is at most 255.
+ */
+void convolution_simd_histogram(const uint16_t* padded_image, size_t padded_width, size_t padded_height,
+    uint16_t* padded_laplace, uint16_t* padded_blur, uint32_t* histogram);
+
+/**
+ * Does the same as convolution_simd() for a strip of width x height pixels and summarizes the laplace responses
+ * of its tiles of FLAT_TILE_WIDTH columns, so that combine_simd_strip() can take fast paths on uniform tiles.
+ * The pointers point to the top left pixel of the halo of the strip, like convolution_simd() gets them for a whole image.
+ * Tiles that have the same value as their halo are not convolved, their summary only holds the value.
+ * @param width: at most FLAT_STRIP_TILES * FLAT_TILE_WIDTH
+ * @param summaries: one summary per tile
+ * @param find_flat: 0 skips the search for flat tiles, for strips below textured ones where it rarely finds any
+ * @return 1 if the strip has flat tiles
+ */
+int convolution_simd_strip(const uint16_t* padded_image, size_t padded_width, size_t width, size_t height,
+    uint16_t* padded_laplace, uint16_t* padded_blur, struct laplace_summary* summaries, int find_flat);
+
 /**
  * Make use of the separability of the gaussian kernel to perform the blur in two 1D passes.
  * Integer arithmetic is used for better performance, but the result is less accurate.
  */
 void blur_2_1d(const uint8_t* image, size_t width, size_t height, uint16_t* tmp, uint8_t* result);
 
+/**
+ * Does the same as blur_2_1d(), optimized using SSE, SSE4.1 is required. The result is exact.
+ * Every row is blurred along the columns into sums first, which then are blurred along the row, so no transposed copy is needed.
+ * @param sums: width + 2 16 bit sums of a row
+ * @param result: must not be the same as image
+ */
+void blur_2_1d_simd(const uint8_t* image, size_t width, size_t height, uint16_t* sums, uint8_t* result);
+
 /**
  * Helper function to pad an image with zeros to avoid accessing wrong pixel values
  * which also simply the convolution in SIMD with a 3x3 kernel
@@ -40,4 +92,21 @@ void blur_2_1d(const uint8_t* image, size_t width, size_t height, uint16_t* tmp,
  */
 void pad_image_simd(const uint8_t* img, size_t width, size_t height, size_t padded_width, uint16_t* padded_image);
 
+// Does the same as pad_image_simd() for a strided view, the padded image itself is always packed
+void pad_image_simd_view(struct image_view img, size_t padded_width, uint16_t* padded_image);
+
+// Does the same as pad_image_simd_view() for convolution_simd_8bit(), the pixels stay 8 bit
+void pad_image_8bit_view(struct image_view img, size_t padded_width, uint8_t* padded_image);
+
+/**
+ * Approximates convolution_simd() with the pixels in 8 bit lanes, 16 pixels per register instead of 8, SSE4.1 is required.
+ * The [1 2 1] blur is a cascade of byte averages along the columns and then along the rows: the outer pixels are averaged
+ * rounding down, their average and the center with _mm_avg_epu8(), which rounds up. The laplace response is the absolute
+ * difference of the center and the average of its 4 neighbours, with saturating subtractions.
+ * Both are at most 1 from the rounded results of convolution(), the blur is 0.2 higher on average and the laplace response 0.1 lower,
+ * while convolution_simd() truncates both, they are 0.5 lower on average.
+ * @param padded_image: padded with zeros by pad_image_8bit_view(), the padded arrays have 8 bit pixels
+ */
+void convolution_simd_8bit(const uint8_t* padded_image, size_t padded_width, size_t padded_height, uint8_t* padded_laplace, uint8_t* padded_blur);
+
 #endif // CONVOLUTION_H
\ No newline at end of file
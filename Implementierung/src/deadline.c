@@ -0,0 +1,127 @@
+#include "deadline.h"
+#include <string.h>
+
+const char* deadline_level_name(enum deadline_level level)
+{
+    const char* names[DEADLINE_LEVELS] = { "accurate SISD", "integer SISD", "SIMD", "blur only", "SIMD on half resolution" };
+    return level < DEADLINE_LEVELS ? names[level] : "unknown";
+}
+
+void deadline_init(struct deadline_controller* controller, double budget)
+{
+    memset(controller, 0, sizeof(*controller));
+    controller->budget = budget;
+    // the SISD versions take many times the time of the SIMD version, they are only tried once there is time left
+    controller->level = DEADLINE_SIMD;
+    controller->probe_frames = DEADLINE_PROBE_FRAMES;
+}
+
+// Time per pixel of the levels relative to SIMD, measured with the benchmarks and rounded up,
+// so a level that was never measured is rather predicted too slow than too fast
+static const double level_cost[DEADLINE_LEVELS] = { 40, 16, 1, 0.7, 0.5 };
+
+// Predicted seconds of a frame at a level. A level that was never measured is predicted from the nearest measured one
+// and the ratio of their costs, 0 if no level was measured yet
+static double predicted(const struct deadline_controller* controller, enum deadline_level level, size_t pixels)
+{
+    if (controller->seconds_per_pixel[level] > 0)
+        return controller->seconds_per_pixel[level] * (double)pixels;
+    for (int distance = 1; distance < DEADLINE_LEVELS; distance++) {
+        for (int side = -1; side <= 1; side += 2) {
+            int measured = (int)level + side * distance;
+            if (measured >= 0 && measured < DEADLINE_LEVELS && controller->seconds_per_pixel[measured] > 0)
+                return controller->seconds_per_pixel[measured] * level_cost[level] / level_cost[measured] * (double)pixels;
+        }
+    }
+    return 0;
+}
+
+enum deadline_event deadline_pick(struct deadline_controller* controller, size_t pixels, enum deadline_level best, FILE* log)
+{
+    if (controller->level < best)
+        controller->level = best;
+    enum deadline_level level = controller->level;
+    double prediction = predicted(controller, level, pixels);
+    enum deadline_event event = DEADLINE_KEEP;
+    if (controller->missed || prediction > DEADLINE_HEADROOM * controller->budget) {
+        // a failed attempt of a better level waits twice as long before the next one
+        if (controller->probing && controller->probe_frames < DEADLINE_MAX_PROBE_FRAMES)
+            controller->probe_frames *= 2;
+        enum deadline_level next = level;
+        while (next + 1 < DEADLINE_LEVELS) {
+            next++;
+            double next_prediction = predicted(controller, next, pixels);
+            if (next_prediction <= DEADLINE_HEADROOM * controller->budget)
+                break;
+        }
+        if (next != level) {
+            if (log && controller->missed)
+                fprintf(log, "Deadline: frame %zu downgraded from %s to %s, the last frame took longer than the budget of %.2f ms\n",
+                    controller->frame, deadline_level_name(level), deadline_level_name(next), controller->budget * 1e3);
+            else if (log)
+                fprintf(log, "Deadline: frame %zu downgraded from %s to %s, predicted %.2f ms of the budget of %.2f ms\n",
+                    controller->frame, deadline_level_name(level), deadline_level_name(next), prediction * 1e3, controller->budget * 1e3);
+            event = DEADLINE_DOWNGRADE;
+            controller->downgrades++;
+        }
+        controller->level = next;
+        controller->calm_frames = 0;
+        controller->probing = 0;
+    } else if (level > best && controller->calm_frames >= controller->probe_frames) {
+        enum deadline_level better = level - 1;
+        double better_prediction = predicted(controller, better, pixels);
+        if (better_prediction <= DEADLINE_CALM * controller->budget) {
+            if (log) {
+                fprintf(log, "Deadline: frame %zu recovered from %s to %s after %zu frames within %.0f%% of the budget of %.2f ms\n",
+                    controller->frame, deadline_level_name(level), deadline_level_name(better), controller->calm_frames, DEADLINE_CALM * 100,
+                    controller->budget * 1e3);
+            }
+            event = DEADLINE_RECOVER;
+            controller->recoveries++;
+            controller->level = better;
+            controller->calm_frames = 0;
+            controller->probing = 1;
+        } else {
+            // a level that missed the budget the last time it ran is not tried again just because time passed
+            if (!controller->over_budget[better])
+                controller->seconds_per_pixel[better] *= 1 - DEADLINE_SMOOTHING;
+            controller->calm_frames = 0;
+        }
+    }
+    controller->missed = 0;
+    return event;
+}
+
+void deadline_update(struct deadline_controller* controller, size_t pixels, double seconds)
+{
+    enum deadline_level level = controller->level;
+    double measured = pixels ? seconds / (double)pixels : 0;
+    double* smoothed = &controller->seconds_per_pixel[level];
+    *smoothed = *smoothed > 0 ? DEADLINE_SMOOTHING * measured + (1 - DEADLINE_SMOOTHING) * *smoothed : measured;
+    controller->over_budget[level] = seconds > controller->budget;
+    if (seconds > controller->budget) {
+        controller->missed = 1;
+        controller->missed_frames++;
+    } else if (seconds <= DEADLINE_CALM * controller->budget) {
+        controller->calm_frames++;
+        // a calm frame is a successful attempt, the next one waits as long as the first one
+        if (controller->probing)
+            controller->probe_frames = DEADLINE_PROBE_FRAMES;
+        controller->probing = 0;
+    } else {
+        controller->calm_frames = 0;
+    }
+    controller->frames_per_level[level]++;
+    controller->frame++;
+}
+
+void deadline_summary(const struct deadline_controller* controller, FILE* log)
+{
+    fprintf(log, "Deadline: %zu frames, %zu over the budget of %.2f ms, %zu downgrades, %zu recoveries\n", controller->frame,
+        controller->missed_frames, controller->budget * 1e3, controller->downgrades, controller->recoveries);
+    for (int level = 0; level < DEADLINE_LEVELS; level++) {
+        if (controller->frames_per_level[level])
+            fprintf(log, "Deadline: %zu frames with %s, %.3f ms per megapixel\n", controller->frames_per_level[level],
+                deadline_level_name((enum deadline_level)level), controller->seconds_per_pixel[level] * 1e9);
+    }
+}
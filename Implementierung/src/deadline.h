@@ -0,0 +1,72 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+#include <stddef.h>
+#include <stdio.h>
+
+// share of the budget a frame is predicted to take at most, the rest is kept for the variation between frames
+#define DEADLINE_HEADROOM 0.9
+// frames that take at most this share of the budget are calm, enough calm frames in a row try a better level
+#define DEADLINE_CALM 0.5
+// calm frames before the first attempt of a better level, doubled after every attempt that misses the budget
+#define DEADLINE_PROBE_FRAMES 8
+#define DEADLINE_MAX_PROBE_FRAMES 512
+// weight of the newest frame in the smoothed time per pixel of a level
+#define DEADLINE_SMOOTHING 0.25
+
+// Versions of the denoise, from the best quality to the cheapest
+enum deadline_level {
+    DEADLINE_ACCURATE, // accurate SISD
+    DEADLINE_INTEGER, // integer SISD
+    DEADLINE_SIMD, // SIMD
+    DEADLINE_BLUR, // blur without the laplace weights, see denoise_blur()
+    DEADLINE_HALF, // SIMD on half the resolution, see denoise_half_resolution()
+    DEADLINE_LEVELS
+};
+
+// What deadline_pick() did
+enum deadline_event {
+    DEADLINE_KEEP,
+    DEADLINE_DOWNGRADE,
+    DEADLINE_RECOVER
+};
+
+struct deadline_controller {
+    double budget; // seconds per frame
+    enum deadline_level level; // level of the next frame
+    double seconds_per_pixel[DEADLINE_LEVELS]; // smoothed time of the levels, 0 until a level is measured
+    int over_budget[DEADLINE_LEVELS]; // the last frame at the level took longer than the budget
+    int missed; // the last frame took longer than the budget
+    size_t calm_frames; // calm frames in a row at the current level
+    size_t probe_frames; // calm frames needed before the next attempt of a better level
+    int probing; // the current level is an attempt that has not yet had a calm frame
+    size_t frame; // index of the next frame
+    // counts for the summary
+    size_t missed_frames, downgrades, recoveries;
+    size_t frames_per_level[DEADLINE_LEVELS];
+};
+
+// Name of a level for the log
+const char* deadline_level_name(enum deadline_level level);
+
+// Start with the SIMD version, nothing is measured yet
+void deadline_init(struct deadline_controller* controller, double budget);
+
+/**
+ * Pick the level of the next frame of the given number of pixels. A frame that missed the budget or a level that is
+ * predicted to take more than DEADLINE_HEADROOM of it moves to the best cheaper level that is predicted to fit.
+ * Levels that were never measured are predicted from the nearest measured level and a conservative ratio of their costs.
+ * After probe_frames calm frames the next better level is tried, unless it is predicted to take more than DEADLINE_CALM
+ * of the budget: then its prediction is reduced by DEADLINE_SMOOTHING, so a level that was measured under a passing load
+ * is tried again later. The prediction of a level whose last frame missed the budget is kept.
+ * Every downgrade and recovery is written with its reason to log, if it is not NULL.
+ * @param best: best level the frame allows, the SISD versions only take RGB
+ */
+enum deadline_event deadline_pick(struct deadline_controller* controller, size_t pixels, enum deadline_level best, FILE* log);
+
+// Record the measured time of the frame denoised at the picked level
+void deadline_update(struct deadline_controller* controller, size_t pixels, double seconds);
+
+// Print the frames per level, the missed frames, the downgrades and the recoveries
+void deadline_summary(const struct deadline_controller* controller, FILE* log);
+
+#endif // DEADLINE_H
@@ -1,37 +1,552 @@
 #include "denoise.h"
+#include "bilateral.h"
+#include "box.h"
 #include "combine.h"
 #include "convolution.h"
 #include "grayscale.h"
+#include "median.h"
+#include "pyramid.h"
+#include "trace.h"
+#include <smmintrin.h>
+#include <string.h>
 
 void denoise(const uint8_t* img, size_t width, size_t height,
     float a, float b, float c,
     uint8_t* tmp1, uint8_t* tmp2, uint8_t* result)
 {
-    grayscale(img, width, height, a, b, c, result);
-    convolution(result, width, height, tmp1, laplace_kernel, 1);
-    convolution(result, width, height, tmp2, blur_kernel, 0);
-    combine(result, tmp1, tmp2, width, height, result, 1);
+    denoise_view(packed_view(img, width, height, 3), a, b, c, tmp1, tmp2, packed_view(result, width, height, 1));
+}
+
+void denoise_view(struct image_view img, float a, float b, float c,
+    uint8_t* tmp1, uint8_t* tmp2, struct image_view result)
+{
+    struct image_view laplace = packed_view(tmp1, img.width, img.height, 1);
+    struct image_view blur = packed_view(tmp2, img.width, img.height, 1);
+    TRACE_BEGIN("grayscale");
+    grayscale_view(img, a, b, c, result);
+    TRACE_END("grayscale");
+    TRACE_BEGIN("convolution");
+    convolution_view(result, laplace, laplace_kernel, 1);
+    convolution_view(result, blur, blur_kernel, 0);
+    TRACE_END("convolution");
+    TRACE_BEGIN("combine");
+    combine_view(result, laplace, blur, result, 1);
+    TRACE_END("combine");
 }
 
 void denoise_integer(const uint8_t* img, size_t width, size_t height,
     float a, float b, float c,
     uint8_t* tmp1, uint8_t* tmp2, uint8_t* result)
 {
-    grayscale_integer(img, width, height, a, b, c, result);
-    convolution_1pass(result, width, height, tmp1, tmp2);
-    combine(result, tmp1, tmp2, width, height, result, 0);
+    denoise_integer_view(packed_view(img, width, height, 3), a, b, c, tmp1, tmp2, packed_view(result, width, height, 1));
+}
+
+void denoise_integer_view(struct image_view img, float a, float b, float c,
+    uint8_t* tmp1, uint8_t* tmp2, struct image_view result)
+{
+    struct image_view laplace = packed_view(tmp1, img.width, img.height, 1);
+    struct image_view blur = packed_view(tmp2, img.width, img.height, 1);
+    TRACE_BEGIN("grayscale");
+    grayscale_integer_view(img, a, b, c, result);
+    TRACE_END("grayscale");
+    TRACE_BEGIN("convolution");
+    convolution_1pass_view(result, laplace, blur);
+    TRACE_END("convolution");
+    TRACE_BEGIN("combine");
+    combine_view(result, laplace, blur, result, 0);
+    TRACE_END("combine");
 }
 
 void denoise_simd(const uint8_t* img, size_t width, size_t height,
     float a, float b, float c,
     uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, uint8_t* result)
 {
-    grayscale_simd(img, width, height, a, b, c, result);
+    denoise_simd_view(packed_view(img, width, height, 3), a, b, c, padded_image, padded_laplace, padded_blur, packed_view(result, width, height, 1));
+}
+
+void denoise_simd_view(struct image_view img, float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, struct image_view result)
+{
+    denoise_simd_format_view(img, PIXEL_RGB, a, b, c, padded_image, padded_laplace, padded_blur, result);
+}
+
+void denoise_simd_format_view(struct image_view img, enum pixel_format format, float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, struct image_view result)
+{
+    // luma is padded straight from the input, the other formats are converted into result first
+    TRACE_BEGIN("grayscale");
+    struct image_view gray = grayscale_simd_format_view(img, format, a, b, c, result);
+    TRACE_END("grayscale");
+
+    size_t padded_width = img.width + 2;
+
+    TRACE_BEGIN("pad");
+    pad_image_simd_view(gray, padded_width, padded_image);
+    TRACE_END("pad");
+    convolve_combine_simd_view(gray, padded_image, padded_width, padded_laplace, padded_blur, result);
+}
+
+void denoise_simd_8bit_view(struct image_view img, enum pixel_format format, float a, float b, float c,
+    uint8_t* padded_image, uint8_t* padded_laplace, uint8_t* padded_blur, struct image_view result)
+{
+    // the 8 bit padded image has the layout of the grayscale image, the other formats are converted straight into it
+    size_t padded_width = img.width + 2;
+    struct image_view padded_gray = { padded_image + padded_width + 1, img.width, img.height, padded_width };
+    TRACE_BEGIN("grayscale");
+    struct image_view gray = grayscale_simd_format_view(img, format, a, b, c, padded_gray);
+    TRACE_END("grayscale");
+    if (format == PIXEL_LUMA) {
+        TRACE_BEGIN("pad");
+        pad_image_8bit_view(gray, padded_width, padded_image);
+        TRACE_END("pad");
+    }
+    if (img.width >= 16) {
+        TRACE_BEGIN("convolution and combine");
+        convolve_combine_simd_8bit_view(padded_image, padded_width, result);
+        TRACE_END("convolution and combine");
+        return;
+    }
+    // narrower images are convolved and combined in two passes
+    TRACE_BEGIN("convolution");
+    convolution_simd_8bit(padded_image, padded_width, img.height + 2, padded_laplace, padded_blur);
+    TRACE_END("convolution");
+    TRACE_BEGIN("combine");
+    combine_simd_8bit_view(padded_gray, padded_laplace, padded_blur, padded_width, result);
+    TRACE_END("combine");
+}
+
+void denoise_simd_batch(const uint8_t* images, enum pixel_format format, size_t count, size_t width, size_t height,
+    float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, uint8_t* result)
+{
+    // the images one after the other are one image of count * height rows for the grayscale conversion
+    TRACE_BEGIN("grayscale");
+    struct image_view gray = grayscale_simd_format_view(packed_view(images, width, count * height, pixel_size(format)), format, a, b, c,
+        packed_view(result, width, count * height, 1));
+    TRACE_END("grayscale");
+    size_t padded_width = width + 2;
+    // image i starts below the zero row at padded row i * (height + 1)
+    size_t stride = (height + 1) * padded_width;
+
+    TRACE_BEGIN("pad");
+    for (size_t i = 0; i < count; i++)
+        pad_image_simd_view(view_region(gray, 0, i * height, width, height, 1), padded_width, padded_image + i * stride);
+    TRACE_END("pad");
+    TRACE_BEGIN("convolution");
+    convolution_simd(padded_image, padded_width, count * (height + 1) + 1, padded_laplace, padded_blur);
+    TRACE_END("convolution");
+    TRACE_BEGIN("combine");
+    for (size_t i = 0; i < count; i++) {
+        combine_simd_view(view_region(gray, 0, i * height, width, height, 1), padded_laplace + i * stride, padded_blur + i * stride,
+            padded_width, packed_view(result + i * width * height, width, height, 1));
+    }
+    TRACE_END("combine");
+}
+
+void denoise_simd_strips(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, size_t strip_rows, uint8_t* scratch, uint8_t* result)
+{
+    size_t padded_width = width + 2;
+    size_t padded_size = padded_width * (strip_rows + 4);
+    uint16_t* padded_image = (uint16_t*)scratch;
+    uint16_t* padded_laplace = padded_image + padded_size;
+    uint16_t* padded_blur = padded_laplace + padded_size;
+    // the results of the strip and of the strip before it, which is not written yet
+    uint8_t* strip_results[2] = { (uint8_t*)(padded_blur + padded_size), (uint8_t*)(padded_blur + padded_size) + width * (strip_rows + 2) };
+    memset(padded_image, 0, padded_size * sizeof(uint16_t));
+
+    size_t bytes = pixel_size(format);
+    size_t pending_y0 = 0, pending_y1 = 0, pending_first = 0;
+    for (size_t y0 = 0, strip = 0; y0 < height; y0 += strip_rows, strip++) {
+        size_t y1 = y0 + strip_rows < height ? y0 + strip_rows : height;
+        size_t region_y0 = y0 ? y0 - 1 : 0;
+        size_t region_y1 = y1 < height ? y1 + 1 : height;
+        size_t region_height = region_y1 - region_y0;
+        // the bottom border of a shorter last strip held pixels of the strip before
+        memset(padded_image + (region_height + 1) * padded_width, 0, padded_width * sizeof(uint16_t));
+        uint8_t* strip_result = strip_results[strip % 2];
+        denoise_simd_format_view(packed_view(img + region_y0 * width * bytes, width, region_height, bytes), format, a, b, c,
+            padded_image, padded_laplace, padded_blur, packed_view(strip_result, width, region_height, 1));
+
+        // the input of this strip is read, the rows of the strip before can be written
+        if (pending_y1 > pending_y0)
+            memcpy(result + pending_y0 * width, strip_results[(strip + 1) % 2] + pending_first * width, (pending_y1 - pending_y0) * width);
+        pending_y0 = y0;
+        pending_y1 = y1;
+        pending_first = y0 - region_y0;
+    }
+    if (pending_y1 > pending_y0)
+        memcpy(result + pending_y0 * width, strip_results[(height - 1) / strip_rows % 2] + pending_first * width, (pending_y1 - pending_y0) * width);
+}
+
+void denoise_simd_downscale(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, size_t factor, uint8_t* gray,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, uint16_t* sums,
+    uint8_t* result)
+{
+    // a band is converted and padded, then the band before it is denoised, whose bottom row needs the first row of the band.
+    // The bands alternate between two slots of gray and padded rows, a padded slot holds a band with the rows above and below
+    struct image_view image = packed_view(img, width, height, pixel_size(format)), previous = { 0 };
+    size_t padded_width = width + 2, band_rows = DOWNSCALE_BAND_ROWS(factor), scaled_width = DOWNSCALED_SIZE(width, factor);
+    size_t slot_size = DOWNSCALE_PADDED_SIZE(width, factor);
+    for (size_t y = 0, band = 0; y < height + band_rows; y += band_rows, band++) {
+        struct image_view original = previous;
+        uint16_t* padded_band = padded_image + band % 2 * slot_size;
+        uint16_t* padded_previous = padded_image + (band + 1) % 2 * slot_size;
+        if (y < height) {
+            size_t rows = y + band_rows < height ? band_rows : height - y;
+            TRACE_BEGIN("grayscale");
+            previous = grayscale_simd_format_view(view_region(image, 0, y, width, rows, pixel_size(format)), format, a, b, c,
+                packed_view(gray + band % 2 * band_rows * width, width, rows, 1));
+            TRACE_END("grayscale");
+            TRACE_BEGIN("pad");
+            pad_image_simd_view(previous, padded_width, padded_band);
+            for (size_t row = 1; row <= rows; row++)
+                padded_band[row * padded_width] = padded_band[row * padded_width + width + 1] = 0;
+            // the row above is the last row of the band before, whose row below is the first row of this band
+            if (y == 0) {
+                memset(padded_band, 0, padded_width * sizeof(uint16_t));
+            } else {
+                memcpy(padded_band, padded_previous + original.height * padded_width, padded_width * sizeof(uint16_t));
+                memcpy(padded_previous + (original.height + 1) * padded_width, padded_band + padded_width, padded_width * sizeof(uint16_t));
+            }
+            TRACE_END("pad");
+        } else {
+            // the last band is followed by the zero border
+            memset(padded_previous + (original.height + 1) * padded_width, 0, padded_width * sizeof(uint16_t));
+        }
+        if (y == 0)
+            continue;
+
+        // the band is convolved from its padded slot into the first rows of the padded laplace and blur
+        size_t band_y = y - band_rows, rows = original.height;
+        struct image_view band_result = packed_view(result + band_y / factor * scaled_width, scaled_width, DOWNSCALED_SIZE(rows, factor), 1);
+        // factors 2 and 4 are convolved and combined in registers, the other factors and the last band of partial blocks in two passes
+        if ((factor == 2 || factor == 4) && rows % factor == 0 && width >= 8 * factor) {
+            TRACE_BEGIN("convolution and combine");
+            convolve_combine_downscale_simd(padded_previous, padded_width, width, rows, factor, band_result);
+            TRACE_END("convolution and combine");
+            continue;
+        }
+        TRACE_BEGIN("convolution");
+        convolution_simd(padded_previous, padded_width, rows + 2, padded_laplace, padded_blur);
+        TRACE_END("convolution");
+        TRACE_BEGIN("combine");
+        combine_simd_downscale_view(original, padded_laplace, padded_blur, padded_width, factor, sums, band_result);
+        TRACE_END("combine");
+    }
+}
+
+void convolve_combine_simd_view(struct image_view gray, const uint16_t* padded_image, size_t padded_width,
+    uint16_t* padded_laplace, uint16_t* padded_blur, struct image_view result)
+{
+    // strips of FLAT_TILE_ROWS rows, split into columns of at most FLAT_STRIP_TILES tiles, stay in the cache between the stages
+    struct laplace_summary summaries[FLAT_STRIP_TILES];
+    size_t strip_width = FLAT_STRIP_TILES * FLAT_TILE_WIDTH;
+    // after two rows of strips without flat tiles, like in photos, only every 8th row of strips searches for them
+    size_t textured_rows = 0;
+    for (size_t y = 0; y < gray.height; y += FLAT_TILE_ROWS) {
+        size_t rows = y + FLAT_TILE_ROWS < gray.height ? FLAT_TILE_ROWS : gray.height - y;
+        int find_flat = textured_rows < 2 || textured_rows % 8 == 0;
+        int any_flat = 0;
+        for (size_t x = 0; x < gray.width; x += strip_width) {
+            size_t width = x + strip_width < gray.width ? strip_width : gray.width - x;
+            // the strip starts at padded pixel (x, y) with its halo
+            size_t offset = y * padded_width + x;
+            TRACE_BEGIN("convolution");
+            any_flat |= convolution_simd_strip(padded_image + offset, padded_width, width, rows, padded_laplace + offset, padded_blur + offset,
+                summaries, find_flat);
+            TRACE_END("convolution");
+            TRACE_BEGIN("combine");
+            combine_simd_strip(view_region(gray, x, y, width, rows, 1), padded_laplace + offset, padded_blur + offset,
+                padded_width, summaries, view_region(result, x, y, width, rows, 1));
+            TRACE_END("combine");
+        }
+        textured_rows = any_flat ? 0 : textured_rows + 1;
+    }
+}
+
+void denoise_median(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, size_t window,
+    uint8_t* gray, uint8_t* scratch, uint8_t* result)
+{
+    TRACE_BEGIN("grayscale");
+    struct image_view image = grayscale_simd_format_view(packed_view(img, width, height, pixel_size(format)), format, a, b, c,
+        packed_view(gray, width, height, 1));
+    TRACE_END("grayscale");
+    TRACE_BEGIN("median");
+    median_simd(image.pixels, width, height, window, scratch, result);
+    TRACE_END("median");
+}
+
+void denoise_bilateral(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, const struct bilateral_weights* weights,
+    uint8_t* gray, uint8_t* scratch, uint8_t* result)
+{
+    TRACE_BEGIN("grayscale");
+    struct image_view image = grayscale_simd_format_view(packed_view(img, width, height, pixel_size(format)), format, a, b, c,
+        packed_view(gray, width, height, 1));
+    TRACE_END("grayscale");
+    TRACE_BEGIN("bilateral");
+    bilateral_simd(image.pixels, width, height, weights, scratch, result);
+    TRACE_END("bilateral");
+}
+
+void denoise_box(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, const size_t* radii,
+    uint8_t* blurred, uint8_t* scratch,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
+    uint8_t* result)
+{
+    TRACE_BEGIN("grayscale");
+    struct image_view gray = grayscale_simd_format_view(packed_view(img, width, height, pixel_size(format)), format, a, b, c,
+        packed_view(result, width, height, 1));
+    TRACE_END("grayscale");
+    size_t padded_width = width + 2;
+
+    TRACE_BEGIN("pad");
+    pad_image_simd_view(gray, padded_width, padded_image);
+    TRACE_END("pad");
+    TRACE_BEGIN("convolution");
+    convolution_simd(padded_image, padded_width, height + 2, padded_laplace, padded_blur);
+    TRACE_END("convolution");
+    // the 3x3 blur of the convolution is replaced, only the laplace responses are used
+    TRACE_BEGIN("box blur");
+    box_blur_simd(gray.pixels, width, height, radii, scratch, blurred);
+    TRACE_END("box blur");
+    TRACE_BEGIN("pad");
+    pad_image_simd(blurred, width, height, padded_width, padded_blur);
+    TRACE_END("pad");
+    TRACE_BEGIN("combine");
+    combine_simd_view(gray, padded_laplace, padded_blur, padded_width, packed_view(result, width, height, 1));
+    TRACE_END("combine");
+}
 
+// Write the border of a padded level of width x height pixels, pad_image_simd_view() and pyramid_up_add_simd() do not write it
+static void pad_level_border(uint16_t* padded_image, size_t width, size_t height, int replicate)
+{
     size_t padded_width = width + 2;
-    size_t padded_height = height + 2;
+    for (size_t y = 1; y <= height; y++) {
+        uint16_t* row = padded_image + y * padded_width;
+        row[0] = replicate ? row[1] : 0;
+        row[padded_width - 1] = replicate ? row[padded_width - 2] : 0;
+    }
+    uint16_t* bottom = padded_image + (height + 1) * padded_width;
+    if (replicate) {
+        memcpy(padded_image, padded_image + padded_width, padded_width * sizeof(uint16_t));
+        memcpy(bottom, bottom - padded_width, padded_width * sizeof(uint16_t));
+    } else {
+        memset(padded_image, 0, padded_width * sizeof(uint16_t));
+        memset(bottom, 0, padded_width * sizeof(uint16_t));
+    }
+}
+
+/**
+ * Pad a level into a padded array that held a larger level before.
+ * The smaller levels replicate their edge pixels, with a zero border their edges would be darkened by the blur
+ * and the darkened edges would be spread over the finer levels.
+ */
+static void pad_level(struct image_view gray, int replicate, uint16_t* padded_image)
+{
+    pad_image_simd_view(gray, gray.width + 2, padded_image);
+    pad_level_border(padded_image, gray.width, gray.height, replicate);
+}
+
+void denoise_pyramid(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, size_t levels, uint8_t* scratch,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
+    uint8_t* result)
+{
+    // every smaller level keeps its original for the difference to the finer level and its denoised image
+    levels = pyramid_levels(width, height, levels);
+    uint16_t* sums = (uint16_t*)scratch;
+    const uint8_t* originals[PYRAMID_MAX_LEVELS];
+    uint8_t* denoised[PYRAMID_MAX_LEVELS] = { result };
+    size_t widths[PYRAMID_MAX_LEVELS] = { width }, heights[PYRAMID_MAX_LEVELS] = { height };
+    uint8_t* next = scratch + (width + 32) * sizeof(uint16_t);
+    for (size_t level = 1; level < levels; level++) {
+        widths[level] = PYRAMID_HALF(widths[level - 1]);
+        heights[level] = PYRAMID_HALF(heights[level - 1]);
+        originals[level] = next;
+        denoised[level] = next + widths[level] * heights[level];
+        next = denoised[level] + widths[level] * heights[level];
+    }
+
+    // the grayscale image is converted in bands of rows, which are downsampled to the next level while they are still in the cache
+    struct image_view image = packed_view(img, width, height, pixel_size(format));
+    size_t band_rows = 32;
+    for (size_t y = 0; y < height; y += band_rows) {
+        size_t rows = y + band_rows < height ? band_rows : height - y;
+        TRACE_BEGIN("grayscale");
+        struct image_view band = grayscale_simd_format_view(view_region(image, 0, y, width, rows, pixel_size(format)), format, a, b, c,
+            packed_view(result + y * width, width, rows, 1));
+        TRACE_END("grayscale");
+        if (y == 0)
+            originals[0] = band.pixels;
+        if (levels > 1) {
+            // the rows of the next level whose rows 2y - 1 to 2y + 2 are converted, the last band finishes the level
+            size_t converted = y + rows;
+            TRACE_BEGIN("pyramid down");
+            pyramid_down_rows_simd(originals[0], width, height, y > 0 ? (y - 1) / 2 : 0,
+                converted == height ? heights[1] : (converted - 1) / 2, sums, (uint8_t*)originals[1]);
+            TRACE_END("pyramid down");
+        }
+    }
+    TRACE_BEGIN("pyramid down");
+    for (size_t level = 2; level < levels; level++)
+        pyramid_down_simd(originals[level - 1], widths[level - 1], heights[level - 1], sums, (uint8_t*)originals[level]);
+    TRACE_END("pyramid down");
+
+    // from the coarsest level on, the original of the level on the full resolution may be overwritten by then
+    for (size_t level = levels; level-- > 0;) {
+        struct image_view input = packed_view(originals[level], widths[level], heights[level], 1);
+        struct image_view output = packed_view(denoised[level], widths[level], heights[level], 1);
+        if (level + 1 < levels) {
+            // the finer level is padded while the change of the coarser level is added to it
+            TRACE_BEGIN("pyramid up");
+            int bias = pyramid_mean_change(denoised[level + 1], originals[level + 1], widths[level + 1] * heights[level + 1]);
+            pyramid_up_add_simd(denoised[level + 1], originals[level + 1], originals[level], widths[level], heights[level], bias,
+                (int16_t*)sums, denoised[level], padded_image);
+            TRACE_END("pyramid up");
+            input = output;
+            TRACE_BEGIN("pad");
+            pad_level_border(padded_image, widths[level], heights[level], level > 0);
+            TRACE_END("pad");
+        } else {
+            TRACE_BEGIN("pad");
+            pad_level(input, level > 0, padded_image);
+            TRACE_END("pad");
+        }
+        convolve_combine_simd_view(input, padded_image, widths[level] + 2, padded_laplace, padded_blur, output);
+    }
+}
 
-    pad_image_simd(result, width, height, padded_width, padded_image);
-    convolution_simd(padded_image, padded_width, padded_height, padded_laplace, padded_blur);
-    combine_simd(result, padded_laplace, padded_blur, width, height, padded_width, result);
-}
\ No newline at end of file
+/**
+ * Average the 2x2 pixels of a packed image of 1, 3 or 4 bytes per pixel with _mm_avg_epu8(), first along the columns
+ * and then along the rows, so the average is rounded up by less than 1. The last column and row of an odd size are
+ * averaged with themselves. Writes up to 2 bytes after the end of result.
+ */
+static void half_average_simd(const uint8_t* image, size_t width, size_t height, size_t bytes, uint8_t* result)
+{
+    size_t half_width = PYRAMID_HALF(width), half_height = PYRAMID_HALF(height);
+    // luma keeps the even bytes of 16, 3 and 4 byte pixels keep the first 2 of the 4 pixels in a vector
+    __m128i even = _mm_set1_epi16(0x00ff);
+    __m128i pairs = bytes == 3 ? _mm_setr_epi8(0, 1, 2, 6, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)
+                               : _mm_setr_epi8(0, 1, 2, 3, 8, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t step = bytes == 1 ? 8 : 2;
+    for (size_t y = 0; y < half_height; y++) {
+        const uint8_t* above = image + 2 * y * width * bytes;
+        const uint8_t* below = 2 * y + 1 < height ? above + width * bytes : above;
+        uint8_t* row = result + y * half_width * bytes;
+        size_t x = 0;
+        for (; 2 * (x + step) <= width && 2 * x * bytes + 16 <= width * bytes; x += step) {
+            __m128i columns = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(above + 2 * x * bytes)), _mm_loadu_si128((const __m128i*)(below + 2 * x * bytes)));
+            __m128i average = _mm_avg_epu8(columns, bytes == 1 ? _mm_srli_si128(columns, 1) : bytes == 3 ? _mm_srli_si128(columns, 3) : _mm_srli_si128(columns, 4));
+            average = bytes == 1 ? _mm_packus_epi16(_mm_and_si128(average, even), average) : _mm_shuffle_epi8(average, pairs);
+            _mm_storel_epi64((__m128i*)(row + x * bytes), average);
+        }
+        for (; x < half_width; x++) {
+            size_t left = 2 * x * bytes, right = 2 * x + 1 < width ? left + bytes : left;
+            for (size_t k = 0; k < bytes; k++) {
+                int first = (above[left + k] + below[left + k] + 1) >> 1, second = (above[right + k] + below[right + k] + 1) >> 1;
+                row[x * bytes + k] = (uint8_t)((first + second + 1) >> 1);
+            }
+        }
+    }
+}
+
+// 3/4 of center and 1/4 of neighbour with two _mm_avg_epu8(), rounded up by less than 1
+static inline __m128i three_quarters(__m128i center, __m128i neighbour)
+{
+    return _mm_avg_epu8(center, _mm_avg_epu8(center, neighbour));
+}
+
+static inline uint8_t three_quarters_scalar(uint8_t center, uint8_t neighbour)
+{
+    return (uint8_t)((center + ((center + neighbour + 1) >> 1) + 1) >> 1);
+}
+
+/**
+ * Upsample a half image to width x height pixels bilinearly, with the weights 3/4 and 1/4 along both axes like
+ * pyramid_up_add(), but without a finer level. Pixels outside the half image are replaced by the nearest edge pixel.
+ * @param row: PYRAMID_HALF(width) + 2 bytes, a row interpolated along the columns with its edge pixels
+ */
+static void upsample_half_simd(const uint8_t* half, size_t width, size_t height, uint8_t* row, uint8_t* result)
+{
+    size_t half_width = PYRAMID_HALF(width), half_height = PYRAMID_HALF(height);
+    for (size_t y = 0; y < height; y++) {
+        // even rows lie in the upper half of a half row and take 1/4 of the one above, odd rows of the one below
+        size_t center = y / 2;
+        size_t neighbour = y % 2 ? (center + 1 < half_height ? center + 1 : center) : (center > 0 ? center - 1 : 0);
+        const uint8_t* c = half + center * half_width;
+        const uint8_t* n = half + neighbour * half_width;
+        size_t x = 0;
+        for (; x + 16 <= half_width; x += 16)
+            _mm_storeu_si128((__m128i*)(row + 1 + x), three_quarters(_mm_loadu_si128((const __m128i*)(c + x)), _mm_loadu_si128((const __m128i*)(n + x))));
+        for (; x < half_width; x++)
+            row[1 + x] = three_quarters_scalar(c[x], n[x]);
+        row[0] = row[1];
+        row[half_width + 1] = row[half_width];
+
+        uint8_t* out = result + y * width;
+        x = 0;
+        for (; 2 * x + 32 <= width; x += 16) {
+            __m128i middle = _mm_loadu_si128((const __m128i*)(row + 1 + x));
+            __m128i even = three_quarters(middle, _mm_loadu_si128((const __m128i*)(row + x)));
+            __m128i odd = three_quarters(middle, _mm_loadu_si128((const __m128i*)(row + 2 + x)));
+            _mm_storeu_si128((__m128i*)(out + 2 * x), _mm_unpacklo_epi8(even, odd));
+            _mm_storeu_si128((__m128i*)(out + 2 * x + 16), _mm_unpackhi_epi8(even, odd));
+        }
+        for (; 2 * x < width; x++) {
+            out[2 * x] = three_quarters_scalar(row[1 + x], row[x]);
+            if (2 * x + 1 < width)
+                out[2 * x + 1] = three_quarters_scalar(row[1 + x], row[2 + x]);
+        }
+    }
+}
+
+void denoise_half_resolution(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, uint8_t* scratch, uint8_t* result)
+{
+    size_t half_width = PYRAMID_HALF(width), half_height = PYRAMID_HALF(height);
+    size_t padded_size = (half_width + 2) * (half_height + 2), bytes = pixel_size(format);
+    uint16_t* padded_image = (uint16_t*)scratch;
+    uint16_t* padded_laplace = padded_image + padded_size;
+    uint16_t* padded_blur = padded_laplace + padded_size;
+    uint8_t* row = (uint8_t*)(padded_blur + padded_size);
+    uint8_t* gray_pixels = row + half_width + 2;
+    uint8_t* denoised = gray_pixels + half_width * half_height;
+    // followed by the bytes half_average_simd() may write after the end
+    uint8_t* pixels = denoised + half_width * half_height;
+
+    // averaging the pixels before the conversion leaves a quarter of the pixels to convert
+    TRACE_BEGIN("downsample");
+    half_average_simd(img, width, height, bytes, pixels);
+    TRACE_END("downsample");
+    TRACE_BEGIN("grayscale");
+    struct image_view gray = grayscale_simd_format_view(packed_view(pixels, half_width, half_height, bytes), format, a, b, c,
+        packed_view(gray_pixels, half_width, half_height, 1));
+    TRACE_END("grayscale");
+    // the border is replicated like for the smaller levels of denoise_pyramid()
+    TRACE_BEGIN("pad");
+    pad_level(gray, 1, padded_image);
+    TRACE_END("pad");
+    convolve_combine_simd_view(gray, padded_image, half_width + 2, padded_laplace, padded_blur, packed_view(denoised, half_width, half_height, 1));
+    TRACE_BEGIN("upsample");
+    upsample_half_simd(denoised, width, height, row, result);
+    TRACE_END("upsample");
+}
+
+void denoise_blur(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, uint8_t* scratch, uint8_t* result)
+{
+    TRACE_BEGIN("grayscale");
+    // the sums come first, so that they are aligned
+    uint16_t* sums = (uint16_t*)scratch;
+    struct image_view gray = grayscale_simd_format_view(packed_view(img, width, height, pixel_size(format)), format, a, b, c,
+        packed_view(scratch + (width + 2) * sizeof(uint16_t), width, height, 1));
+    TRACE_END("grayscale");
+    TRACE_BEGIN("convolution");
+    blur_2_1d_simd(gray.pixels, width, height, sums, result);
+    TRACE_END("convolution");
+}
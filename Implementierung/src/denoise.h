@@ -1,8 +1,11 @@
 #ifndef DENOISE_H
 #define DENOISE_H
+#include "view.h"
 #include <stdint.h>
 #include <stdlib.h>
 
+struct bilateral_weights;
+
 /**
  * Function to convert an RGB image to a grayscale image and reduce the noise of the grayscale image.
  * This implementation is naive and the pixel value is rounded correctly throughout the process to get an accurate result.
@@ -21,6 +24,14 @@ void denoise(const uint8_t* img, size_t width, size_t height,
     uint8_t* tmp1, uint8_t* tmp2,
     uint8_t* result);
 
+/**
+ * Does the same as denoise() on strided views, e.g. a region of interest in a larger frame buffer.
+ * img is a view with 3 bytes per pixel, result a view of the same size with 1 byte per pixel, which may lie
+ * in the same buffer as long as they don't overlap. The temporary results are packed, allocate width * height pixels.
+ */
+void denoise_view(struct image_view img, float a, float b, float c,
+    uint8_t* tmp1, uint8_t* tmp2, struct image_view result);
+
 /**
  * Does the same as denoise().
  * Optimized for speed by using integer arithmetic and doing two convolutions in one pass.
@@ -31,6 +42,10 @@ void denoise_integer(const uint8_t* img, size_t width, size_t height,
     uint8_t* tmp1, uint8_t* tmp2,
     uint8_t* result);
 
+// Does the same as denoise_integer() on strided views, like denoise_view()
+void denoise_integer_view(struct image_view img, float a, float b, float c,
+    uint8_t* tmp1, uint8_t* tmp2, struct image_view result);
+
 /**
  * Does the samen as denoise(), optimized using SSE, SSE4.1 is required.
  * The result is not exact, it may vary ±2, but the difference is not noticeable to human eyes.
@@ -53,4 +68,181 @@ void denoise_simd(const uint8_t* img, size_t width, size_t height,
     uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
     uint8_t* result);
 
+// Does the same as denoise_simd() on strided views, like denoise_view(). The padded arrays are packed.
+void denoise_simd_view(struct image_view img, float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, struct image_view result);
+
+/**
+ * Does the same as denoise_simd_view() for an input image in the given format.
+ * RGBA and BGRA images are converted with their own SIMD kernels, the result is the same as for RGB.
+ * Luma images, e.g. P5 images or the Y plane of NV12 and I420 frames, skip the grayscale conversion
+ * and are padded directly, result may then be the same view as img.
+ */
+void denoise_simd_format_view(struct image_view img, enum pixel_format format, float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, struct image_view result);
+
+/**
+ * Approximates denoise_simd_format_view() with the pixels in 8 bit lanes, see convolution_simd_8bit() and combine_simd_8bit_view().
+ * The padded arrays have (width + 2) * (height + 2) 8 bit pixels, half the memory, padded_image must have a zero border.
+ * RGB and 4 byte pixels are converted straight into padded_image, luma images copied into it. Images at least 16 pixels wide
+ * are convolved and combined in one pass with convolve_combine_simd_8bit_view(), padded_laplace and padded_blur
+ * are only used for narrower ones.
+ * Compared with denoise(), the result is at most 3 off and about 0.8 darker on average, the one of denoise_simd() about 1.5 darker.
+ * @param result: may be the same view as img for luma images
+ */
+void denoise_simd_8bit_view(struct image_view img, enum pixel_format format, float a, float b, float c,
+    uint8_t* padded_image, uint8_t* padded_laplace, uint8_t* padded_blur, struct image_view result);
+
+// pixels of each padded array of denoise_simd_batch(): the padded images are stacked and share one zero row between them
+#define BATCH_PADDED_SIZE(count, width, height) (((width) + 2) * ((count) * ((height) + 1) + 1))
+
+/**
+ * Does the same as denoise_simd_format_view() for count images of the same size at once, e.g. thumbnails.
+ * Images of different sizes have to be grouped by size first.
+ * The images are converted to grayscale as one long row and padded into one mosaic, where the zero row between two images
+ * is the padding of both. The mosaic is convolved in one sweep, so small images don't pay for the setup and the
+ * scalar tail of every stage once per image. The result is the same as denoising every image on its own.
+ * @param images: count packed images with pixel_size(format) bytes per pixel, one after the other
+ * @param padded_image: BATCH_PADDED_SIZE(count, width, height) pixels, the zero rows must be zero, e.g. allocated with calloc
+ * @param padded_laplace: BATCH_PADDED_SIZE(count, width, height) pixels
+ * @param padded_blur: BATCH_PADDED_SIZE(count, width, height) pixels
+ * @param result: count denoised images of width * height pixels, one after the other
+ */
+void denoise_simd_batch(const uint8_t* images, enum pixel_format format, size_t count, size_t width, size_t height,
+    float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, uint8_t* result);
+
+// bytes of scratch memory denoise_simd_strips() needs: the padded arrays of a strip with its halo and two results of a strip
+#define STRIP_SCRATCH_SIZE(width, rows) (6 * ((width) + 2) * ((rows) + 4) + 2 * (width) * ((rows) + 2))
+
+/**
+ * Does the same as denoise_simd_format_view() on a packed image with far less memory: the image is denoised in strips of
+ * strip_rows rows, every strip with a halo of 1 row above and below like the tiles of denoise_tiled(), so the padded arrays
+ * only hold one strip. The result is the same as denoising the whole image.
+ * The result of a strip is written once the next strip is denoised, its rows then lie before all rows that are still read,
+ * so result may be img itself: the denoised image is written over the front of the input image.
+ * @param scratch: STRIP_SCRATCH_SIZE(width, strip_rows) bytes
+ */
+void denoise_simd_strips(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, size_t strip_rows, uint8_t* scratch, uint8_t* result);
+
+// rows of the bands of denoise_simd_downscale(), whole blocks of at least 8 rows
+#define DOWNSCALE_BAND_ROWS(factor) ((factor) * ((8 + (factor) - 1) / (factor)))
+// pixels of the padded laplace and blur of denoise_simd_downscale(), which only hold one band
+#define DOWNSCALE_PADDED_SIZE(width, factor) (((width) + 2) * (DOWNSCALE_BAND_ROWS(factor) + 2))
+// pixels of the grayscale and the padded image of denoise_simd_downscale(), which hold two bands
+#define DOWNSCALE_GRAY_SIZE(width, factor) (2 * (width) * DOWNSCALE_BAND_ROWS(factor))
+#define DOWNSCALE_PADDED_IMAGE_SIZE(width, factor) (2 * DOWNSCALE_PADDED_SIZE(width, factor))
+
+/**
+ * Does the same as denoise_simd_format_view() on a packed image and reduces the result by an integer factor with
+ * combine_simd_downscale_view(), e.g. for thumbnails and previews, so the full resolution result is never written.
+ * The image is converted, padded, convolved and combined in bands of DOWNSCALE_BAND_ROWS(factor) rows, which stay in the cache
+ * between the stages. Only the grayscale and padded rows of the current band and the one before it are kept. Factors 2 and 4 are convolved and combined in one pass with convolve_combine_downscale_simd().
+ * The result is the same as the area average of the result of denoise_simd_format_view(), before it is rounded to 8 bits.
+ * @param factor: 1 to DOWNSCALE_MAX_FACTOR
+ * @param gray: DOWNSCALE_GRAY_SIZE(width, factor) pixels, not used for luma images
+ * @param padded_image: DOWNSCALE_PADDED_IMAGE_SIZE(width, factor) pixels, its border is written with the bands
+ * @param padded_laplace: DOWNSCALE_PADDED_SIZE(width, factor) pixels
+ * @param padded_blur: DOWNSCALE_PADDED_SIZE(width, factor) pixels
+ * @param sums: width 16 bit sums
+ * @param result: DOWNSCALED_SIZE(width, factor) x DOWNSCALED_SIZE(height, factor) pixels
+ */
+void denoise_simd_downscale(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, size_t factor, uint8_t* gray,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, uint16_t* sums,
+    uint8_t* result);
+
+/**
+ * Convolution and combine of a padded grayscale image, strip by strip with convolution_simd_strip() and combine_simd_strip().
+ * The result is the same as with convolution_simd() and combine_simd_view(), but flat tiles, like the background of
+ * document scans and screenshots, are filled without a convolution and tiles without laplace response skip the multiplications.
+ * @param padded_image: the image padded with pad_image_simd_view(), starting at the padded row above gray
+ * @param result: may be the same view as gray
+ */
+void convolve_combine_simd_view(struct image_view gray, const uint16_t* padded_image, size_t padded_width,
+    uint16_t* padded_laplace, uint16_t* padded_blur, struct image_view result);
+
+/**
+ * Convert an image to grayscale and reduce salt and pepper noise with a median filter, see median_simd().
+ * Unlike the laplace weighted blur, single outliers are removed instead of being smeared over their neighbours.
+ * @param format: layout of img, luma images are filtered directly
+ * @param window: 3 or 5 for a 3x3 or 5x5 window
+ * @param gray: pointer to a temporary result of width * height pixels
+ * @param scratch: pointer to MEDIAN_SCRATCH_SIZE(width, window) bytes
+ */
+void denoise_median(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, size_t window,
+    uint8_t* gray, uint8_t* scratch, uint8_t* result);
+
+/**
+ * Convert an image to grayscale and denoise it with a bilateral filter, see bilateral_simd().
+ * Fine texture next to edges is kept, because neighbours with a very different value get almost no weight.
+ * @param format: layout of img, luma images are filtered directly
+ * @param weights: computed once with bilateral_weights()
+ * @param gray: pointer to a temporary result of width * height pixels
+ * @param scratch: pointer to BILATERAL_SCRATCH_SIZE(width, weights->window) bytes
+ */
+void denoise_bilateral(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, const struct bilateral_weights* weights,
+    uint8_t* gray, uint8_t* scratch, uint8_t* result);
+
+/**
+ * Does the same as denoise_simd_format_view() on a packed image, but with a large blur: the 3x3 blur is replaced by
+ * box_blur_simd(), which approximates a gaussian of any radius at the same cost per pixel, for images with heavy noise.
+ * The laplace responses and the combine are the same, so edges are kept sharp.
+ * @param radii: BOX_PASSES radii of the box filters, e.g. from gaussian_boxes()
+ * @param blurred: pointer to a temporary result of width * height pixels
+ * @param scratch: pointer to BOX_SCRATCH_SIZE(width, height) bytes
+ */
+void denoise_box(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, const size_t* radii,
+    uint8_t* blurred, uint8_t* scratch,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
+    uint8_t* result);
+
+/**
+ * Does the same as denoise_simd_format_view() on a packed image on several scales, for blotchy low-frequency noise,
+ * e.g. of compressed video frames, that the 3x3 kernels can't reach. The grayscale image is downsampled into a pyramid of
+ * levels of half the size with pyramid_down_simd(), the first one band by band during the grayscale conversion.
+ * The coarsest level is denoised with the laplace weighted blur first, then every finer level gets the change of the
+ * coarser level added with pyramid_up_add_simd(), which pads it at the same time, and is denoised as well.
+ * The smaller levels add about a third to the convolution and combine, the resampling adds about as much again,
+ * so the runtime is about 1.4 to 1.5 times that of a single level, whose grayscale conversion is not repeated.
+ * @param levels: levels including the full resolution, limited by pyramid_levels(), 1 is the same as denoise_simd()
+ * @param scratch: pointer to pyramid_scratch_size(width, height, levels) bytes
+ * @param padded_image: (width + 2) * (height + 2) pixels, its border is cleared for every level
+ */
+void denoise_pyramid(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, size_t levels, uint8_t* scratch,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
+    uint8_t* result);
+
+// bytes of scratch memory denoise_half_resolution() needs: the padded arrays, a row, the averaged pixels and both grayscale images
+// of the half resolution
+#define HALF_SCRATCH_SIZE(width, height) \
+    (6 * (((width) + 1) / 2 + 2) * (((height) + 1) / 2 + 2) + (((width) + 1) / 2 + 2) + 6 * (((width) + 1) / 2) * (((height) + 1) / 2) + 16)
+
+/**
+ * Cheaper approximation of denoise_simd_format_view() on a packed image, e.g. for frames that would miss their deadline:
+ * the 2x2 pixels are averaged before the grayscale conversion, so only a quarter of the pixels are converted, convolved
+ * and combined, and the result is upsampled bilinearly. Details smaller than 2 pixels are lost, the averages
+ * are rounded up by less than 1 gray value, about what the combine darkens.
+ * @param scratch: HALF_SCRATCH_SIZE(width, height) bytes, the half resolution is padded there, so the padded arrays of the
+ *                 full resolution keep their zero border
+ */
+void denoise_half_resolution(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, uint8_t* scratch, uint8_t* result);
+
+// bytes of scratch memory denoise_blur() needs: the sums of a row and the grayscale image
+#define BLUR_SCRATCH_SIZE(width, height) (2 * ((width) + 2) + (width) * (height))
+
+/**
+ * Cheap approximation of denoise_simd_format_view() on a packed image: the grayscale image is only blurred with
+ * blur_2_1d_simd(), without the laplace weights that keep the edges.
+ * @param scratch: BLUR_SCRATCH_SIZE(width, height) bytes
+ */
+void denoise_blur(const uint8_t* img, enum pixel_format format, size_t width, size_t height,
+    float a, float b, float c, uint8_t* scratch, uint8_t* result);
+
 #endif
\ No newline at end of file
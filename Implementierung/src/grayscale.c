@@ -2,39 +2,73 @@
 #include <math.h>
 #include <smmintrin.h>
 
+// Number of rows and pixels per row to process, packed images are converted as one long row
+static size_t row_length(struct image_view image, size_t channels, struct image_view result, size_t* rows)
+{
+    if (view_is_packed(image, channels) && view_is_packed(result, 1)) {
+        *rows = 1;
+        return image.width * image.height;
+    }
+    *rows = image.height;
+    return image.width;
+}
+
+static void grayscale_row(const uint8_t* image, size_t size, float a_f, float b_f, float c_f, uint8_t* result)
+{
+    for (size_t i = 0; i < size; i++) {
+        result[i] = (uint8_t)round((image[i * 3] * a_f + image[(i * 3) + 1] * b_f + image[(i * 3) + 2] * c_f));
+    }
+}
+
 void grayscale(const uint8_t* image, size_t width, size_t height,
     float a, float b, float c, uint8_t* result)
+{
+    grayscale_view(packed_view(image, width, height, 3), a, b, c, packed_view(result, width, height, 1));
+}
+
+void grayscale_view(struct image_view image, float a, float b, float c, struct image_view result)
 {
     float a_f = a / (a + b + c);
     float b_f = b / (a + b + c);
     float c_f = c / (a + b + c);
-    for (size_t i = 0; i < (width * height); i++) {
-        result[i] = (uint8_t)round((image[i * 3] * a_f + image[(i * 3) + 1] * b_f + image[(i * 3) + 2] * c_f));
+    size_t rows, length = row_length(image, 3, result, &rows);
+    for (size_t y = 0; y < rows; y++)
+        grayscale_row(view_row(image, y), length, a_f, b_f, c_f, view_row(result, y));
+}
+
+static void grayscale_integer_row(const uint8_t* image, size_t size, uint32_t a_i, uint32_t b_i, uint32_t c_i, uint8_t* result)
+{
+    for (size_t i = 0; i < size; i++) {
+        result[i] = (uint8_t)((image[i * 3] * a_i + image[(i * 3) + 1] * b_i + image[(i * 3) + 2] * c_i) / 1024);
     }
 }
 
 void grayscale_integer(const uint8_t* image, size_t width, size_t height,
     float a, float b, float c, uint8_t* result)
+{
+    grayscale_integer_view(packed_view(image, width, height, 3), a, b, c, packed_view(result, width, height, 1));
+}
+
+void grayscale_integer_view(struct image_view image, float a, float b, float c, struct image_view result)
 {
     uint32_t a_i = (uint32_t)(a * 1024 / (a + b + c));
     uint32_t b_i = (uint32_t)(b * 1024 / (a + b + c));
     uint32_t c_i = (uint32_t)(c * 1024 / (a + b + c));
-    for (size_t i = 0; i < (width * height); i++) {
-        result[i] = (uint8_t)((image[i * 3] * a_i + image[(i * 3) + 1] * b_i + image[(i * 3) + 2] * c_i) / 1024);
-    }
+    size_t rows, length = row_length(image, 3, result, &rows);
+    for (size_t y = 0; y < rows; y++)
+        grayscale_integer_row(view_row(image, y), length, a_i, b_i, c_i, view_row(result, y));
 }
 
-void grayscale_simd(const uint8_t* image, size_t width, size_t height, float a, float b, float c, uint8_t* result)
+static void grayscale_simd_row(const uint8_t* image, size_t size, float a, float b, float c, uint8_t* result)
 {
-
-    size_t size = width * height, i = 0;
+    size_t i = 0;
     __m128 red_coeff = _mm_set1_ps(a), green_coeff = _mm_set1_ps(b), blue_coeff = _mm_set1_ps(c); // coeffs
     __m128 sumOfCoeffs = _mm_add_ps(_mm_add_ps(red_coeff, green_coeff), blue_coeff);
     red_coeff = _mm_div_ps(red_coeff, sumOfCoeffs);
     green_coeff = _mm_div_ps(green_coeff, sumOfCoeffs);
     blue_coeff = _mm_div_ps(blue_coeff, sumOfCoeffs);
 
-    for (; i < size - 5; i += 4) {
+    for (; i + 6 <= size; i += 4) {
         // load 128bits
         __m128i rgb = _mm_loadu_si128((const __m128i*)(&image[i * 3]));
         // rearranging channels
@@ -53,11 +87,93 @@ void grayscale_simd(const uint8_t* image, size_t width, size_t height, float a,
 
         __m128i res = _mm_cvtps_epi32(_mm_add_ps(_mm_add_ps(red_scaled, green_scaled), blue_scaled));
 
-        // converting 32bits int to uint8
-        _mm_storel_epi64((__m128i*)(result + i), _mm_packus_epi16(_mm_packs_epi32(res, res), res));
+        // converting 32bits int to uint8, only the 4 pixels of this iteration are stored
+        _mm_storeu_si32(result + i, _mm_packus_epi16(_mm_packs_epi32(res, res), res));
+    }
+    // remaining pixels, rounded like the vectorized pixels so that splitting the image doesn't change the result
+    float a_f = a / (a + b + c);
+    float b_f = b / (a + b + c);
+    float c_f = c / (a + b + c);
+    for (; i < size; i++) {
+        result[i] = (uint8_t)lrintf(image[i * 3] * a_f + image[(i * 3) + 1] * b_f + image[(i * 3) + 2] * c_f);
+    }
+}
+
+void grayscale_simd(const uint8_t* image, size_t width, size_t height, float a, float b, float c, uint8_t* result)
+{
+    grayscale_simd_view(packed_view(image, width, height, 3), a, b, c, packed_view(result, width, height, 1));
+}
+
+void grayscale_simd_view(struct image_view image, float a, float b, float c, struct image_view result)
+{
+    size_t rows, length = row_length(image, 3, result, &rows);
+    for (size_t y = 0; y < rows; y++)
+        grayscale_simd_row(view_row(image, y), length, a, b, c, view_row(result, y));
+}
+
+
+// Converts 4 byte pixels, the shuffle mask moves the red, green and blue bytes of 4 pixels into 3 groups of 4 bytes
+static void grayscale_simd_4_row(const uint8_t* image, size_t size, float a, float b, float c, __m128i mask, size_t red, size_t blue, uint8_t* result)
+{
+    __m128 red_coeff = _mm_set1_ps(a), green_coeff = _mm_set1_ps(b), blue_coeff = _mm_set1_ps(c);
+    __m128 sumOfCoeffs = _mm_add_ps(_mm_add_ps(red_coeff, green_coeff), blue_coeff);
+    red_coeff = _mm_div_ps(red_coeff, sumOfCoeffs);
+    green_coeff = _mm_div_ps(green_coeff, sumOfCoeffs);
+    blue_coeff = _mm_div_ps(blue_coeff, sumOfCoeffs);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m128i rgb_rearr = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(&image[i * 4])), mask);
+        // same arithmetic as for 3 byte pixels, so the result doesn't depend on the layout
+        __m128 red_scaled = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(rgb_rearr)), red_coeff);
+        __m128 green_scaled = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(rgb_rearr, 4))), green_coeff);
+        __m128 blue_scaled = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(rgb_rearr, 8))), blue_coeff);
+        __m128i res = _mm_cvtps_epi32(_mm_add_ps(_mm_add_ps(red_scaled, green_scaled), blue_scaled));
+        _mm_storeu_si32(result + i, _mm_packus_epi16(_mm_packs_epi32(res, res), res));
     }
-    // remaining pixels
+    float a_f = a / (a + b + c);
+    float b_f = b / (a + b + c);
+    float c_f = c / (a + b + c);
     for (; i < size; i++) {
-        result[i] = (uint8_t)((image[i * 3] * a + image[(i * 3) + 1] * b + image[(i * 3) + 2] * c) / (a + b + c));
+        result[i] = (uint8_t)lrintf(image[i * 4 + red] * a_f + image[(i * 4) + 1] * b_f + image[i * 4 + blue] * c_f);
     }
+}
+
+void grayscale_simd_rgba_view(struct image_view image, float a, float b, float c, struct image_view result)
+{
+    __m128i mask = _mm_set_epi8(
+        15, 11, 7, 3, // alpha, ignored
+        14, 10, 6, 2, // blue
+        13, 9, 5, 1, // green
+        12, 8, 4, 0 // red
+    );
+    size_t rows, length = row_length(image, 4, result, &rows);
+    for (size_t y = 0; y < rows; y++)
+        grayscale_simd_4_row(view_row(image, y), length, a, b, c, mask, 0, 2, view_row(result, y));
+}
+
+void grayscale_simd_bgra_view(struct image_view image, float a, float b, float c, struct image_view result)
+{
+    __m128i mask = _mm_set_epi8(
+        15, 11, 7, 3, // alpha, ignored
+        12, 8, 4, 0, // blue
+        13, 9, 5, 1, // green
+        14, 10, 6, 2 // red
+    );
+    size_t rows, length = row_length(image, 4, result, &rows);
+    for (size_t y = 0; y < rows; y++)
+        grayscale_simd_4_row(view_row(image, y), length, a, b, c, mask, 2, 0, view_row(result, y));
+}
+
+struct image_view grayscale_simd_format_view(struct image_view image, enum pixel_format format, float a, float b, float c, struct image_view result)
+{
+    if (format == PIXEL_LUMA)
+        return image;
+    if (format == PIXEL_RGBA)
+        grayscale_simd_rgba_view(image, a, b, c, result);
+    else if (format == PIXEL_BGRA)
+        grayscale_simd_bgra_view(image, a, b, c, result);
+    else
+        grayscale_simd_view(image, a, b, c, result);
+    return result;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #ifndef GRAYSCALE_H
 #define GRAYSCALE_H
+#include "view.h"
 #include <stddef.h>
 #include <stdint.h>
 /**
@@ -15,6 +16,9 @@
  */
 void grayscale(const uint8_t* image, size_t width, size_t height, float a, float b, float c, uint8_t* result);
 
+// Does the same as grayscale() on strided views, the result view must have the size of the image view
+void grayscale_view(struct image_view image, float a, float b, float c, struct image_view result);
+
 /**
  * Does the same as grayscale()
  * Because of integer arithmetic it is faster but less accurate
@@ -28,6 +32,9 @@ void grayscale(const uint8_t* image, size_t width, size_t height, float a, float
  */
 void grayscale_integer(const uint8_t* image, size_t width, size_t height, float a, float b, float c, uint8_t* result);
 
+// Does the same as grayscale_integer() on strided views
+void grayscale_integer_view(struct image_view image, float a, float b, float c, struct image_view result);
+
 /**
  * Converts a RGB image to a grayscale image using simd instruction.
  * @param image: pointer to the RGB image (3 bytes per pixel)
@@ -40,4 +47,20 @@ void grayscale_integer(const uint8_t* image, size_t width, size_t height, float
  */
 void grayscale_simd(const uint8_t* image, size_t width, size_t height, float a, float b, float c, uint8_t* result);
 
+// Does the same as grayscale_simd() on strided views, row by row unless both views are packed
+void grayscale_simd_view(struct image_view image, float a, float b, float c, struct image_view result);
+
+/**
+ * Does the same as grayscale_simd_view() for images with 4 bytes per pixel in RGBA or BGRA order.
+ * The alpha channel is ignored, the result is the same as for the RGB pixels without alpha.
+ */
+void grayscale_simd_rgba_view(struct image_view image, float a, float b, float c, struct image_view result);
+void grayscale_simd_bgra_view(struct image_view image, float a, float b, float c, struct image_view result);
+
+/**
+ * Converts an image in the given format to grayscale with the matching SIMD kernel.
+ * Returns the view of the grayscale image: result, or image itself for PIXEL_LUMA, which is not converted or copied.
+ */
+struct image_view grayscale_simd_format_view(struct image_view image, enum pixel_format format, float a, float b, float c, struct image_view result);
+
 #endif
\ No newline at end of file
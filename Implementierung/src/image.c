@@ -1,9 +1,12 @@
 #define _XOPEN_SOURCE 700
 #include "image.h"
+#include "ascii.h"
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-#define READ_ERROR "Error reading image: not a valid netpbm format file!\nOnly 24bpp PPM is allowed as input format!"
+#define READ_ERROR "Error reading image: not a valid netpbm format file!\nOnly 24bpp PPM (P6 or P3) and 8bpp PGM (P5) are allowed as input format!"
 // function that prints an error message and exits the program
 int error(const char* message, FILE* file, int read)
 {
@@ -32,19 +35,20 @@ void skip(FILE* file)
     error("Unexpected end of file!", file, 1);
 }
 
-void read_image(const char* path, struct Netpbm* image)
+long read_image_header(const char* path, struct Netpbm* image)
 {
     FILE* input_image = fopen(path, "rb");
     if (!input_image)
         error("Could not open input file!", NULL, 1);
-    // check if the file is a valid 24bpp P6 PPM image
+    // check if the file is a valid 24bpp P6 or P3 PPM image or a 8bpp P5 PGM image
     struct stat statbuf;
     if (fstat(fileno(input_image), &statbuf) < 0 || !S_ISREG(statbuf.st_mode) || statbuf.st_size == 0)
         error("Invalid input file!", input_image, 1);
     skip(input_image);
-    if (fread(image->magicNumber, sizeof(char), 2, input_image) != 2 || image->magicNumber[0] != 'P' || image->magicNumber[1] != '6')
+    if (fread(image->magicNumber, sizeof(char), 2, input_image) != 2 || image->magicNumber[0] != 'P' || (image->magicNumber[1] != '6' && image->magicNumber[1] != '3' && image->magicNumber[1] != '5'))
         error(READ_ERROR, input_image, 1);
     image->magicNumber[2] = '\0';
+    image->format = image->magicNumber[1] == '5' ? PIXEL_LUMA : PIXEL_RGB;
     skip(input_image);
     if (fscanf(input_image, "%zu", &image->width) <= 0 || image->width == 0)
         error(READ_ERROR, input_image, 1);
@@ -55,11 +59,54 @@ void read_image(const char* path, struct Netpbm* image)
     if (fscanf(input_image, "%hu", &image->maxValue) <= 0 || image->maxValue > 255)
         error(READ_ERROR, input_image, 1);
     skip(input_image);
+    long offset = ftell(input_image);
+    // the header is valid, but the file must also be large enough to hold all pixels, ASCII pixels are checked while parsing
+    if (offset < 0 || (image->magicNumber[1] != '3' && (size_t)(statbuf.st_size - offset) < image->width * image->height * pixel_size(image->format)))
+        error(READ_ERROR, input_image, 1);
+    image->pixels = NULL;
+    fclose(input_image);
+    return offset;
+}
+
+// read the whole ASCII pixel data at once, surrounded by whitespace for the parser
+static void read_ascii_pixels(FILE* input_image, long offset, struct Netpbm* image)
+{
+    struct stat statbuf;
+    if (fstat(fileno(input_image), &statbuf) < 0)
+        error("Invalid input file!", input_image, 1);
+    size_t size = (size_t)(statbuf.st_size - offset);
+    char* text = malloc(size + 2 * ASCII_PADDING);
+    if (!text) {
+        free(image->pixels);
+        error("Could not allocate memory for image pixels!", input_image, 1);
+    }
+    memset(text, ' ', ASCII_PADDING);
+    memset(text + ASCII_PADDING + size, ' ', ASCII_PADDING);
+    if (fread(text + ASCII_PADDING, 1, size, input_image) != size
+        || parse_ascii_pixels(text + ASCII_PADDING, size, image->maxValue, image->pixels, image->width * image->height * 3)) {
+        free(text);
+        free(image->pixels);
+        error(READ_ERROR, input_image, 1);
+    }
+    free(text);
+    fclose(input_image);
+}
+
+void read_image(const char* path, struct Netpbm* image)
+{
+    long offset = read_image_header(path, image);
+    FILE* input_image = fopen(path, "rb");
+    if (!input_image || fseek(input_image, offset, SEEK_SET) != 0)
+        error("Could not open input file!", input_image, 1);
     // read the pixels into an array
-    size_t array_size = image->width * image->height * 3;
+    size_t array_size = image->width * image->height * pixel_size(image->format);
     image->pixels = malloc(array_size);
     if (!image->pixels)
         error("Could not allocate memory for image pixels!", input_image, 1);
+    if (image->magicNumber[1] == '3') {
+        read_ascii_pixels(input_image, offset, image);
+        return;
+    }
     if (fread(image->pixels, sizeof(uint8_t), array_size, input_image) != array_size) {
         free(image->pixels);
         error(READ_ERROR, input_image, 1);
@@ -68,6 +115,65 @@ void read_image(const char* path, struct Netpbm* image)
     fclose(input_image);
 }
 
+long read_raw_header(const char* path, enum raw_layout layout, size_t width, size_t height, struct Netpbm* image)
+{
+    FILE* input_image = fopen(path, "rb");
+    if (!input_image)
+        error("Could not open input file!", NULL, 1);
+    // the chroma planes of 4:2:0 frames are not read, but the file must contain them
+    size_t chroma_size = 2 * ((width + 1) / 2) * ((height + 1) / 2);
+    int yuv = layout == RAW_NV12 || layout == RAW_I420;
+    size_t file_size = yuv ? width * height + chroma_size : width * height * 4;
+    struct stat statbuf;
+    if (width == 0 || height == 0 || fstat(fileno(input_image), &statbuf) < 0 || !S_ISREG(statbuf.st_mode) || (size_t)statbuf.st_size < file_size)
+        error("Error reading image: the file is too small for the given size and input format!", input_image, 1);
+    fclose(input_image);
+
+    // raw frames have no magic number, the one of the grayscale output is used
+    memcpy(image->magicNumber, "P5", 3);
+    image->maxValue = 255;
+    image->width = width;
+    image->height = height;
+    image->format = yuv ? PIXEL_LUMA : layout == RAW_RGBA ? PIXEL_RGBA : PIXEL_BGRA;
+    image->pixels = NULL;
+    // the pixels of RGBA and BGRA frames and the Y plane start at the beginning of the file
+    return 0;
+}
+
+void read_raw_image(const char* path, enum raw_layout layout, size_t width, size_t height, struct Netpbm* image)
+{
+    read_raw_header(path, layout, width, height, image);
+    FILE* input_image = fopen(path, "rb");
+    if (!input_image)
+        error("Could not open input file!", NULL, 1);
+    size_t array_size = width * height * pixel_size(image->format);
+    image->pixels = malloc(array_size);
+    if (!image->pixels)
+        error("Could not allocate memory for image pixels!", input_image, 1);
+    if (fread(image->pixels, sizeof(uint8_t), array_size, input_image) != array_size) {
+        free(image->pixels);
+        error("Error reading image: the file is too small for the given size and input format!", input_image, 1);
+    }
+    fclose(input_image);
+}
+
+int read_image_rows(int fd, long offset, const struct Netpbm* image, size_t y0, size_t rows)
+{
+    size_t row_size = image->width * pixel_size(image->format);
+    uint8_t* dst = image->pixels + y0 * row_size;
+    size_t remaining = rows * row_size;
+    off_t pos = offset + (off_t)(y0 * row_size);
+    while (remaining > 0) {
+        ssize_t n = pread(fd, dst, remaining, pos);
+        if (n <= 0)
+            return EXIT_FAILURE;
+        dst += n;
+        pos += n;
+        remaining -= (size_t)n;
+    }
+    return EXIT_SUCCESS;
+}
+
 int write_image(const struct Netpbm* image, const char* outputPath)
 {
     FILE* output_image = fopen(outputPath, "wb");
@@ -1,6 +1,7 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include "view.h"
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -10,11 +11,36 @@ struct Netpbm {
     size_t width;
     size_t height;
     uint8_t* pixels;
+    enum pixel_format format; // layout of pixels, PIXEL_RGB for P6 and P3, PIXEL_LUMA for P5
 };
 
-// Read a PPM image from a file, exits the program on error
+// Layouts of input files without a header, the size has to be given
+enum raw_layout {
+    RAW_RGBA,
+    RAW_BGRA,
+    RAW_NV12, // Y plane followed by interleaved U and V at half the resolution
+    RAW_I420, // Y plane followed by the U plane and the V plane at half the resolution
+};
+
+// Read a PPM image (P6 or ASCII P3) or a PGM image (P5) from a file, exits the program on error
 void read_image(const char* imagePath, struct Netpbm* image);
 
+// Read a headerless frame from a file, exits the program on error
+// Only the Y plane of NV12 and I420 frames is read, it is used as the grayscale image without a conversion
+void read_raw_image(const char* imagePath, enum raw_layout layout, size_t width, size_t height, struct Netpbm* image);
+
+// Check the size of a headerless frame and fill in image like read_image_header(), exits the program on error
+// Returns the byte offset of the pixels that are read, always 0
+long read_raw_header(const char* imagePath, enum raw_layout layout, size_t width, size_t height, struct Netpbm* image);
+
+// Read only the header of a PPM image, exits the program on error
+// Returns the byte offset of the pixel data in the file, image->pixels is set to NULL
+long read_image_header(const char* imagePath, struct Netpbm* image);
+
+// Read the pixel rows [y0, y0 + rows) of a P6 or P5 image with pread() into image->pixels, returns 0 on success
+// Threads can load their own band of the image this way, so the pages are first touched by them
+int read_image_rows(int fd, long offset, const struct Netpbm* image, size_t y0, size_t rows);
+
 // Write a PGM image to a file, returns 0 on success
 int write_image(const struct Netpbm* image, const char* outputPath);
 
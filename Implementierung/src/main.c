@@ -1,20 +1,64 @@
 #define _POSIX_C_SOURCE 200809L
+#include "../src/bilateral.h"
+#include "../src/box.h"
+#include "../src/budget.h"
+#include "../src/cache.h"
+#include "../src/combine.h"
+#include "../src/deadline.h"
 #include "../src/denoise.h"
 #include "../src/image.h"
+#include "../src/grayscale.h"
+#include "../src/median.h"
+#include "../src/metrics.h"
+#include "../src/parallel.h"
+#include "../src/pyramid.h"
+#include "../src/tiled.h"
+#include "../src/trace.h"
+#include "../src/tune.h"
 #include "../tests/functional_tests.h"
 #include "../tests/performance_tests.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <time.h>
+#include <unistd.h>
 
 #define IS_DIGIT(c) ((c >= '0' && c <= '9') ? 1 : 0)
 
+// names of the headerless input formats for Option --input-format, in the order of enum raw_layout
+static const char* raw_layouts[] = { "rgba", "bgra", "nv12", "i420" };
+
 struct option long_options[] = {
     { "help", no_argument, NULL, 'h' },
     { "coeffs", required_argument, NULL, 'c' },
+    { "affinity", required_argument, NULL, 'a' },
+    { "numa-report", no_argument, NULL, 'n' },
+    { "out-of-core", required_argument, NULL, 'O' },
+    { "tune", no_argument, NULL, 'u' },
+    { "wisdom", required_argument, NULL, 'w' },
+    { "tile-rows", required_argument, NULL, 'r' },
+    { "input-format", required_argument, NULL, 'f' },
+    { "size", required_argument, NULL, 's' },
+    { "window", required_argument, NULL, 'W' },
+    { "sigma", required_argument, NULL, 'S' },
+    { "adaptive", no_argument, NULL, 'A' },
+    { "radius", required_argument, NULL, 'R' },
+    { "pyramid", required_argument, NULL, 'P' },
+    { "scale", required_argument, NULL, 'Z' },
+    { "cache", required_argument, NULL, 'C' },
+    { "cache-dir", required_argument, NULL, 'D' },
+    { "cache-disk", required_argument, NULL, 'K' },
+    { "trace", required_argument, NULL, 'X' },
+    { "mem-budget", required_argument, NULL, 'M' },
+    { "baseline", required_argument, NULL, 'L' },
+    { "save-baseline", required_argument, NULL, 'E' },
+    { "reference", required_argument, NULL, 'Q' },
+    { "deadline", required_argument, NULL, 'Y' },
     { NULL, 0, NULL, 0 }
 };
 
@@ -32,8 +76,8 @@ long parseX(char* optarg, char* option)
         printf("For more information, run the program with the --help option.\n");
         return -1;
     }
-    if (option[1] == 'V' && (x < 0 || x > 2)) {
-        fprintf(stderr, "Argument for option %s must be 0 or 1 or 2!\n", option);
+    if (option[1] == 'V' && (x < 0 || x > 5)) {
+        fprintf(stderr, "Argument for option %s must be between 0 and 5!\n", option);
         printf("For more information, run the program with the --help option.\n");
         return -1;
     }
@@ -42,9 +86,110 @@ long parseX(char* optarg, char* option)
         printf("For more information, run the program with the --help option.\n");
         return -1;
     }
+    if (option[1] == '-' && x < 1) {
+        fprintf(stderr, "Argument for option %s must be greater than 0!\n", option);
+        printf("For more information, run the program with the --help option.\n");
+        return -1;
+    }
+    if (option[1] == 'T' && (x < 1 || x > MAX_THREADS)) {
+        fprintf(stderr, "Argument for option %s must be between 1 and %d!\n", option, MAX_THREADS);
+        printf("For more information, run the program with the --help option.\n");
+        return -1;
+    }
     return x;
 }
 
+// With several inputs, the index of the input is inserted before the extension of the output path: output_0.pgm, output_1.pgm, ...
+void number_output_path(const char* output_path, int index, char* path, size_t size)
+{
+    const char* extension = strrchr(output_path, '.');
+    const char* slash = strrchr(output_path, '/');
+    if (!extension || (slash && extension < slash))
+        extension = output_path + strlen(output_path);
+    snprintf(path, size, "%.*s_%d%s", (int)(extension - output_path), output_path, index, extension);
+}
+
+// Key of the result of an image: its pixels and the parameters the result depends on
+// Parameters without an effect, like the number of threads without --adaptive, are left out, so such results are shared
+struct cache_key result_key(const struct Netpbm* image, int version, const float* coeff, size_t window, const float* sigma,
+    long radius, long levels, long scale, const struct parallel_config* parallel)
+{
+    struct {
+        int version;
+        int format;
+        size_t width;
+        size_t height;
+        float coeff[3];
+        size_t window;
+        float sigma[2];
+        long radius;
+        long levels;
+        long scale;
+        int adaptive;
+        size_t threads;
+        size_t tile_rows;
+    } params;
+    // the padding between the fields is hashed as well
+    memset(&params, 0, sizeof(params));
+    params.version = version;
+    params.format = image->format;
+    params.width = image->width;
+    params.height = image->height;
+    if (image->format != PIXEL_LUMA)
+        memcpy(params.coeff, coeff, sizeof(params.coeff));
+    if (version == 3 || version == 4)
+        params.window = window;
+    if (version == 4)
+        memcpy(params.sigma, sigma, sizeof(params.sigma));
+    if (version == 0) {
+        params.radius = radius;
+        params.levels = levels;
+        params.scale = scale;
+        // the strength is picked for every band or tile
+        params.adaptive = parallel->adaptive;
+        params.threads = parallel->adaptive ? parallel->threads : 0;
+        params.tile_rows = parallel->adaptive ? parallel->tile_rows : 0;
+    }
+    struct cache_key key;
+    cache_hash_simd((const uint8_t*)&params, sizeof(params), 0, &key);
+    cache_hash_simd(image->pixels, image->width * image->height * pixel_size(image->format), key.low ^ key.high, &key);
+    return key;
+}
+
+// Peak resident set size of the process so far, it includes the program itself and the allocations of earlier inputs
+void print_peak_memory()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        printf("Peak resident set size: %ld KiB\n", usage.ru_maxrss);
+}
+
+// Print the strategy picked for the memory budget and the bytes allocated for the stages
+void print_memory_plan(const struct memory_plan* plan, long budget)
+{
+    if (plan->strategy == MEMORY_FULL_FRAME)
+        printf("Memory budget of %ld MiB: the whole frame at once\n", budget);
+    else if (plan->strategy == MEMORY_STRIPS)
+        printf("Memory budget of %ld MiB: strips of %zu rows%s\n", budget, plan->strip_rows, plan->result_bytes ? "" : ", the result is written over the input");
+    else
+        printf("Memory budget of %ld MiB: tiles read from the file\n", budget);
+    printf("Bytes allocated: read %zu, grayscale and combine %zu, padding and convolution %zu, strips or tiles %zu, total %zu\n",
+        plan->input_bytes, plan->result_bytes, plan->padded_bytes, plan->strip_bytes, plan_bytes(plan));
+}
+
+// Print the quality of a result compared with the reference and the share of every error that occurs
+void print_metrics(const struct image_metrics* metrics, const char* reference_path, size_t size)
+{
+    printf("Compared with %s: PSNR %.2f dB, SSIM %.4f, mean error %.3f, max error %d\n", reference_path, metrics->psnr, metrics->ssim,
+        metrics->mean_error, metrics->max_error);
+    printf("Errors:");
+    for (size_t error = 0; error <= metrics->max_error; error++) {
+        if (metrics->histogram[error])
+            printf(" %zu: %.3f%%", error, (double)metrics->histogram[error] / (double)size * 100);
+    }
+    printf("\n");
+}
+
 void cleanup_end(int status, int argc, ...)
 {
     va_list args;
@@ -62,27 +207,444 @@ void cleanup_end(int status, int argc, ...)
     exit(status);
 }
 
+// Options of the command line that apply to every input
+struct options {
+    int version; // default choice of version is SIMD, can be changed with Option -V
+    int runtime; // measure the runtime, set with Option -B
+    int iterations; // repetitions of -B
+    float coeff[3]; // coefficients of the greyscale conversion, can be changed with Option --coeffs
+    struct parallel_config parallel; // can be changed with Option -T, --affinity, --tile-rows and --adaptive
+    int numa; // set with Option --numa-report
+    int explicit_config; // the wisdom is only used if -V, -T, --tile-rows and --adaptive are not set
+    const char* wisdom_path; // default wisdom file, can be changed with Option --wisdom
+    int raw_layout; // layout of a headerless input file, can be set with Option --input-format
+    size_t raw_width; // size of a headerless input file, can be set with Option --size
+    size_t raw_height;
+    size_t window; // window of the median and bilateral filter, can be changed with Option --window
+    float sigma[2]; // spatial and range sigma of the bilateral filter, can be changed with Option --sigma
+    long radius; // radius of the large blur of the SIMD version, can be set with Option --radius
+    long pyramid; // levels of the pyramid of the SIMD version, can be set with Option --pyramid
+    long scale; // factor the SIMD version reduces the result by, can be set with Option --scale
+    int caching; // results are cached with Option --cache or --cache-dir
+};
+
+// One input image, the configuration it is denoised with and its buffers, freed by free_frame()
+struct frame {
+    const char* input_path;
+    int version; // version and threads of the options or of the wisdom
+    struct parallel_config parallel;
+    struct memory_plan plan;
+    int in_place; // whether the strips may write the result over the input
+    struct Netpbm image;
+    long pixel_offset;
+    int threaded; // with more than one thread every worker loads its own band of the image, see first_touch_parallel()
+    int banded_read;
+    size_t result_width;
+    size_t result_height;
+    uint8_t* tmp1; // grayscale image of the median and bilateral filter, blurred image of --radius
+    uint8_t* tmp2;
+    uint8_t* result;
+    uint16_t* padded_image;
+    uint16_t* padded_laplace;
+    uint16_t* padded_blur;
+    uint8_t* scratch; // rows of the window, box filters, pyramid levels, strips or the grayscale bands and column sums of --scale, depending on the version
+};
+
+// State of --deadline across the frames, its buffers are allocated and touched once per frame size, so no page faults are measured
+struct deadline_run {
+    struct deadline_controller controller;
+    double milliseconds;
+    uint8_t* scratch;
+    uint16_t* padded[3];
+    size_t width;
+    size_t height;
+};
+
+void free_frame(struct frame* frame)
+{
+    free(frame->image.pixels);
+    free(frame->tmp1);
+    free(frame->tmp2);
+    free(frame->result);
+    free(frame->padded_image);
+    free(frame->padded_laplace);
+    free(frame->padded_blur);
+    free(frame->scratch);
+    *frame = (struct frame) { .input_path = frame->input_path };
+}
+
+void fail_frame(struct frame* frame)
+{
+    free_frame(frame);
+    cleanup_end(EXIT_FAILURE, 0);
+}
+
+// Seconds passed since start
+double seconds_since(const struct timespec* start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// Print the runtime of all iterations of -B started at start
+void print_runtime(const struct options* options, const struct timespec* start)
+{
+    if (!options->runtime)
+        return;
+    double time_taken = seconds_since(start);
+    printf("Time taken in total: %f second for %d iterations\n", time_taken, options->iterations);
+    printf("Time taken per iteration: %f second\n", time_taken / options->iterations);
+}
+
+// Allocate the three padded arrays of the SIMD versions with elements of the given size, zeroed if they need a zero border
+void alloc_padded(struct frame* frame, size_t padded_size, size_t element_size, int zeroed)
+{
+    for (int i = 0; i < 3; i++) {
+        void* buffer = zeroed ? calloc(padded_size, element_size) : malloc(padded_size * element_size);
+        *(i == 0 ? &frame->padded_image : i == 1 ? &frame->padded_laplace : &frame->padded_blur) = buffer;
+    }
+    if (!frame->padded_image || !frame->padded_laplace || !frame->padded_blur)
+        fail_frame(frame);
+}
+
+/**
+ * Read the header of the input, pick the configuration of the wisdom, load the pixels and allocate the result and the
+ * temporary images of the version. Exits the program on error.
+ */
+void load_frame(const struct options* options, struct frame* frame)
+{
+    // avoid dynamic memory on the heap to use exit() directly in read_image() if an error occurs
+    struct Netpbm* image = &frame->image;
+    if (options->raw_layout != -1)
+        frame->pixel_offset = read_raw_header(frame->input_path, options->raw_layout, options->raw_width, options->raw_height, image);
+    else
+        frame->pixel_offset = read_image_header(frame->input_path, image);
+    if (image->format != PIXEL_RGB && (frame->version == 1 || frame->version == 2)) {
+        fprintf(stderr, "Only RGB input (P6 or P3) is supported by the SISD versions!\n");
+        printf("For more information, run the program with the --help option.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // without an explicit configuration the fastest one measured by --tune for the closest size class is used
+    // the configurations are measured with RGB input, which is the only input of the SISD versions
+    struct wisdom wisdom;
+    if (!options->explicit_config && image->format == PIXEL_RGB && load_wisdom(options->wisdom_path, &wisdom) == 0) {
+        const struct wisdom_entry* entry = lookup_wisdom(&wisdom, image->width, image->height);
+        frame->version = entry->version;
+        if (frame->version == 0) {
+            frame->parallel.threads = entry->threads;
+            frame->parallel.tile_rows = entry->tile_rows;
+        } else if (frame->parallel.cpu_count > 0) {
+            fprintf(stderr, "Option --affinity is ignored, %s picks the SISD version %d for the image %s!\n", options->wisdom_path, frame->version,
+                frame->input_path);
+        }
+        printf("Using the configuration of %s for the size class %zux%zu\n", options->wisdom_path, entry->width, entry->height);
+    }
+
+    frame->threaded = frame->version == 0 && (frame->parallel.threads > 1 || frame->parallel.cpu_count > 0);
+    if (image->format == PIXEL_LUMA)
+        printf("The input image is already grayscale, it is denoised without a conversion\n");
+    else
+        printf("Using coefficients %f, %f, %f while converting to grayscale\n", options->coeff[0], options->coeff[1], options->coeff[2]);
+
+    // binary pixels are loaded band by band by the workers, ASCII pixels are parsed up front
+    // with a cache the whole image is hashed before denoising, so it is loaded up front as well
+    // only the workers of the whole frame load bands, the strips read the loaded image
+    frame->banded_read = frame->threaded && frame->plan.strategy == MEMORY_FULL_FRAME && image->magicNumber[1] != '3' && !options->caching;
+    if (frame->banded_read) {
+        // not touched here, the pages are placed by the workers
+        image->pixels = malloc(image->width * image->height * pixel_size(image->format));
+        if (!image->pixels) {
+            fprintf(stderr, "Could not allocate memory for image pixels!\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (options->raw_layout != -1) {
+        TRACE_BEGIN("read");
+        read_raw_image(frame->input_path, options->raw_layout, options->raw_width, options->raw_height, image);
+        TRACE_END("read");
+    } else {
+        TRACE_BEGIN("read");
+        read_image(frame->input_path, image);
+        TRACE_END("read");
+    }
+
+    // allocation of temporary image arrays, only for the versions that use them
+    int strips_in_place = frame->plan.strategy == MEMORY_STRIPS && frame->in_place;
+    int version = frame->version;
+    int need_tmp1 = (version != 0 && version != 5) || options->radius, need_tmp2 = version == 1 || version == 2;
+    frame->tmp1 = need_tmp1 ? malloc(image->width * image->height * sizeof(uint8_t)) : NULL;
+    frame->tmp2 = need_tmp2 ? malloc(image->width * image->height * sizeof(uint8_t)) : NULL;
+    // with --scale only the reduced result is allocated and written
+    frame->result_width = options->scale ? DOWNSCALED_SIZE(image->width, (size_t)options->scale) : image->width;
+    frame->result_height = options->scale ? DOWNSCALED_SIZE(image->height, (size_t)options->scale) : image->height;
+    frame->result = strips_in_place ? NULL : malloc(frame->result_width * frame->result_height * sizeof(uint8_t));
+    if ((need_tmp1 && !frame->tmp1) || (need_tmp2 && !frame->tmp2) || (!strips_in_place && !frame->result))
+        fail_frame(frame);
+}
+
+// Denoise a loaded frame with the level picked by the controller and measure the time it took
+void denoise_deadline_frame(struct deadline_run* run, const struct options* options, struct frame* frame)
+{
+    const struct Netpbm* image = &frame->image;
+    const float* coeff = options->coeff;
+    size_t pixels = image->width * image->height;
+    size_t padded_size = (image->width + 2) * (image->height + 2);
+    if (image->width != run->width || image->height != run->height) {
+        // the padded arrays of another size would have pixels in the border
+        free(run->scratch);
+        for (int i = 0; i < 3; i++)
+            free(run->padded[i]);
+        size_t scratch_size = 2 * pixels;
+        if (HALF_SCRATCH_SIZE(image->width, image->height) > scratch_size)
+            scratch_size = HALF_SCRATCH_SIZE(image->width, image->height);
+        if (BLUR_SCRATCH_SIZE(image->width, image->height) > scratch_size)
+            scratch_size = BLUR_SCRATCH_SIZE(image->width, image->height);
+        run->scratch = malloc(scratch_size);
+        for (int i = 0; i < 3; i++)
+            run->padded[i] = calloc(padded_size, sizeof(uint16_t));
+        if (!run->scratch || !run->padded[0] || !run->padded[1] || !run->padded[2]) {
+            free(run->scratch);
+            for (int i = 0; i < 3; i++)
+                free(run->padded[i]);
+            fail_frame(frame);
+        }
+        memset(run->scratch, 0, scratch_size);
+        for (int i = 0; i < 3; i++)
+            memset(run->padded[i], 0, padded_size * sizeof(uint16_t));
+        run->width = image->width;
+        run->height = image->height;
+    }
+    memset(frame->result, 0, pixels);
+
+    // the SISD versions only take RGB input
+    deadline_pick(&run->controller, pixels, image->format == PIXEL_RGB ? DEADLINE_ACCURATE : DEADLINE_SIMD, stdout);
+    enum deadline_level level = run->controller.level;
+    printf("Denoising the image %s using %s with a budget of %.2f ms...\n", frame->input_path, deadline_level_name(level), run->milliseconds);
+    // only the denoising is measured, reading and writing the frames is not part of the budget
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (level == DEADLINE_ACCURATE || level == DEADLINE_INTEGER) {
+        void (*denoise_sisd)(const uint8_t*, size_t, size_t, float, float, float, uint8_t*, uint8_t*, uint8_t*) = level == DEADLINE_ACCURATE ? denoise : denoise_integer;
+        denoise_sisd(image->pixels, image->width, image->height, coeff[0], coeff[1], coeff[2], run->scratch, run->scratch + pixels, frame->result);
+    } else if (level == DEADLINE_SIMD) {
+        denoise_simd_format_view(packed_view(image->pixels, image->width, image->height, pixel_size(image->format)), image->format, coeff[0], coeff[1], coeff[2],
+            run->padded[0], run->padded[1], run->padded[2], packed_view(frame->result, image->width, image->height, 1));
+    } else if (level == DEADLINE_HALF) {
+        denoise_half_resolution(image->pixels, image->format, image->width, image->height, coeff[0], coeff[1], coeff[2], run->scratch, frame->result);
+    } else {
+        denoise_blur(image->pixels, image->format, image->width, image->height, coeff[0], coeff[1], coeff[2], run->scratch, frame->result);
+    }
+    double time_taken = seconds_since(&start);
+    deadline_update(&run->controller, pixels, time_taken);
+    printf("Time taken: %.3f ms with %s\n", time_taken * 1e3, deadline_level_name(level));
+}
+
+// Denoise a loaded frame with the version and options picked for it, once or -B times
+void denoise_frame(const struct options* options, struct frame* frame)
+{
+    struct Netpbm* image = &frame->image;
+    const float* coeff = options->coeff;
+    const char* input_path = frame->input_path;
+    int version = frame->version;
+    size_t window = options->window;
+    struct timespec start;
+    if (version == 1 || version == 2) {
+        void (*denoise_sisd)(const uint8_t*, size_t, size_t, float, float, float, uint8_t*, uint8_t*, uint8_t*);
+        if (version == 1) {
+            denoise_sisd = denoise_integer;
+            printf("Denoising the image %s using integer version of SISD...\n", input_path);
+        } else {
+            denoise_sisd = denoise;
+            printf("Denoising the image %s using accurate version of SISD...\n", input_path);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < options->iterations; i++)
+            denoise_sisd(image->pixels, image->width, image->height, coeff[0], coeff[1], coeff[2], frame->tmp1, frame->tmp2, frame->result);
+        print_runtime(options, &start);
+    } else if (version == 3 || version == 4) {
+        struct bilateral_weights weights;
+        if (version == 3) {
+            printf("Denoising the image %s using median filter with a %zux%zu window...\n", input_path, window, window);
+        } else {
+            // the tables are computed once, not in every iteration
+            bilateral_weights(&weights, window, options->sigma[0], options->sigma[1]);
+            printf("Denoising the image %s using bilateral filter with a %zux%zu window and sigmas %f, %f...\n", input_path, window, window,
+                options->sigma[0], options->sigma[1]);
+        }
+        // the scratch buffer holds the rows of the window
+        frame->scratch = malloc(version == 3 ? MEDIAN_SCRATCH_SIZE(image->width, window) : BILATERAL_SCRATCH_SIZE(image->width, window));
+        if (!frame->scratch)
+            fail_frame(frame);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < options->iterations; i++) {
+            if (version == 3)
+                denoise_median(image->pixels, image->format, image->width, image->height, coeff[0], coeff[1], coeff[2], window, frame->tmp1, frame->scratch,
+                    frame->result);
+            else
+                denoise_bilateral(image->pixels, image->format, image->width, image->height, coeff[0], coeff[1], coeff[2], &weights, frame->tmp1,
+                    frame->scratch, frame->result);
+        }
+        print_runtime(options, &start);
+    } else if (version == 5) {
+        printf("Denoising the image %s using SIMD with 8 bit pixels...\n", input_path);
+        // the padded arrays have 8 bit pixels, they are kept in the 16 bit pointers of the frame
+        size_t padded_size = (image->width + 2) * (image->height + 2);
+        frame->padded_image = calloc(padded_size, sizeof(uint8_t));
+        frame->padded_laplace = malloc(padded_size * sizeof(uint8_t));
+        frame->padded_blur = malloc(padded_size * sizeof(uint8_t));
+        if (!frame->padded_image || !frame->padded_laplace || !frame->padded_blur)
+            fail_frame(frame);
+        struct image_view input = packed_view(image->pixels, image->width, image->height, pixel_size(image->format));
+        struct image_view output = packed_view(frame->result, image->width, image->height, 1);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < options->iterations; i++)
+            denoise_simd_8bit_view(input, image->format, coeff[0], coeff[1], coeff[2], (uint8_t*)frame->padded_image, (uint8_t*)frame->padded_laplace,
+                (uint8_t*)frame->padded_blur, output);
+        print_runtime(options, &start);
+    } else if (options->radius) {
+        // the gaussian reaches about radius pixels
+        size_t radii[BOX_PASSES];
+        gaussian_boxes((float)options->radius / 3, radii);
+        printf("Denoising the image %s using SIMD with a blur of radius %ld, box filters of radius %zu, %zu and %zu...\n", input_path, options->radius,
+            radii[0], radii[1], radii[2]);
+        alloc_padded(frame, (image->width + 2) * (image->height + 2), sizeof(uint16_t), 1);
+        frame->scratch = malloc(BOX_SCRATCH_SIZE(image->width, image->height));
+        if (!frame->scratch)
+            fail_frame(frame);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < options->iterations; i++)
+            denoise_box(image->pixels, image->format, image->width, image->height, coeff[0], coeff[1], coeff[2], radii, frame->tmp1, frame->scratch,
+                frame->padded_image, frame->padded_laplace, frame->padded_blur, frame->result);
+        print_runtime(options, &start);
+    } else if (options->pyramid) {
+        size_t levels = (size_t)options->pyramid;
+        printf("Denoising the image %s using SIMD on a pyramid of %zu levels...\n", input_path, pyramid_levels(image->width, image->height, levels));
+        alloc_padded(frame, (image->width + 2) * (image->height + 2), sizeof(uint16_t), 0);
+        frame->scratch = malloc(pyramid_scratch_size(image->width, image->height, levels));
+        if (!frame->scratch)
+            fail_frame(frame);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < options->iterations; i++)
+            denoise_pyramid(image->pixels, image->format, image->width, image->height, coeff[0], coeff[1], coeff[2], levels, frame->scratch,
+                frame->padded_image, frame->padded_laplace, frame->padded_blur, frame->result);
+        print_runtime(options, &start);
+    } else if (options->scale) {
+        size_t scale = (size_t)options->scale;
+        printf("Denoising the image %s using SIMD reduced to 1/%zu of its size...\n", input_path, scale);
+        // the padded laplace and blur only hold a band, the grayscale and padded image two,
+        // the scratch holds the grayscale bands followed by the column sums
+        size_t padded_size = DOWNSCALE_PADDED_SIZE(image->width, scale), gray_size = DOWNSCALE_GRAY_SIZE(image->width, scale);
+        frame->padded_image = malloc(DOWNSCALE_PADDED_IMAGE_SIZE(image->width, scale) * sizeof(uint16_t));
+        frame->padded_laplace = malloc(padded_size * sizeof(uint16_t));
+        frame->padded_blur = malloc(padded_size * sizeof(uint16_t));
+        frame->scratch = malloc(gray_size + image->width * sizeof(uint16_t));
+        if (!frame->padded_image || !frame->padded_laplace || !frame->padded_blur || !frame->scratch)
+            fail_frame(frame);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < options->iterations; i++)
+            denoise_simd_downscale(image->pixels, image->format, image->width, image->height, coeff[0], coeff[1], coeff[2], scale, frame->scratch,
+                frame->padded_image, frame->padded_laplace, frame->padded_blur, (uint16_t*)(frame->scratch + gray_size), frame->result);
+        print_runtime(options, &start);
+    } else if (frame->plan.strategy == MEMORY_STRIPS) {
+        printf("Denoising the image %s using SIMD in strips of %zu rows...\n", input_path, frame->plan.strip_rows);
+        frame->scratch = malloc(frame->plan.strip_bytes);
+        if (!frame->scratch)
+            fail_frame(frame);
+        int strips_in_place = frame->result == NULL;
+        uint8_t* strips_result = strips_in_place ? image->pixels : frame->result;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < options->iterations; i++)
+            denoise_simd_strips(image->pixels, image->format, image->width, image->height, coeff[0], coeff[1], coeff[2], frame->plan.strip_rows,
+                frame->scratch, strips_result);
+        print_runtime(options, &start);
+        // the result is the front of the input buffer, which is written instead of being freed
+        if (strips_in_place) {
+            frame->result = image->pixels;
+            image->pixels = NULL;
+        }
+    } else {
+        const struct parallel_config* parallel = &frame->parallel;
+        size_t padded_size = (image->width + 2) * (image->height + 2);
+        if (frame->threaded || parallel->tile_rows > 0)
+            printf("Denoising the image %s using SIMD with %zu threads and tiles of %zu rows%s...\n", input_path, parallel->threads, parallel->tile_rows,
+                parallel->adaptive ? " and adaptive strength per tile" : "");
+        else
+            printf("Denoising the image %s using SIMD%s...\n", input_path, parallel->adaptive ? " with adaptive strength" : "");
+        // the buffers of the workers are zeroed by first_touch_parallel()
+        alloc_padded(frame, padded_size, sizeof(uint16_t), !frame->threaded);
+
+        if (frame->threaded) {
+            int fd = frame->banded_read ? open(input_path, O_RDONLY) : -1;
+            if ((frame->banded_read && fd < 0)
+                || first_touch_parallel(parallel, fd, frame->pixel_offset, image, frame->padded_image, frame->padded_laplace, frame->padded_blur, frame->result)) {
+                fprintf(stderr, "Could not read input file!\n");
+                if (fd >= 0)
+                    close(fd);
+                fail_frame(frame);
+            }
+            close(fd);
+        }
+
+        struct image_view input = packed_view(image->pixels, image->width, image->height, pixel_size(image->format));
+        struct image_view output = packed_view(frame->result, image->width, image->height, 1);
+        int failed = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < options->iterations; i++)
+            failed |= denoise_simd_parallel_view(parallel, input, image->format, coeff[0], coeff[1], coeff[2], frame->padded_image, frame->padded_laplace,
+                frame->padded_blur, output);
+        print_runtime(options, &start);
+        if (failed)
+            fail_frame(frame);
+
+        if (options->numa) {
+            size_t size = image->width * image->height;
+            numa_report("Input image", image->pixels, size * pixel_size(image->format));
+            numa_report("Result", frame->result, size);
+            numa_report("Padded image", frame->padded_image, padded_size * sizeof(uint16_t));
+            numa_report("Padded laplace", frame->padded_laplace, padded_size * sizeof(uint16_t));
+            numa_report("Padded blur", frame->padded_blur, padded_size * sizeof(uint16_t));
+        }
+    }
+}
+
 int main(int argc, char* argv[])
 {
-    int v_opt = 0; // default choice of version is SIMD, can be changed with Option -V
-    int b_opt = 1;
-    int runtime = 0;
-    char* input_path = NULL;
+    struct options options = {
+        .iterations = 1,
+        .coeff = { 0.2126, 0.7152, 0.0722 },
+        .parallel = { .threads = 1, .cpu_count = 0 },
+        .wisdom_path = "denoise.wisdom",
+        .raw_layout = -1,
+        .window = 3,
+        .sigma = { 1.5, 20 },
+    };
     char* output_path = "output.pgm"; // default output path, can be changed with Option -o
-    float coeff[3] = { 0.2126, 0.7152, 0.0722 }; // default choice of coefficients for greyscale conversion, can be changed with Option --coeffs
-    void (*denoise_sisd)(const uint8_t*, size_t, size_t, float, float, float, uint8_t*, uint8_t*, uint8_t*) = NULL;
+    long budget = 0; // memory budget in MiB for the out-of-core mode, can be set with Option --out-of-core
+    int tune_opt = 0;
+    long cache_memory = 0; // MiB of results kept in memory, can be set with Option --cache
+    char* cache_dir = NULL; // directory of the results kept on disk, can be set with Option --cache-dir
+    long cache_disk = 1024; // MiB of results kept on disk, can be changed with Option --cache-disk
+    char* trace_path = NULL; // file of the trace events, can be set with Option --trace
+    long mem_budget = 0; // MiB all buffers of an image have to fit into, can be set with Option --mem-budget
+    int test_opt = 0;
+    char* baseline_path = NULL; // benchmark results -t compares with, can be set with Option --baseline
+    char* save_baseline_path = NULL; // file -t writes the benchmark results to, can be set with Option --save-baseline
+    char* reference_path = NULL; // clean image the results are compared with, can be set with Option --reference
+    double deadline = 0; // milliseconds per frame of the real-time mode, can be set with Option --deadline
 
     int opt;
     int option_index = 0;
-    while ((opt = getopt_long(argc, argv, "V:B::c:o:th", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "V:B::c:o:T:th", long_options, &option_index)) != -1) {
         switch (opt) {
         case 'V':
-            v_opt = parseX(optarg, "-V");
-            if (v_opt == -1)
+            options.version = parseX(optarg, "-V");
+            if (options.version == -1)
                 return EXIT_FAILURE;
+            options.explicit_config = 1;
             break;
         case 'B':
-            runtime = 1;
+            options.runtime = 1;
             if (optarg == NULL) {
                 if (optind < argc && IS_DIGIT(argv[optind][0])) {
                     optarg = argv[optind++];
@@ -90,25 +652,186 @@ int main(int argc, char* argv[])
                     break;
                 }
             }
-            b_opt = parseX(optarg, "-B");
-            if (b_opt == -1)
+            options.iterations = parseX(optarg, "-B");
+            if (options.iterations == -1)
+                return EXIT_FAILURE;
+            break;
+        case 'T':
+            options.parallel.threads = parseX(optarg, "-T");
+            if (options.parallel.threads == (size_t)-1)
                 return EXIT_FAILURE;
+            options.explicit_config = 1;
+            break;
+        case 'a':
+            if (optarg == NULL || parse_affinity(optarg, &options.parallel)) {
+                fprintf(stderr, "Could not parse argument for option --affinity!\n");
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            options.numa = 1;
+            break;
+        case 'O':
+            budget = parseX(optarg, "--out-of-core");
+            if (budget == -1)
+                return EXIT_FAILURE;
+            break;
+        case 'u':
+            tune_opt = 1;
+            break;
+        case 'w':
+            if (optarg != NULL)
+                options.wisdom_path = optarg;
+            break;
+        case 'r': {
+            long tile_rows = parseX(optarg, "--tile-rows");
+            if (tile_rows == -1)
+                return EXIT_FAILURE;
+            options.parallel.tile_rows = (size_t)tile_rows;
+            options.explicit_config = 1;
+            break;
+        }
+        case 'f':
+            for (int i = 0; optarg != NULL && i < (int)(sizeof(raw_layouts) / sizeof(raw_layouts[0])); i++) {
+                if (strcmp(optarg, raw_layouts[i]) == 0)
+                    options.raw_layout = i;
+            }
+            if (options.raw_layout == -1) {
+                fprintf(stderr, "Argument for option --input-format must be rgba, bgra, nv12 or i420!\n");
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            if (optarg == NULL || sscanf(optarg, "%zux%zu", &options.raw_width, &options.raw_height) != 2 || options.raw_width == 0 || options.raw_height == 0) {
+                fprintf(stderr, "Could not parse argument for option --size!\n");
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'W':
+            if (optarg == NULL || (strcmp(optarg, "3") != 0 && strcmp(optarg, "5") != 0)) {
+                fprintf(stderr, "Argument for option --window must be 3 or 5!\n");
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            options.window = (size_t)(optarg[0] - '0');
+            break;
+        case 'A':
+            options.parallel.adaptive = 1;
+            options.explicit_config = 1;
+            break;
+        case 'R':
+            options.radius = parseX(optarg, "--radius");
+            if (options.radius == -1)
+                return EXIT_FAILURE;
+            if (options.radius < 3 || options.radius > 300) {
+                fprintf(stderr, "Argument for option --radius must be between 3 and 300!\n");
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            options.explicit_config = 1;
+            break;
+        case 'P':
+            options.pyramid = parseX(optarg, "--pyramid");
+            if (options.pyramid == -1)
+                return EXIT_FAILURE;
+            if (options.pyramid < 2 || options.pyramid > PYRAMID_MAX_LEVELS) {
+                fprintf(stderr, "Argument for option --pyramid must be between 2 and %d!\n", PYRAMID_MAX_LEVELS);
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            options.explicit_config = 1;
+            break;
+        case 'Z':
+            // 1/4 and 4 both reduce the result to a quarter of its width and height
+            options.scale = parseX(optarg != NULL && strncmp(optarg, "1/", 2) == 0 ? optarg + 2 : optarg, "--scale");
+            if (options.scale == -1)
+                return EXIT_FAILURE;
+            if (options.scale < 2 || options.scale > DOWNSCALE_MAX_FACTOR) {
+                fprintf(stderr, "Argument for option --scale must be between 1/2 and 1/%d!\n", DOWNSCALE_MAX_FACTOR);
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            options.explicit_config = 1;
+            break;
+        case 'C':
+            cache_memory = parseX(optarg, "--cache");
+            if (cache_memory == -1)
+                return EXIT_FAILURE;
+            break;
+        case 'D':
+            if (optarg != NULL)
+                cache_dir = optarg;
+            break;
+        case 'K':
+            cache_disk = parseX(optarg, "--cache-disk");
+            if (cache_disk == -1)
+                return EXIT_FAILURE;
+            break;
+        case 'M':
+            mem_budget = parseX(optarg, "--mem-budget");
+            if (mem_budget == -1)
+                return EXIT_FAILURE;
+            // the strategies are only planned for the SIMD version, so the wisdom can't pick another one
+            options.explicit_config = 1;
+            break;
+        case 'X':
+            if (optarg != NULL)
+                trace_path = optarg;
+            break;
+        case 'S':
+            if (optarg == NULL || sscanf(optarg, "%f,%f", &options.sigma[0], &options.sigma[1]) != 2 || !(options.sigma[0] > 0) || !(options.sigma[1] > 0)) {
+                fprintf(stderr, "Could not parse argument for option --sigma!\n");
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
             break;
         case 'o':
             if (optarg != NULL)
                 output_path = optarg;
             break;
         case 'c':
-            if (optarg == NULL || sscanf(optarg, "%f,%f,%f", &coeff[0], &coeff[1], &coeff[2]) != 3) {
+            if (optarg == NULL || sscanf(optarg, "%f,%f,%f", &options.coeff[0], &options.coeff[1], &options.coeff[2]) != 3) {
                 fprintf(stderr, "Could not parse argument for option --coeffs!\n");
                 printf("For more information, run the program with the --help option.\n");
                 return EXIT_FAILURE;
             }
             break;
+        case 'L':
+            if (optarg != NULL)
+                baseline_path = optarg;
+            break;
+        case 'E':
+            if (optarg != NULL)
+                save_baseline_path = optarg;
+            break;
+        case 'Q':
+            if (optarg != NULL)
+                reference_path = optarg;
+            break;
+        case 'Y': {
+            if (optarg == NULL) {
+                fprintf(stderr, "Could not parse argument for option --deadline!\n");
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            errno = 0;
+            char* endptr = optarg;
+            deadline = strtod(optarg, &endptr);
+            if (errno != 0 || endptr == optarg || *endptr != '\0' || !(deadline > 0)) {
+                fprintf(stderr, "Argument for option --deadline must be a positive number of milliseconds!\n");
+                printf("For more information, run the program with the --help option.\n");
+                return EXIT_FAILURE;
+            }
+            // the version is picked for every frame by the measured times
+            options.explicit_config = 1;
+            break;
+        }
         case 't':
-            if (run_all_func_tests() + run_all_perf_tests())
-                exit(EXIT_FAILURE);
-            exit(EXIT_SUCCESS);
+            test_opt = 1;
+            break;
         case 'h':
         case '?': {
             FILE* file = fopen("help.txt", "r");
@@ -125,80 +848,231 @@ int main(int argc, char* argv[])
         }
         }
     }
-    if (optind < argc) {
-        input_path = argv[optind];
-    } else {
+    if (test_opt) {
+        // with a baseline, the sampled benchmarks replace the percentages of the performance tests
+        int failed = run_all_func_tests();
+        if (baseline_path || save_baseline_path)
+            failed += run_benchmarks(save_baseline_path, baseline_path);
+        else
+            failed += run_all_perf_tests();
+        exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    if (tune_opt) {
+        printf("Measuring the configurations for every size class...\n");
+        exit(tune(options.wisdom_path, &options.parallel));
+    }
+    if (optind >= argc) {
         fprintf(stderr, "No input file specified!\n");
         printf("For more information, run the program with the --help option.\n");
         return EXIT_FAILURE;
     }
-    printf("Using coefficients %f, %f, %f while converting to grayscale\n", coeff[0], coeff[1], coeff[2]);
+    if (options.version != 0 && (options.parallel.threads > 1 || options.parallel.cpu_count > 0 || options.parallel.tile_rows > 0 || options.parallel.adaptive || budget)) {
+        fprintf(stderr, "Options -T, --affinity, --tile-rows, --adaptive and --out-of-core are only supported by the SIMD version!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.radius && (options.version != 0 || options.parallel.threads > 1 || options.parallel.cpu_count > 0 || options.parallel.tile_rows > 0 || options.parallel.adaptive || budget)) {
+        fprintf(stderr, "Option --radius is only supported by the SIMD version without -T, --affinity, --tile-rows, --adaptive and --out-of-core!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.pyramid && (options.version != 0 || options.parallel.threads > 1 || options.parallel.cpu_count > 0 || options.parallel.tile_rows > 0 || options.parallel.adaptive || budget || options.radius)) {
+        fprintf(stderr, "Option --pyramid is only supported by the SIMD version without -T, --affinity, --tile-rows, --adaptive, --radius and --out-of-core!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.scale && (options.version != 0 || options.parallel.threads > 1 || options.parallel.cpu_count > 0 || options.parallel.tile_rows > 0 || options.parallel.adaptive || budget || options.radius || options.pyramid)) {
+        fprintf(stderr, "Option --scale is only supported by the SIMD version without -T, --affinity, --tile-rows, --adaptive, --radius, --pyramid and --out-of-core!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.parallel.adaptive && budget) {
+        fprintf(stderr, "Option --adaptive is not supported in the out-of-core mode!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.raw_layout != -1 && (options.raw_width == 0 || budget)) {
+        fprintf(stderr, "Option --input-format requires --size and is not supported in the out-of-core mode!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    options.caching = cache_memory > 0 || cache_dir != NULL;
+    if (mem_budget && (options.version != 0 || options.radius || options.pyramid || options.scale || options.parallel.adaptive || budget || options.caching)) {
+        fprintf(stderr, "Option --mem-budget is only supported by the SIMD version without --radius, --pyramid, --scale, --adaptive, --out-of-core and the cache!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    if (reference_path && (budget || mem_budget)) {
+        fprintf(stderr, "Option --reference is not supported with --out-of-core and --mem-budget!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    if (deadline && (options.version != 0 || options.runtime || options.parallel.threads > 1 || options.parallel.cpu_count > 0 || options.parallel.tile_rows > 0 || options.parallel.adaptive || options.radius || options.pyramid || options.scale || budget || mem_budget || options.caching)) {
+        fprintf(stderr, "Option --deadline picks the version itself and is not supported with -V, -B, -T, --affinity, --tile-rows, --adaptive, --radius, --pyramid, --scale, --out-of-core, --mem-budget and the cache!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.caching && budget) {
+        fprintf(stderr, "Options --cache and --cache-dir are not supported in the out-of-core mode!\n");
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
+    struct result_cache cache;
+    if (options.caching && cache_open(&cache, (size_t)cache_memory << 20, cache_dir, (size_t)cache_disk << 20) != 0) {
+        fprintf(stderr, "Could not create or read the cache directory %s!\n", cache_dir);
+        printf("For more information, run the program with the --help option.\n");
+        return EXIT_FAILURE;
+    }
 
-    // avoid dynamic memory on the heap to use exit() directly in read_image() if an error occurs
-    struct Netpbm image;
-    read_image(input_path, &image);
-
-    // allocation of temporary image arrays
-    uint8_t* tmp1 = malloc(image.width * image.height * sizeof(uint8_t));
-    uint8_t* tmp2 = malloc(image.width * image.height * sizeof(uint8_t));
-    uint8_t* result_pixels = malloc(image.width * image.height * sizeof(uint8_t));
-    if (!tmp1 || !tmp2 || !result_pixels)
-        cleanup_end(EXIT_FAILURE, 3, tmp1, tmp2, result_pixels);
-    uint16_t* padded_image = NULL;
-    uint16_t* padded_laplace = NULL;
-    uint16_t* padded_blur = NULL;
-
-    if (v_opt == 1 || v_opt == 2) {
-        if (v_opt == 1) {
-            denoise_sisd = denoise_integer;
-            printf("Denoising the image %s using integer version of SISD...\n", input_path);
-        } else {
-            denoise_sisd = denoise;
-            printf("Denoising the image %s using accurate version of SISD...\n", input_path);
+    // the reference is converted to grayscale with the same coefficients as the inputs
+    struct Netpbm reference = { .pixels = NULL };
+    uint8_t* metrics_scratch = NULL;
+    if (reference_path) {
+        read_image(reference_path, &reference);
+        if (reference.format != PIXEL_LUMA) {
+            grayscale_simd_format_view(packed_view(reference.pixels, reference.width, reference.height, pixel_size(reference.format)), reference.format,
+                options.coeff[0], options.coeff[1], options.coeff[2], packed_view(reference.pixels, reference.width, reference.height, 1));
+        }
+        metrics_scratch = malloc(METRICS_SCRATCH_SIZE(reference.width));
+        if (!metrics_scratch)
+            cleanup_end(EXIT_FAILURE, 1, reference.pixels);
+    }
+
+    // started before the first input is read, so the workers of all runs record their stages
+    if (trace_path)
+        trace_start();
+
+    // the level of every frame of --deadline is picked from the times of the frames before it
+    struct deadline_run deadline_run = { .milliseconds = deadline };
+    if (deadline)
+        deadline_init(&deadline_run.controller, deadline * 1e-3);
+
+    // the wisdom may pick a different configuration for every input
+    int input_count = argc - optind;
+    for (int n = 0; n < input_count; n++) {
+        struct frame frame = { .input_path = argv[optind + n], .version = options.version, .parallel = options.parallel };
+        const char* input_path = frame.input_path;
+        char numbered_path[4096];
+        const char* output = output_path;
+        if (input_count > 1) {
+            number_output_path(output_path, n, numbered_path, sizeof(numbered_path));
+            output = numbered_path;
+        }
+        TRACE_BEGIN_DETAIL("frame", input_path);
+        // the strategy for the memory budget is picked from the size in the header, the strips are only written over the input
+        // if it is not denoised again
+        frame.plan = (struct memory_plan) { .strategy = MEMORY_FULL_FRAME };
+        frame.in_place = !(options.runtime && options.iterations > 1);
+        if (mem_budget) {
+            struct Netpbm header;
+            if (options.raw_layout != -1)
+                read_raw_header(input_path, options.raw_layout, options.raw_width, options.raw_height, &header);
+            else
+                read_image_header(input_path, &header);
+            int tiles_possible = options.raw_layout == -1 && header.magicNumber[1] == '6';
+            if (plan_memory(header.width, header.height, header.format, tiles_possible, frame.parallel.threads, frame.in_place, (size_t)mem_budget << 20,
+                    &frame.plan)) {
+                fprintf(stderr, "Memory budget of %ld MiB is too small for the image %s!\n", mem_budget, input_path);
+                cleanup_end(EXIT_FAILURE, 0);
+            }
+            print_memory_plan(&frame.plan, mem_budget);
         }
-        if (runtime) {
-            struct timespec start, end;
+        if (budget || frame.plan.strategy == MEMORY_TILES) {
+            // the image is never loaded as a whole, the tiles are read from and written to the files directly
+            size_t tile_budget = budget ? (size_t)budget << 20 : frame.plan.strip_bytes;
+            printf("Using coefficients %f, %f, %f while converting to grayscale\n", options.coeff[0], options.coeff[1], options.coeff[2]);
+            printf("Denoising the image %s using SIMD out-of-core with a budget of %zu MiB...\n", input_path, tile_budget >> 20);
+            int status = EXIT_SUCCESS;
+            struct timespec start;
             clock_gettime(CLOCK_MONOTONIC, &start);
-            for (int i = 0; i < b_opt; i++)
-                denoise_sisd(image.pixels, image.width, image.height, coeff[0], coeff[1], coeff[2], tmp1, tmp2, result_pixels);
-            clock_gettime(CLOCK_MONOTONIC, &end);
-            double time_taken = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
-            printf("Time taken in total: %f second for %d iterations\n", time_taken, b_opt);
-            printf("Time taken per iteration: %f second\n", time_taken / b_opt);
-        } else {
-            denoise_sisd(image.pixels, image.width, image.height, coeff[0], coeff[1], coeff[2], tmp1, tmp2, result_pixels);
+            for (int i = 0; i < options.iterations && status == EXIT_SUCCESS; i++)
+                status = denoise_tiled(input_path, output, options.coeff[0], options.coeff[1], options.coeff[2], tile_budget, &frame.parallel);
+            if (status == EXIT_FAILURE)
+                cleanup_end(EXIT_FAILURE, 0);
+            print_runtime(&options, &start);
+            if (mem_budget)
+                print_peak_memory();
+            TRACE_END("frame");
+            continue;
         }
-    } else {
-        printf("Denoising the image %s using SIMD...\n", input_path);
-        size_t padded_size = (image.width + 2) * (image.height + 2);
-        padded_image = calloc(padded_size, sizeof(uint16_t));
-        padded_laplace = calloc(padded_size, sizeof(uint16_t));
-        padded_blur = calloc(padded_size, sizeof(uint16_t));
+        load_frame(&options, &frame);
 
-        if (!padded_image || !padded_laplace || !padded_blur)
-            cleanup_end(EXIT_FAILURE, 6, tmp1, tmp2, result_pixels, padded_image, padded_laplace, padded_blur);
+        struct cache_key key;
+        int cached = 0;
+        if (options.caching) {
+            TRACE_BEGIN("cache lookup");
+            key = result_key(&frame.image, frame.version, options.coeff, options.window, options.sigma, options.radius, options.pyramid, options.scale,
+                &frame.parallel);
+            cached = cache_lookup(&cache, key, frame.result_width, frame.result_height, frame.result) == 0;
+            TRACE_END("cache lookup");
+        }
 
-        if (runtime) {
-            struct timespec start, end;
-            clock_gettime(CLOCK_MONOTONIC, &start);
-            for (int i = 0; i < b_opt; i++)
-                denoise_simd(image.pixels, image.width, image.height, coeff[0], coeff[1], coeff[2], padded_image, padded_laplace, padded_blur, result_pixels);
-            clock_gettime(CLOCK_MONOTONIC, &end);
-            double time_taken = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
-            printf("Time taken in total: %f second for %d iterations\n", time_taken, b_opt);
-            printf("Time taken per iteration: %f second\n", time_taken / b_opt);
-        } else {
-            denoise_simd(image.pixels, image.width, image.height, coeff[0], coeff[1], coeff[2], padded_image, padded_laplace, padded_blur, result_pixels);
+        if (cached)
+            printf("Found the result of the image %s in the cache, it is not denoised again\n", input_path);
+        else if (deadline)
+            denoise_deadline_frame(&deadline_run, &options, &frame);
+        else
+            denoise_frame(&options, &frame);
+
+        // a result that can't be written to the cache directory is still written to the output
+        if (options.caching && !cached) {
+            TRACE_BEGIN("cache insert");
+            if (cache_insert(&cache, key, frame.result_width, frame.result_height, frame.result) != 0)
+                fprintf(stderr, "Could not write the result of the image %s to the cache directory!\n", input_path);
+            TRACE_END("cache insert");
         }
-    }
 
-    free(image.pixels);
-    // store results in image struct
-    image.pixels = result_pixels;
-    image.magicNumber[1] = '5';
+        // store results in image struct
+        struct Netpbm result = frame.image;
+        free(frame.image.pixels);
+        frame.image.pixels = NULL;
+        result.pixels = frame.result;
+        result.width = frame.result_width;
+        result.height = frame.result_height;
+        result.magicNumber[1] = '5';
 
-    if (write_image(&image, output_path) == EXIT_FAILURE)
-        cleanup_end(EXIT_FAILURE, 6, tmp1, tmp2, result_pixels, padded_image, padded_laplace, padded_blur);
+        TRACE_BEGIN("write");
+        if (write_image(&result, output) == EXIT_FAILURE)
+            fail_frame(&frame);
+        TRACE_END("write");
+        if (reference_path) {
+            if (reference.width != result.width || reference.height != result.height) {
+                fprintf(stderr, "Reference %s has %zux%zu pixels, the result of the image %s %zux%zu!\n", reference_path, reference.width, reference.height,
+                    input_path, result.width, result.height);
+                free_frame(&frame);
+                cleanup_end(EXIT_FAILURE, 2, reference.pixels, metrics_scratch);
+            }
+            struct image_metrics metrics;
+            image_metrics_simd(frame.result, reference.pixels, result.width, result.height, metrics_scratch, &metrics);
+            print_metrics(&metrics, reference_path, result.width * result.height);
+        }
+        free_frame(&frame);
+        if (mem_budget)
+            print_peak_memory();
+        TRACE_END("frame");
+    }
 
-    cleanup_end(EXIT_SUCCESS, 6, tmp1, tmp2, result_pixels, padded_image, padded_laplace, padded_blur);
+    if (deadline) {
+        deadline_summary(&deadline_run.controller, stdout);
+        free(deadline_run.scratch);
+        for (int i = 0; i < 3; i++)
+            free(deadline_run.padded[i]);
+    }
+    if (options.caching) {
+        printf("Cache: %zu hits in memory, %zu hits on disk, %zu misses, %zu evictions\n",
+            cache.stats.memory_hits, cache.stats.disk_hits, cache.stats.misses, cache.stats.evictions);
+        if (cache.memory.capacity)
+            printf("Cache size: %zu of %zu bytes in memory\n", cache.memory.bytes, cache.memory.capacity);
+        if (cache.directory)
+            printf("Cache size: %zu of %zu bytes in %s\n", cache.disk.bytes, cache.disk.capacity, cache.directory);
+        cache_close(&cache);
+    }
+    if (trace_path) {
+        if (trace_stop(trace_path) != 0) {
+            fprintf(stderr, "Could not write the trace to %s!\n", trace_path);
+            cleanup_end(EXIT_FAILURE, 0);
+        }
+        printf("Trace of the stages written to %s\n", trace_path);
+    }
+    cleanup_end(EXIT_SUCCESS, 2, reference.pixels, metrics_scratch);
 }
\ No newline at end of file
@@ -0,0 +1,228 @@
+#include "median.h"
+#include <smmintrin.h>
+#include <string.h>
+
+// compare and exchange of the sorting networks, w[a] gets the minimum and w[b] the maximum
+#define SWAP(a, b)                                      \
+    {                                                   \
+        __m128i t = _mm_min_epu8(w[a], w[b]);           \
+        w[b] = _mm_max_epu8(w[a], w[b]);                \
+        w[a] = t;                                       \
+    }
+// only one half of the exchange, the other value is not needed anymore
+#define MIN(a, b) w[a] = _mm_min_epu8(w[a], w[b])
+#define MAX(a, b) w[b] = _mm_max_epu8(w[a], w[b])
+
+// Row index y clamped to the image, the rows outside are replaced by the nearest edge row
+static size_t clamp(ptrdiff_t y, size_t height)
+{
+    if (y < 0)
+        return 0;
+    return (size_t)y >= height ? height - 1 : (size_t)y;
+}
+
+void median(const uint8_t* image, size_t width, size_t height, size_t window, uint8_t* result)
+{
+    ptrdiff_t radius = (ptrdiff_t)window / 2;
+    uint8_t values[25];
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            size_t count = 0;
+            for (ptrdiff_t dy = -radius; dy <= radius; dy++) {
+                for (ptrdiff_t dx = -radius; dx <= radius; dx++)
+                    values[count++] = image[clamp((ptrdiff_t)y + dy, height) * width + clamp((ptrdiff_t)x + dx, width)];
+            }
+            // insertion sort of the window
+            for (size_t i = 1; i < count; i++) {
+                uint8_t value = values[i];
+                size_t j = i;
+                for (; j > 0 && values[j - 1] > value; j--)
+                    values[j] = values[j - 1];
+                values[j] = value;
+            }
+            result[y * width + x] = values[count / 2];
+        }
+    }
+}
+
+void extend_row(const uint8_t* image, size_t width, size_t height, ptrdiff_t y, size_t radius, size_t length, uint8_t* row)
+{
+    const uint8_t* source = image + clamp(y, height) * width;
+    memset(row, source[0], radius);
+    memcpy(row + radius, source, width);
+    memset(row + radius + width, source[width - 1], length - radius - width);
+}
+
+// Sort 16 columns of 3, 4 or 5 rows at once, w[k] gets the k-th lowest value of every column
+static inline void sort_columns(uint8_t* const* rows, size_t count, size_t x, __m128i* w)
+{
+    for (size_t k = 0; k < count; k++)
+        w[k] = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+    if (count == 3) {
+        SWAP(0, 1); SWAP(1, 2); SWAP(0, 1);
+    } else if (count == 4) {
+        SWAP(0, 1); SWAP(2, 3); SWAP(0, 2); SWAP(1, 3); SWAP(1, 2);
+    } else {
+        SWAP(0, 1); SWAP(3, 4); SWAP(2, 4); SWAP(2, 3); SWAP(0, 3); SWAP(0, 2); SWAP(1, 4); SWAP(1, 3); SWAP(1, 2);
+    }
+}
+
+// Store the first count of 16 filtered pixels
+static inline void store_pixels(uint8_t* row, size_t count, __m128i m)
+{
+    if (count >= 16) {
+        _mm_storeu_si128((__m128i*)row, m);
+    } else {
+        uint8_t tail[16];
+        _mm_storeu_si128((__m128i*)tail, m);
+        memcpy(row, tail, count);
+    }
+}
+
+static inline __m128i median3(__m128i a, __m128i b, __m128i c)
+{
+    return _mm_max_epu8(_mm_min_epu8(a, b), _mm_min_epu8(_mm_max_epu8(a, b), c));
+}
+
+// Median of the 3x3 windows of 16 pixels, from the sorted columns of this block and the next one
+static inline __m128i median_3x3(const __m128i* current, const __m128i* next)
+{
+    // the median is the median of the largest low, the median middle and the smallest high value of the columns
+    __m128i low = _mm_max_epu8(_mm_max_epu8(current[0], _mm_alignr_epi8(next[0], current[0], 1)), _mm_alignr_epi8(next[0], current[0], 2));
+    __m128i middle = median3(current[1], _mm_alignr_epi8(next[1], current[1], 1), _mm_alignr_epi8(next[1], current[1], 2));
+    __m128i high = _mm_min_epu8(_mm_min_epu8(current[2], _mm_alignr_epi8(next[2], current[2], 1)), _mm_alignr_epi8(next[2], current[2], 2));
+    return median3(low, middle, high);
+}
+
+// Median of the 5x5 windows of 16 pixels, from the sorted columns of this block and the next one
+static inline __m128i median_5x5(const __m128i* current, const __m128i* next)
+{
+    // w[5 * j + k] is the k-th lowest value of column j of the window
+    __m128i w[25];
+    for (size_t k = 0; k < 5; k++) {
+        w[k] = current[k];
+        w[5 + k] = _mm_alignr_epi8(next[k], current[k], 1);
+        w[10 + k] = _mm_alignr_epi8(next[k], current[k], 2);
+        w[15 + k] = _mm_alignr_epi8(next[k], current[k], 3);
+        w[20 + k] = _mm_alignr_epi8(next[k], current[k], 4);
+    }
+    // Batcher's odd-even merges of the sorted columns (((0, 1), 2), (3, 4)), reduced to the exchanges the 13th value depends on
+    SWAP(0, 5); SWAP(4, 9); SWAP(4, 5); SWAP(2, 7); SWAP(2, 4); SWAP(7, 5);
+    SWAP(1, 6); SWAP(3, 8); SWAP(3, 6); SWAP(1, 2); SWAP(3, 4); SWAP(6, 7);
+    SWAP(8, 5); SWAP(0, 10); SWAP(5, 10); SWAP(4, 14); SWAP(4, 5); SWAP(14, 10);
+    SWAP(2, 12); SWAP(7, 12); SWAP(2, 4); SWAP(7, 5); SWAP(12, 14); SWAP(1, 11);
+    SWAP(9, 11); SWAP(6, 9); SWAP(3, 13); SWAP(8, 13); SWAP(3, 6); SWAP(8, 9);
+    SWAP(13, 11); SWAP(1, 2); SWAP(3, 4); SWAP(6, 7); SWAP(8, 5); SWAP(9, 12);
+    SWAP(13, 14); MIN(11, 10); SWAP(15, 20); SWAP(19, 24); SWAP(19, 20); SWAP(17, 22);
+    SWAP(17, 19); SWAP(22, 20); SWAP(16, 21); SWAP(18, 23); SWAP(18, 21); SWAP(16, 17);
+    SWAP(18, 19); SWAP(21, 22); SWAP(23, 20); MAX(0, 15); MIN(5, 20); MAX(5, 15);
+    MAX(4, 19); MIN(14, 19); MIN(14, 15); MAX(2, 17); MIN(12, 17); MIN(7, 22);
+    MAX(7, 12); MAX(12, 14); MAX(1, 16); MIN(9, 24); MAX(9, 16); MAX(6, 21);
+    MIN(11, 21); MIN(11, 16); MAX(3, 18); MIN(13, 18); MIN(8, 23); MAX(8, 13);
+    MIN(13, 11); MAX(13, 14);
+    return w[14];
+}
+
+// Values 8 to 13 of the 20 values of the 4 rows two 5x5 windows above each other share, from their sorted columns of this block and the next one
+static inline void shared_ranks(const __m128i* current, const __m128i* next, __m128i* ranks)
+{
+    // w[4 * j + k] is the k-th lowest value of column j of the 4 rows
+    __m128i w[20];
+    for (size_t k = 0; k < 4; k++) {
+        w[k] = current[k];
+        w[4 + k] = _mm_alignr_epi8(next[k], current[k], 1);
+        w[8 + k] = _mm_alignr_epi8(next[k], current[k], 2);
+        w[12 + k] = _mm_alignr_epi8(next[k], current[k], 3);
+        w[16 + k] = _mm_alignr_epi8(next[k], current[k], 4);
+    }
+    // Batcher's odd-even merges of the sorted columns (((0, 1), 2), (3, 4)), reduced to the exchanges values 8 to 13 depend on
+    SWAP(0, 4); SWAP(2, 6); SWAP(2, 4); SWAP(1, 5); SWAP(3, 7); SWAP(3, 5);
+    SWAP(1, 2); SWAP(3, 4); SWAP(5, 6); SWAP(0, 8); SWAP(4, 8); SWAP(2, 10);
+    SWAP(6, 10); SWAP(2, 4); SWAP(6, 8); SWAP(1, 9); SWAP(5, 9); SWAP(3, 11);
+    SWAP(7, 11); SWAP(3, 5); SWAP(7, 9); SWAP(1, 2); SWAP(3, 4); SWAP(5, 6);
+    SWAP(7, 8); SWAP(9, 10); SWAP(12, 16); SWAP(14, 18); SWAP(14, 16); SWAP(13, 17);
+    SWAP(15, 19); SWAP(15, 17); SWAP(13, 14); SWAP(15, 16); SWAP(17, 18); MAX(0, 12);
+    SWAP(8, 12); SWAP(4, 16); MAX(4, 8); MIN(16, 12); MAX(2, 14); MIN(10, 14);
+    MIN(6, 18); SWAP(6, 10); MAX(6, 8); SWAP(10, 16); MAX(1, 13); SWAP(9, 13);
+    SWAP(5, 17); MAX(5, 9); MIN(17, 13); MAX(3, 15); MIN(11, 15); MIN(7, 19);
+    SWAP(7, 11); SWAP(7, 9); MIN(11, 17); SWAP(7, 8); SWAP(9, 10); SWAP(11, 16);
+    ranks[0] = w[7];
+    ranks[1] = w[8];
+    ranks[2] = w[9];
+    ranks[3] = w[10];
+    ranks[4] = w[11];
+    ranks[5] = w[16];
+}
+
+// Median of the 5x5 windows of 16 pixels, from the values 8 to 13 of the shared rows and the row only these windows contain
+static inline __m128i median_5x5_shared(const __m128i* ranks, const uint8_t* row)
+{
+    __m128i w[5];
+    for (size_t k = 0; k < 5; k++)
+        w[k] = _mm_loadu_si128((const __m128i*)(row + k));
+    SWAP(0, 1); SWAP(3, 4); SWAP(2, 4); SWAP(2, 3); SWAP(0, 3); SWAP(0, 2); SWAP(1, 4); SWAP(1, 3); SWAP(1, 2);
+    // the 13th value is the lowest of value 13 of the shared rows and the maximums of their value 12 - i and value i + 1 of the row
+    __m128i m = ranks[5];
+    for (size_t i = 0; i < 5; i++)
+        m = _mm_min_epu8(m, _mm_max_epu8(ranks[4 - i], w[i]));
+    return m;
+}
+
+// Median of the 5x5 windows of two rows at once, rows[0] to rows[5] are the six rows both windows cover
+static void median_5x5_pair(uint8_t* const* rows, size_t width, uint8_t* top, uint8_t* bottom)
+{
+    // the columns of the 4 shared rows are sorted and merged once for both rows
+    __m128i columns[2][4];
+    sort_columns(rows + 1, 4, 0, columns[0]);
+    for (size_t x = 0, i = 0; x < width; x += 16, i ^= 1) {
+        sort_columns(rows + 1, 4, x + 16, columns[i ^ 1]);
+        __m128i ranks[6];
+        shared_ranks(columns[i], columns[i ^ 1], ranks);
+        store_pixels(top + x, width - x, median_5x5_shared(ranks, rows[0] + x));
+        store_pixels(bottom + x, width - x, median_5x5_shared(ranks, rows[5] + x));
+    }
+}
+
+void median_simd(const uint8_t* image, size_t width, size_t height, size_t window, uint8_t* scratch, uint8_t* result)
+{
+    size_t radius = window / 2;
+    // the columns of the block after the last 16 pixels are sorted too
+    size_t length = (width + 15) / 16 * 16 + 16;
+    // the 5x5 filter keeps one row more to filter two rows at once
+    size_t count = window == 5 ? 6 : window;
+    uint8_t* rows[6];
+    for (size_t k = 0; k < count; k++)
+        rows[k] = scratch + k * length;
+
+    // the rows of the window are a ring, source row i is in rows[(i + radius) % count], so only one row is added per row
+    for (size_t k = 0; k + 1 < window; k++)
+        extend_row(image, width, height, (ptrdiff_t)k - (ptrdiff_t)radius, radius, length, rows[k]);
+    size_t y = 0;
+    if (window == 5) {
+        for (; y + 1 < height; y += 2) {
+            extend_row(image, width, height, (ptrdiff_t)(y + 2), radius, length, rows[(y + 4) % count]);
+            extend_row(image, width, height, (ptrdiff_t)(y + 3), radius, length, rows[(y + 5) % count]);
+            uint8_t* pair[6];
+            for (size_t k = 0; k < 6; k++)
+                pair[k] = rows[(y + k) % count];
+            median_5x5_pair(pair, width, result + y * width, result + (y + 1) * width);
+        }
+    }
+    // the last row of an odd height is filtered alone
+    for (; y < height; y++) {
+        extend_row(image, width, height, (ptrdiff_t)(y + radius), radius, length, rows[(y + 2 * radius) % count]);
+        uint8_t* window_rows[5];
+        for (size_t k = 0; k < window; k++)
+            window_rows[k] = rows[(y + k) % count];
+
+        // every column is sorted once and shared by the windows of its neighbours, which are shifted in with alignr
+        uint8_t* row = result + y * width;
+        __m128i columns[2][5];
+        sort_columns(window_rows, window, 0, columns[0]);
+        for (size_t x = 0, i = 0; x < width; x += 16, i ^= 1) {
+            sort_columns(window_rows, window, x + 16, columns[i ^ 1]);
+            __m128i m = window == 3 ? median_3x3(columns[i], columns[i ^ 1]) : median_5x5(columns[i], columns[i ^ 1]);
+            store_pixels(row + x, width - x, m);
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef MEDIAN_H
+#define MEDIAN_H
+#include <stddef.h>
+#include <stdint.h>
+
+// bytes of scratch memory median_simd() needs for a row width and window size
+#define MEDIAN_SCRATCH_SIZE(width, window) (((window) == 5 ? 6 : (window)) * (((width) + 15) / 16 * 16 + 16))
+
+/**
+ * Median filter of a grayscale image with a window of 3x3 or 5x5 pixels.
+ * Naive implementation that sorts every window, the pixels outside the image are replaced by the nearest edge pixel.
+ * @param window: 3 or 5
+ */
+void median(const uint8_t* image, size_t width, size_t height, size_t window, uint8_t* result);
+
+/**
+ * Does the same as median(), optimized using SSE, SSE4.1 is required. The result is exact.
+ * 16 pixels are filtered at once with branch-free min/max sorting networks:
+ * the columns of the window are sorted once per row and shared by all windows they belong to,
+ * then the median of the sorted columns is selected, for 5x5 with a pruned odd-even merge network.
+ * The 5x5 filter does two rows at once: the 4 rows both windows share are merged once, only to the values 8 to 13,
+ * then the median of every window is selected from them and its sorted fifth row.
+ * @param scratch: MEDIAN_SCRATCH_SIZE(width, window) bytes for the rows of the window
+ */
+void median_simd(const uint8_t* image, size_t width, size_t height, size_t window, uint8_t* scratch, uint8_t* result);
+
+/**
+ * Copy row y of an image, clamped to the image, with radius edge pixels replicated on both sides.
+ * The rest of the length bytes is filled with the last pixel. Also used by the bilateral filter.
+ */
+void extend_row(const uint8_t* image, size_t width, size_t height, ptrdiff_t y, size_t radius, size_t length, uint8_t* row);
+
+#endif // MEDIAN_H
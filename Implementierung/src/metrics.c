@@ -0,0 +1,224 @@
+#include "metrics.h"
+#include <immintrin.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// sums of the pixels of both images, of their squares and of their products over a window
+struct window_sums {
+    uint64_t image, reference, image_squares, reference_squares, products;
+};
+
+// constants of SSIM that keep the quotients stable for dark and flat windows
+#define SSIM_C1 ((0.01 * 255) * (0.01 * 255))
+#define SSIM_C2 ((0.03 * 255) * (0.03 * 255))
+
+// SSIM of a window of count pixels from its sums, the means, variances and the covariance are scaled by count^2
+// The operations are in the same order as in windows_ssim_simd(), so both round the same
+static double window_ssim(struct window_sums sums, uint64_t count)
+{
+    double n = (double)count, a = (double)sums.image, b = (double)sums.reference;
+    double c1 = SSIM_C1 * n * n, c2 = SSIM_C2 * n * n;
+    double ab = a * b, aa = a * a, bb = b * b;
+    double numerator = (2 * ab + c1) * (2 * (n * (double)sums.products - ab) + c2);
+    double denominator = (aa + bb + c1) * (n * (double)sums.image_squares - aa + n * (double)sums.reference_squares - bb + c2);
+    return numerator / denominator;
+}
+
+// window_ssim() of 2 windows of METRICS_WINDOW x METRICS_WINDOW pixels, sums holds the 5 sums of both
+static __m128d windows_ssim_simd(const __m128d* sums)
+{
+    const double n = METRICS_WINDOW * METRICS_WINDOW;
+    const __m128d count = _mm_set1_pd(n), two = _mm_set1_pd(2);
+    const __m128d c1 = _mm_set1_pd(SSIM_C1 * n * n), c2 = _mm_set1_pd(SSIM_C2 * n * n);
+    __m128d ab = _mm_mul_pd(sums[0], sums[1]), aa = _mm_mul_pd(sums[0], sums[0]), bb = _mm_mul_pd(sums[1], sums[1]);
+    __m128d numerator = _mm_mul_pd(_mm_add_pd(_mm_mul_pd(two, ab), c1),
+        _mm_add_pd(_mm_mul_pd(two, _mm_sub_pd(_mm_mul_pd(count, sums[4]), ab)), c2));
+    __m128d variances = _mm_sub_pd(_mm_add_pd(_mm_sub_pd(_mm_mul_pd(count, sums[2]), aa), _mm_mul_pd(count, sums[3])), bb);
+    __m128d denominator = _mm_mul_pd(_mm_add_pd(_mm_add_pd(aa, bb), c1), _mm_add_pd(variances, c2));
+    return _mm_div_pd(numerator, denominator);
+}
+
+// Sums of a block of width x height pixels starting at the given pixel
+static struct window_sums block_sums(const uint8_t* image, const uint8_t* reference, size_t stride, size_t width, size_t height)
+{
+    struct window_sums sums = { 0, 0, 0, 0, 0 };
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            uint64_t a = image[y * stride + x], b = reference[y * stride + x];
+            sums.image += a;
+            sums.reference += b;
+            sums.image_squares += a * a;
+            sums.reference_squares += b * b;
+            sums.products += a * b;
+        }
+    }
+    return sums;
+}
+
+// PSNR and mean error from the sums of the errors
+static void finish_errors(struct image_metrics* metrics, uint64_t error_sum, uint64_t square_sum, size_t size)
+{
+    metrics->mean_error = size ? (double)error_sum / (double)size : 0;
+    metrics->psnr = square_sum ? 10 * log10(255.0 * 255.0 * (double)size / (double)square_sum) : INFINITY;
+}
+
+void image_metrics(const uint8_t* image, const uint8_t* reference, size_t width, size_t height, struct image_metrics* metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    size_t size = width * height;
+    uint64_t error_sum = 0, square_sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        int error = abs(image[i] - reference[i]);
+        error_sum += (uint64_t)error;
+        square_sum += (uint64_t)(error * error);
+        metrics->histogram[error]++;
+        if (error > metrics->max_error)
+            metrics->max_error = (uint8_t)error;
+    }
+    finish_errors(metrics, error_sum, square_sum, size);
+
+    if (width < METRICS_WINDOW || height < METRICS_WINDOW) {
+        metrics->ssim = window_ssim(block_sums(image, reference, width, width, height), size);
+        return;
+    }
+    double total = 0;
+    size_t windows = 0;
+    for (size_t y = 0; y + METRICS_WINDOW <= height; y += METRICS_STEP) {
+        for (size_t x = 0; x + METRICS_WINDOW <= width; x += METRICS_STEP, windows++)
+            total += window_ssim(block_sums(image + y * width + x, reference + y * width + x, width, METRICS_WINDOW, METRICS_WINDOW),
+                METRICS_WINDOW * METRICS_WINDOW);
+    }
+    metrics->ssim = total / (double)windows;
+}
+
+// Absolute errors, their sums and their histogram of size pixels
+static void errors_simd(const uint8_t* image, const uint8_t* reference, size_t size, struct image_metrics* metrics)
+{
+    // 4 histograms, so that runs of the same error, e.g. in areas without a change, don't wait for the increment before
+    uint64_t histograms[4][256];
+    memset(histograms, 0, sizeof(histograms));
+    __m128i maximum = _mm_setzero_si128(), error_sums = _mm_setzero_si128();
+    uint64_t square_sum = 0;
+    uint8_t errors[16];
+    size_t i = 0;
+    while (i + 16 <= size) {
+        // every 32 bit lane of the squares adds up at most 4 * 255^2 per vector, 4096 vectors still fit
+        size_t end = size - i >= 4096 * 16 ? i + 4096 * 16 : size - (size - i) % 16;
+        __m128i squares = _mm_setzero_si128();
+        for (; i < end; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)&image[i]);
+            __m128i b = _mm_loadu_si128((const __m128i*)&reference[i]);
+            __m128i error = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+            maximum = _mm_max_epu8(maximum, error);
+            error_sums = _mm_add_epi64(error_sums, _mm_sad_epu8(error, _mm_setzero_si128()));
+            __m128i low = _mm_cvtepu8_epi16(error), high = _mm_unpackhi_epi8(error, _mm_setzero_si128());
+            squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+            _mm_storeu_si128((__m128i*)errors, error);
+            for (size_t k = 0; k < 16; k++)
+                histograms[k % 4][errors[k]]++;
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, squares);
+        square_sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    uint64_t error_sum = (uint64_t)_mm_cvtsi128_si64(error_sums) + (uint64_t)_mm_extract_epi64(error_sums, 1);
+    _mm_storeu_si128((__m128i*)errors, maximum);
+    for (size_t k = 0; k < 16; k++)
+        metrics->max_error = errors[k] > metrics->max_error ? errors[k] : metrics->max_error;
+    for (; i < size; i++) {
+        int error = abs(image[i] - reference[i]);
+        error_sum += (uint64_t)error;
+        square_sum += (uint64_t)(error * error);
+        histograms[0][error]++;
+        if (error > metrics->max_error)
+            metrics->max_error = (uint8_t)error;
+    }
+    for (size_t e = 0; e < 256; e++)
+        metrics->histogram[e] = histograms[0][e] + histograms[1][e] + histograms[2][e] + histograms[3][e];
+    finish_errors(metrics, error_sum, square_sum, size);
+}
+
+// Sums of the first cells cells of 4x4 pixels in the 4 rows starting at image and reference, sums holds the 5 sums of every cell
+static void cell_sums(const uint8_t* image, const uint8_t* reference, size_t width, size_t cells, uint32_t** sums)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    size_t x = 0;
+    for (; x + 8 <= cells * METRICS_STEP; x += 8) {
+        __m128i a_sum = _mm_setzero_si128(), b_sum = _mm_setzero_si128();
+        __m128i aa_sum = _mm_setzero_si128(), bb_sum = _mm_setzero_si128(), ab_sum = _mm_setzero_si128();
+        for (size_t y = 0; y < METRICS_STEP; y++) {
+            __m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&image[y * width + x]));
+            __m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&reference[y * width + x]));
+            a_sum = _mm_add_epi32(a_sum, _mm_madd_epi16(a, ones));
+            b_sum = _mm_add_epi32(b_sum, _mm_madd_epi16(b, ones));
+            aa_sum = _mm_add_epi32(aa_sum, _mm_madd_epi16(a, a));
+            bb_sum = _mm_add_epi32(bb_sum, _mm_madd_epi16(b, b));
+            ab_sum = _mm_add_epi32(ab_sum, _mm_madd_epi16(a, b));
+        }
+        // lanes 0 and 1 hold the pairs of columns of the first cell, lanes 2 and 3 those of the second
+        _mm_storel_epi64((__m128i*)&sums[0][x / METRICS_STEP], _mm_hadd_epi32(a_sum, a_sum));
+        _mm_storel_epi64((__m128i*)&sums[1][x / METRICS_STEP], _mm_hadd_epi32(b_sum, b_sum));
+        _mm_storel_epi64((__m128i*)&sums[2][x / METRICS_STEP], _mm_hadd_epi32(aa_sum, aa_sum));
+        _mm_storel_epi64((__m128i*)&sums[3][x / METRICS_STEP], _mm_hadd_epi32(bb_sum, bb_sum));
+        _mm_storel_epi64((__m128i*)&sums[4][x / METRICS_STEP], _mm_hadd_epi32(ab_sum, ab_sum));
+    }
+    for (; x < cells * METRICS_STEP; x += METRICS_STEP) {
+        struct window_sums cell = block_sums(image + x, reference + x, width, METRICS_STEP, METRICS_STEP);
+        sums[0][x / METRICS_STEP] = (uint32_t)cell.image;
+        sums[1][x / METRICS_STEP] = (uint32_t)cell.reference;
+        sums[2][x / METRICS_STEP] = (uint32_t)cell.image_squares;
+        sums[3][x / METRICS_STEP] = (uint32_t)cell.reference_squares;
+        sums[4][x / METRICS_STEP] = (uint32_t)cell.products;
+    }
+}
+
+void image_metrics_simd(const uint8_t* image, const uint8_t* reference, size_t width, size_t height, uint8_t* scratch,
+    struct image_metrics* metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    errors_simd(image, reference, width * height, metrics);
+
+    if (width < METRICS_WINDOW || height < METRICS_WINDOW) {
+        metrics->ssim = window_ssim(block_sums(image, reference, width, width, height), width * height);
+        return;
+    }
+    // a window covers 2x2 cells, the cells of the row above are kept for the windows of the next row
+    size_t cells = width / METRICS_STEP, cell_rows = height / METRICS_STEP;
+    uint32_t* rows[2][5];
+    for (size_t i = 0; i < 10; i++)
+        rows[i / 5][i % 5] = (uint32_t*)scratch + i * (cells + 1);
+    double total = 0;
+    for (size_t r = 0; r < cell_rows; r++) {
+        uint32_t** current = rows[r % 2];
+        uint32_t** above = rows[(r + 1) % 2];
+        cell_sums(image + r * METRICS_STEP * width, reference + r * METRICS_STEP * width, width, cells, current);
+        if (r == 0)
+            continue;
+        // the sums of 4 windows are added from 2 rows of cells and the cells next to them, at most 64 * 255^2 fits into 32 bits
+        size_t x = 0;
+        for (; x + 4 < cells; x += 4) {
+            __m128d low[5], high[5];
+            for (size_t k = 0; k < 5; k++) {
+                __m128i left = _mm_add_epi32(_mm_loadu_si128((const __m128i*)&above[k][x]), _mm_loadu_si128((const __m128i*)&current[k][x]));
+                __m128i right = _mm_add_epi32(_mm_loadu_si128((const __m128i*)&above[k][x + 1]), _mm_loadu_si128((const __m128i*)&current[k][x + 1]));
+                __m128i window = _mm_add_epi32(left, right);
+                low[k] = _mm_cvtepi32_pd(window);
+                high[k] = _mm_cvtepi32_pd(_mm_unpackhi_epi64(window, window));
+            }
+            // added one after the other like the naive windows
+            double ssim[4];
+            _mm_storeu_pd(&ssim[0], windows_ssim_simd(low));
+            _mm_storeu_pd(&ssim[2], windows_ssim_simd(high));
+            total = total + ssim[0] + ssim[1] + ssim[2] + ssim[3];
+        }
+        for (; x + 1 < cells; x++) {
+            uint64_t window[5];
+            for (size_t k = 0; k < 5; k++)
+                window[k] = (uint64_t)above[k][x] + above[k][x + 1] + current[k][x] + current[k][x + 1];
+            struct window_sums sums = { window[0], window[1], window[2], window[3], window[4] };
+            total += window_ssim(sums, METRICS_WINDOW * METRICS_WINDOW);
+        }
+    }
+    metrics->ssim = total / (double)((cells - 1) * (cell_rows - 1));
+}
@@ -0,0 +1,42 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stddef.h>
+#include <stdint.h>
+
+// side and step of the SSIM windows, every window overlaps its neighbours by half
+#define METRICS_WINDOW 8
+#define METRICS_STEP 4
+
+// bytes of scratch memory image_metrics_simd() needs: 5 sums of 4x4 cells for two rows of cells
+#define METRICS_SCRATCH_SIZE(width) (10 * ((width) / METRICS_STEP + 1) * sizeof(uint32_t))
+
+// Quality of an image compared to a reference, e.g. the result of a faster variant compared to the accurate one
+struct image_metrics {
+    // peak signal-to-noise ratio in dB, INFINITY for identical images
+    double psnr;
+    // mean structural similarity of the windows, 1 for identical images
+    double ssim;
+    // mean and largest absolute error of a pixel
+    double mean_error;
+    uint8_t max_error;
+    // pixels per absolute error
+    uint64_t histogram[256];
+};
+
+/**
+ * Compare two grayscale images of the same size, naive implementation.
+ * SSIM uses uniform METRICS_WINDOW x METRICS_WINDOW windows every METRICS_STEP pixels that lie inside the image,
+ * with the constants (0.01 * 255)^2 and (0.03 * 255)^2. An image smaller than a window is a single window.
+ */
+void image_metrics(const uint8_t* image, const uint8_t* reference, size_t width, size_t height, struct image_metrics* metrics);
+
+/**
+ * Does the same as image_metrics(), optimized using SSE, SSE4.1 is required. The result is exact.
+ * The errors are taken with saturating subtractions and summed with _mm_sad_epu8(), the squares with multiply-adds.
+ * The sums of the SSIM windows are built from sums of 4x4 cells, which every window shares with its neighbours.
+ * @param scratch: METRICS_SCRATCH_SIZE(width) bytes
+ */
+void image_metrics_simd(const uint8_t* image, const uint8_t* reference, size_t width, size_t height, uint8_t* scratch,
+    struct image_metrics* metrics);
+
+#endif // METRICS_H
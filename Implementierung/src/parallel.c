@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+#include "combine.h"
+#include "convolution.h"
+#include "denoise.h"
+#include "grayscale.h"
+#include "trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// bands with fewer rows are not worth a thread
+#define MIN_BAND_ROWS 8
+#define MAX_NUMA_NODES 64
+#define MPOL_F_MEMS_ALLOWED (1 << 2)
+
+struct shared {
+    const struct parallel_config* config;
+    void (*work)(struct shared* shared, size_t index, size_t y0, size_t y1);
+    size_t bands;
+    pthread_mutex_t lock;
+    pthread_cond_t started;
+    int go; // set once all threads are created, bands is final from then on
+    pthread_barrier_t barrier;
+    atomic_int failed;
+
+    // arguments of the job
+    struct image_view img;
+    enum pixel_format format;
+    size_t width;
+    size_t height;
+    float a, b, c;
+    uint16_t* padded_image;
+    uint16_t* padded_laplace;
+    uint16_t* padded_blur;
+    struct image_view result;
+    int fd;
+    long offset;
+    const struct Netpbm* image;
+};
+
+struct worker {
+    struct shared* shared;
+    size_t index;
+};
+
+int parse_affinity(const char* list, struct parallel_config* config)
+{
+    size_t count = 0;
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return -1;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (count == MAX_THREADS || cpu >= CPU_SETSIZE)
+                return -1;
+            config->cpus[count++] = (int)cpu;
+        }
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+    if (count == 0)
+        return -1;
+    config->cpu_count = count;
+    return 0;
+}
+
+int create_pinned_thread(pthread_t* thread, const struct parallel_config* config, size_t index, void* (*start)(void*), void* arg)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (config->cpu_count > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config->cpus[index % config->cpu_count], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
+    }
+    int err = pthread_create(thread, &attr, start, arg);
+    if (err == EINVAL && config->cpu_count > 0) {
+        // the cpu is not available, run the thread unpinned
+        fprintf(stderr, "Could not pin thread %zu to cpu %d!\n", index, config->cpus[index % config->cpu_count]);
+        pthread_attr_destroy(&attr);
+        pthread_attr_init(&attr);
+        err = pthread_create(thread, &attr, start, arg);
+    }
+    pthread_attr_destroy(&attr);
+    return err;
+}
+
+static void* worker_main(void* arg)
+{
+    struct worker* worker = arg;
+    struct shared* shared = worker->shared;
+
+    pthread_mutex_lock(&shared->lock);
+    while (!shared->go)
+        pthread_cond_wait(&shared->started, &shared->lock);
+    pthread_mutex_unlock(&shared->lock);
+
+    trace_thread(worker->index + 1);
+    if (worker->index < shared->bands) {
+        size_t y0 = shared->height * worker->index / shared->bands;
+        size_t y1 = shared->height * (worker->index + 1) / shared->bands;
+        shared->work(shared, worker->index, y0, y1);
+    }
+    return NULL;
+}
+
+// Start one pinned worker per band and wait for all of them
+// If not all threads can be created, the image is split between the threads that could be created
+static int run_workers(struct shared* shared)
+{
+    const struct parallel_config* config = shared->config;
+    size_t bands = config->threads;
+    if (bands > shared->height / MIN_BAND_ROWS)
+        bands = shared->height / MIN_BAND_ROWS;
+    if (bands == 0)
+        bands = 1;
+
+    pthread_t threads[MAX_THREADS];
+    struct worker workers[MAX_THREADS];
+    pthread_mutex_init(&shared->lock, NULL);
+    pthread_cond_init(&shared->started, NULL);
+    shared->go = 0;
+    shared->failed = 0;
+
+    size_t created = 0;
+    for (; created < bands; created++) {
+        workers[created].shared = shared;
+        workers[created].index = created;
+        int err = create_pinned_thread(&threads[created], config, created, worker_main, &workers[created]);
+        if (err)
+            break;
+    }
+
+    pthread_mutex_lock(&shared->lock);
+    shared->bands = created;
+    if (created > 0)
+        pthread_barrier_init(&shared->barrier, NULL, (unsigned)created);
+    shared->go = 1;
+    pthread_cond_broadcast(&shared->started);
+    pthread_mutex_unlock(&shared->lock);
+
+    for (size_t i = 0; i < created; i++)
+        pthread_join(threads[i], NULL);
+
+    if (created > 0)
+        pthread_barrier_destroy(&shared->barrier);
+    pthread_cond_destroy(&shared->started);
+    pthread_mutex_destroy(&shared->lock);
+    return created == 0 || shared->failed;
+}
+
+static void first_touch_band(struct shared* shared, size_t index, size_t y0, size_t y1)
+{
+    size_t width = shared->width;
+    size_t padded_width = width + 2;
+    // padded rows y0 + 1 to y1 belong to this band, the first and last band also own the border rows
+    size_t first_row = index == 0 ? 0 : y0 + 1;
+    size_t last_row = index == shared->bands - 1 ? y1 + 2 : y1 + 1;
+    size_t offset = first_row * padded_width;
+    size_t size = (last_row - first_row) * padded_width * sizeof(uint16_t);
+    memset(shared->padded_image + offset, 0, size);
+    memset(shared->padded_laplace + offset, 0, size);
+    memset(shared->padded_blur + offset, 0, size);
+    for (size_t y = y0; y < y1; y++)
+        memset(view_row(shared->result, y), 0, width);
+    TRACE_BEGIN("read");
+    if (shared->fd >= 0 && read_image_rows(shared->fd, shared->offset, shared->image, y0, y1 - y0))
+        shared->failed = 1;
+    TRACE_END("read");
+}
+
+// Grayscale rows [y0, y0 + rows): the luma input itself or the converted rows in the result
+static struct image_view gray_rows(struct shared* shared, size_t y0, size_t rows)
+{
+    if (shared->format == PIXEL_LUMA)
+        return view_region(shared->img, 0, y0, shared->width, rows, 1);
+    return view_region(shared->result, 0, y0, shared->width, rows, 1);
+}
+
+// Convert the rows [y0, y1) to grayscale and pad them
+static void grayscale_pad_rows(struct shared* shared, size_t y0, size_t y1)
+{
+    if (y1 <= y0)
+        return;
+    size_t width = shared->width;
+    struct image_view img = view_region(shared->img, 0, y0, width, y1 - y0, pixel_size(shared->format));
+    TRACE_BEGIN("grayscale");
+    struct image_view gray = grayscale_simd_format_view(img, shared->format, shared->a, shared->b, shared->c, gray_rows(shared, y0, y1 - y0));
+    TRACE_END("grayscale");
+    TRACE_BEGIN("pad");
+    pad_image_simd_view(gray, width + 2, shared->padded_image + y0 * (width + 2));
+    TRACE_END("pad");
+}
+
+static void denoise_band(struct shared* shared, size_t index, size_t y0, size_t y1)
+{
+    size_t width = shared->width;
+    size_t padded_width = width + 2;
+    size_t tile_rows = shared->config->tile_rows ? shared->config->tile_rows : y1 - y0;
+
+    // the convolution reads one padded row of the neighbouring bands, so the edge rows are padded first
+    int first_done = index > 0;
+    int last_done = index < shared->bands - 1 && !(first_done && y1 - y0 == 1);
+    if (first_done)
+        grayscale_pad_rows(shared, y0, y0 + 1);
+    if (last_done)
+        grayscale_pad_rows(shared, y1 - 1, y1);
+    if (shared->bands > 1) {
+        TRACE_BEGIN("wait");
+        pthread_barrier_wait(&shared->barrier);
+        TRACE_END("wait");
+    }
+
+    // the band is processed in tiles of rows, so the rows of a tile are still in the cache for the next stage
+    size_t padded_to = first_done ? y0 + 1 : y0;
+    for (size_t y = y0; y < y1; y += tile_rows) {
+        size_t rows = y + tile_rows < y1 ? tile_rows : y1 - y;
+        // the convolution of the tile needs the first row of the next tile
+        size_t target = y + rows + 1 < y1 ? y + rows + 1 : y1;
+        grayscale_pad_rows(shared, padded_to, last_done && target == y1 ? y1 - 1 : target);
+        padded_to = target;
+
+        if (shared->config->adaptive) {
+            // the noise of the tile is estimated while convolving it, the strength is picked before combining
+            uint32_t histogram[256] = { 0 };
+            TRACE_BEGIN("convolution");
+            convolution_simd_histogram(shared->padded_image + y * padded_width, padded_width, rows + 2,
+                shared->padded_laplace + y * padded_width, shared->padded_blur + y * padded_width, histogram);
+            TRACE_END("convolution");
+            TRACE_BEGIN("combine");
+            combine_simd_gain_view(gray_rows(shared, y, rows), shared->padded_laplace + y * padded_width, shared->padded_blur + y * padded_width,
+                padded_width, adaptive_gain(histogram), view_region(shared->result, 0, y, width, rows, 1));
+            TRACE_END("combine");
+            continue;
+        }
+        convolve_combine_simd_view(gray_rows(shared, y, rows), shared->padded_image + y * padded_width, padded_width,
+            shared->padded_laplace + y * padded_width, shared->padded_blur + y * padded_width, view_region(shared->result, 0, y, width, rows, 1));
+    }
+}
+
+int first_touch_parallel(const struct parallel_config* config, int fd, long offset, const struct Netpbm* image,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, uint8_t* result)
+{
+    struct shared shared = {
+        .config = config,
+        .work = first_touch_band,
+        .width = image->width,
+        .height = image->height,
+        .padded_image = padded_image,
+        .padded_laplace = padded_laplace,
+        .padded_blur = padded_blur,
+        .result = packed_view(result, image->width, image->height, 1),
+        .fd = fd,
+        .offset = offset,
+        .image = image,
+    };
+    return run_workers(&shared);
+}
+
+int denoise_simd_parallel(const struct parallel_config* config, const uint8_t* img, size_t width, size_t height,
+    float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
+    uint8_t* result)
+{
+    return denoise_simd_parallel_view(config, packed_view(img, width, height, 3), PIXEL_RGB, a, b, c,
+        padded_image, padded_laplace, padded_blur, packed_view(result, width, height, 1));
+}
+
+int denoise_simd_parallel_view(const struct parallel_config* config, struct image_view img, enum pixel_format format,
+    float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
+    struct image_view result)
+{
+    int single = config->threads <= 1 && config->cpu_count == 0;
+    if (single && config->tile_rows == 0 && !config->adaptive) {
+        denoise_simd_format_view(img, format, a, b, c, padded_image, padded_laplace, padded_blur, result);
+        return 0;
+    }
+    struct shared shared = {
+        .config = config,
+        .work = denoise_band,
+        .img = img,
+        .format = format,
+        .width = img.width,
+        .height = img.height,
+        .a = a,
+        .b = b,
+        .c = c,
+        .padded_image = padded_image,
+        .padded_laplace = padded_laplace,
+        .padded_blur = padded_blur,
+        .result = result,
+    };
+    if (single) {
+        // one band processed in tiles on the calling thread, without tile rows the adaptive strength is picked for the whole image
+        shared.bands = 1;
+        denoise_band(&shared, 0, 0, img.height);
+        return 0;
+    }
+    return run_workers(&shared);
+}
+
+void numa_report(const char* name, const void* buffer, size_t size)
+{
+    unsigned long allowed[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    int mode;
+    size_t nodes = 0;
+    if (syscall(SYS_get_mempolicy, &mode, allowed, MAX_NUMA_NODES, NULL, MPOL_F_MEMS_ALLOWED) == 0) {
+        for (size_t i = 0; i < MAX_NUMA_NODES; i++)
+            nodes += (allowed[i / (8 * sizeof(unsigned long))] >> (i % (8 * sizeof(unsigned long)))) & 1;
+    }
+    if (nodes <= 1) {
+        printf("%s: single NUMA node, page placement not relevant\n", name);
+        return;
+    }
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)buffer & ~(uintptr_t)(page_size - 1);
+    size_t count = ((uintptr_t)buffer + size - first + page_size - 1) / page_size;
+    void** pages = malloc(count * sizeof(void*));
+    int* status = malloc(count * sizeof(int));
+    if (!pages || !status) {
+        printf("%s: could not allocate memory for the page placement report\n", name);
+        free(pages);
+        free(status);
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+        pages[i] = (void*)(first + i * page_size);
+
+    // move_pages() without target nodes only queries the node of every page
+    if (syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0) {
+        printf("%s: page placement not available (%s)\n", name, strerror(errno));
+    } else {
+        size_t per_node[MAX_NUMA_NODES] = { 0 };
+        size_t missing = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (status[i] >= 0 && status[i] < MAX_NUMA_NODES)
+                per_node[status[i]]++;
+            else
+                missing++;
+        }
+        printf("%s: %zu pages", name, count);
+        for (size_t node = 0; node < MAX_NUMA_NODES; node++) {
+            if (per_node[node])
+                printf(", node %zu: %zu (%.1f%%)", node, per_node[node], 100.0 * per_node[node] / count);
+        }
+        if (missing)
+            printf(", not present: %zu", missing);
+        printf("\n");
+    }
+    free(pages);
+    free(status);
+}
@@ -0,0 +1,70 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include "image.h"
+#include "view.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 256
+
+struct parallel_config {
+    size_t threads; // number of worker threads, each one works on its own horizontal band of the image
+    int cpus[MAX_THREADS]; // worker i is pinned to cpus[i % cpu_count]
+    size_t cpu_count; // 0 means the workers are not pinned
+    size_t tile_rows; // rows a worker processes through all stages at once, 0 means its whole band
+    int adaptive; // pick the strength of every tile from its noise, see adaptive_gain()
+};
+
+/**
+ * Parse an affinity list like "0,2,4-7" into config->cpus.
+ * Returns 0 on success and -1 if the list is malformed.
+ */
+int parse_affinity(const char* list, struct parallel_config* config);
+
+/**
+ * Create a thread pinned to config->cpus[index % config->cpu_count].
+ * The thread is not pinned if no cpus are configured or the cpu is not available.
+ * Returns 0 on success, like pthread_create().
+ */
+int create_pinned_thread(pthread_t* thread, const struct parallel_config* config, size_t index, void* (*start)(void*), void* arg);
+
+/**
+ * Load the pixels of an image band by band and zero the padded buffers band by band.
+ * Every worker first touches the memory it will work on in denoise_simd_parallel(),
+ * so on NUMA machines the pages are placed on the node of the worker.
+ * image->pixels must be allocated, but not touched, e.g. with malloc(). Only binary (P6) images can be loaded by band.
+ * @param fd: file descriptor of the input image, -1 if image->pixels is already loaded
+ * @param offset: offset of the pixel data, returned by read_image_header()
+ * Returns 0 on success.
+ */
+int first_touch_parallel(const struct parallel_config* config, int fd, long offset, const struct Netpbm* image,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur, uint8_t* result);
+
+/**
+ * Does the same as denoise_simd(), but every worker processes its own band of rows.
+ * The bands are the same as in first_touch_parallel().
+ * With config->tile_rows set, a band is processed in tiles of rows: grayscale, padding, convolution and combine
+ * run on one tile before the next, so the rows are still in the cache. This also works with a single thread.
+ * With config->adaptive set, the noise of every tile is estimated during its convolution and the strength of the blur
+ * is picked per tile, so the result depends on the tiles. A single thread without tile rows picks it for the whole image.
+ * Returns 0 on success.
+ */
+int denoise_simd_parallel(const struct parallel_config* config, const uint8_t* img, size_t width, size_t height,
+    float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
+    uint8_t* result);
+
+// Does the same as denoise_simd_parallel() on strided views of an image in the given format, like denoise_simd_format_view()
+int denoise_simd_parallel_view(const struct parallel_config* config, struct image_view img, enum pixel_format format,
+    float a, float b, float c,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur,
+    struct image_view result);
+
+/**
+ * Print on which NUMA node the pages of a buffer are placed.
+ * On single node machines or without support for move_pages() a short notice is printed instead.
+ */
+void numa_report(const char* name, const void* buffer, size_t size);
+
+#endif // PARALLEL_H
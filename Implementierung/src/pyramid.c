@@ -0,0 +1,210 @@
+#include "pyramid.h"
+#include <immintrin.h>
+
+size_t pyramid_levels(size_t width, size_t height, size_t levels)
+{
+    size_t count = 1;
+    while (count < levels && count < PYRAMID_MAX_LEVELS) {
+        width = PYRAMID_HALF(width);
+        height = PYRAMID_HALF(height);
+        if (width < PYRAMID_MIN_SIZE || height < PYRAMID_MIN_SIZE)
+            break;
+        count++;
+    }
+    return count;
+}
+
+size_t pyramid_scratch_size(size_t width, size_t height, size_t levels)
+{
+    // the sums of pyramid_down_simd() are the longer ones
+    size_t size = (width + 32) * sizeof(uint16_t);
+    levels = pyramid_levels(width, height, levels);
+    for (size_t level = 1; level < levels; level++) {
+        width = PYRAMID_HALF(width);
+        height = PYRAMID_HALF(height);
+        size += 2 * width * height;
+    }
+    return size;
+}
+
+static size_t clamp_index(long index, size_t size)
+{
+    return index < 0 ? 0 : (size_t)index >= size ? size - 1 : (size_t)index;
+}
+
+void pyramid_down(const uint8_t* image, size_t width, size_t height, uint8_t* result)
+{
+    const uint32_t weights[4] = { 1, 3, 3, 1 };
+    for (size_t y = 0; y < PYRAMID_HALF(height); y++) {
+        for (size_t x = 0; x < PYRAMID_HALF(width); x++) {
+            uint32_t sum = 0;
+            for (long i = 0; i < 4; i++) {
+                const uint8_t* row = image + clamp_index(2 * (long)y - 1 + i, height) * width;
+                for (long j = 0; j < 4; j++)
+                    sum += weights[i] * weights[j] * row[clamp_index(2 * (long)x - 1 + j, width)];
+            }
+            result[y * PYRAMID_HALF(width) + x] = (uint8_t)((sum + 32) / 64);
+        }
+    }
+}
+
+void pyramid_down_simd(const uint8_t* image, size_t width, size_t height, uint16_t* sums, uint8_t* result)
+{
+    pyramid_down_rows_simd(image, width, height, 0, PYRAMID_HALF(height), sums, result);
+}
+
+void pyramid_down_rows_simd(const uint8_t* image, size_t width, size_t height, size_t y0, size_t y1, uint16_t* sums, uint8_t* result)
+{
+    size_t half_width = PYRAMID_HALF(width);
+    const __m128i weights_13 = _mm_set1_epi32(3 << 16 | 1);
+    const __m128i weights_31 = _mm_set1_epi32(1 << 16 | 3);
+    const __m128i round = _mm_set1_epi32(32);
+    for (size_t y = y0; y < y1; y++) {
+        // column sums of rows 2y - 1 to 2y + 2 with weights 1, 3, 3, 1, sums[x + 1] is the sum of column x
+        const uint8_t* row0 = image + clamp_index(2 * (long)y - 1, height) * width;
+        const uint8_t* row1 = image + 2 * y * width;
+        const uint8_t* row2 = image + clamp_index(2 * (long)y + 1, height) * width;
+        const uint8_t* row3 = image + clamp_index(2 * (long)y + 2, height) * width;
+        size_t x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m128i outer = _mm_add_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&row0[x])),
+                _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&row3[x])));
+            __m128i inner = _mm_add_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&row1[x])),
+                _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&row2[x])));
+            __m128i sum = _mm_add_epi16(outer, _mm_add_epi16(inner, _mm_add_epi16(inner, inner)));
+            _mm_storeu_si128((__m128i*)&sums[x + 1], sum);
+        }
+        for (; x < width; x++)
+            sums[x + 1] = (uint16_t)(row0[x] + 3 * (row1[x] + row2[x]) + row3[x]);
+        // columns -1, width and width + 1 are the nearest edge columns
+        sums[0] = sums[1];
+        sums[width + 1] = sums[width];
+        sums[width + 2] = sums[width];
+
+        // pixel x takes columns 2x - 1 to 2x + 2, the sums of 2x - 1 and 2x with weights 1, 3 and of 2x + 1 and 2x + 2 with 3, 1
+        uint8_t* out = result + y * half_width;
+        x = 0;
+        for (; x + 8 <= half_width; x += 8) {
+            __m128i low = _mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)&sums[2 * x]), weights_13),
+                _mm_madd_epi16(_mm_loadu_si128((const __m128i*)&sums[2 * x + 2]), weights_31));
+            __m128i high = _mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)&sums[2 * x + 8]), weights_13),
+                _mm_madd_epi16(_mm_loadu_si128((const __m128i*)&sums[2 * x + 10]), weights_31));
+            low = _mm_srli_epi32(_mm_add_epi32(low, round), 6);
+            high = _mm_srli_epi32(_mm_add_epi32(high, round), 6);
+            __m128i pixels = _mm_packs_epi32(low, high);
+            _mm_storel_epi64((__m128i*)&out[x], _mm_packus_epi16(pixels, pixels));
+        }
+        for (; x < half_width; x++)
+            out[x] = (uint8_t)((sums[2 * x] + 3 * (sums[2 * x + 1] + sums[2 * x + 2]) + sums[2 * x + 3] + 32) / 64);
+    }
+}
+
+int pyramid_mean_change(const uint8_t* denoised, const uint8_t* original, size_t size)
+{
+    // both sums are taken against zero, their difference is the change
+    __m128i denoised_sum = _mm_setzero_si128(), original_sum = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        denoised_sum = _mm_add_epi64(denoised_sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)&denoised[i]), _mm_setzero_si128()));
+        original_sum = _mm_add_epi64(original_sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)&original[i]), _mm_setzero_si128()));
+    }
+    int64_t change = _mm_cvtsi128_si64(denoised_sum) + _mm_extract_epi64(denoised_sum, 1)
+        - _mm_cvtsi128_si64(original_sum) - _mm_extract_epi64(original_sum, 1);
+    for (; i < size; i++)
+        change += denoised[i] - original[i];
+    if (size == 0)
+        return 0;
+    // rounded to the nearest 1/16 in both directions
+    int64_t sixteenths = (change * 32 + (change < 0 ? -(int64_t)size : (int64_t)size)) / (2 * (int64_t)size);
+    return (int)sixteenths;
+}
+
+// Weighted difference rounded to the nearest 1/16, floor((sum + 8) / 16) like an arithmetic shift, sum is at least -8160
+static int up_correction(int sum)
+{
+    return (sum + 8 + 8192) / 16 - 512;
+}
+
+static uint8_t saturate(int value)
+{
+    return (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+void pyramid_up_add(const uint8_t* denoised, const uint8_t* original, const uint8_t* fine, size_t width, size_t height, int bias,
+    uint8_t* result)
+{
+    size_t half_width = PYRAMID_HALF(width), half_height = PYRAMID_HALF(height);
+    for (size_t y = 0; y < height; y++) {
+        // even rows lie between the coarse row above and their own, odd rows between their own and the one below
+        size_t row = y / 2, neighbour_row = clamp_index((long)row + (y % 2 ? 1 : -1), half_height);
+        for (size_t x = 0; x < width; x++) {
+            size_t column = x / 2, neighbour_column = clamp_index((long)column + (x % 2 ? 1 : -1), half_width);
+            size_t rows[2] = { row, neighbour_row }, columns[2] = { column, neighbour_column };
+            const int weights[2] = { 3, 1 };
+            int sum = 0;
+            for (size_t i = 0; i < 2; i++) {
+                for (size_t j = 0; j < 2; j++) {
+                    size_t index = rows[i] * half_width + columns[j];
+                    sum += weights[i] * weights[j] * (denoised[index] - original[index]);
+                }
+            }
+            result[y * width + x] = saturate(fine[y * width + x] + up_correction(sum - bias));
+        }
+    }
+}
+
+void pyramid_up_add_simd(const uint8_t* denoised, const uint8_t* original, const uint8_t* fine, size_t width, size_t height, int bias,
+    int16_t* sums, uint8_t* result, uint16_t* padded_image)
+{
+    size_t half_width = PYRAMID_HALF(width), half_height = PYRAMID_HALF(height);
+    const __m128i round = _mm_set1_epi16((short)(8 - bias));
+    for (size_t y = 0; y < height; y++) {
+        // differences of the coarse row with weight 3 and its neighbour with weight 1, sums[x + 1] is the sum of column x
+        size_t row = y / 2 * half_width, neighbour_row = clamp_index((long)(y / 2) + (y % 2 ? 1 : -1), half_height) * half_width;
+        size_t x = 0;
+        for (; x + 8 <= half_width; x += 8) {
+            __m128i own = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&denoised[row + x])),
+                _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&original[row + x])));
+            __m128i neighbour = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&denoised[neighbour_row + x])),
+                _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&original[neighbour_row + x])));
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(own, _mm_add_epi16(own, own)), neighbour);
+            _mm_storeu_si128((__m128i*)&sums[x + 1], sum);
+        }
+        for (; x < half_width; x++) {
+            sums[x + 1] = (int16_t)(3 * (denoised[row + x] - original[row + x])
+                + denoised[neighbour_row + x] - original[neighbour_row + x]);
+        }
+        sums[0] = sums[1];
+        sums[half_width + 1] = sums[half_width];
+
+        // even columns take the coarse column to their left, odd columns the one to their right with weight 1
+        const uint8_t* in = fine + y * width;
+        uint8_t* out = result + y * width;
+        uint16_t* padded_row = padded_image ? padded_image + (y + 1) * (width + 2) + 1 : NULL;
+        x = 0;
+        for (; 2 * x + 16 <= width; x += 8) {
+            __m128i own = _mm_loadu_si128((const __m128i*)&sums[x + 1]);
+            __m128i own_3 = _mm_add_epi16(own, _mm_add_epi16(own, own));
+            __m128i even = _mm_add_epi16(own_3, _mm_loadu_si128((const __m128i*)&sums[x]));
+            __m128i odd = _mm_add_epi16(own_3, _mm_loadu_si128((const __m128i*)&sums[x + 2]));
+            even = _mm_srai_epi16(_mm_add_epi16(even, round), 4);
+            odd = _mm_srai_epi16(_mm_add_epi16(odd, round), 4);
+            __m128i pixels = _mm_loadu_si128((const __m128i*)&in[2 * x]);
+            __m128i low = _mm_add_epi16(_mm_cvtepu8_epi16(pixels), _mm_unpacklo_epi16(even, odd));
+            __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(pixels, _mm_setzero_si128()), _mm_unpackhi_epi16(even, odd));
+            pixels = _mm_packus_epi16(low, high);
+            _mm_storeu_si128((__m128i*)&out[2 * x], pixels);
+            if (padded_image) {
+                _mm_storeu_si128((__m128i*)&padded_row[2 * x], _mm_cvtepu8_epi16(pixels));
+                _mm_storeu_si128((__m128i*)&padded_row[2 * x + 8], _mm_unpackhi_epi8(pixels, _mm_setzero_si128()));
+            }
+        }
+        for (x *= 2; x < width; x++) {
+            size_t column = x / 2 + 1;
+            int sum = 3 * sums[column] + sums[x % 2 ? column + 1 : column - 1];
+            out[x] = saturate(in[x] + up_correction(sum - bias));
+            if (padded_image)
+                padded_row[x] = out[x];
+        }
+    }
+}
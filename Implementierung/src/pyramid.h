@@ -0,0 +1,70 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+#include <stddef.h>
+#include <stdint.h>
+
+// levels of a pyramid including the full resolution, 5 levels denoise features of up to about 16 times the size of a pixel
+#define PYRAMID_MAX_LEVELS 6
+// smallest width and height of a level, smaller levels are not built
+#define PYRAMID_MIN_SIZE 8
+
+// size of the next smaller level of a width or height
+#define PYRAMID_HALF(size) (((size) + 1) / 2)
+
+/**
+ * Number of levels of at most the requested number whose width and height are at least PYRAMID_MIN_SIZE,
+ * at least 1 for the full resolution.
+ */
+size_t pyramid_levels(size_t width, size_t height, size_t levels);
+
+// Bytes of scratch memory denoise_pyramid() needs: both images of every smaller level and a row of 16 bit sums
+size_t pyramid_scratch_size(size_t width, size_t height, size_t levels);
+
+/**
+ * Downsample a grayscale image to PYRAMID_HALF(width) x PYRAMID_HALF(height) pixels with the binomial kernel
+ * [1 3 3 1] / 8 along both axes, the 4x4 window of a pixel is centered between the 2x2 pixels it replaces.
+ * Pixels outside the image are replaced by the nearest edge pixel. The sum is rounded to 8 bits.
+ */
+void pyramid_down(const uint8_t* image, size_t width, size_t height, uint8_t* result);
+
+/**
+ * Does the same as pyramid_down(), optimized using SSE, SSE4.1 is required. The result is exact.
+ * The columns are summed first, then the weights of the columns are applied to pairs of sums with a multiply-add.
+ * @param sums: width + 32 16 bit sums of a row
+ */
+void pyramid_down_simd(const uint8_t* image, size_t width, size_t height, uint16_t* sums, uint8_t* result);
+
+/**
+ * Does the same as pyramid_down_simd() for the rows y0 to y1 - 1 of the result, which need the rows up to 2 * y1
+ * of the image, so the rows can be downsampled while they are still in the cache.
+ */
+void pyramid_down_rows_simd(const uint8_t* image, size_t width, size_t height, size_t y0, size_t y1, uint16_t* sums, uint8_t* result);
+
+/**
+ * Change of the mean of a denoised level in 1/16, rounded. The blur keeps the mean, only the truncation of the combine
+ * makes the denoised level about a gray value darker, which would add up over the levels.
+ * Summed with _mm_sad_epu8(), SSE4.1 is required.
+ */
+int pyramid_mean_change(const uint8_t* denoised, const uint8_t* original, size_t size);
+
+/**
+ * Add the change a coarser level got by denoising to the next finer level: the difference denoised - original
+ * of the coarse level is upsampled bilinearly, with weights 3/4 and 1/4 along both axes like the inverse of pyramid_down(),
+ * and added to fine with saturation. Pixels outside the coarse level are replaced by the nearest edge pixel.
+ * @param denoised, original: PYRAMID_HALF(width) x PYRAMID_HALF(height) pixels
+ * @param bias: subtracted from the difference in 1/16, e.g. pyramid_mean_change(), between -4080 and 4080
+ * @param result: width x height pixels, may be the same as fine
+ */
+void pyramid_up_add(const uint8_t* denoised, const uint8_t* original, const uint8_t* fine, size_t width, size_t height, int bias,
+    uint8_t* result);
+
+/**
+ * Does the same as pyramid_up_add(), optimized using SSE, SSE4.1 is required. The result is exact.
+ * @param sums: PYRAMID_HALF(width) + 32 16 bit sums of a row
+ * @param padded_image: NULL, or the result is also written into it like pad_image_simd() does with width + 2 columns,
+ * which saves the padding of the level, the border is not written
+ */
+void pyramid_up_add_simd(const uint8_t* denoised, const uint8_t* original, const uint8_t* fine, size_t width, size_t height, int bias,
+    int16_t* sums, uint8_t* result, uint16_t* padded_image);
+
+#endif // PYRAMID_H
@@ -0,0 +1,252 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tiled.h"
+#include "denoise.h"
+#include "image.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// smallest tile that is worth the overhead of the halo
+#define MIN_TILE_SIZE 8
+
+struct tiled_job {
+    const struct parallel_config* config;
+    int input_fd;
+    int output_fd;
+    long input_offset;
+    long output_offset;
+    size_t width;
+    size_t height;
+    float a, b, c;
+    struct tile_size tile;
+    size_t tiles_x;
+    size_t tiles;
+    atomic_size_t next; // index of the next tile that is not taken by a worker yet
+    atomic_size_t workers; // started workers, every worker has its own track in the trace
+    atomic_int failed;
+};
+
+// bytes needed for the buffers of one tile, the region of a tile includes the halo
+static size_t tile_bytes(size_t tile_width, size_t tile_height)
+{
+    size_t region = (tile_width + 2) * (tile_height + 2);
+    size_t padded_region = (tile_width + 4) * (tile_height + 4);
+    // RGB region, denoised region and three padded uint16_t buffers
+    return region * 3 + region + padded_region * 3 * sizeof(uint16_t);
+}
+
+int choose_tile_size(size_t width, size_t height, size_t budget, size_t threads, struct tile_size* tile)
+{
+    size_t per_tile = budget / (threads ? threads : 1);
+    // whole rows if enough of them fit
+    size_t rows = per_tile / ((width + 4) * 10);
+    if (rows > height)
+        rows = height;
+    while (rows > 0 && tile_bytes(width, rows) > per_tile)
+        rows--;
+    if (rows >= MIN_TILE_SIZE || rows == height) {
+        tile->width = width;
+        tile->height = rows;
+        return rows ? 0 : -1;
+    }
+    // otherwise square tiles, reduced until they fit
+    size_t side = (size_t)sqrt((double)per_tile / 10);
+    while (side >= MIN_TILE_SIZE && tile_bytes(side, side) > per_tile)
+        side--;
+    if (side < MIN_TILE_SIZE)
+        return -1;
+    tile->width = side < width ? side : width;
+    tile->height = side < height ? side : height;
+    return 0;
+}
+
+static int pread_full(int fd, uint8_t* buffer, size_t size, off_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pread(fd, buffer, size, offset);
+        if (n <= 0)
+            return -1;
+        buffer += n;
+        offset += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+static int pwrite_full(int fd, const uint8_t* buffer, size_t size, off_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buffer, size, offset);
+        if (n <= 0)
+            return -1;
+        buffer += n;
+        offset += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+// Denoise one tile, the region around the tile is read with a halo of 1 pixel where the image has pixels
+static int process_tile(struct tiled_job* job, size_t index, uint8_t* rgb, uint8_t* denoised,
+    uint16_t* padded_image, uint16_t* padded_laplace, uint16_t* padded_blur)
+{
+    size_t width = job->width;
+    size_t x0 = (index % job->tiles_x) * job->tile.width;
+    size_t y0 = (index / job->tiles_x) * job->tile.height;
+    size_t x1 = x0 + job->tile.width < width ? x0 + job->tile.width : width;
+    size_t y1 = y0 + job->tile.height < job->height ? y0 + job->tile.height : job->height;
+    size_t region_x0 = x0 ? x0 - 1 : 0;
+    size_t region_y0 = y0 ? y0 - 1 : 0;
+    size_t region_x1 = x1 < width ? x1 + 1 : width;
+    size_t region_y1 = y1 < job->height ? y1 + 1 : job->height;
+    size_t region_width = region_x1 - region_x0;
+    size_t region_height = region_y1 - region_y0;
+
+    int failed = 0;
+    TRACE_BEGIN("read");
+    if (region_width == width) {
+        // the region is one contiguous block of the file
+        failed = pread_full(job->input_fd, rgb, region_width * region_height * 3, job->input_offset + (off_t)(region_y0 * width * 3));
+    } else {
+        for (size_t y = 0; y < region_height && !failed; y++) {
+            off_t offset = job->input_offset + (off_t)(((region_y0 + y) * width + region_x0) * 3);
+            failed = pread_full(job->input_fd, rgb + y * region_width * 3, region_width * 3, offset);
+        }
+    }
+    TRACE_END("read");
+    if (failed)
+        return -1;
+
+    // the border of the padded image must be zero, it can contain pixels of a larger tile processed before
+    size_t padded_width = region_width + 2;
+    size_t padded_height = region_height + 2;
+    memset(padded_image, 0, padded_width * sizeof(uint16_t));
+    memset(padded_image + (padded_height - 1) * padded_width, 0, padded_width * sizeof(uint16_t));
+    for (size_t y = 1; y < padded_height - 1; y++) {
+        padded_image[y * padded_width] = 0;
+        padded_image[y * padded_width + padded_width - 1] = 0;
+    }
+    // the pixels of the halo are denoised as well, but with missing neighbours, they are not written
+    denoise_simd(rgb, region_width, region_height, job->a, job->b, job->c, padded_image, padded_laplace, padded_blur, denoised);
+
+    const uint8_t* tile = denoised + (y0 - region_y0) * region_width + (x0 - region_x0);
+    TRACE_BEGIN("write");
+    if (x1 - x0 == width) {
+        failed = pwrite_full(job->output_fd, tile, (y1 - y0) * width, job->output_offset + (off_t)(y0 * width));
+    } else {
+        for (size_t y = y0; y < y1 && !failed; y++)
+            failed = pwrite_full(job->output_fd, tile + (y - y0) * region_width, x1 - x0, job->output_offset + (off_t)(y * width + x0));
+    }
+    TRACE_END("write");
+    return failed ? -1 : 0;
+}
+
+static void* tile_worker(void* arg)
+{
+    struct tiled_job* job = arg;
+    trace_thread(atomic_fetch_add(&job->workers, 1) + 1);
+    size_t region = (job->tile.width + 2) * (job->tile.height + 2);
+    size_t padded_region = (job->tile.width + 4) * (job->tile.height + 4);
+    // allocated by the worker itself, so the buffers are placed on its NUMA node
+    uint8_t* rgb = malloc(region * 3);
+    uint8_t* denoised = malloc(region);
+    uint16_t* padded_image = malloc(padded_region * sizeof(uint16_t));
+    uint16_t* padded_laplace = malloc(padded_region * sizeof(uint16_t));
+    uint16_t* padded_blur = malloc(padded_region * sizeof(uint16_t));
+
+    if (!rgb || !denoised || !padded_image || !padded_laplace || !padded_blur) {
+        job->failed = 1;
+    } else {
+        size_t index;
+        while (!job->failed && (index = atomic_fetch_add(&job->next, 1)) < job->tiles) {
+            if (process_tile(job, index, rgb, denoised, padded_image, padded_laplace, padded_blur))
+                job->failed = 1;
+        }
+    }
+    free(rgb);
+    free(denoised);
+    free(padded_image);
+    free(padded_laplace);
+    free(padded_blur);
+    return NULL;
+}
+
+int denoise_tiled(const char* input_path, const char* output_path, float a, float b, float c,
+    size_t budget, const struct parallel_config* config)
+{
+    struct Netpbm image;
+    long input_offset = read_image_header(input_path, &image);
+    if (image.magicNumber[1] != '6') {
+        fprintf(stderr, "Only binary PPM (P6) is supported in the out-of-core mode!\n");
+        return EXIT_FAILURE;
+    }
+
+    struct tiled_job job = {
+        .config = config,
+        .input_offset = input_offset,
+        .width = image.width,
+        .height = image.height,
+        .a = a,
+        .b = b,
+        .c = c,
+    };
+    size_t threads = config->threads ? config->threads : 1;
+    if (choose_tile_size(image.width, image.height, budget, threads, &job.tile)) {
+        fprintf(stderr, "Memory budget is too small for the out-of-core mode!\n");
+        return EXIT_FAILURE;
+    }
+    job.tiles_x = (image.width + job.tile.width - 1) / job.tile.width;
+    job.tiles = job.tiles_x * ((image.height + job.tile.height - 1) / job.tile.height);
+    if (threads > job.tiles)
+        threads = job.tiles;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.workers, 0);
+    atomic_init(&job.failed, 0);
+    printf("Processing %zu tiles of %zux%zu pixels, %zu in flight\n", job.tiles, job.tile.width, job.tile.height, threads);
+
+    job.input_fd = open(input_path, O_RDONLY);
+    if (job.input_fd < 0) {
+        fprintf(stderr, "Could not open input file!\n");
+        return EXIT_FAILURE;
+    }
+    job.output_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (job.output_fd < 0) {
+        fprintf(stderr, "Could not open/create output file!\n");
+        close(job.input_fd);
+        return EXIT_FAILURE;
+    }
+    // same header as write_image(), the file is sized up front so that the tiles can be written in any order
+    char header[64];
+    int header_size = snprintf(header, sizeof(header), "P5\n%zu %zu\n%u\n", image.width, image.height, image.maxValue);
+    job.output_offset = header_size;
+    if (pwrite_full(job.output_fd, (const uint8_t*)header, (size_t)header_size, 0)
+        || ftruncate(job.output_fd, (off_t)header_size + (off_t)(image.width * image.height))) {
+        fprintf(stderr, "Could not write image to file!\n");
+        close(job.input_fd);
+        close(job.output_fd);
+        return EXIT_FAILURE;
+    }
+
+    pthread_t workers[MAX_THREADS];
+    size_t created = 0;
+    for (; created < threads; created++) {
+        if (create_pinned_thread(&workers[created], config, created, tile_worker, &job))
+            break;
+    }
+    // the workers take the tiles one by one, so any number of started workers processes all tiles
+    if (created == 0)
+        job.failed = 1;
+    for (size_t i = 0; i < created; i++)
+        pthread_join(workers[i], NULL);
+
+    close(job.input_fd);
+    if (close(job.output_fd) || job.failed) {
+        fprintf(stderr, "Could not denoise the image tile by tile!\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
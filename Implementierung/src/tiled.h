@@ -0,0 +1,35 @@
+#ifndef TILED_H
+#define TILED_H
+#include "parallel.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Size of the tiles used by denoise_tiled().
+ * Every tile is read with a halo of 1 pixel, so the tiles can be denoised independently.
+ */
+struct tile_size {
+    size_t width;
+    size_t height;
+};
+
+/**
+ * Choose the size of the tiles, so that config->threads tiles in flight fit into the memory budget.
+ * Whole rows are preferred, because then a tile is one contiguous block in the input and output file.
+ * Returns 0 on success and -1 if the budget is too small.
+ */
+int choose_tile_size(size_t width, size_t height, size_t budget, size_t threads, struct tile_size* tile);
+
+/**
+ * Denoise a PPM image with the SIMD version without loading the whole image into memory.
+ * The image is processed in tiles: every tile is read with pread() including its halo,
+ * denoised with denoise_simd() and written with pwrite() at its offset in the pre-sized PGM output file.
+ * config->threads tiles are in flight in parallel, one per worker thread.
+ * The result is the same as denoise_simd() on the whole image.
+ * @param budget: maximum number of bytes used for the buffers of all tiles in flight
+ * Returns 0 on success.
+ */
+int denoise_tiled(const char* input_path, const char* output_path, float a, float b, float c,
+    size_t budget, const struct parallel_config* config);
+
+#endif // TILED_H
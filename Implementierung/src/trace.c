@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// events per chunk of a buffer, a full chunk is followed by a new one
+#define TRACE_CHUNK_EVENTS 4096
+
+struct trace_record {
+    const char* name;
+    const char* detail; // NULL without a detail
+    uint64_t time; // nanoseconds of CLOCK_MONOTONIC
+    char phase;
+};
+
+struct trace_chunk {
+    struct trace_record records[TRACE_CHUNK_EVENTS];
+    size_t count;
+    struct trace_chunk* next;
+};
+
+// Events of one thread, only written by that thread and read by trace_stop() after it finished
+struct trace_buffer {
+    struct trace_chunk* first;
+    struct trace_chunk* last;
+    size_t thread; // track of the thread, 0 is the main thread
+    size_t dropped; // events lost because no chunk could be allocated
+    struct trace_buffer* next;
+};
+
+int trace_on = 0;
+static uint64_t origin;
+static _Atomic(struct trace_buffer*) buffers = NULL;
+// the buffer of a thread belongs to the recording it was created in, buffers of earlier recordings are freed
+static unsigned recording = 0;
+static _Thread_local struct trace_buffer* own_buffer = NULL;
+static _Thread_local unsigned own_recording = 0;
+static _Thread_local size_t own_thread = 0;
+
+static uint64_t now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+// Buffer of the calling thread, created and linked into the list on its first event
+static struct trace_buffer* thread_buffer(void)
+{
+    if (own_buffer && own_recording == recording)
+        return own_buffer;
+    struct trace_buffer* buffer = calloc(1, sizeof(struct trace_buffer));
+    if (!buffer)
+        return NULL;
+    buffer->thread = own_thread;
+    buffer->next = atomic_load(&buffers);
+    while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer))
+        ;
+    own_buffer = buffer;
+    own_recording = recording;
+    return buffer;
+}
+
+void trace_event(const char* name, const char* detail, char phase)
+{
+    uint64_t time = now();
+    struct trace_buffer* buffer = thread_buffer();
+    if (!buffer)
+        return;
+    struct trace_chunk* chunk = buffer->last;
+    if (!chunk || chunk->count == TRACE_CHUNK_EVENTS) {
+        chunk = malloc(sizeof(struct trace_chunk));
+        if (!chunk) {
+            buffer->dropped++;
+            return;
+        }
+        chunk->count = 0;
+        chunk->next = NULL;
+        if (buffer->last)
+            buffer->last->next = chunk;
+        else
+            buffer->first = chunk;
+        buffer->last = chunk;
+    }
+    chunk->records[chunk->count++] = (struct trace_record) { .name = name, .detail = detail, .time = time, .phase = phase };
+}
+
+void trace_thread(size_t index)
+{
+    own_thread = index;
+    if (own_buffer && own_recording == recording)
+        own_buffer->thread = index;
+}
+
+void trace_start(void)
+{
+    origin = now();
+    trace_on = 1;
+}
+
+// JSON string without the quotes
+static void write_escaped(FILE* file, const char* text)
+{
+    for (; *text; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+}
+
+static void write_events(FILE* file, const struct trace_buffer* list)
+{
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"denoise\"}}");
+    // the buffers of the workers of several runs share the track of their index
+    for (const struct trace_buffer* buffer = list; buffer; buffer = buffer->next) {
+        const struct trace_buffer* earlier = list;
+        while (earlier != buffer && earlier->thread != buffer->thread)
+            earlier = earlier->next;
+        if (earlier != buffer)
+            continue;
+        if (buffer->thread == 0)
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}");
+        else
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"worker %zu\"}}", buffer->thread, buffer->thread);
+    }
+    for (const struct trace_buffer* buffer = list; buffer; buffer = buffer->next) {
+        for (const struct trace_chunk* chunk = buffer->first; chunk; chunk = chunk->next) {
+            for (size_t i = 0; i < chunk->count; i++) {
+                const struct trace_record* record = &chunk->records[i];
+                // microseconds since trace_start()
+                double time = (double)(int64_t)(record->time - origin) * 1e-3;
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%zu", record->name, record->phase, time, buffer->thread);
+                if (record->detail) {
+                    fprintf(file, ",\"args\":{\"detail\":\"");
+                    write_escaped(file, record->detail);
+                    fprintf(file, "\"}");
+                }
+                fprintf(file, "}");
+            }
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+int trace_stop(const char* path)
+{
+    trace_on = 0;
+    struct trace_buffer* list = atomic_exchange(&buffers, NULL);
+    int status = 0;
+    if (path) {
+        FILE* file = fopen(path, "w");
+        if (file) {
+            write_events(file, list);
+            status = fclose(file) == 0 ? 0 : -1;
+        } else {
+            status = -1;
+        }
+    }
+    size_t dropped = 0;
+    while (list) {
+        struct trace_buffer* next = list->next;
+        dropped += list->dropped;
+        while (list->first) {
+            struct trace_chunk* chunk = list->first->next;
+            free(list->first);
+            list->first = chunk;
+        }
+        free(list);
+        list = next;
+    }
+    if (dropped)
+        fprintf(stderr, "%zu trace events were dropped, because no memory was left for them\n", dropped);
+    // the buffers of all threads are freed, the next recording starts with new ones
+    recording++;
+    own_buffer = NULL;
+    return status;
+}
@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stddef.h>
+
+// set by trace_start(), without tracing every event costs only the check of this flag
+extern int trace_on;
+
+// Begin and end of a stage on the calling thread, name must be a string literal
+#define TRACE_BEGIN(name)                  \
+    do {                                   \
+        if (trace_on)                      \
+            trace_event(name, NULL, 'B');  \
+    } while (0)
+#define TRACE_END(name)                    \
+    do {                                   \
+        if (trace_on)                      \
+            trace_event(name, NULL, 'E');  \
+    } while (0)
+// Begin of a stage with a detail shown in its arguments, e.g. the input file of a frame, it must live until trace_stop()
+#define TRACE_BEGIN_DETAIL(name, detail)     \
+    do {                                     \
+        if (trace_on)                        \
+            trace_event(name, detail, 'B');  \
+    } while (0)
+
+/**
+ * Record an event with the current time into the buffer of the calling thread.
+ * Every thread appends to its own buffer, the buffers are only linked into the list of all buffers once
+ * with a compare and swap, so threads never wait for each other. Use the macros, they skip the call without tracing.
+ * @param phase: 'B' for the begin and 'E' for the end of a stage, like the Chrome trace event format
+ */
+void trace_event(const char* name, const char* detail, char phase);
+
+// Name the track of the calling thread, e.g. the index of a worker. Threads without a name are shown as the main thread.
+void trace_thread(size_t index);
+
+// Start recording, the times of the events are relative to this call. The threads must be started after it.
+void trace_start(void);
+
+/**
+ * Stop recording and write all events in the Chrome trace event format, for chrome://tracing or Perfetto.
+ * The threads that recorded events must have finished. The buffers are freed, path NULL only discards the events.
+ * Returns 0 on success and -1 if the file can't be written.
+ */
+int trace_stop(const char* path);
+
+#endif // TRACE_H
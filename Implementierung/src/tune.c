@@ -0,0 +1,214 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tune.h"
+#include "denoise.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WISDOM_MAGIC "denoise-wisdom"
+#define WISDOM_VERSION 1
+// every candidate is repeated until it ran this long, the fastest run counts
+#define MIN_MEASURE_TIME 0.2
+#define MAX_REPETITIONS 20
+
+// default coefficients, the runtime doesn't depend on them
+#define COEFF_A 0.2126f
+#define COEFF_B 0.7152f
+#define COEFF_C 0.0722f
+
+static const size_t size_classes[][2] = {
+    { 64, 64 },
+    { 320, 240 },
+    { 1280, 720 },
+    { 1920, 1080 },
+    { 3840, 2160 },
+};
+static const size_t tile_rows_candidates[] = { 0, 8, 32, 128 };
+
+struct buffers {
+    uint8_t* img;
+    uint8_t* tmp1;
+    uint8_t* tmp2;
+    uint8_t* result;
+    uint16_t* padded_image;
+    uint16_t* padded_laplace;
+    uint16_t* padded_blur;
+};
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Runtime of the fastest of several runs of one configuration, negative on failure
+static double measure(const struct wisdom_entry* candidate, const struct parallel_config* base, struct buffers* buffers)
+{
+    struct parallel_config config = *base;
+    config.threads = candidate->threads;
+    config.tile_rows = candidate->tile_rows;
+    size_t width = candidate->width, height = candidate->height;
+
+    double best = INFINITY, total = 0;
+    // the first run is not counted, it warms up the caches
+    for (int i = 0; i <= MAX_REPETITIONS && total < MIN_MEASURE_TIME; i++) {
+        double start = now();
+        if (candidate->version == 2) {
+            denoise(buffers->img, width, height, COEFF_A, COEFF_B, COEFF_C, buffers->tmp1, buffers->tmp2, buffers->result);
+        } else if (candidate->version == 1) {
+            denoise_integer(buffers->img, width, height, COEFF_A, COEFF_B, COEFF_C, buffers->tmp1, buffers->tmp2, buffers->result);
+        } else if (denoise_simd_parallel(&config, buffers->img, width, height, COEFF_A, COEFF_B, COEFF_C,
+                       buffers->padded_image, buffers->padded_laplace, buffers->padded_blur, buffers->result)) {
+            return -1;
+        }
+        double time_taken = now() - start;
+        if (i > 0) {
+            total += time_taken;
+            if (time_taken < best)
+                best = time_taken;
+        }
+    }
+    return best;
+}
+
+int tune(const char* path, const struct parallel_config* config)
+{
+    size_t max_pixels = 0;
+    for (size_t i = 0; i < sizeof(size_classes) / sizeof(size_classes[0]); i++) {
+        if (size_classes[i][0] * size_classes[i][1] > max_pixels)
+            max_pixels = size_classes[i][0] * size_classes[i][1];
+    }
+    // one set of buffers for the largest size class, large enough for the padded buffers of every class
+    // the results are not used, so the borders of the padded buffers don't have to be zeroed between the classes
+    size_t padded_size = max_pixels + 2 * 3840 + 2 * 2160 + 4;
+    struct buffers buffers = {
+        .img = malloc(max_pixels * 3),
+        .tmp1 = malloc(max_pixels),
+        .tmp2 = malloc(max_pixels),
+        .result = malloc(max_pixels),
+        .padded_image = calloc(padded_size, sizeof(uint16_t)),
+        .padded_laplace = calloc(padded_size, sizeof(uint16_t)),
+        .padded_blur = calloc(padded_size, sizeof(uint16_t)),
+    };
+    int status = EXIT_FAILURE;
+    if (!buffers.img || !buffers.tmp1 || !buffers.tmp2 || !buffers.result || !buffers.padded_image || !buffers.padded_laplace || !buffers.padded_blur) {
+        fprintf(stderr, "Could not allocate memory for tuning!\n");
+        goto cleanup;
+    }
+    // noise, the runtime of the versions doesn't depend on the content
+    uint32_t seed = 1;
+    for (size_t i = 0; i < max_pixels * 3; i++) {
+        seed = seed * 1103515245 + 12345;
+        buffers.img[i] = (uint8_t)(seed >> 16);
+    }
+
+    long cpus = config->cpu_count ? (long)config->cpu_count : sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    if (cpus > MAX_THREADS)
+        cpus = MAX_THREADS;
+
+    struct wisdom wisdom = { .count = 0 };
+    for (size_t i = 0; i < sizeof(size_classes) / sizeof(size_classes[0]); i++) {
+        struct wisdom_entry best = { .seconds = INFINITY };
+        struct wisdom_entry candidate = { .width = size_classes[i][0], .height = size_classes[i][1] };
+        // the SISD versions, then the SIMD version with 1, 2, 4, ... threads and all numbers of tile rows
+        for (candidate.version = 2; candidate.version >= 0; candidate.version--) {
+            size_t max_threads = candidate.version == 0 ? (size_t)cpus : 1;
+            for (candidate.threads = 1; candidate.threads <= max_threads;) {
+                size_t tiles = candidate.version == 0 ? sizeof(tile_rows_candidates) / sizeof(tile_rows_candidates[0]) : 1;
+                for (size_t t = 0; t < tiles; t++) {
+                    candidate.tile_rows = tile_rows_candidates[t];
+                    candidate.seconds = measure(&candidate, config, &buffers);
+                    if (candidate.seconds < 0) {
+                        fprintf(stderr, "Could not start threads for tuning!\n");
+                        goto cleanup;
+                    }
+                    if (candidate.seconds < best.seconds)
+                        best = candidate;
+                }
+                // powers of two and the number of cpus
+                if (candidate.threads == max_threads)
+                    break;
+                candidate.threads = candidate.threads * 2 < max_threads ? candidate.threads * 2 : max_threads;
+            }
+        }
+        printf("Size class %zux%zu: version %d, %zu threads, tiles of %zu rows, %f seconds\n",
+            best.width, best.height, best.version, best.threads, best.tile_rows, best.seconds);
+        wisdom.entries[wisdom.count++] = best;
+    }
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not open/create wisdom file!\n");
+        goto cleanup;
+    }
+    fprintf(file, "%s %d\n", WISDOM_MAGIC, WISDOM_VERSION);
+    fprintf(file, "# width height version threads tile_rows seconds\n");
+    for (size_t i = 0; i < wisdom.count; i++) {
+        const struct wisdom_entry* entry = &wisdom.entries[i];
+        fprintf(file, "%zu %zu %d %zu %zu %.9f\n", entry->width, entry->height, entry->version, entry->threads, entry->tile_rows, entry->seconds);
+    }
+    if (fclose(file) == 0) {
+        printf("Wisdom written to %s\n", path);
+        status = EXIT_SUCCESS;
+    } else {
+        fprintf(stderr, "Could not write wisdom file!\n");
+    }
+
+cleanup:
+    free(buffers.img);
+    free(buffers.tmp1);
+    free(buffers.tmp2);
+    free(buffers.result);
+    free(buffers.padded_image);
+    free(buffers.padded_laplace);
+    free(buffers.padded_blur);
+    return status;
+}
+
+int load_wisdom(const char* path, struct wisdom* wisdom)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -1;
+    char magic[sizeof(WISDOM_MAGIC)];
+    int version;
+    if (fscanf(file, "%14s %d", magic, &version) != 2 || strcmp(magic, WISDOM_MAGIC) != 0 || version != WISDOM_VERSION) {
+        fclose(file);
+        return -1;
+    }
+    wisdom->count = 0;
+    char line[256];
+    while (wisdom->count < MAX_WISDOM && fgets(line, sizeof(line), file)) {
+        struct wisdom_entry entry;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%zu %zu %d %zu %zu %lf", &entry.width, &entry.height, &entry.version, &entry.threads, &entry.tile_rows, &entry.seconds) != 6
+            || entry.width == 0 || entry.height == 0 || entry.version < 0 || entry.version > 2 || entry.threads < 1 || entry.threads > MAX_THREADS) {
+            fclose(file);
+            return -1;
+        }
+        wisdom->entries[wisdom->count++] = entry;
+    }
+    fclose(file);
+    return wisdom->count ? 0 : -1;
+}
+
+const struct wisdom_entry* lookup_wisdom(const struct wisdom* wisdom, size_t width, size_t height)
+{
+    // the size classes are compared by the ratio of the numbers of pixels
+    const struct wisdom_entry* best = NULL;
+    double best_distance = INFINITY;
+    for (size_t i = 0; i < wisdom->count; i++) {
+        double distance = fabs(log((double)(width * height) / (double)(wisdom->entries[i].width * wisdom->entries[i].height)));
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = &wisdom->entries[i];
+        }
+    }
+    return best;
+}
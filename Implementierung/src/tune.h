@@ -0,0 +1,38 @@
+#ifndef TUNE_H
+#define TUNE_H
+#include "parallel.h"
+#include <stdlib.h>
+
+#define MAX_WISDOM 16
+
+// Fastest configuration measured for one size class
+struct wisdom_entry {
+    size_t width; // size of the image the configurations were measured with
+    size_t height;
+    int version; // 0: SIMD, 1: integer SISD, 2: accurate SISD, like option -V
+    size_t threads;
+    size_t tile_rows;
+    double seconds; // measured runtime per image
+};
+
+// Fastest configurations of all size classes, like FFTW wisdom only valid for the machine it was measured on
+struct wisdom {
+    size_t count;
+    struct wisdom_entry entries[MAX_WISDOM];
+};
+
+/**
+ * Benchmark the candidate configurations for a set of size classes and write the fastest ones to a wisdom file.
+ * The candidates are the SISD versions and the SIMD version with different numbers of threads and tile rows.
+ * @param config: the cpus the threads are pinned to while measuring, if any
+ * Returns 0 on success.
+ */
+int tune(const char* path, const struct parallel_config* config);
+
+// Read a wisdom file written by tune(), returns 0 on success and -1 if the file is missing or invalid
+int load_wisdom(const char* path, struct wisdom* wisdom);
+
+// Entry of the size class closest to the size of the image, NULL if there are no entries
+const struct wisdom_entry* lookup_wisdom(const struct wisdom* wisdom, size_t width, size_t height);
+
+#endif // TUNE_H
@@ -0,0 +1,56 @@
+#ifndef VIEW_H
+#define VIEW_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * View of an image or a region of an image in a larger buffer.
+ * Rows don't have to follow each other directly, e.g. frame buffers with a row pitch aligned to 64 bytes
+ * or a crop window of a larger image, so they can be processed without copying them into a packed buffer first.
+ * Views given as input are only read, even though pixels is not const.
+ */
+struct image_view {
+    uint8_t* pixels; // first pixel of the view
+    size_t width; // width in pixels
+    size_t height;
+    size_t stride; // bytes from the start of one row to the start of the next row
+};
+
+// Layout of the pixels of an input image
+enum pixel_format {
+    PIXEL_RGB, // 3 bytes per pixel, like P6 and P3 images
+    PIXEL_RGBA, // 4 bytes per pixel, the alpha channel is ignored
+    PIXEL_BGRA, // 4 bytes per pixel, e.g. screen captures, the alpha channel is ignored
+    PIXEL_LUMA, // 1 byte per pixel, already grayscale, e.g. P5 images or the Y plane of NV12 and I420 frames
+};
+
+static inline size_t pixel_size(enum pixel_format format)
+{
+    return format == PIXEL_LUMA ? 1 : format == PIXEL_RGB ? 3 : 4;
+}
+
+// View of a packed image with channels bytes per pixel, like the images the other functions take
+static inline struct image_view packed_view(const uint8_t* pixels, size_t width, size_t height, size_t channels)
+{
+    return (struct image_view) { (uint8_t*)pixels, width, height, width * channels };
+}
+
+// View of the region of an image starting at pixel (x, y), the region must lie inside the view
+static inline struct image_view view_region(struct image_view view, size_t x, size_t y, size_t width, size_t height, size_t channels)
+{
+    return (struct image_view) { view.pixels + y * view.stride + x * channels, width, height, view.stride };
+}
+
+// Pointer to the first pixel of row y
+static inline uint8_t* view_row(struct image_view view, size_t y)
+{
+    return view.pixels + y * view.stride;
+}
+
+// True if the rows follow each other directly, so the view can be processed as one long row
+static inline int view_is_packed(struct image_view view, size_t channels)
+{
+    return view.stride == view.width * channels;
+}
+
+#endif // VIEW_H
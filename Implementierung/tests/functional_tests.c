@@ -1,8 +1,32 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../src/ascii.h"
+#include "../src/bench.h"
+#include "../src/bilateral.h"
+#include "../src/box.h"
+#include "../src/budget.h"
+#include "../src/cache.h"
 #include "../src/combine.h"
 #include "../src/convolution.h"
+#include "../src/deadline.h"
 #include "../src/denoise.h"
 #include "../src/grayscale.h"
+#include "../src/image.h"
+#include "../src/median.h"
+#include "../src/metrics.h"
+#include "../src/parallel.h"
+#include "../src/pyramid.h"
+#include "../src/tiled.h"
+#include "../src/trace.h"
+#include "../src/tune.h"
+#include <fcntl.h>
+#include <math.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
 
 int check(char* prefix, const uint8_t* expected, const uint8_t* actual, size_t size, int exact)
 {
@@ -27,6 +51,27 @@ int check(char* prefix, const uint8_t* expected, const uint8_t* actual, size_t s
     return 0;
 }
 
+// Next value of the linear congruential generator of the test images, the upper bits are the most random
+static uint32_t next_random(uint32_t* seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed;
+}
+
+// Fill pixels with values of the whole range, the same for the same seed
+static void random_pixels(uint8_t* pixels, size_t size, uint32_t seed)
+{
+    for (size_t i = 0; i < size; i++)
+        pixels[i] = (uint8_t)(next_random(&seed) >> 16);
+}
+
+// Free the buffers of a test, e.g. free_all((void*[]) { a, b }, 2), the ones that could not be allocated are NULL
+static void free_all(void* buffers[], size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(buffers[i]);
+}
+
 int test_grayscale()
 {
     // using random numbers and a seperate implementation for testing purposes
@@ -250,8 +295,1524 @@ int test_combine_simd()
     return check("Combine SIMD", expected_result, result, 51, 0);
 }
 
+int test_denoise_8bit()
+{
+    // widths below a vector, with a scalar tail and with an overlapping last vector
+    size_t sizes[][2] = { { 1, 1 }, { 5, 3 }, { 16, 2 }, { 45, 37 }, { 130, 61 } };
+    static uint8_t rgb[130 * 61 * 3], gray[130 * 61], expected[130 * 61], result[130 * 61], laplace[130 * 61], blur[130 * 61];
+    static uint8_t padded_image[132 * 63], padded_laplace[132 * 63], padded_blur[132 * 63], tmp1[130 * 61], tmp2[130 * 61];
+    static uint16_t laplace_16b[132 * 63], blur_16b[132 * 63];
+    uint32_t seed = 43;
+    int fail = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t width = sizes[s][0], height = sizes[s][1], padded_width = width + 2;
+        // noise around a gradient, and every 7th pixel of the whole range for large laplace responses
+        for (size_t i = 0; i < width * height * 3; i++) {
+            uint32_t random = next_random(&seed);
+            rgb[i] = i % 7 ? (uint8_t)((i / 3) % width + (random >> 28)) : (uint8_t)(random >> 16);
+        }
+        grayscale_simd(rgb, width, height, 0.2126, 0.7152, 0.0722, gray);
+
+        // both responses are at most 1 from the rounded ones
+        memset(padded_image, 0, sizeof(padded_image));
+        pad_image_8bit_view(packed_view(gray, width, height, 1), padded_width, padded_image);
+        convolution_simd_8bit(padded_image, padded_width, height + 2, padded_laplace, padded_blur);
+        convolution(gray, width, height, laplace, laplace_kernel, 1);
+        convolution(gray, width, height, blur, blur_kernel, 0);
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                size_t i = (y + 1) * padded_width + x + 1;
+                if (abs(padded_laplace[i] - laplace[y * width + x]) > 1 || abs(padded_blur[i] - blur[y * width + x]) > 1) {
+                    printf("Denoise 8 bit test failed at %zux%zu: laplace %d and %d, blur %d and %d at (%zu, %zu)\n", width, height,
+                        padded_laplace[i], laplace[y * width + x], padded_blur[i], blur[y * width + x], x, y);
+                    fail++;
+                    y = height;
+                    break;
+                }
+            }
+        }
+
+        // the same responses give the same result as the 16 bit combine, also in place
+        for (size_t i = 0; i < padded_width * (height + 2); i++) {
+            laplace_16b[i] = padded_laplace[i];
+            blur_16b[i] = padded_blur[i];
+        }
+        combine_simd_view(packed_view(gray, width, height, 1), laplace_16b, blur_16b, padded_width, packed_view(expected, width, height, 1));
+        memcpy(result, gray, width * height);
+        combine_simd_8bit_view(packed_view(result, width, height, 1), padded_laplace, padded_blur, padded_width, packed_view(result, width, height, 1));
+        if (memcmp(expected, result, width * height) != 0) {
+            printf("Denoise 8 bit test failed: the combine differs from combine_simd_view() at %zux%zu\n", width, height);
+            fail++;
+        }
+        // and both in one pass, a row of 16 pixels has no vector that slides along it, one of 45 pixels one and an overlapping last one
+        if (width >= 16) {
+            convolve_combine_simd_8bit_view(padded_image, padded_width, packed_view(tmp1, width, height, 1));
+            if (memcmp(expected, tmp1, width * height) != 0) {
+                printf("Denoise 8 bit test failed: the convolution and combine in one pass differ at %zux%zu\n", width, height);
+                fail++;
+            }
+        }
+
+        // at most 3 from denoise(), luma gives the same result as RGB
+        denoise(rgb, width, height, 0.2126, 0.7152, 0.0722, tmp1, tmp2, expected);
+        memset(padded_image, 0, sizeof(padded_image));
+        denoise_simd_8bit_view(packed_view(rgb, width, height, 3), PIXEL_RGB, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur,
+            packed_view(result, width, height, 1));
+        double mean = 0;
+        int max = 0;
+        for (size_t i = 0; i < width * height; i++) {
+            int error = result[i] - expected[i];
+            mean += (double)error / (double)(width * height);
+            max = abs(error) > max ? abs(error) : max;
+        }
+        if (max > 3 || (width * height > 1000 && (mean < -1.2 || mean > -0.4))) {
+            printf("Denoise 8 bit test failed at %zux%zu: error of %f on average and %d at most compared with denoise()\n", width, height, mean, max);
+            fail++;
+        }
+        denoise_simd_8bit_view(packed_view(gray, width, height, 1), PIXEL_LUMA, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur,
+            packed_view(gray, width, height, 1));
+        if (memcmp(gray, result, width * height) != 0) {
+            printf("Denoise 8 bit test failed: luma differs from RGB at %zux%zu\n", width, height);
+            fail++;
+        }
+    }
+    if (fail == 0)
+        printf("Denoise 8 bit Test passed\n");
+    return fail;
+}
+
+int test_denoise_parallel()
+{
+    // 45x37 pseudo random image, the bands of the workers must give exactly the same result as one pass
+    uint8_t image[45 * 37 * 3];
+    random_pixels(image, sizeof(image), 42);
+    uint16_t padded_image[47 * 39] = { 0 };
+    uint16_t padded_laplace[47 * 39] = { 0 };
+    uint16_t padded_blur[47 * 39] = { 0 };
+    uint8_t expected_result[45 * 37];
+    uint8_t result[45 * 37];
+    denoise_simd(image, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, expected_result);
+
+    struct parallel_config config = { .threads = 4, .cpu_count = 0 };
+    if (denoise_simd_parallel(&config, image, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result)) {
+        printf("Denoise SIMD parallel test failed: could not start threads\n");
+        return 1;
+    }
+    int fail = check("Denoise SIMD parallel", expected_result, result, 45 * 37, 1);
+
+    // bands processed in tiles of 5 rows, with several threads and on the calling thread
+    config.tile_rows = 5;
+    memset(result, 0, sizeof(result));
+    fail += denoise_simd_parallel(&config, image, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result);
+    fail += check("Denoise SIMD parallel tiles", expected_result, result, 45 * 37, 1);
+
+    // single-threaded --tile-rows runs get their buffers from calloc in main(), one tile, several and one row per tile
+    config.threads = 1;
+    size_t tile_rows[] = { 1, 5, 8, 36, 37, 100 };
+    for (size_t i = 0; i < sizeof(tile_rows) / sizeof(tile_rows[0]); i++) {
+        uint16_t* buffers[3];
+        for (int j = 0; j < 3; j++)
+            buffers[j] = calloc(47 * 39, sizeof(uint16_t));
+        config.tile_rows = tile_rows[i];
+        memset(result, 0, sizeof(result));
+        if (buffers[0] && buffers[1] && buffers[2])
+            fail += denoise_simd_parallel(&config, image, 45, 37, 0.2126, 0.7152, 0.0722, buffers[0], buffers[1], buffers[2], result);
+        else
+            fail++;
+        for (int j = 0; j < 3; j++)
+            free(buffers[j]);
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "Denoise SIMD tiles of %zu rows", tile_rows[i]);
+        fail += check(prefix, expected_result, result, 45 * 37, 1);
+    }
+    return fail;
+}
+
+// Compare a region of a strided view with a packed image and check that the rest of the buffer is untouched
+static int check_view(char* prefix, const uint8_t* expected, uint8_t* frame, size_t frame_size, struct image_view region)
+{
+    uint8_t actual[45 * 37];
+    for (size_t y = 0; y < region.height; y++) {
+        memcpy(actual + y * region.width, view_row(region, y), region.width);
+        memset(view_row(region, y), 0xAA, region.width);
+    }
+    size_t untouched = 0;
+    for (size_t i = 0; i < frame_size; i++)
+        untouched += frame[i] == 0xAA;
+    if (untouched != frame_size) {
+        printf("%s Test failed: pixels outside of the view were written\n", prefix);
+        return 1;
+    }
+    return check(prefix, expected, actual, region.width * region.height, 1);
+}
+
+int test_denoise_view()
+{
+    // the 45x37 image of test_denoise_parallel() at (3, 2) in a 50x40 frame with rows aligned to 64 bytes
+    uint8_t image[45 * 37 * 3];
+    uint8_t rgb_frame[40 * 192] = { 0 };
+    struct image_view rgb = view_region((struct image_view) { rgb_frame, 50, 40, 192 }, 3, 2, 45, 37, 3);
+    random_pixels(image, sizeof(image), 42);
+    for (size_t y = 0; y < 37; y++)
+        memcpy(view_row(rgb, y), image + y * 45 * 3, 45 * 3);
+
+    uint16_t padded_image[47 * 39] = { 0 };
+    uint16_t padded_laplace[47 * 39] = { 0 };
+    uint16_t padded_blur[47 * 39] = { 0 };
+    uint8_t tmp1[45 * 37], tmp2[45 * 37];
+    uint8_t expected_simd[45 * 37], expected_integer[45 * 37], expected_accurate[45 * 37];
+    denoise_simd(image, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, expected_simd);
+    denoise_integer(image, 45, 37, 0.2126, 0.7152, 0.0722, tmp1, tmp2, expected_integer);
+    denoise(image, 45, 37, 0.2126, 0.7152, 0.0722, tmp1, tmp2, expected_accurate);
+
+    uint8_t frame[40 * 64];
+    struct image_view result = view_region((struct image_view) { frame, 50, 40, 64 }, 3, 2, 45, 37, 1);
+    memset(frame, 0xAA, sizeof(frame));
+    denoise_simd_view(rgb, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result);
+    int fail = check_view("Denoise SIMD view", expected_simd, frame, sizeof(frame), result);
+    memset(frame, 0xAA, sizeof(frame));
+    denoise_integer_view(rgb, 0.2126, 0.7152, 0.0722, tmp1, tmp2, result);
+    fail += check_view("Denoise integer view", expected_integer, frame, sizeof(frame), result);
+    memset(frame, 0xAA, sizeof(frame));
+    denoise_view(rgb, 0.2126, 0.7152, 0.0722, tmp1, tmp2, result);
+    fail += check_view("Denoise view", expected_accurate, frame, sizeof(frame), result);
+
+    struct parallel_config config = { .threads = 4, .cpu_count = 0, .tile_rows = 5 };
+    memset(frame, 0xAA, sizeof(frame));
+    fail += denoise_simd_parallel_view(&config, rgb, PIXEL_RGB, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result);
+    return fail + check_view("Denoise SIMD parallel view", expected_simd, frame, sizeof(frame), result);
+}
+
+int test_denoise_formats()
+{
+    // 45x37 pseudo random image as RGB, RGBA, BGRA, and as luma repeated in all three channels of the RGB image
+    uint8_t rgb[45 * 37 * 3], rgba[45 * 37 * 4], bgra[45 * 37 * 4], luma[45 * 37], gray_rgb[45 * 37 * 3];
+    random_pixels(rgba, sizeof(rgba), 11);
+    for (size_t i = 0; i < 45 * 37; i++) {
+        for (size_t channel = 0; channel < 3; channel++) {
+            rgb[i * 3 + channel] = rgba[i * 4 + channel];
+            bgra[i * 4 + 2 - channel] = rgba[i * 4 + channel];
+        }
+        bgra[i * 4 + 3] = 0;
+        luma[i] = rgb[i * 3 + 1];
+        gray_rgb[i * 3] = gray_rgb[i * 3 + 1] = gray_rgb[i * 3 + 2] = luma[i];
+    }
+    uint16_t padded_image[47 * 39] = { 0 };
+    uint16_t padded_laplace[47 * 39] = { 0 };
+    uint16_t padded_blur[47 * 39] = { 0 };
+    uint8_t expected_result[45 * 37], expected_luma[45 * 37], result[45 * 37];
+    denoise_simd(rgb, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, expected_result);
+    denoise_simd(gray_rgb, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, expected_luma);
+
+    struct image_view output = packed_view(result, 45, 37, 1);
+    denoise_simd_format_view(packed_view(rgba, 45, 37, 4), PIXEL_RGBA, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, output);
+    int fail = check("Denoise RGBA", expected_result, result, 45 * 37, 1);
+    denoise_simd_format_view(packed_view(bgra, 45, 37, 4), PIXEL_BGRA, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, output);
+    fail += check("Denoise BGRA", expected_result, result, 45 * 37, 1);
+    denoise_simd_format_view(packed_view(luma, 45, 37, 1), PIXEL_LUMA, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, output);
+    fail += check("Denoise luma", expected_luma, result, 45 * 37, 1);
+
+    // luma denoised in place by the workers
+    struct parallel_config config = { .threads = 3, .cpu_count = 0, .tile_rows = 4 };
+    struct image_view in_place = packed_view(luma, 45, 37, 1);
+    fail += denoise_simd_parallel_view(&config, in_place, PIXEL_LUMA, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, in_place);
+    return fail + check("Denoise luma parallel in place", expected_luma, luma, 45 * 37, 1);
+}
+
+int test_denoise_batch()
+{
+    // every image of the batch is denoised as on its own, also for widths below 16 and in the last image
+    size_t sizes[][2] = { { 7, 5 }, { 45, 37 }, { 16, 1 } };
+    static uint8_t images[6 * 45 * 37 * 3], expected[6 * 45 * 37], result[6 * 45 * 37];
+    static uint16_t padded_image[BATCH_PADDED_SIZE(6, 45, 37)], padded_laplace[BATCH_PADDED_SIZE(6, 45, 37)], padded_blur[BATCH_PADDED_SIZE(6, 45, 37)];
+    random_pixels(images, sizeof(images), 31);
+    enum pixel_format formats[] = { PIXEL_RGB, PIXEL_LUMA };
+    int fail = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t f = 0; f < 2; f++) {
+            enum pixel_format format = formats[f];
+            size_t width = sizes[s][0], height = sizes[s][1], size = width * height;
+            for (size_t i = 0; i < 6; i++) {
+                memset(padded_image, 0, sizeof(padded_image));
+                denoise_simd_format_view(packed_view(images + i * size * pixel_size(format), width, height, pixel_size(format)), format,
+                    0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, packed_view(expected + i * size, width, height, 1));
+            }
+            memset(padded_image, 0, sizeof(padded_image));
+            denoise_simd_batch(images, format, 6, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result);
+            char prefix[64];
+            snprintf(prefix, sizeof(prefix), "Denoise batch %s %zux%zu", format == PIXEL_RGB ? "RGB" : "luma", width, height);
+            fail += check(prefix, expected, result, 6 * size, 1);
+        }
+    }
+    return fail;
+}
+
+int test_denoise_strips()
+{
+    // 45x37 pseudo random image with flat rows at the top, strips of any height must give the same result as the whole image
+    const size_t strip_rows[] = { 1, 2, 5, 8, 36, 64 };
+    const enum pixel_format formats[] = { PIXEL_RGB, PIXEL_RGBA, PIXEL_LUMA };
+    uint8_t image[45 * 37 * 4], input[45 * 37 * 4], expected_result[45 * 37], result[45 * 37];
+    static uint8_t scratch[STRIP_SCRATCH_SIZE(45, 64)];
+    uint16_t padded_image[47 * 39] = { 0 };
+    uint16_t padded_laplace[47 * 39] = { 0 };
+    uint16_t padded_blur[47 * 39] = { 0 };
+    random_pixels(image, sizeof(image), 17);
+    memset(image, 77, 45 * 16 * 4);
+    const char* format_names[] = { "RGB", "RGBA", "luma" };
+    int fail = 0;
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        size_t bytes = pixel_size(formats[f]);
+        denoise_simd_format_view(packed_view(image, 45, 37, bytes), formats[f], 0.2126, 0.7152, 0.0722,
+            padded_image, padded_laplace, padded_blur, packed_view(expected_result, 45, 37, 1));
+        // every strip height, also with the result written over the input, only the first wrong result is checked
+        for (size_t i = 0; i < sizeof(strip_rows) / sizeof(strip_rows[0]); i++) {
+            memset(result, 0, sizeof(result));
+            denoise_simd_strips(image, formats[f], 45, 37, 0.2126, 0.7152, 0.0722, strip_rows[i], scratch, result);
+            memcpy(input, image, sizeof(input));
+            denoise_simd_strips(input, formats[f], 45, 37, 0.2126, 0.7152, 0.0722, strip_rows[i], scratch, input);
+            if (memcmp(result, expected_result, sizeof(result)) != 0 || memcmp(input, expected_result, sizeof(result)) != 0) {
+                printf("Denoise strips failed with strips of %zu rows\n", strip_rows[i]);
+                break;
+            }
+        }
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "Denoise strips %s", format_names[f]);
+        fail += check(prefix, expected_result, memcmp(result, expected_result, sizeof(result)) != 0 ? result : input, 45 * 37, 1);
+    }
+
+    // a 1000x1000 RGB image: 10 MB for the whole frame, 3 MB for the image itself
+    struct memory_plan plan;
+    fail += plan_memory(1000, 1000, PIXEL_RGB, 1, 1, 1, 20000000, &plan) || plan.strategy != MEMORY_FULL_FRAME || plan_bytes(&plan) > 20000000;
+    fail += plan_memory(1000, 1000, PIXEL_RGB, 1, 1, 1, 5000000, &plan) || plan.strategy != MEMORY_STRIPS || plan.strip_rows != BUDGET_MAX_STRIP_ROWS;
+    // the highest strip that fits: 3000000 + 6 * 1002 * (rows + 4) + 2 * 1000 * (rows + 2) bytes
+    fail += plan_memory(1000, 1000, PIXEL_RGB, 1, 1, 1, 3200000, &plan) || plan.strategy != MEMORY_STRIPS || plan.strip_rows != 21;
+    fail += plan_memory(1000, 1000, PIXEL_RGB, 1, 1, 0, 4200000, &plan) || plan.strategy != MEMORY_STRIPS || plan.result_bytes != 1000000;
+    fail += plan_memory(1000, 1000, PIXEL_RGB, 1, 1, 1, 2000000, &plan) || plan.strategy != MEMORY_TILES;
+    fail += plan_memory(1000, 1000, PIXEL_RGB, 0, 1, 1, 2000000, &plan) != -1;
+    if (fail) {
+        printf("Denoise strips test failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Run this program with the arguments in argv, its output is discarded
+static int run_denoise(char* argv[])
+{
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return -1;
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    int status = -1;
+    if (posix_spawn(&pid, "/proc/self/exe", &actions, NULL, argv, environ) != 0 || waitpid(pid, &status, 0) != pid)
+        status = -1;
+    posix_spawn_file_actions_destroy(&actions);
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? 0 : -1;
+}
+
+int test_memory_budget_threads()
+{
+    // a 480x360 image written to a file, 1 MiB only fits the strips, 16 MiB the whole frame loaded by the workers
+    const size_t width = 480, height = 360;
+    uint8_t* pixels = malloc(width * height * 3);
+    uint8_t* expected_result = malloc(width * height);
+    uint8_t* result = malloc(width * height);
+    uint16_t* padded = calloc(3 * (width + 2) * (height + 2), sizeof(uint16_t));
+    if (!pixels || !expected_result || !result || !padded) {
+        printf("Memory budget threads test failed: could not allocate memory\n");
+        free_all((void*[]) { pixels, expected_result, result, padded }, 4);
+        return 1;
+    }
+    random_pixels(pixels, width * height * 3, 23);
+    size_t padded_size = (width + 2) * (height + 2);
+    denoise_simd(pixels, width, height, 0.2126, 0.7152, 0.0722, padded, padded + padded_size, padded + 2 * padded_size, expected_result);
+
+    int fail = 0;
+    char input_path[] = "/tmp/denoise_budget_XXXXXX";
+    int fd = mkstemp(input_path);
+    FILE* input = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!input) {
+        printf("Memory budget threads test failed: could not create temporary file\n");
+        fail = 1;
+    } else {
+        fprintf(input, "P6\n%zu %zu\n255\n", width, height);
+        fwrite(pixels, 1, width * height * 3, input);
+        fclose(input);
+    }
+    char output_path[64];
+    snprintf(output_path, sizeof(output_path), "%s.pgm", input_path);
+    char* budgets[] = { "1", "16" };
+    for (size_t i = 0; i < 2 && !fail; i++) {
+        char* argv[] = { "denoise", "-T", "4", "--mem-budget", budgets[i], input_path, "-o", output_path, NULL };
+        memset(result, 0, width * height);
+        FILE* output = NULL;
+        if (run_denoise(argv) != 0 || !(output = fopen(output_path, "rb")) || fseek(output, -(long)(width * height), SEEK_END) != 0
+            || fread(result, 1, width * height, output) != width * height) {
+            printf("Memory budget threads test failed: could not denoise with a budget of %s MiB\n", budgets[i]);
+            fail = 1;
+        }
+        if (output)
+            fclose(output);
+        char prefix[48];
+        snprintf(prefix, sizeof(prefix), "Memory budget of %s MiB with 4 threads", budgets[i]);
+        fail = fail || check(prefix, expected_result, result, width * height, 1);
+    }
+    remove(input_path);
+    remove(output_path);
+    free_all((void*[]) { pixels, expected_result, result, padded }, 4);
+    return fail;
+}
+
+int test_median()
+{
+    // pseudo random image with salt and pepper noise, the vectorized median must be exact, also for narrow images
+    // and for odd and even heights, 5x5 filters two rows at once
+    const size_t sizes[][2] = { { 45, 37 }, { 20, 6 }, { 16, 5 }, { 3, 2 }, { 1, 1 } };
+    uint8_t image[45 * 37], expected_result[45 * 37], result[45 * 37];
+    uint8_t scratch[MEDIAN_SCRATCH_SIZE(45, 5)];
+    uint32_t seed = 5;
+    for (size_t i = 0; i < sizeof(image); i++) {
+        uint32_t random = next_random(&seed);
+        image[i] = (random >> 16) % 10 == 0 ? 255 : (random >> 16) % 10 == 1 ? 0 : (uint8_t)(100 + (random >> 24) % 32);
+    }
+    int fail = 0;
+    for (size_t window = 3; window <= 5; window += 2) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            size_t width = sizes[i][0], height = sizes[i][1];
+            median(image, width, height, window, expected_result);
+            median_simd(image, width, height, window, scratch, result);
+            char prefix[32];
+            snprintf(prefix, sizeof(prefix), "Median %zux%zu %zux%zu", window, window, width, height);
+            fail += check(prefix, expected_result, result, width * height, 1);
+        }
+    }
+    // a single outlier in a flat area is removed completely
+    uint8_t flat[5 * 5], flat_result[5 * 5], flat_expected[5 * 5];
+    memset(flat, 50, sizeof(flat));
+    memset(flat_expected, 50, sizeof(flat_expected));
+    flat[12] = 255;
+    median_simd(flat, 5, 5, 3, scratch, flat_result);
+    return fail + check("Median outlier", flat_expected, flat_result, 25, 1);
+}
+
+int test_bilateral()
+{
+    // pseudo random image with a step edge, the vectorized filter must be exact for every table size and window
+    const size_t sizes[][2] = { { 45, 37 }, { 16, 5 }, { 3, 2 }, { 1, 1 } };
+    const float sigmas[][2] = { { 1.0f, 10.0f }, { 2.0f, 60.0f }, { 1.5f, 1000.0f } };
+    uint8_t image[45 * 37], expected_result[45 * 37], result[45 * 37];
+    uint8_t scratch[BILATERAL_SCRATCH_SIZE(45, 5)];
+    uint32_t seed = 9;
+    for (size_t i = 0; i < sizeof(image); i++)
+        image[i] = (uint8_t)((i % 45 < 20 ? 40 : 200) + (next_random(&seed) >> 24) % 32 - 16);
+    int fail = 0;
+    for (size_t window = 3; window <= 5; window += 2) {
+        for (size_t j = 0; j < sizeof(sigmas) / sizeof(sigmas[0]); j++) {
+            struct bilateral_weights weights;
+            bilateral_weights(&weights, window, sigmas[j][0], sigmas[j][1]);
+            for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+                size_t width = sizes[i][0], height = sizes[i][1];
+                bilateral(image, width, height, &weights, expected_result);
+                bilateral_simd(image, width, height, &weights, scratch, result);
+                char prefix[64];
+                snprintf(prefix, sizeof(prefix), "Bilateral %zux%zu sigma %g,%g %zux%zu", window, window, sigmas[j][0], sigmas[j][1], width, height);
+                fail += check(prefix, expected_result, result, width * height, 1);
+            }
+        }
+    }
+    // the step edge stays sharp: with a small range sigma the pixels next to it are not mixed with the other side
+    struct bilateral_weights weights;
+    bilateral_weights(&weights, 5, 2.0f, 10.0f);
+    uint8_t step[32 * 4], step_result[32 * 4];
+    for (size_t i = 0; i < sizeof(step); i++)
+        step[i] = i % 32 < 16 ? 50 : 180;
+    bilateral_simd(step, 32, 4, &weights, scratch, step_result);
+    return fail + check("Bilateral edge", step, step_result, sizeof(step), 1);
+}
+
+int test_box_blur()
+{
+    // widths and heights below 16 and not multiples of 16, radii of 0, beyond the image and the largest radius
+    size_t sizes[][2] = { { 1, 1 }, { 5, 3 }, { 45, 37 }, { 33, 70 } };
+    size_t radii[][BOX_PASSES] = { { 1, 1, 1 }, { 0, 0, 2 }, { 3, 4, 4 }, { 40, 0, 9 }, { BOX_MAX_RADIUS, BOX_MAX_RADIUS, BOX_MAX_RADIUS } };
+    static uint8_t image[45 * 70], tmp[45 * 70], expected[45 * 70], result[45 * 70], scratch[BOX_SCRATCH_SIZE(45, 70)];
+    random_pixels(image, sizeof(image), 23);
+    int fail = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+            size_t width = sizes[s][0], height = sizes[s][1];
+            box_blur(image, width, height, radii[r], tmp, expected);
+            box_blur_simd(image, width, height, radii[r], scratch, result);
+            char prefix[64];
+            snprintf(prefix, sizeof(prefix), "Box blur %zux%zu, radii %zu %zu %zu", width, height, radii[r][0], radii[r][1], radii[r][2]);
+            fail += check(prefix, expected, result, width * height, 1);
+        }
+    }
+
+    // a flat image stays flat, the rounded reciprocals are exact for the sum of a flat window
+    memset(image, 201, sizeof(image));
+    box_blur_simd(image, 45, 70, radii[3], scratch, result);
+    fail += check("Box blur flat", image, result, 45 * 70, 1);
+
+    // the variances of the boxes add up to the variance of the gaussian
+    for (float sigma = 2; sigma <= 64; sigma *= 2) {
+        size_t boxes[BOX_PASSES];
+        gaussian_boxes(sigma, boxes);
+        double variance = 0;
+        for (size_t i = 0; i < BOX_PASSES; i++)
+            variance += ((2.0 * boxes[i] + 1) * (2.0 * boxes[i] + 1) - 1) / 12;
+        if (fabs(sqrt(variance) - sigma) > 0.25) {
+            printf("Gaussian boxes test failed for sigma %f: radii %zu %zu %zu\n", sigma, boxes[0], boxes[1], boxes[2]);
+            fail++;
+        }
+    }
+
+    // the large blur replaces the 3x3 blur before the combine, the laplace responses are the same
+    uint8_t rgb[45 * 37 * 3], gray[45 * 37], blurred[45 * 37];
+    random_pixels(rgb, sizeof(rgb), 24);
+    static uint16_t padded_image[47 * 39], padded_laplace[47 * 39], padded_blur[47 * 39];
+    size_t boxes[BOX_PASSES];
+    gaussian_boxes(10.0f, boxes);
+    grayscale_simd(rgb, 45, 37, 0.2126, 0.7152, 0.0722, gray);
+    pad_image_simd(gray, 45, 37, 47, padded_image);
+    convolution_simd(padded_image, 47, 39, padded_laplace, padded_blur);
+    box_blur(gray, 45, 37, boxes, tmp, blurred);
+    pad_image_simd(blurred, 45, 37, 47, padded_blur);
+    combine_simd(gray, padded_laplace, padded_blur, 45, 37, 47, expected);
+    memset(padded_image, 0, sizeof(padded_image));
+    denoise_box(rgb, PIXEL_RGB, 45, 37, 0.2126, 0.7152, 0.0722, boxes, tmp, scratch, padded_image, padded_laplace, padded_blur, result);
+    return fail + check("Denoise box", expected, result, 45 * 37, 1);
+}
+
+// Mean absolute difference of two images
+static double mean_error(const uint8_t* a, const uint8_t* b, size_t size)
+{
+    double sum = 0;
+    for (size_t i = 0; i < size; i++)
+        sum += abs((int)a[i] - (int)b[i]);
+    return sum / size;
+}
+
+int test_adaptive()
+{
+    // the histogram is counted in the same sweep and the convolution itself is not changed
+    uint8_t gray[45 * 37];
+    random_pixels(gray, sizeof(gray), 11);
+    uint16_t padded_image[47 * 39] = { 0 };
+    uint16_t padded_laplace[47 * 39] = { 0 }, padded_blur[47 * 39] = { 0 };
+    uint16_t expected_laplace[47 * 39] = { 0 }, expected_blur[47 * 39] = { 0 };
+    pad_image_simd(gray, 45, 37, 47, padded_image);
+    convolution_simd(padded_image, 47, 39, expected_laplace, expected_blur);
+    uint32_t histogram[256] = { 0 }, expected_histogram[256] = { 0 };
+    convolution_simd_histogram(padded_image, 47, 39, padded_laplace, padded_blur, histogram);
+    int fail = 0;
+    if (memcmp(expected_laplace, padded_laplace, sizeof(padded_laplace)) || memcmp(expected_blur, padded_blur, sizeof(padded_blur))) {
+        printf("Convolution histogram test failed: the convolution differs from convolution_simd()\n");
+        fail++;
+    }
+    // the whole vectors of 8 pixels inside the rows 1, 17 and 33 of the padded image, 40 of the 45 pixels of each row
+    for (size_t y = 1; y + 1 < 39; y += 16) {
+        for (size_t x = 1; x <= 40; x++)
+            expected_histogram[expected_laplace[y * 47 + x]]++;
+    }
+    if (memcmp(expected_histogram, histogram, sizeof(histogram))) {
+        printf("Convolution histogram test failed: wrong counts\n");
+        fail++;
+    }
+
+    // the unit gain gives the same result as combine_simd(), other gains scale the laplace weights
+    uint8_t expected_result[45 * 37], result[45 * 37];
+    combine_simd(gray, padded_laplace, padded_blur, 45, 37, 47, expected_result);
+    combine_simd_gain_view(packed_view(gray, 45, 37, 1), padded_laplace, padded_blur, 47, ADAPTIVE_UNIT_GAIN, packed_view(result, 45, 37, 1));
+    fail += check("Combine unit gain", expected_result, result, sizeof(result), 1);
+    for (size_t y = 0; y < 37; y++) {
+        for (size_t x = 0; x < 45; x++) {
+            int laplace = padded_laplace[(y + 1) * 47 + x + 1] * 40 / 16;
+            laplace = laplace < 255 ? laplace : 255;
+            expected_result[y * 45 + x] = (uint8_t)((laplace * gray[y * 45 + x] + (255 - laplace) * padded_blur[(y + 1) * 47 + x + 1]) >> 8);
+        }
+    }
+    combine_simd_gain_view(packed_view(gray, 45, 37, 1), padded_laplace, padded_blur, 47, 40, packed_view(result, 45, 37, 1));
+    fail += check("Combine gain", expected_result, result, sizeof(result), 1);
+
+    // the gain follows the median response, not the mean, and is limited
+    uint32_t flat[256] = { [0] = 100 }, reference[256] = { [ADAPTIVE_REFERENCE] = 60, [200] = 40 }, noisy[256] = { [120] = 100 };
+    if (adaptive_gain(flat) != ADAPTIVE_MAX_GAIN || adaptive_gain(reference) != ADAPTIVE_UNIT_GAIN || adaptive_gain(noisy) != ADAPTIVE_MIN_GAIN) {
+        printf("Adaptive gain test failed: %u, %u, %u\n", adaptive_gain(flat), adaptive_gain(reference), adaptive_gain(noisy));
+        fail++;
+    }
+
+    // a gradient with weak and with strong noise: the adaptive strength is closer to the clean gradient in both cases
+    static uint8_t clean[64 * 64], noisy_image[64 * 64], fixed_result[64 * 64], adaptive_result[64 * 64];
+    static uint16_t padded[3][66 * 66];
+    struct parallel_config config = { .threads = 1, .cpu_count = 0 };
+    uint32_t seed = 11;
+    for (int amplitude = 2; amplitude <= 40; amplitude += 38) {
+        for (size_t i = 0; i < sizeof(clean); i++) {
+            clean[i] = (uint8_t)(64 + i % 64 + i / 64);
+            // sum of 4 uniform values, roughly gaussian
+            int noise = 0;
+            for (int k = 0; k < 4; k++)
+                noise += (int)((next_random(&seed) >> 16) % (2 * amplitude + 1)) - amplitude;
+            noisy_image[i] = (uint8_t)(clean[i] + noise / 2);
+        }
+        struct image_view input = packed_view(noisy_image, 64, 64, 1);
+        config.adaptive = 0;
+        memset(padded, 0, sizeof(padded));
+        denoise_simd_parallel_view(&config, input, PIXEL_LUMA, 1, 1, 1, padded[0], padded[1], padded[2], packed_view(fixed_result, 64, 64, 1));
+        config.adaptive = 1;
+        memset(padded, 0, sizeof(padded));
+        denoise_simd_parallel_view(&config, input, PIXEL_LUMA, 1, 1, 1, padded[0], padded[1], padded[2], packed_view(adaptive_result, 64, 64, 1));
+        double fixed_error = mean_error(clean, fixed_result, sizeof(clean)), adaptive_error = mean_error(clean, adaptive_result, sizeof(clean));
+        if (adaptive_error >= fixed_error) {
+            printf("Adaptive strength test failed with noise %d: error %f, without adaptive strength %f\n", amplitude, adaptive_error, fixed_error);
+            fail++;
+        }
+    }
+    if (fail)
+        return fail;
+    printf("Adaptive strength Test passed\n");
+    return 0;
+}
+
+// Pixel (x, y) of the test images of test_flat_tiles()
+static uint8_t flat_pattern(int kind, size_t x, size_t y, uint32_t* seed)
+{
+    uint32_t random = next_random(seed);
+    switch (kind) {
+    case 0: // blank page with a few strokes, flat tiles of 255 next to textured ones
+        return (x / 16 + y / 4) % 11 == 3 && x % 7 < 3 ? 20 : 255;
+    case 1: // flat regions of 0, 1 and 128, the zero padding makes the border tiles of 0 flat as well
+        return x < 70 ? 0 : x < 140 ? 1 : 128;
+    case 2: // horizontal gradient, the laplace response is 0 inside
+        return (uint8_t)(x / 2 + 10);
+    case 3: // checkerboard, every laplace response is 255
+        return (x + y) % 2 ? 255 : 0;
+    case 4: // noise above a flat region, the strips below the textured ones are not all searched for flat tiles
+        return y < 24 ? (uint8_t)(random >> 16) : 200;
+    default: // noise
+        return (uint8_t)(random >> 16);
+    }
+}
+
+// Standard deviation of the means of the 8x8 blocks of a square image, the blotchiness of low-frequency noise
+static double block_deviation(const uint8_t* image, size_t width)
+{
+    size_t blocks = width / 8;
+    double sum = 0, square_sum = 0;
+    for (size_t i = 0; i < blocks * blocks; i++) {
+        double mean = 0;
+        for (size_t y = 0; y < 8; y++) {
+            for (size_t x = 0; x < 8; x++)
+                mean += image[(i / blocks * 8 + y) * width + i % blocks * 8 + x];
+        }
+        mean /= 64;
+        sum += mean;
+        square_sum += mean * mean;
+    }
+    double mean = sum / (blocks * blocks);
+    return sqrt(square_sum / (blocks * blocks) - mean * mean);
+}
+
+int test_pyramid()
+{
+    // widths and heights below 8 and 16 and odd ones, with a vector tail and a scalar tail of every row
+    size_t sizes[][2] = { { 1, 1 }, { 7, 3 }, { 8, 8 }, { 45, 37 }, { 33, 70 }, { 64, 17 } };
+    static uint8_t image[64 * 70], denoised[32 * 35], original[32 * 35], expected[96 * 96], result[96 * 96];
+    static uint16_t sums[64 + 32], padded[66 * 72];
+    random_pixels(image, sizeof(image), 29);
+    random_pixels(denoised, sizeof(denoised), 30);
+    random_pixels(original, sizeof(original), 31);
+    int fail = 0, padded_fail = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t width = sizes[s][0], height = sizes[s][1];
+        char prefix[64];
+        pyramid_down(image, width, height, expected);
+        pyramid_down_simd(image, width, height, sums, result);
+        snprintf(prefix, sizeof(prefix), "Pyramid down %zux%zu", width, height);
+        fail += check(prefix, expected, result, PYRAMID_HALF(width) * PYRAMID_HALF(height), 1);
+        // in two parts of rows, like the bands of denoise_pyramid()
+        memset(result, 0, PYRAMID_HALF(width) * PYRAMID_HALF(height));
+        pyramid_down_rows_simd(image, width, height, 0, PYRAMID_HALF(height) / 2, sums, result);
+        pyramid_down_rows_simd(image, width, height, PYRAMID_HALF(height) / 2, PYRAMID_HALF(height), sums, result);
+        snprintf(prefix, sizeof(prefix), "Pyramid down rows %zux%zu", width, height);
+        fail += check(prefix, expected, result, PYRAMID_HALF(width) * PYRAMID_HALF(height), 1);
+        // the differences cover the whole range, so the sums saturate in both directions, also with the largest biases
+        int bias = (int[]) { 0, 21, -7, 4080, -4080, 300 }[s];
+        pyramid_up_add(denoised, original, image, width, height, bias, expected);
+        memcpy(result, image, width * height);
+        pyramid_up_add_simd(denoised, original, result, width, height, bias, (int16_t*)sums, result, padded);
+        snprintf(prefix, sizeof(prefix), "Pyramid up %zux%zu", width, height);
+        fail += check(prefix, expected, result, width * height, 1);
+        // the padded result is the same as the padding of the result
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++)
+                padded_fail |= padded[(y + 1) * (width + 2) + x + 1] != result[y * width + x];
+        }
+    }
+    if (padded_fail) {
+        printf("Pyramid test failed: the padded result differs from the result\n");
+        fail++;
+    }
+    // a flat image stays flat, and so does an image that was not changed by denoising the coarser level
+    memset(image, 77, sizeof(image));
+    pyramid_down_simd(image, 45, 37, sums, result);
+    fail += check("Pyramid down flat", image, result, 23 * 19, 1);
+    pyramid_up_add_simd(denoised, denoised, image, 45, 37, 0, (int16_t*)sums, result, NULL);
+    fail += check("Pyramid up unchanged", image, result, 45 * 37, 1);
+    // a level brightened by 1 has a mean change of 16 sixteenths, the bias takes it back out
+    uint8_t brighter[23 * 19];
+    for (size_t i = 0; i < sizeof(brighter); i++)
+        brighter[i] = (uint8_t)(denoised[i] + (denoised[i] < 255));
+    int change = 0;
+    for (size_t i = 0; i < sizeof(brighter); i++)
+        change += brighter[i] - denoised[i];
+    fail += pyramid_mean_change(brighter, denoised, sizeof(brighter)) != (change * 32 + (int)sizeof(brighter)) / (2 * (int)sizeof(brighter));
+    memset(brighter, 78, sizeof(brighter));
+    memset(original, 77, 23 * 19);
+    pyramid_up_add_simd(brighter, original, image, 45, 37, pyramid_mean_change(brighter, original, 23 * 19), (int16_t*)sums, result, NULL);
+    fail += check("Pyramid up without mean change", image, result, 45 * 37, 1);
+    if (pyramid_levels(1000, 1000, 6) != 6 || pyramid_levels(1000, 1000, 10) != PYRAMID_MAX_LEVELS || pyramid_levels(20, 100, 6) != 2
+        || pyramid_levels(7, 7, 3) != 1) {
+        printf("Pyramid test failed: wrong number of levels\n");
+        fail++;
+    }
+
+    // a single level is the laplace weighted blur of denoise_simd()
+    static uint8_t rgb[45 * 37 * 3], gray[96 * 96], flat[96 * 96];
+    static uint16_t padded_image[98 * 98], padded_laplace[98 * 98], padded_blur[98 * 98];
+    random_pixels(rgb, 45 * 37 * 3, 32);
+    uint8_t* scratch = malloc(pyramid_scratch_size(96, 96, 4));
+    if (!scratch)
+        return 1;
+    denoise_simd(rgb, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, expected);
+    denoise_pyramid(rgb, PIXEL_RGB, 45, 37, 0.2126, 0.7152, 0.0722, 1, scratch, padded_image, padded_laplace, padded_blur, result);
+    fail += check("Denoise pyramid of 1 level", expected, result, 45 * 37, 1);
+
+    // blotches of 8x8 pixels and fine noise on a flat image: the levels reach the blotches, which survive a single level
+    uint32_t seed = 33;
+    for (size_t y = 0; y < 96; y++) {
+        for (size_t x = 0; x < 96; x++) {
+            uint32_t blotch = (uint32_t)(y / 8 * 12 + x / 8) * 2654435761u;
+            gray[y * 96 + x] = (uint8_t)(128 + (int)(blotch >> 27) - 16 + (int)(next_random(&seed) >> 28) - 8);
+        }
+    }
+    denoise_pyramid(gray, PIXEL_LUMA, 96, 96, 0, 0, 0, 1, scratch, padded_image, padded_laplace, padded_blur, expected);
+    denoise_pyramid(gray, PIXEL_LUMA, 96, 96, 0, 0, 0, 4, scratch, padded_image, padded_laplace, padded_blur, result);
+    free(scratch);
+    // the means of the blotches spread less, and the brightness is the same as with a single level
+    double single = block_deviation(expected, 96), pyramid = block_deviation(result, 96);
+    memset(flat, 0, sizeof(flat));
+    double brightness = fabs(mean_error(flat, expected, sizeof(flat)) - mean_error(flat, result, sizeof(flat)));
+    if (pyramid > 0.75 * single || brightness > 0.5) {
+        printf("Pyramid test failed: deviation of the blotches %f of 4 levels, %f of 1 level, brightness changed by %f\n",
+            pyramid, single, brightness);
+        fail++;
+    }
+    if (fail == 0)
+        printf("Pyramid Test passed\n");
+    return fail;
+}
+
+// Rounded mean of every block of factor x factor pixels, the blocks at the edges average the pixels they contain
+static void area_average(const uint8_t* image, size_t width, size_t height, size_t factor, uint8_t* result)
+{
+    for (size_t y = 0; y < DOWNSCALED_SIZE(height, factor); y++) {
+        for (size_t x = 0; x < DOWNSCALED_SIZE(width, factor); x++) {
+            size_t sum = 0, count = 0;
+            for (size_t i = y * factor; i < (y + 1) * factor && i < height; i++) {
+                for (size_t j = x * factor; j < (x + 1) * factor && j < width; j++, count++)
+                    sum += image[i * width + j];
+            }
+            result[y * DOWNSCALED_SIZE(width, factor) + x] = (uint8_t)((sum + count / 2) / count);
+        }
+    }
+}
+
+int test_downscale()
+{
+    // sizes with partial blocks and bands, factors with and without the vectorized reduction, 39 columns end with
+    // a group of 8 blocks that overlaps the one before and a block of 3 columns for factor 4
+    size_t sizes[][2] = { { 1, 1 }, { 7, 3 }, { 45, 37 }, { 64, 17 }, { 33, 70 }, { 39, 24 } };
+    size_t factors[] = { 2, 3, 4, 5, 8, 16 };
+    static uint8_t rgb[64 * 70 * 3], full[64 * 70], expected[64 * 70], result[64 * 70];
+    static uint16_t padded_image[66 * 72], padded_laplace[66 * 72], padded_blur[66 * 72];
+    random_pixels(rgb, sizeof(rgb), 31);
+    int fail = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t width = sizes[s][0], height = sizes[s][1];
+        for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+            size_t factor = factors[f];
+            // the buffers of the bands have their exact sizes, so the address sanitizer finds every access past them
+            uint8_t* gray = malloc(DOWNSCALE_GRAY_SIZE(width, factor));
+            uint16_t* padded_bands = malloc(DOWNSCALE_PADDED_IMAGE_SIZE(width, factor) * sizeof(uint16_t));
+            uint16_t* laplace_band = malloc(DOWNSCALE_PADDED_SIZE(width, factor) * sizeof(uint16_t));
+            uint16_t* blur_band = malloc(DOWNSCALE_PADDED_SIZE(width, factor) * sizeof(uint16_t));
+            uint16_t* sums = malloc(width * sizeof(uint16_t));
+            if (!gray || !padded_bands || !laplace_band || !blur_band || !sums) {
+                printf("Downscale test failed: could not allocate the bands\n");
+                free_all((void*[]) { gray, padded_bands, laplace_band, blur_band, sums }, 5);
+                return fail + 1;
+            }
+            for (int luma = 0; luma < 2; luma++) {
+                enum pixel_format format = luma ? PIXEL_LUMA : PIXEL_RGB;
+                // the padded image of the size before has pixels where this one has its border
+                memset(padded_image, 0, sizeof(padded_image));
+                denoise_simd_format_view(packed_view(rgb, width, height, pixel_size(format)), format, 0.2126, 0.7152, 0.0722,
+                    padded_image, padded_laplace, padded_blur, packed_view(full, width, height, 1));
+                area_average(full, width, height, factor, expected);
+                // the border of the bands is written with them, whatever the padded image held before
+                memset(padded_bands, 0xff, DOWNSCALE_PADDED_IMAGE_SIZE(width, factor) * sizeof(uint16_t));
+                // the rows above the first and below the last band must not depend on the bands of an image before
+                denoise_simd_downscale(rgb + 1, format, width, height, 0.2126, 0.7152, 0.0722, factor, gray, padded_bands, laplace_band, blur_band,
+                    sums, result);
+                denoise_simd_downscale(rgb, format, width, height, 0.2126, 0.7152, 0.0722, factor, gray, padded_bands, laplace_band, blur_band,
+                    sums, result);
+                if (memcmp(expected, result, DOWNSCALED_SIZE(width, factor) * DOWNSCALED_SIZE(height, factor)) != 0) {
+                    printf("Downscale test failed: %s image of %zux%zu reduced by %zu\n", luma ? "luma" : "RGB", width, height, factor);
+                    fail++;
+                }
+            }
+            free_all((void*[]) { gray, padded_bands, laplace_band, blur_band, sums }, 5);
+        }
+    }
+    if (fail == 0)
+        printf("Downscale Test passed\n");
+    return fail;
+}
+
+// Both metrics of an image are the same, the sums are exact, so are PSNR and SSIM computed from them
+static int same_metrics(const struct image_metrics* expected, const struct image_metrics* actual)
+{
+    return expected->psnr == actual->psnr && expected->ssim == actual->ssim && expected->mean_error == actual->mean_error
+        && expected->max_error == actual->max_error && memcmp(expected->histogram, actual->histogram, sizeof(expected->histogram)) == 0;
+}
+
+int test_metrics()
+{
+    // sizes below a window, with partial cells and with a scalar tail of the errors
+    size_t sizes[][2] = { { 1, 1 }, { 7, 20 }, { 8, 8 }, { 45, 37 }, { 64, 17 }, { 257, 260 } };
+    static uint8_t image[257 * 260], reference[257 * 260], scratch[METRICS_SCRATCH_SIZE(257)];
+    uint32_t seed = 37;
+    random_pixels(reference, sizeof(reference), 38);
+    for (size_t i = 0; i < sizeof(image); i++) {
+        uint32_t random = next_random(&seed);
+        // mostly small errors and some of the whole range
+        image[i] = i % 97 ? (uint8_t)(reference[i] + (int)(random >> 29) - 4) : (uint8_t)(random >> 16);
+    }
+    int fail = 0;
+    struct image_metrics expected, actual;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t width = sizes[s][0], height = sizes[s][1];
+        image_metrics(image, reference, width, height, &expected);
+        image_metrics_simd(image, reference, width, height, scratch, &actual);
+        if (!same_metrics(&expected, &actual)) {
+            printf("Metrics test failed at %zux%zu: PSNR %f and %f, SSIM %f and %f, mean error %f and %f, max error %d and %d\n", width, height,
+                expected.psnr, actual.psnr, expected.ssim, actual.ssim, expected.mean_error, actual.mean_error, expected.max_error, actual.max_error);
+            fail++;
+        }
+    }
+
+    // identical images, and images that differ by 1 everywhere, which have a PSNR of 20 log10(255)
+    image_metrics_simd(reference, reference, 257, 260, scratch, &actual);
+    if (!isinf(actual.psnr) || actual.ssim != 1 || actual.mean_error != 0 || actual.max_error != 0 || actual.histogram[0] != 257 * 260) {
+        printf("Metrics test failed: identical images have a PSNR of %f and a SSIM of %f\n", actual.psnr, actual.ssim);
+        fail++;
+    }
+    for (size_t i = 0; i < sizeof(image); i++)
+        image[i] = (uint8_t)(reference[i] < 255 ? reference[i] + 1 : 254);
+    image_metrics_simd(image, reference, 257, 260, scratch, &actual);
+    if (fabs(actual.psnr - 20 * log10(255)) > 1e-9 || actual.mean_error != 1 || actual.max_error != 1 || actual.histogram[1] != 257 * 260
+        || actual.ssim < 0.99) {
+        printf("Metrics test failed: an error of 1 gives a PSNR of %f, a SSIM of %f and a mean error of %f\n", actual.psnr, actual.ssim, actual.mean_error);
+        fail++;
+    }
+    // more noise is less similar
+    double ssim[2];
+    for (int k = 0; k < 2; k++) {
+        for (size_t i = 0; i < sizeof(image); i++) {
+            int noisy = reference[i] + ((int)(next_random(&seed) >> 28) - 8) * (k ? 4 : 1);
+            image[i] = (uint8_t)(noisy < 0 ? 0 : noisy > 255 ? 255 : noisy);
+        }
+        image_metrics_simd(image, reference, 257, 260, scratch, &actual);
+        ssim[k] = actual.ssim;
+    }
+    if (!(ssim[0] > ssim[1] && ssim[1] > 0)) {
+        printf("Metrics test failed: SSIM %f with little noise and %f with much noise\n", ssim[0], ssim[1]);
+        fail++;
+    }
+    if (fail == 0)
+        printf("Metrics Test passed\n");
+    return fail;
+}
+
+int test_approximations()
+{
+    // widths below a vector and with a scalar tail, odd sizes of the half level
+    size_t sizes[][2] = { { 1, 1 }, { 5, 3 }, { 16, 2 }, { 45, 37 }, { 130, 61 } };
+    static uint8_t image[130 * 61 * 3], gray[130 * 61], expected[130 * 61], result[130 * 61];
+    static uint8_t scratch[HALF_SCRATCH_SIZE(130, 61)];
+    static uint16_t tmp[130 * 61], sums[132], padded_image[132 * 63], padded_laplace[132 * 63], padded_blur[132 * 63];
+    uint32_t seed = 41;
+    int fail = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t width = sizes[s][0], height = sizes[s][1];
+        random_pixels(gray, width * height, seed + (uint32_t)s);
+        blur_2_1d(gray, width, height, tmp, expected);
+        blur_2_1d_simd(gray, width, height, sums, result);
+        if (memcmp(expected, result, width * height) != 0) {
+            printf("Approximations test failed: blur_2_1d_simd differs from blur_2_1d at %zux%zu\n", width, height);
+            fail++;
+        }
+        denoise_blur(gray, PIXEL_LUMA, width, height, 0.2126, 0.7152, 0.0722, scratch, result);
+        if (memcmp(expected, result, width * height) != 0) {
+            printf("Approximations test failed: denoise_blur differs from blur_2_1d at %zux%zu\n", width, height);
+            fail++;
+        }
+    }
+
+    // a smooth RGB image with some noise: the half level is close to the SIMD version and keeps its brightness
+    size_t width = 130, height = 61;
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            for (int k = 0; k < 3; k++)
+                image[(y * width + x) * 3 + k] = (uint8_t)(40 + x + y + k * 20 + (next_random(&seed) >> 29));
+        }
+    }
+    memset(padded_image, 0, sizeof(padded_image));
+    denoise_simd_format_view(packed_view(image, width, height, 3), PIXEL_RGB, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur,
+        packed_view(expected, width, height, 1));
+    denoise_half_resolution(image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, scratch, result);
+    static uint8_t metrics_scratch[METRICS_SCRATCH_SIZE(130)];
+    struct image_metrics metrics;
+    image_metrics_simd(result, expected, width, height, metrics_scratch, &metrics);
+    if (metrics.psnr < 30 || metrics.ssim < 0.9) {
+        printf("Approximations test failed: the half level has a PSNR of %f dB and a SSIM of %f\n", metrics.psnr, metrics.ssim);
+        fail++;
+    }
+    // the 2x2 averages don't depend on the layout of the pixels
+    static uint8_t rgba[130 * 61 * 4];
+    for (size_t i = 0; i < width * height; i++) {
+        memcpy(rgba + i * 4, image + i * 3, 3);
+        rgba[i * 4 + 3] = 255;
+    }
+    denoise_half_resolution(rgba, PIXEL_RGBA, width, height, 0.2126, 0.7152, 0.0722, scratch, expected);
+    if (memcmp(expected, result, width * height) != 0) {
+        printf("Approximations test failed: the half level of RGBA differs from RGB\n");
+        fail++;
+    }
+    // a flat image stays flat up to the edges, only darkened by the combine
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t flat_width = sizes[s][0], flat_height = sizes[s][1];
+        memset(gray, 200, flat_width * flat_height);
+        denoise_half_resolution(gray, PIXEL_LUMA, flat_width, flat_height, 0.2126, 0.7152, 0.0722, scratch, result);
+        for (size_t i = 0; i < flat_width * flat_height; i++) {
+            if (result[i] != (255 * 200) >> 8) {
+                printf("Approximations test failed: the half level of a flat %zux%zu image is %d at %zu\n", flat_width, flat_height, result[i], i);
+                fail++;
+                break;
+            }
+        }
+    }
+    if (fail == 0)
+        printf("Approximations Test passed\n");
+    return fail;
+}
+
+// Denoise frames of a megapixel with the given milliseconds per level, returns the events of the last frame
+static enum deadline_event simulate(struct deadline_controller* controller, enum deadline_level best, const double* ms, size_t frames)
+{
+    enum deadline_event event = DEADLINE_KEEP;
+    for (size_t i = 0; i < frames; i++) {
+        event = deadline_pick(controller, 1000000, best, NULL);
+        deadline_update(controller, 1000000, ms[controller->level] * 1e-3);
+    }
+    return event;
+}
+
+int test_deadline()
+{
+    struct deadline_controller controller;
+    int fail = 0;
+    // the SISD versions are never picked for luma frames, the cheap levels stay calm
+    double calm[DEADLINE_LEVELS] = { 40, 25, 4, 2, 1 };
+    double loaded[DEADLINE_LEVELS] = { 120, 75, 12, 3, 2 };
+    deadline_init(&controller, 10e-3);
+    simulate(&controller, DEADLINE_SIMD, calm, 20);
+    if (controller.level != DEADLINE_SIMD || controller.downgrades || controller.recoveries) {
+        printf("Deadline test failed: calm luma frames end with %s after %zu downgrades and %zu recoveries\n",
+            deadline_level_name(controller.level), controller.downgrades, controller.recoveries);
+        fail++;
+    }
+    // a frame over the budget downgrades the next one
+    simulate(&controller, DEADLINE_SIMD, loaded, 1);
+    if (simulate(&controller, DEADLINE_SIMD, loaded, 1) != DEADLINE_DOWNGRADE || controller.level != DEADLINE_BLUR) {
+        printf("Deadline test failed: a frame over the budget is followed by %s\n", deadline_level_name(controller.level));
+        fail++;
+    }
+    // the last frame of SIMD missed the budget, its prediction is kept, so it is not tried again
+    simulate(&controller, DEADLINE_SIMD, loaded, 100);
+    if (controller.level != DEADLINE_BLUR || controller.recoveries) {
+        printf("Deadline test failed: a level that missed the budget is tried again, %s after %zu recoveries\n", deadline_level_name(controller.level),
+            controller.recoveries);
+        fail++;
+    }
+
+    // a level that is predicted to take more than DEADLINE_HEADROOM of the budget is skipped, blur only is predicted from SIMD
+    double slow[DEADLINE_LEVELS] = { 400, 250, 30, 9.5, 1 };
+    deadline_init(&controller, 10e-3);
+    simulate(&controller, DEADLINE_SIMD, slow, 1);
+    if (simulate(&controller, DEADLINE_SIMD, slow, 1) != DEADLINE_DOWNGRADE || controller.level != DEADLINE_HALF) {
+        printf("Deadline test failed: a level predicted over the headroom is followed by %s\n", deadline_level_name(controller.level));
+        fail++;
+    }
+    // SIMD within the budget, but predicted over the headroom, is tried again after DEADLINE_PROBE_FRAMES calm frames,
+    // here the attempt misses the budget
+    double busy[DEADLINE_LEVELS] = { 120, 75, 9.5, 3, 2 };
+    deadline_init(&controller, 10e-3);
+    simulate(&controller, DEADLINE_SIMD, busy, 1);
+    if (simulate(&controller, DEADLINE_SIMD, busy, 1) != DEADLINE_DOWNGRADE || controller.level != DEADLINE_BLUR) {
+        printf("Deadline test failed: a level predicted over the headroom is followed by %s\n", deadline_level_name(controller.level));
+        fail++;
+    }
+    size_t frames = 0;
+    while (controller.level != DEADLINE_SIMD && frames < 100) {
+        simulate(&controller, DEADLINE_SIMD, loaded, 1);
+        frames++;
+    }
+    if (controller.level != DEADLINE_SIMD || frames <= DEADLINE_PROBE_FRAMES || controller.recoveries != 1) {
+        printf("Deadline test failed: recovered to %s after %zu calm frames\n", deadline_level_name(controller.level), frames);
+        fail++;
+    }
+    // an attempt that misses the budget doubles the wait for the next one
+    simulate(&controller, DEADLINE_SIMD, loaded, 1);
+    if (controller.level != DEADLINE_BLUR || controller.probe_frames != 2 * DEADLINE_PROBE_FRAMES) {
+        printf("Deadline test failed: a failed attempt waits %zu frames at %s\n", controller.probe_frames, deadline_level_name(controller.level));
+        fail++;
+    }
+
+    // the SISD versions were never measured, they are predicted from SIMD and are too slow for the budget
+    double sisd_slow[DEADLINE_LEVELS] = { 400, 250, 1, 1, 1 };
+    deadline_init(&controller, 10e-3);
+    simulate(&controller, DEADLINE_ACCURATE, sisd_slow, 100);
+    if (controller.level != DEADLINE_SIMD || controller.recoveries || controller.missed_frames) {
+        printf("Deadline test failed: calm RGB frames with slow SISD versions end with %s after %zu recoveries\n", deadline_level_name(controller.level),
+            controller.recoveries);
+        fail++;
+    }
+    // RGB frames recover up to the accurate version if there is time left
+    double fast[DEADLINE_LEVELS] = { 3, 1.5, 0.1, 0.1, 0.1 };
+    deadline_init(&controller, 10e-3);
+    simulate(&controller, DEADLINE_ACCURATE, fast, 3 * DEADLINE_PROBE_FRAMES);
+    if (controller.level != DEADLINE_ACCURATE || controller.missed_frames) {
+        printf("Deadline test failed: fast RGB frames end with %s\n", deadline_level_name(controller.level));
+        fail++;
+    }
+    if (fail == 0)
+        printf("Deadline Test passed\n");
+    return fail;
+}
+
+int test_flat_tiles()
+{
+    // widths below 8, not multiples of the tile width and wider than a strip, heights not multiples of the tile rows
+    size_t sizes[][2] = { { 3, 5 }, { 70, 19 }, { 200, 40 }, { 2100, 9 } };
+    static uint8_t gray[24000], expected[24000], result[24000];
+    static uint16_t padded_image[24000], padded_laplace[24000], padded_blur[24000];
+    uint32_t seed = 5;
+    int fail = 0;
+    for (int kind = 0; kind < 6; kind++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t width = sizes[s][0], height = sizes[s][1], padded_width = width + 2;
+            for (size_t y = 0; y < height; y++) {
+                for (size_t x = 0; x < width; x++)
+                    gray[y * width + x] = flat_pattern(kind, x, y, &seed);
+            }
+            memset(padded_image, 0, sizeof(padded_image));
+            pad_image_simd(gray, width, height, padded_width, padded_image);
+            convolution_simd(padded_image, padded_width, height + 2, padded_laplace, padded_blur);
+            combine_simd(gray, padded_laplace, padded_blur, width, height, padded_width, expected);
+            // the skipped tiles must not depend on the previous contents of the padded arrays
+            memset(padded_laplace, 0xff, sizeof(padded_laplace));
+            memset(padded_blur, 0xff, sizeof(padded_blur));
+            convolve_combine_simd_view(packed_view(gray, width, height, 1), padded_image, padded_width, padded_laplace, padded_blur,
+                packed_view(result, width, height, 1));
+            char prefix[64];
+            snprintf(prefix, sizeof(prefix), "Flat tiles pattern %d, %zux%zu", kind, width, height);
+            fail += check(prefix, expected, result, width * height, 1);
+        }
+    }
+
+    // in place, like the denoising of P5 images
+    memcpy(result, gray, 2100 * 9);
+    convolve_combine_simd_view(packed_view(result, 2100, 9, 1), padded_image, 2102, padded_laplace, padded_blur, packed_view(result, 2100, 9, 1));
+    fail += check("Flat tiles in place", expected, result, 2100 * 9, 1);
+
+    // only tiles whose halo is flat are skipped, the zero padding counts as part of the halo
+    struct laplace_summary summaries[FLAT_STRIP_TILES], halo[FLAT_STRIP_TILES], zero[FLAT_STRIP_TILES];
+    memset(gray, 128, 200 * 40);
+    pad_image_simd(gray, 200, 40, 202, padded_image);
+    convolution_simd_strip(padded_image + 8 * 202, 202, 200, 8, padded_laplace + 8 * 202, padded_blur + 8 * 202, summaries, 1);
+    padded_image[17 * 202 + 65] = 0;
+    convolution_simd_strip(padded_image + 8 * 202, 202, 200, 8, padded_laplace + 8 * 202, padded_blur + 8 * 202, halo, 1);
+    memset(gray, 0, 200 * 40);
+    pad_image_simd(gray, 200, 40, 202, padded_image);
+    convolution_simd_strip(padded_image, 202, 200, 8, padded_laplace, padded_blur, zero, 1);
+    if (summaries[0].flat || !summaries[1].flat || !summaries[2].flat || summaries[3].flat || summaries[1].value != 128
+        || halo[1].flat || !halo[2].flat || !zero[0].flat || !zero[2].flat) {
+        printf("Flat tiles test failed: wrong flat tiles\n");
+        fail++;
+    }
+    if (summaries[0].laplace_min != 0 || summaries[0].laplace_max != 32 || halo[1].laplace_max != 32) {
+        printf("Flat tiles test failed: wrong laplace summaries %u %u %u\n", summaries[0].laplace_min, summaries[0].laplace_max, halo[1].laplace_max);
+        fail++;
+    }
+    if (fail)
+        return fail;
+    printf("Flat tiles Test passed\n");
+    return 0;
+}
+
+int test_denoise_tiled()
+{
+    // 45x37 pseudo random image, written to a file because the out-of-core mode works on files
+    struct Netpbm image = { "P6", 255, 45, 37, NULL, PIXEL_RGB };
+    uint8_t pixels[45 * 37 * 3];
+    random_pixels(pixels, sizeof(pixels), 7);
+    uint16_t padded_image[47 * 39] = { 0 };
+    uint16_t padded_laplace[47 * 39] = { 0 };
+    uint16_t padded_blur[47 * 39] = { 0 };
+    uint8_t expected_result[45 * 37];
+    denoise_simd(pixels, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, expected_result);
+
+    char input_path[] = "/tmp/denoise_tiled_XXXXXX";
+    int fd = mkstemp(input_path);
+    if (fd < 0) {
+        printf("Denoise tiled test failed: could not create temporary file\n");
+        return 1;
+    }
+    FILE* input = fdopen(fd, "wb");
+    fprintf(input, "P6\n%zu %zu\n%u\n", image.width, image.height, image.maxValue);
+    fwrite(pixels, 1, sizeof(pixels), input);
+    fclose(input);
+    char output_path[64];
+    snprintf(output_path, sizeof(output_path), "%s.pgm", input_path);
+
+    // a budget of 4 KiB per tile results in 2D tiles smaller than the image
+    struct parallel_config config = { .threads = 2, .cpu_count = 0 };
+    struct tile_size tile;
+    int fail = choose_tile_size(45, 37, 8192, 2, &tile) || tile.width >= 45 || tile.height >= 37;
+    fail = fail || denoise_tiled(input_path, output_path, 0.2126, 0.7152, 0.0722, 8192, &config);
+    struct Netpbm result = { "", 0, 0, 0, NULL, PIXEL_RGB };
+    if (!fail) {
+        // the output has the same header as write_image(), so only the pixels at the end of the file are compared
+        FILE* output = fopen(output_path, "rb");
+        fail = !output || fseek(output, -(long)sizeof(expected_result), SEEK_END) != 0;
+        result.pixels = malloc(sizeof(expected_result));
+        fail = fail || !result.pixels || fread(result.pixels, 1, sizeof(expected_result), output) != sizeof(expected_result);
+        if (output)
+            fclose(output);
+    }
+    remove(input_path);
+    remove(output_path);
+    if (fail) {
+        printf("Denoise tiled test failed: could not denoise the image tile by tile\n");
+        free(result.pixels);
+        return 1;
+    }
+    int ret = check("Denoise tiled", expected_result, result.pixels, 45 * 37, 1);
+    free(result.pixels);
+    return ret;
+}
+
+static int test_parse_ascii_chunks()
+{
+    // 3000 values with comments, some of them right after a value or with digits in them, split into 1 to 64 chunks
+    // the chunk borders fall into values and comments, which must be parsed by the chunk they start in
+    const char* separators[] = { " ", "\n", "\t", "\r\n", "#\n", " # 12 34\n", "# 5#6 \r", "\n#7\n\n", "  " };
+    const size_t chunk_counts[] = { 1, 2, 3, 5, 8, 13, 31, 64 };
+    uint8_t expected_result[3000], result[3000];
+    static char text[ASCII_PADDING + 3000 * 12 + ASCII_PADDING];
+    memset(text, ' ', sizeof(text));
+    size_t size = 0;
+    uint32_t seed = 9;
+    for (size_t i = 0; i < 3000; i++) {
+        uint32_t random = next_random(&seed);
+        expected_result[i] = (uint8_t)(random >> 16) >> (random % 7);
+        size += (size_t)sprintf(text + ASCII_PADDING + size, "%u%s", expected_result[i], separators[(random >> 8) % 9]);
+    }
+    text[ASCII_PADDING + size] = ' ';
+    int fail = 0;
+    for (size_t i = 0; i < sizeof(chunk_counts) / sizeof(chunk_counts[0]) && !fail; i++) {
+        memset(result, 0, sizeof(result));
+        if (parse_ascii_pixels_chunks(text + ASCII_PADDING, size, 255, result, 3000, chunk_counts[i]) != 0 || memcmp(result, expected_result, sizeof(result)) != 0) {
+            printf("Parse ASCII chunks test failed with %zu chunks\n", chunk_counts[i]);
+            fail = 1;
+        }
+    }
+    // a value after a comment that reaches into the next chunk is part of the comment
+    const char* comment = "1 # 2 3 4 5 6 7 8 9 10 11 12\n2 3";
+    memcpy(text + ASCII_PADDING, comment, strlen(comment));
+    memset(text + ASCII_PADDING + strlen(comment), ' ', ASCII_PADDING);
+    uint8_t comment_result[3];
+    if (parse_ascii_pixels_chunks(text + ASCII_PADDING, strlen(comment), 255, comment_result, 3, 4) != 0 || memcmp(comment_result, "\1\2\3", 3) != 0) {
+        printf("Parse ASCII chunks test failed: values of a comment across chunks were parsed\n");
+        fail = 1;
+    }
+    return fail + check("Parse ASCII chunks", expected_result, result, 3000, 1);
+}
+
+int test_parse_ascii()
+{
+    // values with 1 to 3 digits separated by different whitespace, so that values cross the 64 byte blocks
+    const char* separators[] = { " ", "\n", "  ", "\t", "\r\n", " \v", "\f" };
+    uint8_t expected_result[300];
+    char text[ASCII_PADDING + 300 * 6 + ASCII_PADDING];
+    memset(text, ' ', sizeof(text));
+    size_t size = 0;
+    uint32_t seed = 3;
+    for (size_t i = 0; i < 300; i++) {
+        uint32_t random = next_random(&seed);
+        expected_result[i] = (uint8_t)(random >> 16) >> (random % 7);
+        size += (size_t)sprintf(text + ASCII_PADDING + size, "%u%s", expected_result[i], separators[(random >> 8) % 7]);
+    }
+    text[ASCII_PADDING + size] = ' '; // overwrite the terminating zero of sprintf()
+    uint8_t result[300];
+    int fail = parse_ascii_pixels(text + ASCII_PADDING, size, 255, result, 300);
+    // too few values, too large value and invalid character
+    uint8_t invalid_result[4];
+    char invalid[ASCII_PADDING + 16 + ASCII_PADDING];
+    memset(invalid, ' ', sizeof(invalid));
+    memcpy(invalid + ASCII_PADDING, "1 2 3", 5);
+    fail |= parse_ascii_pixels(invalid + ASCII_PADDING, 5, 255, invalid_result, 4) != -1;
+    memcpy(invalid + ASCII_PADDING, "1 2 3 256", 9);
+    fail |= parse_ascii_pixels(invalid + ASCII_PADDING, 9, 255, invalid_result, 4) != -1;
+    memcpy(invalid + ASCII_PADDING, "1 2 3 4a", 8);
+    fail |= parse_ascii_pixels(invalid + ASCII_PADDING, 8, 255, invalid_result, 4) != -1;
+    memcpy(invalid + ASCII_PADDING, "1 2 # 3\n4 5", 11);
+    fail |= parse_ascii_pixels(invalid + ASCII_PADDING, 11, 255, invalid_result, 4) != 0 || memcmp(invalid_result, "\1\2\4\5", 4) != 0;
+    if (fail) {
+        printf("Parse ASCII test failed: valid text rejected or invalid text accepted\n");
+        return 1;
+    }
+    return check("Parse ASCII", expected_result, result, 300, 1) + test_parse_ascii_chunks();
+}
+
+int test_wisdom()
+{
+    char path[] = "/tmp/denoise_wisdom_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Wisdom test failed: could not create temporary file\n");
+        return 1;
+    }
+    FILE* file = fdopen(fd, "w");
+    fprintf(file, "denoise-wisdom 1\n# width height version threads tile_rows seconds\n");
+    fprintf(file, "64 64 2 1 0 0.00001\n1920 1080 0 4 32 0.004\n3840 2160 0 8 0 0.016\n");
+    fclose(file);
+    struct wisdom wisdom;
+    int fail = load_wisdom(path, &wisdom) != 0 || wisdom.count != 3;
+    // the closest size class by the ratio of the numbers of pixels
+    fail = fail || lookup_wisdom(&wisdom, 32, 32) != &wisdom.entries[0];
+    fail = fail || lookup_wisdom(&wisdom, 2048, 1536) != &wisdom.entries[1];
+    fail = fail || lookup_wisdom(&wisdom, 4000, 3000) != &wisdom.entries[2];
+    fail = fail || wisdom.entries[1].threads != 4 || wisdom.entries[1].tile_rows != 32;
+
+    // invalid version
+    file = fopen(path, "w");
+    fprintf(file, "denoise-wisdom 1\n64 64 3 1 0 0.00001\n");
+    fclose(file);
+    fail = fail || load_wisdom(path, &wisdom) != -1;
+    remove(path);
+    fail = fail || load_wisdom(path, &wisdom) != -1;
+    if (fail) {
+        printf("Wisdom test failed: wrong configuration read from the wisdom file\n");
+        return 1;
+    }
+    printf("Wisdom Test passed\n");
+    return 0;
+}
+
+int test_cache()
+{
+    // the SIMD hash is the same as the naive one for all lengths of the last block
+    uint8_t data[4099];
+    random_pixels(data, sizeof(data), 11);
+    size_t sizes[] = { 0, 1, 63, 64, 65, 1000, 4099 };
+    int fail = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct cache_key expected, actual;
+        cache_hash(data, sizes[i], 5, &expected);
+        cache_hash_simd(data, sizes[i], 5, &actual);
+        fail |= expected.low != actual.low || expected.high != actual.high;
+    }
+    // another seed, another byte or a trailing zero byte give another key
+    struct cache_key key, other;
+    cache_hash_simd(data, 1000, 5, &key);
+    cache_hash_simd(data, 1000, 6, &other);
+    fail |= key.low == other.low && key.high == other.high;
+    data[999] ^= 1;
+    cache_hash_simd(data, 1000, 5, &other);
+    fail |= key.low == other.low && key.high == other.high;
+    data[999] = 0;
+    cache_hash_simd(data, 999, 5, &key);
+    cache_hash_simd(data, 1000, 5, &other);
+    fail |= key.low == other.low && key.high == other.high;
+    if (fail) {
+        printf("Cache test failed: wrong hash\n");
+        return 1;
+    }
+
+    // results of 10x10 pixels, the memory tier holds two of them
+    uint8_t results[3][100], result[100];
+    struct cache_key keys[3];
+    for (size_t i = 0; i < 3; i++) {
+        memset(results[i], (int)i + 1, 100);
+        cache_hash_simd(results[i], 100, 0, &keys[i]);
+    }
+    struct result_cache cache;
+    fail = cache_open(&cache, 200, NULL, 0) != 0;
+    fail = fail || cache_insert(&cache, keys[0], 10, 10, results[0]) || cache_insert(&cache, keys[1], 10, 10, results[1]);
+    fail = fail || cache_lookup(&cache, keys[0], 10, 10, result) != 0 || memcmp(result, results[0], 100) != 0;
+    // the least recently used result is evicted
+    fail = fail || cache_insert(&cache, keys[2], 10, 10, results[2]);
+    fail = fail || cache_lookup(&cache, keys[1], 10, 10, result) != -1;
+    fail = fail || cache_lookup(&cache, keys[0], 10, 10, result) != 0 || cache_lookup(&cache, keys[2], 10, 10, result) != 0;
+    // another size is a miss
+    fail = fail || cache_lookup(&cache, keys[2], 20, 5, result) != -1;
+    fail = fail || cache.stats.memory_hits != 3 || cache.stats.misses != 2 || cache.stats.evictions != 1 || cache.memory.bytes != 200;
+    cache_close(&cache);
+    // 1000 results of one pixel, the index grows several times and the 400 least recently used are evicted
+    fail = fail || cache_open(&cache, 600, NULL, 0) != 0;
+    for (uint32_t i = 0; i < 1000 && !fail; i++) {
+        cache_hash_simd((const uint8_t*)&i, sizeof(i), 0, &key);
+        uint8_t pixel = (uint8_t)i;
+        fail = cache_insert(&cache, key, 1, 1, &pixel) != 0;
+    }
+    for (uint32_t i = 0; i < 1000 && !fail; i++) {
+        cache_hash_simd((const uint8_t*)&i, sizeof(i), 0, &key);
+        fail = cache_lookup(&cache, key, 1, 1, result) != (i < 400 ? -1 : 0) || (i >= 400 && result[0] != (uint8_t)i);
+    }
+    fail = fail || cache.memory.count != 600 || cache.memory.bucket_count < 600 || cache.stats.evictions != 400;
+    cache_close(&cache);
+    if (fail) {
+        printf("Cache test failed: wrong results in memory\n");
+        return 1;
+    }
+
+    // the files have 113 bytes, the directory holds two of them
+    char directory[] = "/tmp/denoise_cache_XXXXXX";
+    if (!mkdtemp(directory)) {
+        printf("Cache test failed: could not create temporary directory\n");
+        return 1;
+    }
+    fail = cache_open(&cache, 0, directory, 300) != 0;
+    fail = fail || cache_insert(&cache, keys[0], 10, 10, results[0]) || cache_insert(&cache, keys[1], 10, 10, results[1]);
+    fail = fail || cache_insert(&cache, keys[2], 10, 10, results[2]);
+    fail = fail || cache_lookup(&cache, keys[0], 10, 10, result) != -1;
+    fail = fail || cache_lookup(&cache, keys[1], 10, 10, result) != 0 || memcmp(result, results[1], 100) != 0;
+    fail = fail || cache.stats.disk_hits != 1 || cache.stats.evictions != 1 || cache.disk.bytes != 226;
+    cache_close(&cache);
+    // the next run finds the files
+    fail = fail || cache_open(&cache, 0, directory, 300) != 0 || cache.disk.bytes != 226;
+    fail = fail || cache_lookup(&cache, keys[2], 10, 10, result) != 0 || memcmp(result, results[2], 100) != 0;
+    cache_close(&cache);
+    // without room all files are evicted
+    fail = fail || cache_open(&cache, 0, directory, 0) != 0 || cache.disk.bytes != 0;
+    cache_close(&cache);
+    fail = fail || rmdir(directory) != 0;
+    if (fail) {
+        printf("Cache test failed: wrong results on disk\n");
+        return 1;
+    }
+    printf("Cache Test passed\n");
+    return 0;
+}
+
+// Occurrences of pattern in text
+static size_t count_matches(const char* text, const char* pattern)
+{
+    size_t count = 0;
+    for (const char* match = strstr(text, pattern); match; match = strstr(match + 1, pattern))
+        count++;
+    return count;
+}
+
+// Read a whole text file, NULL on error
+static char* read_text(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char* text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (text && fread(text, 1, (size_t)size, file) == (size_t)size) {
+        text[size] = '\0';
+    } else {
+        free(text);
+        text = NULL;
+    }
+    fclose(file);
+    return text;
+}
+
+int test_trace()
+{
+    uint8_t image[45 * 37 * 3];
+    random_pixels(image, sizeof(image), 13);
+    uint16_t padded_image[47 * 39];
+    uint16_t padded_laplace[47 * 39];
+    uint16_t padded_blur[47 * 39];
+    uint8_t result[45 * 37];
+    char path[] = "/tmp/denoise_trace_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Trace test failed: could not create temporary file\n");
+        return 1;
+    }
+    close(fd);
+
+    // the stages of two workers and a frame on the calling thread, whose detail has to be escaped
+    struct parallel_config config = { .threads = 2, .cpu_count = 0 };
+    trace_start();
+    TRACE_BEGIN_DETAIL("frame", "test \"image\"");
+    int fail = denoise_simd_parallel(&config, image, 45, 37, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result);
+    TRACE_END("frame");
+    fail = fail || trace_stop(path) != 0;
+    char* text = read_text(path);
+    fail = fail || !text || strncmp(text, "{\"traceEvents\":[", 16) != 0;
+    fail = fail || count_matches(text, "\"ph\":\"B\"") == 0 || count_matches(text, "\"ph\":\"B\"") != count_matches(text, "\"ph\":\"E\"");
+    fail = fail || !strstr(text, "\"name\":\"worker 2\"") || !strstr(text, "\"name\":\"combine\",\"ph\":\"E\"");
+    fail = fail || !strstr(text, "\"args\":{\"detail\":\"test \\\"image\\\"\"}");
+    free(text);
+
+    // without tracing nothing is recorded
+    TRACE_BEGIN("frame");
+    TRACE_END("frame");
+    trace_start();
+    fail = fail || trace_stop(path) != 0;
+    text = read_text(path);
+    fail = fail || !text || count_matches(text, "\"ph\":\"B\"") != 0 || count_matches(text, "\"ph\":\"E\"") != 0;
+    free(text);
+    remove(path);
+    if (fail) {
+        printf("Trace test failed: wrong events in the trace\n");
+        return 1;
+    }
+    printf("Trace Test passed\n");
+    return 0;
+}
+
+int test_bench()
+{
+    // separated, interleaved and equal samples, 0.000182672 is the p value of scipy.stats.mannwhitneyu for the separated ones
+    double low[10], high[10], odd[10], even[10];
+    for (size_t i = 0; i < 10; i++) {
+        low[i] = (double)i + 1;
+        high[i] = (double)i + 11;
+        odd[i] = (double)(2 * i + 1);
+        even[i] = (double)(2 * i + 2);
+    }
+    int fail = fabs(mann_whitney(low, 10, high, 10) - 0.000182672) > 1e-9;
+    fail |= fabs(mann_whitney(high, 10, low, 10) - 0.000182672) > 1e-9;
+    fail |= mann_whitney(odd, 10, even, 10) < 0.5;
+    fail |= mann_whitney(low, 10, low, 10) != 1;
+    fail |= mann_whitney(low, 1, low, 1) != 1;
+    if (fail) {
+        printf("Bench test failed: wrong p value\n");
+        return 1;
+    }
+
+    // 20 noisy samples, scaled by 1.3, 0.7 and 1.1
+    struct bench_result baseline = { .stage = "denoise", .variant = "simd", .count = 20 };
+    struct bench_result slower = baseline, faster = baseline, nearly = baseline;
+    uint32_t seed = 7;
+    for (size_t i = 0; i < 20; i++) {
+        baseline.seconds[i] = 1 + (double)(next_random(&seed) >> 16 & 0xFF) / 10000;
+        slower.seconds[i] = baseline.seconds[i] * 1.3;
+        faster.seconds[i] = baseline.seconds[i] * 0.7;
+        nearly.seconds[i] = baseline.seconds[i] * 1.1;
+    }
+    double change, p;
+    fail = bench_compare(&baseline, &slower, &change, &p) != BENCH_SLOWER || fabs(change - 0.3) > 1e-9;
+    fail |= bench_compare(&baseline, &faster, &change, &p) != BENCH_FASTER || fabs(change + 0.3) > 1e-9;
+    // significant, but smaller than BENCH_MIN_CHANGE
+    fail |= bench_compare(&baseline, &nearly, &change, &p) != BENCH_UNCHANGED || p >= BENCH_ALPHA;
+    fail |= bench_compare(&baseline, &baseline, &change, &p) != BENCH_UNCHANGED || change != 0;
+    // larger than BENCH_MIN_CHANGE, but within the spread of the baseline
+    struct bench_result spread = baseline;
+    spread.spread = 0.4;
+    fail |= bench_compare(&spread, &slower, &change, &p) != BENCH_UNCHANGED || p >= BENCH_ALPHA;
+    if (fail) {
+        printf("Bench test failed: wrong verdict\n");
+        return 1;
+    }
+
+    // two runs of the baseline, the second 10% slower, a single run and a run per sample
+    struct bench_result pooled = baseline;
+    for (size_t i = 0; i < 20; i++)
+        pooled.seconds[20 + i] = baseline.seconds[i] * 1.1;
+    pooled.count = 40;
+    bench_spread(&pooled, 2);
+    fail = fabs(pooled.spread - 0.1) > 1e-9;
+    bench_spread(&pooled, 1);
+    fail |= pooled.spread != 0;
+    pooled.count = 2;
+    bench_spread(&pooled, 2);
+    fail |= fabs(pooled.spread - (fmax(pooled.seconds[0], pooled.seconds[1]) / fmin(pooled.seconds[0], pooled.seconds[1]) - 1)) > 1e-9;
+    if (fail) {
+        printf("Bench test failed: wrong spread\n");
+        return 1;
+    }
+
+    // the run written as JSON is read back, quotes and backslashes in the image path are escaped
+    static struct bench_run run, loaded;
+    snprintf(run.image, sizeof(run.image), "%s", "dir\\\"quoted\".ppm");
+    run.width = 517;
+    run.height = 689;
+    run.count = 2;
+    run.results[0] = baseline;
+    run.results[0].calls = 5;
+    run.results[0].spread = 0.125;
+    run.results[1] = (struct bench_result) { .stage = "combine", .variant = "integer", .calls = 20, .count = 1, .seconds = { 2.5e-4 } };
+    char path[] = "/tmp/denoise_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Bench test failed: could not create a temporary file\n");
+        return 1;
+    }
+    close(fd);
+    fail = bench_save(path, &run) != 0 || bench_load(path, &loaded) != 0;
+    fail = fail || strcmp(loaded.image, run.image) != 0 || loaded.width != 517 || loaded.height != 689 || loaded.count != 2;
+    for (size_t i = 0; !fail && i < run.count; i++) {
+        const struct bench_result* result = bench_find(&loaded, run.results[i].stage, run.results[i].variant);
+        fail = !result || result->calls != run.results[i].calls || result->spread != run.results[i].spread || result->count != run.results[i].count;
+        for (size_t j = 0; !fail && j < result->count; j++)
+            fail = fabs(result->seconds[j] / run.results[i].seconds[j] - 1) > 1e-8;
+    }
+    fail = fail || bench_find(&loaded, "combine", "simd") != NULL;
+    // a truncated file is rejected
+    FILE* file = fopen(path, "w");
+    if (file) {
+        fprintf(file, "{\"image\": \"a.ppm\", \"width\": 1, \"height\": 1, \"results\": [{\"stage\": \"x\", \"variant\": \"y\", \"calls\": 1, \"spread\": 0, \"seconds\": [1, 2");
+        fclose(file);
+    }
+    fail = fail || !file || bench_load(path, &loaded) != -1;
+    unlink(path);
+    if (fail) {
+        printf("Bench test failed: baseline not read back\n");
+        return 1;
+    }
+    printf("Bench Test passed\n");
+    return 0;
+}
+
 int run_all_func_tests()
 {
     printf("\nTesting correctness of functions...\n\n");
-    return (test_grayscale() + test_pad_image() + test_convolution() + test_combine() + test_combine_simd());
+    return (test_grayscale() + test_pad_image() + test_convolution() + test_combine() + test_combine_simd() + test_denoise_8bit() + test_denoise_parallel() + test_denoise_view() + test_denoise_formats() + test_denoise_batch() + test_denoise_strips() + test_memory_budget_threads() + test_median() + test_bilateral() + test_box_blur() + test_adaptive() + test_pyramid() + test_downscale() + test_metrics() + test_approximations() + test_deadline() + test_flat_tiles() + test_denoise_tiled() + test_parse_ascii() + test_wisdom() + test_cache() + test_trace() + test_bench());
 }
\ No newline at end of file
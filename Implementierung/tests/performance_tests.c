@@ -5,8 +5,19 @@
 #include "../src/denoise.h"
 #include "../src/grayscale.h"
 #include "../src/image.h"
+#include "../src/median.h"
+#include "../src/metrics.h"
+#include "../src/pyramid.h"
+#include "../src/bench.h"
+#include "../src/bilateral.h"
+#include "../src/box.h"
+#include "../src/budget.h"
+#include "../src/cache.h"
+#include "../src/trace.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 // path to image used for performance tests:
@@ -52,9 +63,10 @@ int setup()
     blurred = malloc(width * height * sizeof(uint8_t));
     laplaced = malloc(width * height * sizeof(uint8_t));
     result = malloc(width * height * sizeof(uint8_t));
-    padded_image = malloc(padded_width * padded_height * sizeof(uint16_t));
-    padded_laplace = malloc(padded_width * padded_height * sizeof(uint16_t));
-    padded_blur = malloc(padded_width * padded_height * sizeof(uint16_t));
+    // the border of the padded image must be zero, the laplace responses counted by convolution_simd_histogram() are at most 255 then
+    padded_image = calloc(padded_width * padded_height, sizeof(uint16_t));
+    padded_laplace = calloc(padded_width * padded_height, sizeof(uint16_t));
+    padded_blur = calloc(padded_width * padded_height, sizeof(uint16_t));
 
     if (!grayscale_image || !blurred || !result || !laplaced || !padded_laplace || !padded_blur || !padded_image)
         return 1;
@@ -102,9 +114,15 @@ int test_convolution_performance()
     timer(convolution_simd(padded_image, padded_width, padded_height, padded_laplace, padded_blur), time_convolution_simd);
     time_convolution_simd += time_padding;
     printf("Time taken for %s: %f seconds\n", "Convolution Simd", time_convolution_simd);
+    double time_convolution_histogram;
+    uint32_t histogram[256] = { 0 };
+    timer(convolution_simd_histogram(padded_image, padded_width, padded_height, padded_laplace, padded_blur, histogram), time_convolution_histogram);
+    time_convolution_histogram += time_padding;
+    printf("Time taken for %s: %f seconds\n", "Convolution Simd with noise histogram", time_convolution_histogram);
 
     printf("Time for Convolution Integer as percentage of accurate: %f\n", time_convolution_integer / time_convolution_accurate * 100);
-    printf("Time for Convolution SIMD as percentage of accurate: %f\n\n", time_convolution_simd / time_convolution_accurate * 100);
+    printf("Time for Convolution SIMD as percentage of accurate: %f\n", time_convolution_simd / time_convolution_accurate * 100);
+    printf("Time for Convolution SIMD with noise histogram as percentage of without: %f\n\n", time_convolution_histogram / time_convolution_simd * 100);
     return 0;
 }
 
@@ -127,6 +145,389 @@ int test_combine_performance()
     return 0;
 }
 
+int test_median_performance()
+{
+    uint8_t* scratch = malloc(MEDIAN_SCRATCH_SIZE(width, 5));
+    if (!scratch)
+        return 1;
+    double time_taken_accurate, time_taken_simd, time_taken_simd_5x5, time_convolution_simd;
+    timer(median(grayscale_image, width, height, 3, result), time_taken_accurate);
+    printf("Time taken for %s: %f seconds\n", "Median 3x3", time_taken_accurate);
+    timer(median_simd(grayscale_image, width, height, 3, scratch, result), time_taken_simd);
+    printf("Time taken for %s: %f seconds\n", "Median 3x3 SIMD", time_taken_simd);
+    timer(median_simd(grayscale_image, width, height, 5, scratch, result), time_taken_simd_5x5);
+    printf("Time taken for %s: %f seconds\n", "Median 5x5 SIMD", time_taken_simd_5x5);
+    timer(convolution_simd(padded_image, padded_width, padded_height, padded_laplace, padded_blur), time_convolution_simd);
+
+    printf("Time for Median 3x3 SIMD as percentage of naive: %f\n", time_taken_simd / time_taken_accurate * 100);
+    printf("Time for Median 3x3 SIMD as percentage of Convolution SIMD: %f\n", time_taken_simd / time_convolution_simd * 100);
+    printf("Time for Median 5x5 SIMD as percentage of Convolution SIMD: %f\n\n", time_taken_simd_5x5 / time_convolution_simd * 100);
+    free(scratch);
+    return 0;
+}
+
+int test_bilateral_performance()
+{
+    uint8_t* scratch = malloc(BILATERAL_SCRATCH_SIZE(width, 5));
+    if (!scratch)
+        return 1;
+    struct bilateral_weights weights_3x3, weights_5x5;
+    bilateral_weights(&weights_3x3, 3, 1.0f, 20.0f);
+    bilateral_weights(&weights_5x5, 5, 1.5f, 20.0f);
+    double time_taken_accurate, time_taken_simd, time_taken_simd_5x5, time_denoise_simd;
+    timer(bilateral(grayscale_image, width, height, &weights_3x3, result), time_taken_accurate);
+    printf("Time taken for %s: %f seconds\n", "Bilateral 3x3", time_taken_accurate);
+    timer(bilateral_simd(grayscale_image, width, height, &weights_3x3, scratch, result), time_taken_simd);
+    printf("Time taken for %s: %f seconds\n", "Bilateral 3x3 SIMD", time_taken_simd);
+    timer(bilateral_simd(grayscale_image, width, height, &weights_5x5, scratch, result), time_taken_simd_5x5);
+    printf("Time taken for %s: %f seconds\n", "Bilateral 5x5 SIMD", time_taken_simd_5x5);
+    timer(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), time_denoise_simd);
+
+    printf("Time for Bilateral 3x3 SIMD as percentage of naive: %f\n", time_taken_simd / time_taken_accurate * 100);
+    printf("Time for Bilateral 3x3 SIMD as percentage of Denoise SIMD: %f\n", time_taken_simd / time_denoise_simd * 100);
+    printf("Time for Bilateral 5x5 SIMD as percentage of Denoise SIMD: %f\n\n", time_taken_simd_5x5 / time_denoise_simd * 100);
+    free(scratch);
+    return 0;
+}
+
+int test_box_performance()
+{
+    uint8_t* scratch = malloc(BOX_SCRATCH_SIZE(width, height));
+    uint8_t* tmp = malloc(width * height);
+    if (!scratch || !tmp) {
+        free(scratch);
+        free(tmp);
+        return 1;
+    }
+    // the radii of the blur, the gaussians have a standard deviation of a third of them
+    long radius[] = { 3, 30, 300 };
+    double time_taken_simd[3];
+    for (size_t i = 0; i < 3; i++) {
+        size_t radii[BOX_PASSES];
+        gaussian_boxes((float)radius[i] / 3, radii);
+        timer(box_blur_simd(grayscale_image, width, height, radii, scratch, result), time_taken_simd[i]);
+        printf("Time taken for Box blur SIMD of radius %ld: %f seconds\n", radius[i], time_taken_simd[i]);
+    }
+    size_t radii[BOX_PASSES];
+    gaussian_boxes(10.0f, radii);
+    double time_taken_naive;
+    timer(box_blur(grayscale_image, width, height, radii, tmp, result), time_taken_naive);
+    printf("Time taken for Box blur naive of radius 30: %f seconds\n", time_taken_naive);
+
+    printf("Time for Box blur SIMD of radius 30 as percentage of naive: %f\n", time_taken_simd[1] / time_taken_naive * 100);
+    printf("Time for Box blur SIMD of radius 300 as percentage of radius 30: %f\n\n", time_taken_simd[2] / time_taken_simd[1] * 100);
+    free(scratch);
+    free(tmp);
+    return 0;
+}
+
+int test_cache_performance()
+{
+    // a cache hit costs the hash of the input, a miss the hash and the denoising
+    struct cache_key key;
+    double time_taken_naive, time_taken_simd, time_taken_denoise;
+    timer(cache_hash(rgb_image, width * height * 3, 0, &key), time_taken_naive);
+    printf("Time taken for Cache hash naive: %f seconds\n", time_taken_naive);
+    timer(cache_hash_simd(rgb_image, width * height * 3, 0, &key), time_taken_simd);
+    printf("Time taken for Cache hash SIMD: %f seconds\n", time_taken_simd);
+    timer(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), time_taken_denoise);
+    printf("Time taken for Denoise SIMD: %f seconds\n", time_taken_denoise);
+
+    printf("Time for Cache hash SIMD as percentage of naive: %f\n", time_taken_simd / time_taken_naive * 100);
+    printf("Time for Cache hash SIMD as percentage of Denoise SIMD: %f\n\n", time_taken_simd / time_taken_denoise * 100);
+    return 0;
+}
+
+int test_strips_performance()
+{
+    // the strips recompute a halo row above and below, but their padded arrays stay in the cache
+    uint8_t* scratch = malloc(STRIP_SCRATCH_SIZE(width, 64));
+    if (!scratch)
+        return 1;
+    double time_taken_frame, time_taken_strips;
+    timer(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), time_taken_frame);
+    printf("Time taken for Denoise SIMD of the whole frame: %f seconds\n", time_taken_frame);
+    timer(denoise_simd_strips(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, 64, scratch, result), time_taken_strips);
+    printf("Time taken for Denoise SIMD in strips of 64 rows: %f seconds\n", time_taken_strips);
+
+    printf("Time for Denoise SIMD in strips as percentage of the whole frame: %f\n", time_taken_strips / time_taken_frame * 100);
+    printf("Memory for Denoise SIMD in strips as percentage of the whole frame: %f\n\n",
+        (double)(width * height * 3 + STRIP_SCRATCH_SIZE(width, 64)) / (double)(width * height * 4 + padded_width * padded_height * 6) * 100);
+    free(scratch);
+    return 0;
+}
+
+int test_pyramid_performance()
+{
+    // the smaller levels add a third to the convolution and combine, downsampling and upsampling about as much again
+    uint8_t* scratch = malloc(pyramid_scratch_size(width, height, 4));
+    if (!scratch)
+        return 1;
+    double time_taken_single, time_taken_pyramid;
+    timer(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), time_taken_single);
+    printf("Time taken for Denoise SIMD: %f seconds\n", time_taken_single);
+    timer(denoise_pyramid(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, 4, scratch, padded_image, padded_laplace, padded_blur, result),
+        time_taken_pyramid);
+    printf("Time taken for Denoise SIMD on a pyramid of 4 levels: %f seconds\n", time_taken_pyramid);
+
+    printf("Time for Denoise SIMD on a pyramid of 4 levels as percentage of a single level: %f\n\n", time_taken_pyramid / time_taken_single * 100);
+    free(scratch);
+    return 0;
+}
+
+// Reduce a denoised image by a factor afterwards, like a resize of the written result: every block of factor x factor pixels
+// becomes its rounded mean
+static void downscale_afterwards(const uint8_t* image, size_t factor, uint8_t* output)
+{
+    size_t scaled_width = DOWNSCALED_SIZE(width, factor);
+    for (size_t y = 0; y < DOWNSCALED_SIZE(height, factor); y++) {
+        for (size_t x = 0; x < scaled_width; x++) {
+            size_t sum = 0, count = 0;
+            for (size_t i = y * factor; i < (y + 1) * factor && i < height; i++) {
+                for (size_t j = x * factor; j < (x + 1) * factor && j < width; j++, count++)
+                    sum += image[i * width + j];
+            }
+            output[y * scaled_width + x] = (uint8_t)((sum + count / 2) / count);
+        }
+    }
+}
+
+int test_downscale_performance()
+{
+    // the fused versions never write the full resolution result, their padded laplace and blur only hold a band
+    uint16_t* sums = malloc(width * sizeof(uint16_t));
+    uint8_t* scaled = malloc(DOWNSCALED_SIZE(width, 2) * DOWNSCALED_SIZE(height, 2));
+    if (!sums || !scaled) {
+        free(sums);
+        free(scaled);
+        return 1;
+    }
+    double time_taken_full, time_taken_afterwards, time_taken_half, time_taken_quarter;
+    timer(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), time_taken_full);
+    printf("Time taken for Denoise SIMD: %f seconds\n", time_taken_full);
+    timer((denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result),
+              downscale_afterwards(result, 2, scaled)),
+        time_taken_afterwards);
+    printf("Time taken for Denoise SIMD reduced to 1/2 afterwards: %f seconds\n", time_taken_afterwards);
+    timer(denoise_simd_downscale(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, 2, grayscale_image, padded_image, padded_laplace,
+              padded_blur, sums, scaled),
+        time_taken_half);
+    printf("Time taken for Denoise SIMD fused with a reduction to 1/2: %f seconds\n", time_taken_half);
+    timer(denoise_simd_downscale(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, 4, grayscale_image, padded_image, padded_laplace,
+              padded_blur, sums, scaled),
+        time_taken_quarter);
+    printf("Time taken for Denoise SIMD fused with a reduction to 1/4: %f seconds\n", time_taken_quarter);
+
+    printf("Time for the reduction to 1/2 fused as percentage of afterwards: %f\n", time_taken_half / time_taken_afterwards * 100);
+    printf("Time for the reduction to 1/2 fused as percentage of Denoise SIMD: %f\n", time_taken_half / time_taken_full * 100);
+    printf("Time for the reduction to 1/4 fused as percentage of Denoise SIMD: %f\n\n", time_taken_quarter / time_taken_full * 100);
+    free(sums);
+    free(scaled);
+    return 0;
+}
+
+int test_metrics_performance()
+{
+    // the metrics of the SIMD result compared with the grayscale image, the errors are spread like a real comparison
+    uint8_t* scratch = malloc(METRICS_SCRATCH_SIZE(width));
+    if (!scratch)
+        return 1;
+    struct image_metrics metrics;
+    grayscale_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, grayscale_image);
+    denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result);
+    double time_taken_naive, time_taken_simd;
+    timer(image_metrics(result, grayscale_image, width, height, &metrics), time_taken_naive);
+    printf("Time taken for Metrics: %f seconds\n", time_taken_naive);
+    timer(image_metrics_simd(result, grayscale_image, width, height, scratch, &metrics), time_taken_simd);
+    printf("Time taken for Metrics SIMD: %f seconds\n", time_taken_simd);
+
+    printf("Time for Metrics SIMD as percentage of naive: %f\n\n", time_taken_simd / time_taken_naive * 100);
+    free(scratch);
+    return 0;
+}
+
+int test_denoise_8bit_performance()
+{
+    // the 8 bit padded arrays, the padded image needs its own zero border
+    uint8_t* padded_8bit = calloc(3 * padded_width * padded_height, sizeof(uint8_t));
+    if (!padded_8bit)
+        return 1;
+    uint8_t* laplace_8bit = padded_8bit + padded_width * padded_height;
+    uint8_t* blur_8bit = laplace_8bit + padded_width * padded_height;
+    struct image_view rgb = packed_view(rgb_image, width, height, 3), luma = packed_view(grayscale_image, width, height, 1);
+    struct image_view output = packed_view(result, width, height, 1);
+    grayscale_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, grayscale_image);
+    double time_taken_16bit, time_taken_8bit, time_taken_luma_16bit, time_taken_luma_8bit;
+    timer(denoise_simd_format_view(rgb, PIXEL_RGB, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, output), time_taken_16bit);
+    printf("Time taken for Denoise SIMD: %f seconds\n", time_taken_16bit);
+    timer(denoise_simd_8bit_view(rgb, PIXEL_RGB, 0.2126, 0.7152, 0.0722, padded_8bit, laplace_8bit, blur_8bit, output), time_taken_8bit);
+    printf("Time taken for Denoise SIMD with 8 bit pixels: %f seconds\n", time_taken_8bit);
+    // without the grayscale conversion only the padding, convolution and combine are compared
+    timer(denoise_simd_format_view(luma, PIXEL_LUMA, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, output), time_taken_luma_16bit);
+    printf("Time taken for Denoise SIMD of luma: %f seconds\n", time_taken_luma_16bit);
+    timer(denoise_simd_8bit_view(luma, PIXEL_LUMA, 0.2126, 0.7152, 0.0722, padded_8bit, laplace_8bit, blur_8bit, output), time_taken_luma_8bit);
+    printf("Time taken for Denoise SIMD of luma with 8 bit pixels: %f seconds\n", time_taken_luma_8bit);
+    // the convolution and combine alone, on the images padded by the luma runs
+    double time_taken_kernels_16bit, time_taken_kernels_8bit;
+    timer(convolve_combine_simd_view(luma, padded_image, padded_width, padded_laplace, padded_blur, output), time_taken_kernels_16bit);
+    printf("Time taken for the convolution and combine of Denoise SIMD: %f seconds\n", time_taken_kernels_16bit);
+    timer(convolve_combine_simd_8bit_view(padded_8bit, padded_width, output), time_taken_kernels_8bit);
+    printf("Time taken for the convolution and combine with 8 bit pixels: %f seconds\n", time_taken_kernels_8bit);
+
+    printf("Time for Denoise SIMD with 8 bit pixels as percentage of 16 bit: %f\n", time_taken_8bit / time_taken_16bit * 100);
+    printf("Time for Denoise SIMD of luma with 8 bit pixels as percentage of 16 bit: %f\n", time_taken_luma_8bit / time_taken_luma_16bit * 100);
+    printf("Time for the convolution and combine with 8 bit pixels as percentage of 16 bit: %f\n\n", time_taken_kernels_8bit / time_taken_kernels_16bit * 100);
+    free(padded_8bit);
+    return 0;
+}
+
+int test_deadline_levels_performance()
+{
+    // the levels the deadline mode falls back to, the half level pads and convolves its own arrays in the scratch
+    size_t scratch_size = HALF_SCRATCH_SIZE(width, height) > BLUR_SCRATCH_SIZE(width, height) ? HALF_SCRATCH_SIZE(width, height) : BLUR_SCRATCH_SIZE(width, height);
+    uint8_t* scratch = malloc(scratch_size);
+    uint16_t* tmp = malloc(width * height * sizeof(uint16_t));
+    if (!scratch || !tmp) {
+        free(scratch);
+        free(tmp);
+        return 1;
+    }
+    grayscale_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, grayscale_image);
+    double time_taken_blur, time_taken_blur_simd, time_taken_full, time_taken_half, time_taken_blur_only;
+    timer(blur_2_1d(grayscale_image, width, height, tmp, result), time_taken_blur);
+    printf("Time taken for Blur 2 1D: %f seconds\n", time_taken_blur);
+    timer(blur_2_1d_simd(grayscale_image, width, height, (uint16_t*)scratch, result), time_taken_blur_simd);
+    printf("Time taken for Blur 2 1D SIMD: %f seconds\n", time_taken_blur_simd);
+    timer(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), time_taken_full);
+    printf("Time taken for Denoise SIMD: %f seconds\n", time_taken_full);
+    timer(denoise_half_resolution(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, scratch, result), time_taken_half);
+    printf("Time taken for Denoise SIMD on half resolution: %f seconds\n", time_taken_half);
+    timer(denoise_blur(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, scratch, result), time_taken_blur_only);
+    printf("Time taken for Denoise blur only: %f seconds\n", time_taken_blur_only);
+
+    printf("Time for Blur 2 1D SIMD as percentage of Blur 2 1D: %f\n", time_taken_blur_simd / time_taken_blur * 100);
+    printf("Time for Denoise SIMD on half resolution as percentage of Denoise SIMD: %f\n", time_taken_half / time_taken_full * 100);
+    printf("Time for Denoise blur only as percentage of Denoise SIMD: %f\n\n", time_taken_blur_only / time_taken_full * 100);
+    free(scratch);
+    free(tmp);
+    return 0;
+}
+
+int test_trace_performance()
+{
+    // every strip of 8 rows records its convolution and combine, the events are discarded afterwards
+    double time_taken_off, time_taken_on;
+    timer(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), time_taken_off);
+    printf("Time taken for Denoise SIMD without tracing: %f seconds\n", time_taken_off);
+    trace_start();
+    timer(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), time_taken_on);
+    trace_stop(NULL);
+    printf("Time taken for Denoise SIMD with tracing: %f seconds\n", time_taken_on);
+
+    printf("Time for Denoise SIMD with tracing as percentage of without: %f\n\n", time_taken_on / time_taken_off * 100);
+    return 0;
+}
+
+// Time of pad + convolution_simd + combine_simd and of pad + convolve_combine_simd_view, which skips the flat tiles
+static int time_flat_tiles(const uint8_t* gray, size_t gray_width, size_t gray_height, const char* description)
+{
+    size_t size = (gray_width + 2) * (gray_height + 2);
+    uint16_t* image = calloc(size, sizeof(uint16_t));
+    uint16_t* laplace = calloc(size, sizeof(uint16_t));
+    uint16_t* blur = calloc(size, sizeof(uint16_t));
+    uint8_t* output = malloc(gray_width * gray_height);
+    if (!image || !laplace || !blur || !output) {
+        free(image);
+        free(laplace);
+        free(blur);
+        free(output);
+        return 1;
+    }
+    double time_taken_whole, time_taken_tiles;
+    timer((pad_image_simd(gray, gray_width, gray_height, gray_width + 2, image), convolution_simd(image, gray_width + 2, gray_height + 2, laplace, blur),
+              combine_simd(gray, laplace, blur, gray_width, gray_height, gray_width + 2, output)),
+        time_taken_whole);
+    timer((pad_image_simd(gray, gray_width, gray_height, gray_width + 2, image),
+              convolve_combine_simd_view(packed_view(gray, gray_width, gray_height, 1), image, gray_width + 2, laplace, blur, packed_view(output, gray_width, gray_height, 1))),
+        time_taken_tiles);
+    printf("Time taken for %s, whole image: %f seconds\n", description, time_taken_whole);
+    printf("Time taken for %s, flat tiles skipped: %f seconds\n", description, time_taken_tiles);
+    printf("Time for %s with flat tiles skipped as percentage of whole image: %f\n", description, time_taken_tiles / time_taken_whole * 100);
+    free(image);
+    free(laplace);
+    free(blur);
+    free(output);
+    return 0;
+}
+
+int test_flat_tiles_performance()
+{
+    grayscale_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, grayscale_image);
+    // 1080p screenshot: title bar, side bar, two background shades and a gradient
+    size_t screen_width = 1920, screen_height = 1080;
+    uint8_t* screenshot = malloc(screen_width * screen_height);
+    if (!screenshot)
+        return 1;
+    for (size_t y = 0; y < screen_height; y++) {
+        for (size_t x = 0; x < screen_width; x++) {
+            uint8_t background = (x / 400 + y / 300) % 2 ? 250 : 245;
+            uint8_t gradient = (uint8_t)(100 + (x - 500) / 8);
+            screenshot[y * screen_width + x] = y < 60 ? 40 : x < 300 ? 230 : y >= 400 && y < 700 && x >= 500 && x < 1500 ? gradient : background;
+        }
+    }
+    int fail = time_flat_tiles(grayscale_image, width, height, "Convolution and combine SIMD") || time_flat_tiles(screenshot, screen_width, screen_height, "Screenshot");
+    printf("\n");
+    free(screenshot);
+    return fail;
+}
+
+static void denoise_one_by_one(const uint8_t* thumbnails, size_t count, size_t thumbnail_width, size_t thumbnail_height,
+    uint16_t* image, uint16_t* laplace, uint16_t* blur, uint8_t* output)
+{
+    size_t size = thumbnail_width * thumbnail_height;
+    for (size_t k = 0; k < count; k++)
+        denoise_simd(thumbnails + k * size * 3, thumbnail_width, thumbnail_height, 0.2126, 0.7152, 0.0722, image, laplace, blur, output + k * size);
+}
+
+int test_batch_performance()
+{
+    // 256 thumbnails of 40x30 pixels cut from the image
+    size_t count = 256, thumbnail_width = 40, thumbnail_height = 30, size = thumbnail_width * thumbnail_height;
+    uint8_t* thumbnails = malloc(count * size * 3);
+    uint8_t* output = malloc(count * size);
+    uint16_t* image = calloc(BATCH_PADDED_SIZE(count, thumbnail_width, thumbnail_height), sizeof(uint16_t));
+    uint16_t* laplace = malloc(BATCH_PADDED_SIZE(count, thumbnail_width, thumbnail_height) * sizeof(uint16_t));
+    uint16_t* blur = malloc(BATCH_PADDED_SIZE(count, thumbnail_width, thumbnail_height) * sizeof(uint16_t));
+    if (!thumbnails || !output || !image || !laplace || !blur) {
+        free(thumbnails);
+        free(output);
+        free(image);
+        free(laplace);
+        free(blur);
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t x0 = i * 7 % (width - thumbnail_width), y0 = i * 13 % (height - thumbnail_height);
+        for (size_t y = 0; y < thumbnail_height; y++)
+            memcpy(thumbnails + (i * size + y * thumbnail_width) * 3, rgb_image + ((y0 + y) * width + x0) * 3, thumbnail_width * 3);
+    }
+    // one by one, the padded arrays of a thumbnail are the first rows of the batch arrays
+    double time_taken_single, time_taken_batch;
+    timer(denoise_one_by_one(thumbnails, count, thumbnail_width, thumbnail_height, image, laplace, blur, output), time_taken_single);
+    printf("Time taken for %zu thumbnails of %zux%zu one by one: %f seconds\n", count, thumbnail_width, thumbnail_height, time_taken_single);
+    memset(image, 0, BATCH_PADDED_SIZE(count, thumbnail_width, thumbnail_height) * sizeof(uint16_t));
+    timer(denoise_simd_batch(thumbnails, PIXEL_RGB, count, thumbnail_width, thumbnail_height, 0.2126, 0.7152, 0.0722, image, laplace, blur, output), time_taken_batch);
+    printf("Time taken for %zu thumbnails of %zux%zu as a batch: %f seconds\n", count, thumbnail_width, thumbnail_height, time_taken_batch);
+
+    printf("Time for the batch as percentage of one by one: %f\n\n", time_taken_batch / time_taken_single * 100);
+    free(thumbnails);
+    free(output);
+    free(image);
+    free(laplace);
+    free(blur);
+    return 0;
+}
+
 int test_denoise_performance()
 {
     double time_taken_accurate;
@@ -146,12 +547,8 @@ int test_denoise_performance()
     return 0;
 }
 
-int run_all_perf_tests()
+void teardown()
 {
-    printf("\nTesting performance with %s at %i iterations...\n\n", path, iterations);
-    int a = 0;
-    if (setup() || test_grayscale_performance() || test_convolution_performance() || test_combine_performance() || test_denoise_performance())
-        a = 1;
     free(grayscale_image);
     free(blurred);
     free(result);
@@ -160,5 +557,219 @@ int run_all_perf_tests()
     free(padded_blur);
     free(padded_image);
     free(image.pixels);
+}
+
+// samples of every benchmark, taken round-robin over the whole run, so they spread over the drift of the machine during the run.
+// A baseline takes BENCH_BASELINE_RUNS times as many, which have to fit into BENCH_MAX_SAMPLES
+#define BENCH_SAMPLES 20
+// shortest time of a sample, the calls per sample of every benchmark are calibrated to it in the first round
+#define BENCH_SAMPLE_SECONDS 0.005
+
+// Time a sample of a call in the current round and add it to run as the given stage and variant. Round 0 is not recorded:
+// it warms the call up and calibrates its calls per sample from the time of a single call
+#define sample(function_call, stage_name, variant_name)                                                       \
+    {                                                                                                         \
+        struct bench_result* sampled = &run.results[benchmark++];                                             \
+        if (round == 0) {                                                                                     \
+            snprintf(sampled->stage, BENCH_NAME_SIZE, "%s", stage_name);                                      \
+            snprintf(sampled->variant, BENCH_NAME_SIZE, "%s", variant_name);                                  \
+            (function_call);                                                                                  \
+            double single;                                                                                    \
+            iterations = 1;                                                                                   \
+            timer(function_call, single);                                                                     \
+            sampled->calls = single < BENCH_SAMPLE_SECONDS / UINT16_MAX ? UINT16_MAX : (size_t)(BENCH_SAMPLE_SECONDS / single) + 1; \
+        } else {                                                                                              \
+            double seconds;                                                                                   \
+            iterations = (uint16_t)sampled->calls;                                                            \
+            timer(function_call, seconds);                                                                    \
+            sampled->seconds[sampled->count++] = seconds / (double)sampled->calls;                            \
+        }                                                                                                     \
+    }
+
+static const char* verdicts[] = { "unchanged", "faster", "SLOWER" };
+
+// Print the medians of a run and its verdicts against the baseline, returns the number of significant regressions
+static int report_benchmarks(const struct bench_run* run, const struct bench_run* baseline)
+{
+    int regressions = 0;
+    printf("%-12s %-10s %12s", "Stage", "Variant", "Median ms");
+    if (baseline)
+        printf(" %12s %9s %9s %10s  %s", "Baseline ms", "Spread %", "Change %", "p", "Verdict");
+    printf("\n");
+    for (size_t i = 0; i < run->count; i++) {
+        const struct bench_result* current = &run->results[i];
+        printf("%-12s %-10s %12.4f", current->stage, current->variant, bench_median(current) * 1e3);
+        const struct bench_result* before = baseline ? bench_find(baseline, current->stage, current->variant) : NULL;
+        if (before) {
+            double change, p;
+            enum bench_verdict verdict = bench_compare(before, current, &change, &p);
+            printf(" %12.4f %9.2f %+9.2f %10.2e  %s", bench_median(before) * 1e3, before->spread * 100, change * 100, p, verdicts[verdict]);
+            regressions += verdict == BENCH_SLOWER;
+        } else if (baseline) {
+            printf(" %12s %9s %9s %10s  %s", "-", "-", "-", "-", "new");
+        }
+        printf("\n");
+    }
+    return regressions;
+}
+
+// Quality of the result of every denoise variant compared with the accurate SISD version, which the others approximate
+static void report_quality(uint8_t* strip_scratch, uint8_t* pyramid_scratch, uint8_t* level_scratch, uint8_t* padded_8bit, uint8_t* accurate,
+    uint8_t* metrics_scratch)
+{
+    denoise(rgb_image, width, height, 0.2126, 0.7152, 0.0722, laplaced, blurred, accurate);
+    printf("\n%-12s %-10s %10s %8s %10s %9s\n", "Stage", "Variant", "PSNR dB", "SSIM", "Mean error", "Max error");
+    for (int variant = 0; variant < 7; variant++) {
+        const char* names[] = { "integer", "simd", "strips", "pyramid", "half", "blur", "8bit" };
+        if (variant == 0)
+            denoise_integer(rgb_image, width, height, 0.2126, 0.7152, 0.0722, laplaced, blurred, result);
+        else if (variant == 1)
+            denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result);
+        else if (variant == 2)
+            denoise_simd_strips(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, BUDGET_MAX_STRIP_ROWS, strip_scratch, result);
+        else if (variant == 3)
+            denoise_pyramid(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, 4, pyramid_scratch, padded_image, padded_laplace, padded_blur, result);
+        else if (variant == 4)
+            denoise_half_resolution(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, level_scratch, result);
+        else if (variant == 5)
+            denoise_blur(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, level_scratch, result);
+        else
+            denoise_simd_8bit_view(packed_view(rgb_image, width, height, 3), PIXEL_RGB, 0.2126, 0.7152, 0.0722, padded_8bit,
+                padded_8bit + padded_width * padded_height, padded_8bit + 2 * padded_width * padded_height, packed_view(result, width, height, 1));
+        struct image_metrics metrics;
+        image_metrics_simd(result, accurate, width, height, metrics_scratch, &metrics);
+        printf("%-12s %-10s %10.2f %8.4f %10.3f %9d\n", "denoise", names[variant], metrics.psnr, metrics.ssim, metrics.mean_error, metrics.max_error);
+    }
+}
+
+int run_benchmarks(const char* save_path, const char* baseline_path)
+{
+    static struct bench_run baseline, run;
+    if (baseline_path && bench_load(baseline_path, &baseline)) {
+        fprintf(stderr, "Could not read baseline file %s!\n", baseline_path);
+        return 1;
+    }
+    if (setup()) {
+        teardown();
+        return 1;
+    }
+    uint8_t* median_scratch = malloc(MEDIAN_SCRATCH_SIZE(width, 3));
+    uint8_t* bilateral_scratch = malloc(BILATERAL_SCRATCH_SIZE(width, 3));
+    uint8_t* box_scratch = malloc(BOX_SCRATCH_SIZE(width, height));
+    uint8_t* strip_scratch = malloc(STRIP_SCRATCH_SIZE(width, BUDGET_MAX_STRIP_ROWS));
+    uint8_t* pyramid_scratch = malloc(pyramid_scratch_size(width, height, 4));
+    uint16_t* downscale_sums = malloc(width * sizeof(uint16_t));
+    uint8_t* metrics_scratch = malloc(METRICS_SCRATCH_SIZE(width));
+    uint8_t* level_scratch = malloc(HALF_SCRATCH_SIZE(width, height) > BLUR_SCRATCH_SIZE(width, height) ? HALF_SCRATCH_SIZE(width, height) : BLUR_SCRATCH_SIZE(width, height));
+    uint8_t* padded_8bit = calloc(3 * padded_width * padded_height, sizeof(uint8_t));
+    uint8_t* accurate = malloc(width * height);
+    int status = 1;
+    if (!median_scratch || !bilateral_scratch || !box_scratch || !strip_scratch || !pyramid_scratch || !downscale_sums || !metrics_scratch || !level_scratch
+        || !padded_8bit || !accurate)
+        goto cleanup;
+
+    memset(&run, 0, sizeof(run));
+    snprintf(run.image, sizeof(run.image), "%s", path);
+    run.width = width;
+    run.height = height;
+    if (baseline_path && (strcmp(baseline.image, run.image) != 0 || baseline.width != width || baseline.height != height)) {
+        fprintf(stderr, "Baseline %s was measured with %s (%zux%zu), not comparable!\n", baseline_path, baseline.image, baseline.width, baseline.height);
+        goto cleanup;
+    }
+    // a baseline pools several runs, whose spread is the noise a later change has to exceed
+    size_t runs = save_path ? BENCH_BASELINE_RUNS : 1;
+    printf("\nBenchmarking with %s, %zu samples of at least %g ms of every variant...\n\n", path, runs * BENCH_SAMPLES, BENCH_SAMPLE_SECONDS * 1e3);
+
+    struct bilateral_weights weights;
+    bilateral_weights(&weights, 3, 1.0f, 20.0f);
+    size_t radii[BOX_PASSES];
+    gaussian_boxes(10.0f, radii);
+    struct cache_key key;
+    // in the order of the pipeline, every stage leaves the input of the next one, in every round
+    uint16_t total = iterations;
+    for (size_t round = 0; round <= runs * BENCH_SAMPLES; round++) {
+        size_t benchmark = 0;
+        sample(grayscale(rgb_image, width, height, 0.2126, 0.7152, 0.0722, grayscale_image), "grayscale", "accurate");
+        sample(grayscale_integer(rgb_image, width, height, 0.2126, 0.7152, 0.0722, grayscale_image), "grayscale", "integer");
+        sample(grayscale_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, grayscale_image), "grayscale", "simd");
+        sample((convolution(grayscale_image, width, height, laplaced, laplace_kernel, 1), convolution(grayscale_image, width, height, blurred, blur_kernel, 0)),
+            "convolution", "accurate");
+        sample(convolution_1pass(grayscale_image, width, height, laplaced, blurred), "convolution", "integer");
+        // the grayscale image is padded once, the sample only measures the convolution
+        pad_image_simd(grayscale_image, width, height, padded_width, padded_image);
+        sample(convolution_simd(padded_image, padded_width, padded_height, padded_laplace, padded_blur), "convolution", "simd");
+        sample(combine(grayscale_image, laplaced, blurred, width, height, result, 1), "combine", "accurate");
+        sample(combine(grayscale_image, laplaced, blurred, width, height, result, 0), "combine", "integer");
+        sample(combine_simd(grayscale_image, padded_laplace, padded_blur, width, height, padded_width, result), "combine", "simd");
+        sample(median(grayscale_image, width, height, 3, result), "median", "naive");
+        sample(median_simd(grayscale_image, width, height, 3, median_scratch, result), "median", "simd");
+        sample(bilateral(grayscale_image, width, height, &weights, result), "bilateral", "naive");
+        sample(bilateral_simd(grayscale_image, width, height, &weights, bilateral_scratch, result), "bilateral", "simd");
+        sample(box_blur_simd(grayscale_image, width, height, radii, box_scratch, result), "box", "simd");
+        sample(cache_hash_simd(rgb_image, width * height * 3, 0, &key), "hash", "simd");
+        sample(denoise(rgb_image, width, height, 0.2126, 0.7152, 0.0722, laplaced, blurred, result), "denoise", "accurate");
+        sample(denoise_integer(rgb_image, width, height, 0.2126, 0.7152, 0.0722, laplaced, blurred, result), "denoise", "integer");
+        sample(denoise_simd(rgb_image, width, height, 0.2126, 0.7152, 0.0722, padded_image, padded_laplace, padded_blur, result), "denoise", "simd");
+        sample(denoise_simd_8bit_view(packed_view(rgb_image, width, height, 3), PIXEL_RGB, 0.2126, 0.7152, 0.0722, padded_8bit,
+                   padded_8bit + padded_width * padded_height, padded_8bit + 2 * padded_width * padded_height, packed_view(result, width, height, 1)),
+            "denoise", "8bit");
+        sample(denoise_simd_strips(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, BUDGET_MAX_STRIP_ROWS, strip_scratch, result), "denoise", "strips");
+        sample(denoise_pyramid(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, 4, pyramid_scratch, padded_image, padded_laplace, padded_blur, result),
+            "denoise", "pyramid");
+        sample(denoise_simd_downscale(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, 4, grayscale_image, padded_image, padded_laplace,
+                   padded_blur, downscale_sums, result),
+            "denoise", "scale 1/4");
+        sample(denoise_half_resolution(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, level_scratch, result), "denoise", "half");
+        sample(denoise_blur(rgb_image, PIXEL_RGB, width, height, 0.2126, 0.7152, 0.0722, level_scratch, result), "denoise", "blur");
+        struct image_metrics metrics;
+        sample(image_metrics(result, grayscale_image, width, height, &metrics), "metrics", "naive");
+        sample(image_metrics_simd(result, grayscale_image, width, height, metrics_scratch, &metrics), "metrics", "simd");
+        run.count = benchmark;
+    }
+    iterations = total;
+    for (size_t i = 0; i < run.count; i++)
+        bench_spread(&run.results[i], runs);
+
+    int regressions = report_benchmarks(&run, baseline_path ? &baseline : NULL);
+    report_quality(strip_scratch, pyramid_scratch, level_scratch, padded_8bit, accurate, metrics_scratch);
+    status = 0;
+    if (baseline_path) {
+        printf("\n%d of %zu benchmarks significantly slower than the baseline %s\n", regressions, run.count, baseline_path);
+        // a change of the code rarely slows down every stage, a busy machine does
+        if ((size_t)regressions > run.count / 2)
+            printf("Most of them are slower, the machine was probably busy, run it again when it is idle\n");
+        status = regressions > 0;
+    }
+    if (save_path) {
+        if (bench_save(save_path, &run) == 0) {
+            printf("Baseline written to %s\n", save_path);
+        } else {
+            fprintf(stderr, "Could not write baseline file %s!\n", save_path);
+            status = 1;
+        }
+    }
+
+cleanup:
+    free(median_scratch);
+    free(bilateral_scratch);
+    free(box_scratch);
+    free(strip_scratch);
+    free(pyramid_scratch);
+    free(downscale_sums);
+    free(metrics_scratch);
+    free(level_scratch);
+    free(padded_8bit);
+    free(accurate);
+    teardown();
+    return status;
+}
+
+int run_all_perf_tests()
+{
+    printf("\nTesting performance with %s at %i iterations...\n\n", path, iterations);
+    int a = 0;
+    if (setup() || test_grayscale_performance() || test_convolution_performance() || test_combine_performance() || test_median_performance() || test_bilateral_performance() || test_box_performance() || test_flat_tiles_performance() || test_batch_performance() || test_cache_performance() || test_strips_performance() || test_pyramid_performance() || test_downscale_performance() || test_metrics_performance() || test_denoise_8bit_performance() || test_deadline_levels_performance() || test_trace_performance() || test_denoise_performance())
+        a = 1;
+    teardown();
     return a;
 }
\ No newline at end of file
@@ -4,4 +4,13 @@
 // Performance tests for grayscale, convolution and combine and denoise
 int run_all_perf_tests();
 
+/**
+ * Measure every stage and variant in samples and print their medians.
+ * @param save_path: file the samples are written to as the baseline of later runs, NULL to not save them
+ * @param baseline_path: baseline every stage and variant is compared with, faster, slower or unchanged by a Mann-Whitney U test,
+ *                       NULL to not compare
+ * Returns 0 on success and 1 on errors or if any variant is significantly slower than its baseline.
+ */
+int run_benchmarks(const char* save_path, const char* baseline_path);
+
 #endif
\ No newline at end of file
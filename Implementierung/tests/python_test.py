@@ -0,0 +1,106 @@
+# Tests of the Python extension module, run with "make python-tests"
+# The results of the module are compared with the ones of the program for the same image and version
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import unittest
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.join(ROOT, 'python'))
+import denoise  # noqa: E402
+
+try:
+    import numpy as np
+except ImportError:
+    np = None
+    from _testbuffer import ND_WRITABLE, ndarray
+
+# odd sizes, a single pixel and sizes that are no multiple of the 16 pixels of a vector
+SIZES = [(1, 1), (3, 2), (17, 5), (45, 37), (64, 33)]
+VERSIONS = {'denoise_simd': '0', 'denoise_integer': '1'}
+
+
+def random_pixels(width, height, seed):
+    rng = random.Random(seed)
+    return bytes(rng.randrange(256) for _ in range(width * height * 3))
+
+
+def reference(pixels, width, height, version):
+    # denoise the image with the program, the output is a PGM image with the pixels at the end
+    with tempfile.TemporaryDirectory() as directory:
+        input_path = os.path.join(directory, 'input.ppm')
+        output_path = os.path.join(directory, 'output.pgm')
+        with open(input_path, 'wb') as f:
+            f.write(f'P6\n{width} {height}\n255\n'.encode('ascii'))
+            f.write(pixels)
+        subprocess.run([os.path.join(ROOT, 'denoise'), '-V', version, '-o', output_path, input_path],
+                       check=True, stdout=subprocess.DEVNULL)
+        with open(output_path, 'rb') as f:
+            return f.read()[-width * height:]
+
+
+def strided(buffer, shape, row_stride, offset):
+    # a crop of a larger uint8 array, the rows are row_stride bytes apart
+    strides = [row_stride, 3, 1] if len(shape) == 3 else [row_stride, 1]
+    if np is not None:
+        base = np.frombuffer(buffer, dtype=np.uint8)
+        return np.lib.stride_tricks.as_strided(base[offset:], shape=shape, strides=strides)
+    return ndarray(list(buffer), shape=list(shape), strides=strides, offset=offset, format='B', flags=ND_WRITABLE)
+
+
+class DenoiseModuleTest(unittest.TestCase):
+    def test_packed(self):
+        for name, version in VERSIONS.items():
+            for width, height in SIZES:
+                with self.subTest(version=name, width=width, height=height):
+                    pixels = random_pixels(width, height, width * height)
+                    image = memoryview(pixels).cast('B', (height, width, 3))
+                    result = getattr(denoise, name)(image)
+                    self.assertEqual(result.shape, (height, width))
+                    self.assertEqual(result.tobytes(), reference(pixels, width, height, version))
+
+    def test_strided(self):
+        # the image at (5, 3) in a frame of 80 pixels per row, the result at (2, 1) of a 70 byte wide array
+        for name, version in VERSIONS.items():
+            for width, height in SIZES:
+                with self.subTest(version=name, width=width, height=height):
+                    pixels = random_pixels(width, height, width + height)
+                    frame = bytearray(80 * 3 * (height + 3))
+                    for y in range(height):
+                        start = (y + 3) * 80 * 3 + 5 * 3
+                        frame[start:start + width * 3] = pixels[y * width * 3:(y + 1) * width * 3]
+                    image = strided(frame, (height, width, 3), 80 * 3, 3 * 80 * 3 + 5 * 3)
+                    out_frame = bytearray(70 * (height + 1))
+                    out = strided(out_frame, (height, width), 70, 70 + 2)
+                    getattr(denoise, name)(image, out=out)
+                    result = bytes(value for row in memoryview(out).tolist() for value in row)
+                    self.assertEqual(result, reference(pixels, width, height, version))
+
+    def test_errors(self):
+        pixels = random_pixels(5, 4, 0)
+        image = memoryview(pixels).cast('B', (4, 5, 3))
+        for name in VERSIONS:
+            function = getattr(denoise, name)
+            with self.subTest(version=name):
+                # out of the wrong size
+                with self.assertRaises(ValueError):
+                    function(image, out=memoryview(bytearray(5 * 3)).cast('B', (3, 5)))
+                # wrong number of dimensions and channels
+                with self.assertRaises(ValueError):
+                    function(memoryview(pixels).cast('B', (4, 15)))
+                with self.assertRaises(ValueError):
+                    function(memoryview(pixels).cast('B', (4, 15, 1)))
+                # wrong element types of image and out
+                with self.assertRaises(TypeError):
+                    function(memoryview(bytearray(4 * 5 * 3 * 2)).cast('H', (4, 5, 3)))
+                with self.assertRaises(TypeError):
+                    function(image, out=memoryview(bytearray(4 * 5 * 2)).cast('H', (4, 5)))
+                # read-only out
+                with self.assertRaises(BufferError):
+                    function(image, out=memoryview(bytes(4 * 5)).cast('B', (4, 5)))
+
+
+if __name__ == '__main__':
+    unittest.main()